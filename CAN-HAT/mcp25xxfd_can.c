@@ -43,6 +43,7 @@
 #include <linux/device.h>
 #include <linux/interrupt.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/of.h>
 #include <linux/regulator/consumer.h>
@@ -51,9 +52,13 @@
 #include "mcp25xxfd_base.h"
 #include "mcp25xxfd_can.h"
 #include "mcp25xxfd_can_debugfs.h"
+#include "mcp25xxfd_can_ethtool.h"
 #include "mcp25xxfd_can_fifo.h"
 #include "mcp25xxfd_can_int.h"
 #include "mcp25xxfd_can_priv.h"
+#include "mcp25xxfd_can_ptp.h"
+#include "mcp25xxfd_can_rx.h"
+#include "mcp25xxfd_can_stats.h"
 #include "mcp25xxfd_can_tx.h"
 #include "mcp25xxfd_clock.h"
 #include "mcp25xxfd_cmd.h"
@@ -195,6 +200,42 @@ static int mcp25xxfd_can_do_set_data_bittiming(struct net_device *net)
 				   cpriv->regs.dbtcfg);
 }
 
+/* the minimum time a frame occupies the bus in ns including the
+ * interframe space - stuff bits are ignored, so this is a lower bound
+ */
+u32 mcp25xxfd_can_frame_duration(struct mcp25xxfd_can_priv *cpriv, u32 flags)
+{
+	u32 bitrate = cpriv->can.bittiming.bitrate;
+	u32 dbitrate = cpriv->can.data_bittiming.bitrate;
+	int dlc = (flags & MCP25XXFD_CAN_OBJ_FLAGS_DLC_MASK) >>
+		MCP25XXFD_CAN_OBJ_FLAGS_DLC_SHIFT;
+	int len = can_dlc2len(dlc);
+	bool ide = flags & MCP25XXFD_CAN_OBJ_FLAGS_IDE;
+	u32 nbits, dbits;
+
+	if (!bitrate)
+		return 0;
+
+	if (flags & MCP25XXFD_CAN_OBJ_FLAGS_FDF) {
+		/* SOF thru BRS */
+		nbits = ide ? 36 : 17;
+		/* ESI, DLC, data, stuff count, CRC and CRC delimiter */
+		dbits = 1 + 4 + 8 * len + 4 + ((len > 16) ? 21 : 17) + 1;
+		/* ACK, EOF and IFS */
+		nbits += 2 + 7 + 3;
+		if (!(flags & MCP25XXFD_CAN_OBJ_FLAGS_BRS) || !dbitrate)
+			dbitrate = bitrate;
+	} else {
+		/* SOF thru DLC, data, CRC, ACK, EOF and IFS */
+		nbits = (ide ? 39 : 19) + 8 * len + 16 + 2 + 7 + 3;
+		dbits = 0;
+		dbitrate = bitrate;
+	}
+
+	return div_u64((u64)nbits * NSEC_PER_SEC, bitrate) +
+		div_u64((u64)dbits * NSEC_PER_SEC, dbitrate);
+}
+
 int mcp25xxfd_can_get_mode(struct mcp25xxfd_priv *priv, u32 *reg)
 {
 	int ret;
@@ -411,14 +452,16 @@ static int mcp25xxfd_can_config(struct net_device *net)
 	if (ret)
 		return 0;
 
-	/* time stamp control register - 1ns resolution */
+	/* time stamp control register - 1us resolution
+	 * the TBC increments every TBCPRE + 1 clock cycles
+	 */
 	cpriv->regs.tscon = 0;
 	ret = mcp25xxfd_cmd_write(spi, MCP25XXFD_CAN_TBC, 0);
 	if (ret)
 		return ret;
 
 	cpriv->regs.tscon = MCP25XXFD_CAN_TSCON_TBCEN |
-		((cpriv->can.clock.freq / 1000000)
+		((cpriv->can.clock.freq / 1000000 - 1)
 		 << MCP25XXFD_CAN_TSCON_TBCPRE_SHIFT);
 	ret = mcp25xxfd_cmd_write(spi, MCP25XXFD_CAN_TSCON, cpriv->regs.tscon);
 	if (ret)
@@ -442,18 +485,78 @@ static int mcp25xxfd_can_config(struct net_device *net)
 	return ret;
 }
 
+/* restart after a bus-off without a full stop/open cycle:
+ * the controller configuration, the fifo layout and the prepared
+ * tx spi_messages are kept, only pending transmissions get flushed
+ */
+static int mcp25xxfd_can_restart(struct net_device *net)
+{
+	struct mcp25xxfd_can_priv *cpriv = netdev_priv(net);
+	struct spi_device *spi = cpriv->priv->spi;
+	ktime_t start = ktime_get();
+	int ret;
+
+	/* make sure the interrupt handler is not running */
+	if (cpriv->irq.enabled) {
+		disable_irq(spi->irq);
+		mcp25xxfd_can_int_sync(cpriv);
+	}
+
+	/* stop the network queue and wait for start_xmit to finish */
+	netif_tx_disable(net);
+
+	/* flush the tx fifos on the controller and the tx_queue */
+	ret = mcp25xxfd_can_tx_queue_flush(cpriv);
+	if (ret)
+		goto out;
+
+	/* reset the state */
+	cpriv->can.state = CAN_STATE_ERROR_ACTIVE;
+	cpriv->bus.state = CAN_STATE_ERROR_ACTIVE;
+
+	/* and get back into the operating mode - this also clears ABAT */
+	ret = mcp25xxfd_can_switch_mode(cpriv->priv, &cpriv->regs.con,
+					mcp25xxfd_can_targetmode(cpriv));
+	if (ret)
+		goto out;
+
+	/* TREC is only read again on CERRIF - drop the TXBO/TXBP bits
+	 * from before the bus-off so they do not get reported again
+	 */
+	ret = mcp25xxfd_cmd_read(spi, MCP25XXFD_CAN_TREC,
+				 &cpriv->status.trec);
+	if (ret)
+		goto out;
+
+	/* and restart rx interrupt coalescing with the RXIE set */
+	ret = mcp25xxfd_can_rx_coalesce_start(cpriv);
+	if (ret)
+		goto out;
+
+	/* restart the tx_queue */
+	mcp25xxfd_can_tx_queue_manage(cpriv,
+				      MCP25XXFD_CAN_TX_QUEUE_STATE_STARTED);
+
+	/* record the time it took to restart */
+	MCP25XXFD_DEBUGFS_STATS_SET(cpriv, restart_latency_us,
+				    ktime_us_delta(ktime_get(), start));
+out:
+	if (cpriv->irq.enabled)
+		enable_irq(spi->irq);
+
+	return ret;
+}
+
 /* mode setting */
 static int mcp25xxfd_can_do_set_mode(struct net_device *net,
 				     enum can_mode mode)
 {
 	switch (mode) {
 	case CAN_MODE_START:
-		break;
+		return mcp25xxfd_can_restart(net);
 	default:
 		return -EOPNOTSUPP;
 	}
-
-	return 0;
 }
 
 /* binary error counters */
@@ -461,10 +564,18 @@ static int mcp25xxfd_can_get_berr_counter(const struct net_device *net,
 					  struct can_berr_counter *bec)
 {
 	struct mcp25xxfd_can_priv *cpriv = netdev_priv(net);
+	u32 trec;
 
-	bec->txerr = (cpriv->status.trec & MCP25XXFD_CAN_TREC_TEC_MASK) >>
+	/* the interrupt handler only reads TREC when needed,
+	 * so read the current counters if we can
+	 */
+	if (!netif_running(net) ||
+	    mcp25xxfd_cmd_read(cpriv->priv->spi, MCP25XXFD_CAN_TREC, &trec))
+		trec = cpriv->status.trec;
+
+	bec->txerr = (trec & MCP25XXFD_CAN_TREC_TEC_MASK) >>
 		MCP25XXFD_CAN_TREC_TEC_SHIFT;
-	bec->rxerr = (cpriv->status.trec & MCP25XXFD_CAN_TREC_REC_MASK) >>
+	bec->rxerr = (trec & MCP25XXFD_CAN_TREC_REC_MASK) >>
 		MCP25XXFD_CAN_TREC_REC_SHIFT;
 
 	return 0;
@@ -474,6 +585,7 @@ static int mcp25xxfd_can_open(struct net_device *net)
 {
 	struct mcp25xxfd_can_priv *cpriv = netdev_priv(net);
 	struct spi_device *spi = cpriv->priv->spi;
+	ktime_t start = ktime_get();
 	int ret;
 
 	ret = open_candev(net);
@@ -483,17 +595,22 @@ static int mcp25xxfd_can_open(struct net_device *net)
 	}
 
 	/* clear those statistics */
-	memset(&cpriv->stats, 0, sizeof(cpriv->stats));
+	mcp25xxfd_can_stats_clear(cpriv);
+
+	/* prepare the status read issued by the hard irq handler */
+	ret = mcp25xxfd_can_int_alloc(cpriv);
+	if (ret)
+		goto out_candev;
 
 	/* request an IRQ but keep disabled for now */
-	ret = request_threaded_irq(spi->irq, NULL,
+	ret = request_threaded_irq(spi->irq, mcp25xxfd_can_int_hardirq,
 				   mcp25xxfd_can_int,
 				   IRQF_ONESHOT | IRQF_TRIGGER_LOW,
 				   cpriv->priv->device_name, cpriv);
 	if (ret) {
 		dev_err(&spi->dev, "failed to acquire irq %d - %i\n",
 			spi->irq, ret);
-		goto out_candev;
+		goto out_int_alloc;
 	}
 	disable_irq(spi->irq);
 	cpriv->irq.allocated = true;
@@ -517,10 +634,18 @@ static int mcp25xxfd_can_open(struct net_device *net)
 	/* setting up state */
 	cpriv->can.state = CAN_STATE_ERROR_ACTIVE;
 
+	/* start the hardware clock based on the TBC */
+	ret = mcp25xxfd_can_ptp_start(cpriv);
+	if (ret)
+		goto out_canconfig;
+
 	/* enable interrupts */
 	ret = mcp25xxfd_int_enable(cpriv->priv, true);
 	if (ret)
 		goto out_canconfig;
+	ret = mcp25xxfd_can_rx_coalesce_start(cpriv);
+	if (ret)
+		goto out_int;
 
 	/* switch to active mode */
 	ret = mcp25xxfd_can_switch_mode(cpriv->priv, &cpriv->regs.con,
@@ -534,11 +659,16 @@ static int mcp25xxfd_can_open(struct net_device *net)
 	mcp25xxfd_can_tx_queue_manage(cpriv,
 				      MCP25XXFD_CAN_TX_QUEUE_STATE_STARTED);
 
+	/* record the time it took to bring up the interface */
+	MCP25XXFD_DEBUGFS_STATS_SET(cpriv, ifup_latency_us,
+				    ktime_us_delta(ktime_get(), start));
+
 	return 0;
 
 out_int:
 	mcp25xxfd_int_enable(cpriv->priv, false);
 out_canconfig:
+	mcp25xxfd_can_ptp_stop(cpriv);
 	mcp25xxfd_can_fifo_release(cpriv);
 out_canclock:
 	mcp25xxfd_clock_stop(cpriv->priv, MCP25XXFD_CLK_USER_CAN);
@@ -548,6 +678,8 @@ out_irq:
 	free_irq(spi->irq, cpriv);
 	cpriv->irq.allocated = false;
 	cpriv->irq.enabled = false;
+out_int_alloc:
+	mcp25xxfd_can_int_free(cpriv);
 out_candev:
 	close_candev(net);
 	return ret;
@@ -569,12 +701,16 @@ static int mcp25xxfd_can_stop(struct net_device *net)
 	/* disable inerrupts on controller */
 	// mcp25xxfd_int_enable(cpriv->priv, false);
 	disable_irq(spi->irq);
+	mcp25xxfd_can_int_sync(cpriv);
 	cpriv->irq.enabled = false;
 
 	/* stop transmit queue */
 	mcp25xxfd_can_tx_queue_manage(cpriv,
 				      MCP25XXFD_CAN_TX_QUEUE_STATE_STOPPED);
 
+	/* stop the hardware clock */
+	mcp25xxfd_can_ptp_stop(cpriv);
+
 	/* release fifos and debugfs */
 	mcp25xxfd_can_fifo_release(cpriv);
 
@@ -596,6 +732,7 @@ static int mcp25xxfd_can_stop(struct net_device *net)
 	free_irq(spi->irq, cpriv);
 	cpriv->irq.allocated = false;
 	cpriv->irq.enabled = false;
+	mcp25xxfd_can_int_free(cpriv);
 
 	/* close the can_decice */
 	close_candev(net);
@@ -608,6 +745,7 @@ static const struct net_device_ops mcp25xxfd_netdev_ops = {
 	.ndo_stop = mcp25xxfd_can_stop,
 	.ndo_start_xmit = mcp25xxfd_can_tx_start_xmit,
 	.ndo_change_mtu = can_change_mtu,
+	.ndo_do_ioctl = mcp25xxfd_can_ptp_ioctl,
 };
 
 /* probe and remove */
@@ -635,11 +773,20 @@ int mcp25xxfd_can_setup(struct mcp25xxfd_priv *priv)
 	cpriv->priv = priv;
 	priv->cpriv = cpriv;
 
+	/* the per cpu statistics */
+	ret = mcp25xxfd_can_stats_alloc(cpriv);
+	if (ret)
+		goto out;
+
 	/* setup network */
 	SET_NETDEV_DEV(net, &spi->dev);
 	net->netdev_ops = &mcp25xxfd_netdev_ops;
+	net->ethtool_ops = &mcp25xxfd_can_ethtool_ops;
 	net->flags |= IFF_ECHO;
 
+	/* rx interrupt coalescing defaults */
+	mcp25xxfd_can_rx_coalesce_init(cpriv);
+
 	/* assign transceiver */
 	cpriv->transceiver = transceiver;
 
@@ -666,15 +813,23 @@ int mcp25xxfd_can_setup(struct mcp25xxfd_priv *priv)
 		CAN_CTRLMODE_BERR_REPORTING |
 		CAN_CTRLMODE_ONE_SHOT;
 
+	/* the hardware clock - set up before the netdev can get opened
+	 * or asked for its timestamping config
+	 */
+	mcp25xxfd_can_ptp_setup(cpriv);
+
 	ret = register_candev(net);
 	if (ret) {
 		dev_err(&spi->dev, "Failed to register can device\n");
-		goto out;
+		goto out_ptp;
 	}
 
 	mcp25xxfd_can_debugfs_setup(cpriv);
 
 	return 0;
+out_ptp:
+	mcp25xxfd_can_ptp_remove(cpriv);
+	mcp25xxfd_can_stats_free(cpriv);
 out:
 	free_candev(net);
 	priv->cpriv = NULL;
@@ -686,6 +841,9 @@ void mcp25xxfd_can_remove(struct mcp25xxfd_priv *priv)
 {
 	if (priv->cpriv) {
 		unregister_candev(priv->cpriv->can.dev);
+		mcp25xxfd_can_ptp_remove(priv->cpriv);
+		mcp25xxfd_can_debugfs_remove(priv->cpriv);
+		mcp25xxfd_can_stats_free(priv->cpriv);
 		free_candev(priv->cpriv->can.dev);
 		priv->cpriv = NULL;
 	}
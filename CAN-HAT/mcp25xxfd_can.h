@@ -23,7 +23,7 @@ int mcp25xxfd_can_targetmode(struct mcp25xxfd_can_priv *cpriv)
 
 static inline
 void mcp25xxfd_can_queue_frame(struct mcp25xxfd_can_priv *cpriv,
-			       s32 fifo, u16 ts, bool is_rx)
+			       s32 fifo, u32 ts, bool is_rx)
 {
 	int idx = cpriv->fifos.submit_queue_count;
 
@@ -31,9 +31,12 @@ void mcp25xxfd_can_queue_frame(struct mcp25xxfd_can_priv *cpriv,
 	cpriv->fifos.submit_queue[idx].ts = ts;
 	cpriv->fifos.submit_queue[idx].is_rx = is_rx;
 
-	MCP25XXFD_DEBUGFS_INCR(cpriv->fifos.submit_queue_count);
+	cpriv->fifos.submit_queue_count++;
 }
 
+/* the minimum time a frame with these object flags occupies the bus */
+u32 mcp25xxfd_can_frame_duration(struct mcp25xxfd_can_priv *cpriv, u32 flags);
+
 /* get the current controller mode */
 int mcp25xxfd_can_get_mode(struct mcp25xxfd_priv *priv, u32 *reg);
 
@@ -9,8 +9,14 @@
 
 #include <linux/dcache.h>
 #include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/ethtool.h>
+#include <linux/seq_file.h>
+#include <linux/spi/spi.h>
+#include <linux/stddef.h>
 #include "mcp25xxfd_can_debugfs.h"
 #include "mcp25xxfd_can_priv.h"
+#include "mcp25xxfd_can_stats.h"
 #include "mcp25xxfd_can_tx.h"
 
 static void mcp25xxfd_can_debugfs_regs(struct mcp25xxfd_can_priv *cpriv,
@@ -40,75 +46,137 @@ static void mcp25xxfd_can_debugfs_status(struct mcp25xxfd_can_priv *cpriv,
 	debugfs_create_x32("trec",    0444, dir, &cpriv->status.trec);
 }
 
+/* print latency histograms as a table - one column per stage
+ * starting at offset in the stats structure
+ */
+static void mcp25xxfd_can_debugfs_latency(struct seq_file *file,
+					  struct mcp25xxfd_can_priv *cpriv,
+					  const char * const *stages,
+					  int count, size_t offset, int bins)
+{
+	int i, s;
+
+	seq_printf(file, "%-10s", "us");
+	for (s = 0; s < count; s++)
+		seq_printf(file, " %12s", stages[s]);
+	seq_puts(file, "\n");
+
+	for (i = 0; i < bins; i++) {
+		if (i < bins - 1)
+			seq_printf(file, "< %-8u", 1U << i);
+		else
+			seq_printf(file, ">= %-7u", 1U << (i - 1));
+		for (s = 0; s < count; s++)
+			seq_printf(file, " %12llu",
+				   mcp25xxfd_can_stats_sum(cpriv, offset +
+					(s * bins + i) * sizeof(u64)));
+		seq_puts(file, "\n");
+	}
+}
+
+static int mcp25xxfd_can_debugfs_tx_latency_show(struct seq_file *file,
+						 void *offset)
+{
+	static const char * const stages[] = {
+		[MCP25XXFD_CAN_TX_LATENCY_FILL] = "fill",
+		[MCP25XXFD_CAN_TX_LATENCY_TRIGGER] = "trigger",
+		[MCP25XXFD_CAN_TX_LATENCY_BUS] = "bus",
+		[MCP25XXFD_CAN_TX_LATENCY_IRQ] = "irq",
+		[MCP25XXFD_CAN_TX_LATENCY_TOTAL] = "total",
+	};
+	struct mcp25xxfd_can_priv *cpriv = file->private;
+
+	mcp25xxfd_can_debugfs_latency(file, cpriv, stages, ARRAY_SIZE(stages),
+				      offsetof(struct mcp25xxfd_can_stats,
+					       tx_latency),
+				      MCP25XXFD_CAN_TX_LATENCY_BINS);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mcp25xxfd_can_debugfs_tx_latency);
+
+static int mcp25xxfd_can_debugfs_rx_latency_show(struct seq_file *file,
+						 void *offset)
+{
+	static const char * const stages[] = {
+		[MCP25XXFD_CAN_RX_LATENCY_IRQ] = "irq",
+		[MCP25XXFD_CAN_RX_LATENCY_STATUS] = "status",
+		[MCP25XXFD_CAN_RX_LATENCY_FIFO] = "fifo",
+		[MCP25XXFD_CAN_RX_LATENCY_SUBMIT] = "submit",
+		[MCP25XXFD_CAN_RX_LATENCY_NETIF_RX] = "netif_rx",
+		[MCP25XXFD_CAN_RX_LATENCY_TOTAL] = "total",
+	};
+	struct mcp25xxfd_can_priv *cpriv = file->private;
+
+	mcp25xxfd_can_debugfs_latency(file, cpriv, stages, ARRAY_SIZE(stages),
+				      offsetof(struct mcp25xxfd_can_stats,
+					       rx_latency),
+				      MCP25XXFD_CAN_RX_LATENCY_BINS);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mcp25xxfd_can_debugfs_rx_latency);
+
+/* the data of a single stats file - the counters are per cpu,
+ * so they get summed up on every read
+ */
+struct mcp25xxfd_can_debugfs_stat {
+	struct mcp25xxfd_can_priv *cpriv;
+	int index;
+};
+
+static int mcp25xxfd_can_debugfs_stat_get(void *data, u64 *val)
+{
+	struct mcp25xxfd_can_debugfs_stat *stat = data;
+
+	*val = mcp25xxfd_can_stats_read(stat->cpriv, stat->index);
+
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(mcp25xxfd_can_debugfs_stat_fops,
+			 mcp25xxfd_can_debugfs_stat_get, NULL, "%llu\n");
+
 static void mcp25xxfd_can_debugfs_stats(struct mcp25xxfd_can_priv *cpriv,
 					struct dentry *root)
 {
+	struct device *dev = &cpriv->priv->spi->dev;
+	struct mcp25xxfd_can_debugfs_stat *stat;
 	struct dentry *dir = debugfs_create_dir("stats", root);
-	char name[32];
-	u64 *data;
-	int i;
+	int i, count = mcp25xxfd_can_stats_count();
+	char name[ETH_GSTRING_LEN];
 
-# define DEBUGFS_CREATE(name, var) debugfs_create_u64(name, 0444, dir, \
-						      &cpriv->stats.var)
-	DEBUGFS_CREATE("irq_calls",		 irq_calls);
-	DEBUGFS_CREATE("irq_loops",		 irq_loops);
-	DEBUGFS_CREATE("irq_thread_rescheduled", irq_thread_rescheduled);
-
-	DEBUGFS_CREATE("int_system_error",	 int_serr_count);
-	DEBUGFS_CREATE("int_system_error_tx",	 int_serr_tx_count);
-	DEBUGFS_CREATE("int_system_error_rx",	 int_serr_rx_count);
-	DEBUGFS_CREATE("int_mode_switch",	 int_mod_count);
-	DEBUGFS_CREATE("int_rx",		 int_rx_count);
-	DEBUGFS_CREATE("int_tx_attempt",	 int_txat_count);
-	DEBUGFS_CREATE("int_tef",		 int_tef_count);
-	DEBUGFS_CREATE("int_rx_overflow",	 int_rxov_count);
-	DEBUGFS_CREATE("int_ecc_error",		 int_ecc_count);
-	DEBUGFS_CREATE("int_rx_invalid_message", int_ivm_count);
-	DEBUGFS_CREATE("int_crcerror",		 int_cerr_count);
-
-	DEBUGFS_CREATE("tef_reads",		 tef_reads);
-	DEBUGFS_CREATE("tef_conservative_reads", tef_conservative_reads);
-	DEBUGFS_CREATE("tef_optimized_reads",	 tef_optimized_reads);
-	DEBUGFS_CREATE("tef_read_splits",	 tef_read_splits);
-
-	for (i = 0; i < MCP25XXFD_CAN_TEF_READ_BINS - 1; i++) {
-		snprintf(name, sizeof(name),
-			 "tef_optimized_reads_%i", i + 1);
-		data = &cpriv->stats.tef_optimized_read_sizes[i];
-		debugfs_create_u64(name, 0444, dir, data);
-	}
-	snprintf(name, sizeof(name), "tef_optimized_reads_%i+", i + 1);
-	debugfs_create_u64(name, 0444, dir,
-			   &cpriv->stats.tef_optimized_read_sizes[i]);
-
-	DEBUGFS_CREATE("tx_frames_fd",		 tx_fd_count);
-	DEBUGFS_CREATE("tx_frames_brs",		 tx_brs_count);
-
-	DEBUGFS_CREATE("rx_reads",		 rx_reads);
-	DEBUGFS_CREATE("rx_reads_prefetched_too_few",
-		       rx_reads_prefetched_too_few);
-	DEBUGFS_CREATE("rx_reads_prefetched_too_few_bytes",
-		       rx_reads_prefetched_too_few_bytes);
-	DEBUGFS_CREATE("rx_reads_prefetched_too_many",
-		       rx_reads_prefetched_too_many);
-	DEBUGFS_CREATE("rx_reads_prefetched_too_many_bytes",
-		       rx_reads_prefetched_too_many_bytes);
-	DEBUGFS_CREATE("rx_single_reads",	 rx_single_reads);
-	DEBUGFS_CREATE("rx_bulk_reads",		 rx_bulk_reads);
-
-	for (i = 0; i < MCP25XXFD_CAN_RX_BULK_READ_BINS - 1; i++) {
-		snprintf(name, sizeof(name), "rx_bulk_reads_%i", i + 1);
-		data = &cpriv->stats.rx_bulk_read_sizes[i];
-		debugfs_create_u64(name, 0444, dir, data);
+	debugfs_create_u64("ifup_latency_us", 0444, dir,
+			   &cpriv->gauges.ifup_latency_us);
+	debugfs_create_u64("restart_latency_us", 0444, dir,
+			   &cpriv->gauges.restart_latency_us);
+
+	/* one file per counter and histogram bin - the latency
+	 * histograms are shown as tables instead
+	 */
+	if (!cpriv->debugfs_stats)
+		cpriv->debugfs_stats = devm_kcalloc(dev, count, sizeof(*stat),
+						    GFP_KERNEL);
+	if (cpriv->debugfs_stats) {
+		for (i = 0; i < count; i++) {
+			if (mcp25xxfd_can_stats_flags(i) &
+			    MCP25XXFD_CAN_STATS_TABLE)
+				continue;
+			stat = &cpriv->debugfs_stats[i];
+			stat->cpriv = cpriv;
+			stat->index = i;
+			mcp25xxfd_can_stats_name(i, name, sizeof(name));
+			debugfs_create_file_unsafe(name, 0444, dir, stat,
+					&mcp25xxfd_can_debugfs_stat_fops);
+		}
 	}
-	snprintf(name, sizeof(name), "rx_bulk_reads_%i+", i + 1);
-	debugfs_create_u64(name, 0444, dir,
-			   &cpriv->stats.rx_bulk_read_sizes[i]);
+	debugfs_create_file("tx_latency", 0444, dir, cpriv,
+			    &mcp25xxfd_can_debugfs_tx_latency_fops);
+	debugfs_create_file("rx_latency", 0444, dir, cpriv,
+			    &mcp25xxfd_can_debugfs_rx_latency_fops);
 
 	if (cpriv->can.dev->mtu == CANFD_MTU)
 		debugfs_create_u32("rx_reads_prefetch_predicted_len", 0444,
 				   dir, &cpriv->rx_history.predicted_len);
-#undef DEBUGFS_CREATE
 }
 
 static void mcp25xxfd_can_debugfs_tef(struct mcp25xxfd_can_priv *cpriv,
@@ -182,6 +250,29 @@ static void mcp25xxfd_can_debugfs_tx_fifos(struct mcp25xxfd_can_priv *cpriv,
 	mcp25xxfd_can_debugfs_rxtx_fifos(&cpriv->fifos.rx, dir);
 }
 
+static int mcp25xxfd_can_debugfs_tx_queue_fifos_show(struct seq_file *file,
+						     void *offset)
+{
+	static const char * const stages[] = {
+		[MCP25XXFD_CAN_TX_STAGE_IDLE] = "idle",
+		[MCP25XXFD_CAN_TX_STAGE_IN_FILL_FIFO_TRANSFER] =
+			"in_fill_fifo_transfer",
+		[MCP25XXFD_CAN_TX_STAGE_IN_TRIGGER_FIFO_TRANSFER] =
+			"in_trigger_fifo_transfer",
+		[MCP25XXFD_CAN_TX_STAGE_IN_CAN_TRANSFER] = "in_can_transfer",
+	};
+	struct mcp25xxfd_tx_spi_message_queue *queue = file->private;
+	int i;
+
+	/* the fifos may change stage while this gets read */
+	for (i = 0; i < ARRAY_SIZE(stages); i++)
+		seq_printf(file, "%-25s %08x\n", stages[i],
+			   mcp25xxfd_can_tx_queue_fifos(queue, i));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mcp25xxfd_can_debugfs_tx_queue_fifos);
+
 static void mcp25xxfd_can_debugfs_tx_queue(struct mcp25xxfd_can_priv *cpriv,
 					   struct dentry *root)
 {
@@ -194,15 +285,10 @@ static void mcp25xxfd_can_debugfs_tx_queue(struct mcp25xxfd_can_priv *cpriv,
 	dir = debugfs_create_dir("tx_queue", root);
 
 	debugfs_create_u32("state", 0444, dir, &queue->state);
-	debugfs_create_x32("fifos_idle", 0444, dir, &queue->idle);
-	debugfs_create_x32("fifos_in_fill_fifo_transfer",
-			   0444, dir, &queue->in_fill_fifo_transfer);
-	debugfs_create_x32("fifos_in_trigger_fifo_transfer",
-			   0444, dir, &queue->in_trigger_fifo_transfer);
-	debugfs_create_x32("fifos_in_can_transfer",
-			   0444, dir, &queue->in_can_transfer);
-	debugfs_create_x32("fifos_transferred",
-			   0444, dir, &queue->transferred);
+	debugfs_create_file("fifos", 0444, dir, queue,
+			    &mcp25xxfd_can_debugfs_tx_queue_fifos_fops);
+	debugfs_create_x32("fifos_blocked",
+			   0444, dir, &queue->blocked);
 }
 
 void mcp25xxfd_can_debugfs_remove(struct mcp25xxfd_can_priv *cpriv)
@@ -15,10 +15,8 @@
 
 #define MCP25XXFD_DEBUGFS_INCR(counter) ((counter)++)
 #define MCP25XXFD_DEBUGFS_ADD(counter, val) ((counter) += (val))
-#define MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, counter)		\
-	(((cpriv)->stats.counter)++)
-#define MCP25XXFD_DEBUGFS_STATS_ADD(cpriv, counter, val)	\
-	(((cpriv)->stats.counter) += (val))
+#define MCP25XXFD_DEBUGFS_STATS_SET(cpriv, counter, val)	\
+	(((cpriv)->gauges.counter) = (val))
 
 void mcp25xxfd_can_debugfs_setup(struct mcp25xxfd_can_priv *cpriv);
 void mcp25xxfd_can_debugfs_remove(struct mcp25xxfd_can_priv *cpriv);
@@ -27,8 +25,7 @@ void mcp25xxfd_can_debugfs_remove(struct mcp25xxfd_can_priv *cpriv);
 
 #define MCP25XXFD_DEBUGFS_INCR(counter)
 #define MCP25XXFD_DEBUGFS_ADD(counter, val)
-#define MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, counter)
-#define MCP25XXFD_DEBUGFS_STATS_ADD(cpriv, counter, val)
+#define MCP25XXFD_DEBUGFS_STATS_SET(cpriv, counter, val)
 
 static inline
 void mcp25xxfd_can_debugfs_setup(struct mcp25xxfd_can_priv *cpriv)
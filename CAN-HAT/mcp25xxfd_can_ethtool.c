@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* CAN bus driver for Microchip 25XXFD CAN Controller with SPI Interface
+ *
+ * Copyright 2019 Martin Sperl <kernel@martin.sperl.org>
+ */
+
+#include <linux/errno.h>
+#include <linux/ethtool.h>
+#include <linux/kernel.h>
+#include <linux/net_tstamp.h>
+#include <linux/netdevice.h>
+#include <linux/time.h>
+
+#include "mcp25xxfd_can_ethtool.h"
+#include "mcp25xxfd_can_priv.h"
+#include "mcp25xxfd_can_ptp.h"
+#include "mcp25xxfd_can_stats.h"
+
+/* rx interrupt coalescing - see mcp25xxfd_can_rx.c for details:
+ * rx-usecs:  the maximum delay of rx frames while coalescing,
+ *            0 disables coalescing
+ * rx-frames: the number of frames pending in a single rx interrupt
+ *            that switches to coalescing
+ */
+static int mcp25xxfd_can_ethtool_get_coalesce(struct net_device *net,
+					      struct ethtool_coalesce *ec)
+{
+	struct mcp25xxfd_can_priv *cpriv = netdev_priv(net);
+
+	ec->rx_coalesce_usecs = cpriv->rx_coalesce.usecs;
+	ec->rx_max_coalesced_frames = cpriv->rx_coalesce.frames;
+
+	return 0;
+}
+
+static int mcp25xxfd_can_ethtool_set_coalesce(struct net_device *net,
+					      struct ethtool_coalesce *ec)
+{
+	struct mcp25xxfd_can_priv *cpriv = netdev_priv(net);
+
+	/* there are at most 31 rx fifos */
+	if (ec->rx_max_coalesced_frames < 1 ||
+	    ec->rx_max_coalesced_frames > 31)
+		return -EINVAL;
+	if (ec->rx_coalesce_usecs > USEC_PER_SEC)
+		return -EINVAL;
+
+	WRITE_ONCE(cpriv->rx_coalesce.frames, ec->rx_max_coalesced_frames);
+	WRITE_ONCE(cpriv->rx_coalesce.usecs, ec->rx_coalesce_usecs);
+
+	return 0;
+}
+
+/* hardware timestamps - see mcp25xxfd_can_ptp.c */
+static int mcp25xxfd_can_ethtool_get_ts_info(struct net_device *net,
+					     struct ethtool_ts_info *info)
+{
+	struct mcp25xxfd_can_priv *cpriv = netdev_priv(net);
+
+	info->so_timestamping = SOF_TIMESTAMPING_TX_SOFTWARE |
+		SOF_TIMESTAMPING_RX_SOFTWARE |
+		SOF_TIMESTAMPING_SOFTWARE |
+		SOF_TIMESTAMPING_TX_HARDWARE |
+		SOF_TIMESTAMPING_RX_HARDWARE |
+		SOF_TIMESTAMPING_RAW_HARDWARE;
+	info->phc_index = mcp25xxfd_can_ptp_index(cpriv);
+	info->tx_types = BIT(HWTSTAMP_TX_OFF) | BIT(HWTSTAMP_TX_ON);
+	info->rx_filters = BIT(HWTSTAMP_FILTER_NONE) | BIT(HWTSTAMP_FILTER_ALL);
+
+	return 0;
+}
+
+/* statistics - see mcp25xxfd_can_stats.c */
+static int mcp25xxfd_can_ethtool_get_sset_count(struct net_device *net,
+						int sset)
+{
+	switch (sset) {
+	case ETH_SS_STATS:
+		return mcp25xxfd_can_stats_count();
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void mcp25xxfd_can_ethtool_get_strings(struct net_device *net,
+					      u32 sset, u8 *data)
+{
+	switch (sset) {
+	case ETH_SS_STATS:
+		mcp25xxfd_can_stats_strings(data);
+		break;
+	}
+}
+
+static void mcp25xxfd_can_ethtool_get_stats(struct net_device *net,
+					    struct ethtool_stats *stats,
+					    u64 *data)
+{
+	struct mcp25xxfd_can_priv *cpriv = netdev_priv(net);
+
+	mcp25xxfd_can_stats_values(cpriv, data);
+}
+
+const struct ethtool_ops mcp25xxfd_can_ethtool_ops = {
+	.get_coalesce = mcp25xxfd_can_ethtool_get_coalesce,
+	.set_coalesce = mcp25xxfd_can_ethtool_set_coalesce,
+	.get_ts_info = mcp25xxfd_can_ethtool_get_ts_info,
+	.get_sset_count = mcp25xxfd_can_ethtool_get_sset_count,
+	.get_strings = mcp25xxfd_can_ethtool_get_strings,
+	.get_ethtool_stats = mcp25xxfd_can_ethtool_get_stats,
+};
@@ -0,0 +1,15 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* CAN bus driver for Microchip 25XXFD CAN Controller with SPI Interface
+ *
+ * Copyright 2019 Martin Sperl <kernel@martin.sperl.org>
+ */
+
+#ifndef __MCP25XXFD_CAN_ETHTOOL_H
+#define __MCP25XXFD_CAN_ETHTOOL_H
+
+#include <linux/ethtool.h>
+
+extern const struct ethtool_ops mcp25xxfd_can_ethtool_ops;
+
+#endif /* __MCP25XXFD_CAN_ETHTOOL_H */
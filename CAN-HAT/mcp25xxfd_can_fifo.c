@@ -9,6 +9,7 @@
 
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/slab.h>
 #include <linux/spi/spi.h>
 
 #include "mcp25xxfd_can.h"
@@ -30,8 +31,28 @@ static bool three_shot;
 module_param(three_shot, bool, 0664);
 MODULE_PARM_DESC(three_shot, "Use 3 shots when one-shot is requested");
 
+/* the fifo and filter configuration is written in two contiguous blocks:
+ * TEFCON and TXQCON thru FLTCON(31) - the register at 0x4C is reserved
+ * and thus not part of any of those blocks
+ */
+#define MCP25XXFD_CAN_FIFO_REGS_START	MCP25XXFD_CAN_TXQCON
+#define MCP25XXFD_CAN_FIFO_REGS_END	MCP25XXFD_CAN_FLTOBJ(0)
+#define MCP25XXFD_CAN_FIFO_REGS_SIZE					\
+	(MCP25XXFD_CAN_FIFO_REGS_END - MCP25XXFD_CAN_FIFO_REGS_START)
+#define MCP25XXFD_CAN_FIFO_REGS_IDX(reg)				\
+	(((reg) - MCP25XXFD_CAN_FIFO_REGS_START) / sizeof(u32))
+
+/* the FIFOCON/FIFOSTA/FIFOUA triplets of fifo 1 thru 31 */
+#define MCP25XXFD_CAN_FIFO_STATE_START	MCP25XXFD_CAN_FIFOCON(1)
+#define MCP25XXFD_CAN_FIFO_STATE_END	MCP25XXFD_CAN_FIFOCON(32)
+#define MCP25XXFD_CAN_FIFO_STATE_SIZE					\
+	(MCP25XXFD_CAN_FIFO_STATE_END - MCP25XXFD_CAN_FIFO_STATE_START)
+#define MCP25XXFD_CAN_FIFO_STATE_IDX(reg)				\
+	(((reg) - MCP25XXFD_CAN_FIFO_STATE_START) / sizeof(u32))
+
 static int mcp25xxfd_can_fifo_get_address(struct mcp25xxfd_can_priv *cpriv)
 {
+	u32 *regs;
 	int fifo, ret;
 
 	/* we need to move out of config mode to force address computation */
@@ -46,30 +67,43 @@ static int mcp25xxfd_can_fifo_get_address(struct mcp25xxfd_can_priv *cpriv)
 	if (ret)
 		return ret;
 
-	/* read address and config back in */
-	for (fifo = 1; fifo < 32; fifo++) {
-		ret = mcp25xxfd_cmd_read(cpriv->priv->spi,
-					 MCP25XXFD_CAN_FIFOUA(fifo),
-					 &cpriv->fifos.info[fifo].offset);
-		if (ret)
-			return ret;
-	}
+	regs = kzalloc(MCP25XXFD_CAN_FIFO_STATE_SIZE, GFP_KERNEL);
+	if (!regs)
+		return -ENOMEM;
 
-	return 0;
+	/* read all the FIFOCON/FIFOSTA/FIFOUA triplets back in one go */
+	ret = mcp25xxfd_cmd_read_regs(cpriv->priv->spi,
+				      MCP25XXFD_CAN_FIFO_STATE_START,
+				      regs, MCP25XXFD_CAN_FIFO_STATE_SIZE);
+	if (ret)
+		goto out;
+
+	/* and extract the addresses */
+	for (fifo = 1; fifo < 32; fifo++)
+		cpriv->fifos.info[fifo].offset =
+			regs[MCP25XXFD_CAN_FIFO_STATE_IDX(
+				MCP25XXFD_CAN_FIFOUA(fifo))];
+
+out:
+	kfree(regs);
+
+	return ret;
 }
 
-static int mcp25xxfd_can_fifo_setup_config(struct mcp25xxfd_can_priv *cpriv,
-					   struct mcp25xxfd_fifo *desc,
-					   u32 flags, u32 flags_last)
+static void mcp25xxfd_can_fifo_setup_config(struct mcp25xxfd_can_priv *cpriv,
+					    u32 *regs,
+					    struct mcp25xxfd_fifo *desc,
+					    u32 flags, u32 flags_last)
 {
 	u32 val;
-	int i, p, f, c, ret;
+	int i, p, f, c;
 
 	/* now setup the fifos themselves */
 	for (i = 0, f = desc->start, c = desc->count, p = 31;
 	     c > 0; i++, f++, p--, c--) {
 		/* select the effective value */
 		val = (c > 1) ? flags : flags_last;
+		cpriv->fifos.info[f].con = val;
 
 		/* are we in tx mode */
 		if (flags & MCP25XXFD_CAN_FIFOCON_TXEN) {
@@ -80,17 +114,14 @@ static int mcp25xxfd_can_fifo_setup_config(struct mcp25xxfd_can_priv *cpriv,
 			cpriv->fifos.info[f].is_rx = true;
 		}
 
-		/* write the config to the controller in one go */
-		ret = mcp25xxfd_cmd_write(cpriv->priv->spi,
-					  MCP25XXFD_CAN_FIFOCON(f), val);
-		if (ret)
-			return ret;
+		/* store the config in the register block */
+		regs[MCP25XXFD_CAN_FIFO_REGS_IDX(MCP25XXFD_CAN_FIFOCON(f))] =
+			val;
 	}
-
-	return 0;
 }
 
-static int mcp25xxfd_can_fifo_setup_tx(struct mcp25xxfd_can_priv *cpriv)
+static void mcp25xxfd_can_fifo_setup_tx(struct mcp25xxfd_can_priv *cpriv,
+					u32 *regs)
 {
 	u32 tx_flags = MCP25XXFD_CAN_FIFOCON_FRESET |     /* reset FIFO */
 		MCP25XXFD_CAN_FIFOCON_TXEN |              /* a tx FIFO */
@@ -111,16 +142,18 @@ static int mcp25xxfd_can_fifo_setup_tx(struct mcp25xxfd_can_priv *cpriv)
 		tx_flags |= MCP25XXFD_CAN_FIFOCON_TXAT_UNLIMITED <<
 			MCP25XXFD_CAN_FIFOCON_TXAT_SHIFT;
 
-	return mcp25xxfd_can_fifo_setup_config(cpriv, &cpriv->fifos.tx,
-					       tx_flags, tx_flags);
+	mcp25xxfd_can_fifo_setup_config(cpriv, regs, &cpriv->fifos.tx,
+					tx_flags, tx_flags);
 }
 
-static int mcp25xxfd_can_fifo_setup_rx(struct mcp25xxfd_can_priv *cpriv)
+static void mcp25xxfd_can_fifo_setup_rx(struct mcp25xxfd_can_priv *cpriv,
+					u32 *regs)
 {
+	/* for 1 deep fifos full and half full coincide with not empty,
+	 * rx interrupt coalescing happens on the RXIE in CAN_INT instead
+	 */
 	u32 rx_flags = MCP25XXFD_CAN_FIFOCON_FRESET |     /* reset FIFO */
 		MCP25XXFD_CAN_FIFOCON_RXTSEN |            /* RX timestamps */
-		MCP25XXFD_CAN_FIFOCON_TFERFFIE |          /* FIFO Full */
-		MCP25XXFD_CAN_FIFOCON_TFHRFHIE |          /* FIFO Half Full*/
 		MCP25XXFD_CAN_FIFOCON_TFNRFNIE |          /* FIFO not empty */
 		(cpriv->fifos.payload_mode <<
 		 MCP25XXFD_CAN_FIFOCON_PLSIZE_SHIFT) |
@@ -128,30 +161,26 @@ static int mcp25xxfd_can_fifo_setup_rx(struct mcp25xxfd_can_priv *cpriv)
 	/* enable overflow int on last fifo */
 	u32 rx_flags_last = rx_flags | MCP25XXFD_CAN_FIFOCON_RXOVIE;
 
-	return mcp25xxfd_can_fifo_setup_config(cpriv, &cpriv->fifos.rx,
-					       rx_flags, rx_flags_last);
+	mcp25xxfd_can_fifo_setup_config(cpriv, regs, &cpriv->fifos.rx,
+					rx_flags, rx_flags_last);
 }
 
-static int mcp25xxfd_can_fifo_setup_rxfilter(struct mcp25xxfd_can_priv *cpriv)
+static void mcp25xxfd_can_fifo_setup_rxfilter(struct mcp25xxfd_can_priv *cpriv,
+					      u32 *regs)
 {
-	u8 filter_con[32];
 	int c, f;
 
-	/* clear the filters and filter mappings for all filters */
-	memset(filter_con, 0, sizeof(filter_con));
-
-	/* and now set up the rx filters */
+	/* the filters and filter mappings for all filters are already
+	 * cleared as the register block is zero initialized,
+	 * so we only set up the rx filters themselves
+	 */
 	for (c = 0, f = cpriv->fifos.rx.start; c < cpriv->fifos.rx.count;
 	     c++, f++) {
 		/* set up filter config - we can use the mask of filter 0 */
-		filter_con[c] = MCP25XXFD_CAN_FIFOCON_FLTEN(0) |
-			(f << MCP25XXFD_CAN_FILCON_SHIFT(0));
+		regs[MCP25XXFD_CAN_FIFO_REGS_IDX(MCP25XXFD_CAN_FLTCON(c))] |=
+			MCP25XXFD_CAN_FIFOCON_FLTEN(c) |
+			(f << MCP25XXFD_CAN_FILCON_SHIFT(c));
 	}
-
-	/* and set up filter control */
-	return mcp25xxfd_cmd_write_regs(cpriv->priv->spi,
-					MCP25XXFD_CAN_FLTCON(0),
-					(u32 *)filter_con, sizeof(filter_con));
 }
 
 static int mcp25xxfd_can_fifo_compute(struct mcp25xxfd_can_priv *cpriv)
@@ -264,15 +293,20 @@ static int mcp25xxfd_can_fifo_clear_regs(struct mcp25xxfd_can_priv *cpriv,
 	return ret;
 }
 
-static int mcp25xxfd_can_fifo_clear(struct mcp25xxfd_can_priv *cpriv)
+static void mcp25xxfd_can_fifo_clear_info(struct mcp25xxfd_can_priv *cpriv)
 {
-	int ret;
-
 	memset(&cpriv->fifos.info, 0, sizeof(cpriv->fifos.info));
 	memset(&cpriv->fifos.tx, 0, sizeof(cpriv->fifos.tx));
 	memset(&cpriv->fifos.rx, 0, sizeof(cpriv->fifos.rx));
 	memset(&cpriv->fifos.tef, 0, sizeof(cpriv->fifos.tef));
 	memset(&cpriv->fifos.submit_queue, 0, sizeof(cpriv->fifos.submit_queue));
+}
+
+static int mcp25xxfd_can_fifo_clear(struct mcp25xxfd_can_priv *cpriv)
+{
+	int ret;
+
+	mcp25xxfd_can_fifo_clear_info(cpriv);
 
 	/* clear FIFO config */
 	ret = mcp25xxfd_can_fifo_clear_regs(cpriv, MCP25XXFD_CAN_FIFOCON(1),
@@ -285,20 +319,11 @@ static int mcp25xxfd_can_fifo_clear(struct mcp25xxfd_can_priv *cpriv)
 					     MCP25XXFD_CAN_FLTCON(32));
 }
 
-int mcp25xxfd_can_fifo_setup(struct mcp25xxfd_can_priv *cpriv)
+static int mcp25xxfd_can_fifo_write_config(struct mcp25xxfd_can_priv *cpriv)
 {
+	u32 *regs;
 	int ret;
 
-	/* clear fifo config */
-	ret = mcp25xxfd_can_fifo_clear(cpriv);
-	if (ret)
-		return ret;
-
-	/* compute fifos counts */
-	ret = mcp25xxfd_can_fifo_compute(cpriv);
-	if (ret)
-		return ret;
-
 	/* configure TEF */
 	if (cpriv->fifos.tef.count)
 		cpriv->regs.tefcon =
@@ -314,19 +339,43 @@ int mcp25xxfd_can_fifo_setup(struct mcp25xxfd_can_priv *cpriv)
 	if (ret)
 		return ret;
 
-	/* TXQueue disabled */
-	ret = mcp25xxfd_cmd_write(cpriv->priv->spi, MCP25XXFD_CAN_TXQCON, 0);
-	if (ret)
-		return ret;
+	/* the register block from TXQCON to FLTCON(31) - zero initialized,
+	 * which also leaves the TXQueue disabled, clears the state of
+	 * all FIFOs and disables all filters
+	 */
+	regs = kzalloc(MCP25XXFD_CAN_FIFO_REGS_SIZE, GFP_KERNEL);
+	if (!regs)
+		return -ENOMEM;
 
 	/* configure FIFOS themselves */
-	ret = mcp25xxfd_can_fifo_setup_tx(cpriv);
-	if (ret)
-		return ret;
-	ret = mcp25xxfd_can_fifo_setup_rx(cpriv);
+	mcp25xxfd_can_fifo_setup_tx(cpriv, regs);
+	mcp25xxfd_can_fifo_setup_rx(cpriv, regs);
+	mcp25xxfd_can_fifo_setup_rxfilter(cpriv, regs);
+
+	/* and write the whole fifo and filter config in one go */
+	ret = mcp25xxfd_cmd_write_regs(cpriv->priv->spi,
+				       MCP25XXFD_CAN_FIFO_REGS_START,
+				       regs, MCP25XXFD_CAN_FIFO_REGS_SIZE);
+
+	kfree(regs);
+
+	return ret;
+}
+
+int mcp25xxfd_can_fifo_setup(struct mcp25xxfd_can_priv *cpriv)
+{
+	int ret;
+
+	/* clear fifo info - the registers get written in bulk below */
+	mcp25xxfd_can_fifo_clear_info(cpriv);
+
+	/* compute fifos counts */
+	ret = mcp25xxfd_can_fifo_compute(cpriv);
 	if (ret)
 		return ret;
-	ret = mcp25xxfd_can_fifo_setup_rxfilter(cpriv);
+
+	/* configure TEF, TXQ, FIFOs and filters */
+	ret = mcp25xxfd_can_fifo_write_config(cpriv);
 	if (ret)
 		return ret;
 
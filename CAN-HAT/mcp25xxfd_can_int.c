@@ -8,9 +8,11 @@
 #include <linux/can/core.h>
 #include <linux/can/dev.h>
 #include <linux/device.h>
+#include <linux/delay.h>
 #include <linux/interrupt.h>
 #include <linux/irqreturn.h>
 #include <linux/kernel.h>
+#include <linux/kthread.h>
 #include <linux/module.h>
 #include <linux/net.h>
 #include <linux/netdevice.h>
@@ -18,12 +20,15 @@
 #include <linux/slab.h>
 #include <linux/sort.h>
 
+#include <asm/unaligned.h>
+
 #include "mcp25xxfd_regs.h"
 #include "mcp25xxfd_can.h"
 #include "mcp25xxfd_can_debugfs.h"
 #include "mcp25xxfd_can_int.h"
 #include "mcp25xxfd_can_priv.h"
 #include "mcp25xxfd_can_rx.h"
+#include "mcp25xxfd_can_stats.h"
 #include "mcp25xxfd_can_tx.h"
 #include "mcp25xxfd_cmd.h"
 #include "mcp25xxfd_ecc.h"
@@ -34,6 +39,23 @@ module_param(reschedule_int_thread_after, uint, 0664);
 MODULE_PARM_DESC(reschedule_int_thread_after,
 		 "Reschedule the interrupt thread after this many loops\n");
 
+static unsigned int poll_interval_us;
+module_param(poll_interval_us, uint, 0664);
+MODULE_PARM_DESC(poll_interval_us,
+		 "Poll the controller at this interval instead of using interrupts while under load - 0 disables polling (applied on open)\n");
+static unsigned int poll_enter_loops = 8;
+module_param(poll_enter_loops, uint, 0664);
+MODULE_PARM_DESC(poll_enter_loops,
+		 "Switch to polling after the interrupt thread has looped this many times\n");
+static unsigned int poll_exit_empty = 16;
+module_param(poll_exit_empty, uint, 0664);
+MODULE_PARM_DESC(poll_exit_empty,
+		 "Switch back to interrupts after this many consecutive polls without work\n");
+static int poll_cpu = -1;
+module_param(poll_cpu, int, 0664);
+MODULE_PARM_DESC(poll_cpu,
+		 "Pin the polling thread to this cpu - -1 does not pin (applied on open)\n");
+
 static void mcp25xxfd_can_int_send_error_skb(struct mcp25xxfd_can_priv *cpriv)
 {
 	struct net_device *net = cpriv->can.dev;
@@ -87,7 +109,8 @@ static int mcp25xxfd_can_int_submit_frames(struct mcp25xxfd_can_priv *cpriv)
 		fifo = queue[i].fifo;
 		ret = (queue[i].is_rx) ?
 			mcp25xxfd_can_rx_submit_frame(cpriv, fifo) :
-			mcp25xxfd_can_tx_submit_frame(cpriv, fifo);
+			mcp25xxfd_can_tx_submit_frame(cpriv, fifo,
+						      queue[i].ts);
 		if (ret)
 			return ret;
 	}
@@ -135,7 +158,7 @@ int mcp25xxfd_can_int_handle_serrif_txmab(struct mcp25xxfd_can_priv *cpriv)
 
 	cpriv->can.dev->stats.tx_fifo_errors++;
 	cpriv->can.dev->stats.tx_errors++;
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, int_serr_tx_count);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, int_serr_tx_count);
 
 	/* data7 contains custom mcp25xxfd error flags */
 	cpriv->error_frame.data[7] |= MCP25XXFD_CAN_ERR_DATA7_MCP25XXFD_SERR_TX;
@@ -150,7 +173,7 @@ int mcp25xxfd_can_int_handle_serrif_rxmab(struct mcp25xxfd_can_priv *cpriv)
 {
 	cpriv->can.dev->stats.rx_dropped++;
 	cpriv->can.dev->stats.rx_errors++;
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, int_serr_rx_count);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, int_serr_rx_count);
 
 	/* data7 contains custom mcp25xxfd error flags */
 	cpriv->error_frame.data[7] |= MCP25XXFD_CAN_ERR_DATA7_MCP25XXFD_SERR_RX;
@@ -164,7 +187,7 @@ static int mcp25xxfd_can_int_handle_serrif(struct mcp25xxfd_can_priv *cpriv)
 		return 0;
 
 	/* increment statistics counter now */
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, int_serr_count);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, int_serr_count);
 
 	/* interrupt flags have been cleared already */
 
@@ -216,7 +239,7 @@ static int mcp25xxfd_can_int_handle_modif(struct mcp25xxfd_can_priv *cpriv)
 
 	if (!(cpriv->status.intf & MCP25XXFD_CAN_INT_MODIF))
 		return 0;
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, int_mod_count);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, int_mod_count);
 
 	/* get the current mode */
 	ret = mcp25xxfd_can_get_mode(cpriv->priv, &mode);
@@ -263,7 +286,7 @@ static int mcp25xxfd_can_int_handle_eccif(struct mcp25xxfd_can_priv *cpriv)
 	if (!(cpriv->status.intf & MCP25XXFD_CAN_INT_ECCIF))
 		return 0;
 
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, int_ecc_count);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, int_ecc_count);
 
 	/* and prepare ERROR FRAME */
 	cpriv->error_frame.id |= CAN_ERR_CRTL;
@@ -399,7 +422,7 @@ static int mcp25xxfd_can_int_handle_ivmif(struct mcp25xxfd_can_priv *cpriv)
 	if (!(cpriv->status.intf & MCP25XXFD_CAN_INT_IVMIF))
 		return 0;
 
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, int_ivm_count);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, int_ivm_count);
 
 	/* if we have a systemerror as well,
 	 * then ignore it as they correlate
@@ -407,12 +430,14 @@ static int mcp25xxfd_can_int_handle_ivmif(struct mcp25xxfd_can_priv *cpriv)
 	if (cpriv->status.intf & MCP25XXFD_CAN_INT_SERRIF)
 		return 0;
 
-	/* read bus diagnostics */
-	ret = mcp25xxfd_cmd_read_regs(spi, MCP25XXFD_CAN_BDIAG0,
-				      cpriv->bus.bdiag,
-				      sizeof(cpriv->bus.bdiag));
-	if (ret)
-		return ret;
+	/* read bus diagnostics - unless read with the status block */
+	if (!cpriv->bus.bdiag_valid) {
+		ret = mcp25xxfd_cmd_read_regs(spi, MCP25XXFD_CAN_BDIAG0,
+					      cpriv->bus.bdiag,
+					      sizeof(cpriv->bus.bdiag));
+		if (ret)
+			return ret;
+	}
 
 	/* clear the masks of bits to clear */
 	mask = 0;
@@ -456,7 +481,7 @@ static int mcp25xxfd_can_int_handle_cerrif(struct mcp25xxfd_can_priv *cpriv)
 	 * can be found and controlled in the TREC register
 	 */
 
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, int_cerr_count);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, int_cerr_count);
 
 	netdev_warn(cpriv->can.dev, "CAN Bus error experienced");
 
@@ -495,6 +520,8 @@ static int mcp25xxfd_can_int_error_counters(struct mcp25xxfd_can_priv *cpriv)
 
 static int mcp25xxfd_can_int_error_handling(struct mcp25xxfd_can_priv *cpriv)
 {
+	enum can_state old_state = cpriv->can.state;
+
 	/* based on the last state state check the new state */
 	switch (cpriv->can.state) {
 	case CAN_STATE_ERROR_ACTIVE:
@@ -516,9 +543,12 @@ static int mcp25xxfd_can_int_error_handling(struct mcp25xxfd_can_priv *cpriv)
 	if (cpriv->error_frame.id)
 		mcp25xxfd_can_int_send_error_skb(cpriv);
 
-	/* handle BUS OFF */
+	/* handle BUS OFF - notify the can framework only on the transition,
+	 * which also schedules the restart via do_set_mode if restart-ms
+	 * is configured
+	 */
 	if (cpriv->can.state == CAN_STATE_BUS_OFF) {
-		if (cpriv->can.restart_ms == 0) {
+		if (old_state != CAN_STATE_BUS_OFF) {
 			cpriv->can.can_stats.bus_off++;
 			can_bus_off(cpriv->can.dev);
 		}
@@ -530,6 +560,120 @@ static int mcp25xxfd_can_int_error_handling(struct mcp25xxfd_can_priv *cpriv)
 	return 0;
 }
 
+/* the status block read
+ *
+ * Reading the whole status block (INT thru TREC) clocks 28 bytes on
+ * every loop, while most of the time only INT and RXIF are of interest:
+ * * RXOVIF and TXATIF are only needed when their flag is set in INT
+ * * the state relevant bits of TREC only change together with CERRIF,
+ *   so TREC is only needed with CERRIF set or while in an error state
+ * * TXIF and TXREQ are not used for interrupt handling at all
+ * So while error active only INT and RXIF get read and the remainder
+ * of the block gets read by a second chained transfer when INT needs it.
+ * While in an error state the block including BDIAG0/1 gets read in
+ * one go, so that IVMIF handling does not need to read it again.
+ *
+ * status_read_bytes / status_reads gives the average number of bytes
+ * clocked per status read (the full block read takes 30 bytes).
+ */
+static void mcp25xxfd_can_int_status_account(struct mcp25xxfd_can_priv *cpriv,
+					     u32 len)
+{
+	/* account the command bytes as well */
+	MCP25XXFD_CAN_STATS_ADD(cpriv, status_read_bytes, 2 + len);
+}
+
+static int mcp25xxfd_can_int_read_status(struct mcp25xxfd_can_priv *cpriv)
+{
+	struct spi_device *spi = cpriv->priv->spi;
+	u32 len;
+	int ret;
+
+	MCP25XXFD_CAN_STATS_INCR(cpriv, status_reads);
+
+	/* while in an error state read everything including BDIAG */
+	if (cpriv->can.state != CAN_STATE_ERROR_ACTIVE) {
+		len = MCP25XXFD_CAN_INT_STATUS_SIZE_DIAG;
+		MCP25XXFD_CAN_STATS_INCR(cpriv, status_read_diag);
+		mcp25xxfd_can_int_status_account(cpriv, len);
+
+		ret = mcp25xxfd_cmd_read_regs(spi, MCP25XXFD_CAN_INT,
+					      &cpriv->status.intf, len);
+		if (ret)
+			return ret;
+
+		memcpy(cpriv->bus.bdiag, cpriv->status.bdiag,
+		       sizeof(cpriv->bus.bdiag));
+		cpriv->bus.bdiag_valid = true;
+
+		return 0;
+	}
+	cpriv->bus.bdiag_valid = false;
+
+	/* otherwise read INT and RXIF only */
+	len = MCP25XXFD_CAN_INT_STATUS_SIZE_SHORT;
+	mcp25xxfd_can_int_status_account(cpriv, len);
+	ret = mcp25xxfd_cmd_read_regs(spi, MCP25XXFD_CAN_INT,
+				      &cpriv->status.intf, len);
+	if (ret)
+		return ret;
+
+	/* clear the flags not read, so that nothing stale gets handled
+	 * - TXREQ and TREC keep the values last read
+	 */
+	if (!(cpriv->status.intf & (MCP25XXFD_CAN_INT_RXOVIF |
+				    MCP25XXFD_CAN_INT_TXATIF |
+				    MCP25XXFD_CAN_INT_CERRIF))) {
+		cpriv->status.txif = 0;
+		cpriv->status.rxovif = 0;
+		cpriv->status.txatif = 0;
+		return 0;
+	}
+
+	/* and chain the read of the remainder */
+	len = MCP25XXFD_CAN_INT_STATUS_SIZE -
+		MCP25XXFD_CAN_INT_STATUS_SIZE_SHORT;
+	MCP25XXFD_CAN_STATS_INCR(cpriv, status_read_chained);
+	mcp25xxfd_can_int_status_account(cpriv, len);
+
+	return mcp25xxfd_cmd_read_regs(spi, MCP25XXFD_CAN_TXIF,
+				       &cpriv->status.txif, len);
+}
+
+/* rx latency: mark the steps of a status handling cycle
+ * the frames handled in the cycle get accounted on submission
+ * - see mcp25xxfd_can_rx_latency
+ */
+#ifdef CONFIG_DEBUG_FS
+static void mcp25xxfd_can_int_rx_latency_irq(struct mcp25xxfd_can_priv *cpriv)
+{
+	atomic64_set(&cpriv->rx_latency.irq, ktime_get_real_ns());
+}
+
+static
+void mcp25xxfd_can_int_rx_latency_status(struct mcp25xxfd_can_priv *cpriv)
+{
+	atomic64_set(&cpriv->rx_latency.status, ktime_get_real_ns());
+}
+
+static void mcp25xxfd_can_int_rx_latency_fifo(struct mcp25xxfd_can_priv *cpriv)
+{
+	atomic64_set(&cpriv->rx_latency.fifo, ktime_get_real_ns());
+}
+#else
+static void mcp25xxfd_can_int_rx_latency_irq(struct mcp25xxfd_can_priv *cpriv)
+{
+}
+
+static
+void mcp25xxfd_can_int_rx_latency_status(struct mcp25xxfd_can_priv *cpriv)
+{
+}
+
+static void mcp25xxfd_can_int_rx_latency_fifo(struct mcp25xxfd_can_priv *cpriv)
+{
+}
+#endif /* CONFIG_DEBUG_FS */
 
 static int mcp25xxfd_can_int_handle_status(struct mcp25xxfd_can_priv *cpriv)
 {
@@ -564,6 +708,7 @@ static int mcp25xxfd_can_int_handle_status(struct mcp25xxfd_can_priv *cpriv)
 	/* handle the rx */
 	ret = mcp25xxfd_can_rx_handle_int_rxif(cpriv);
 	HANDLE_ERROR("mcp25xxfd_can_rx_handle_int_rxif");
+	mcp25xxfd_can_int_rx_latency_fifo(cpriv);
 
 	/* handle aborted TX FIFOs */
 	ret = mcp25xxfd_can_tx_handle_int_txatif(cpriv);
@@ -609,24 +754,503 @@ err:
 }
 #undef HANDLE_ERROR
 
+/* the hard irq handler and the async status read
+ *
+ * The hard irq handler masks the irq line and submits a prepared
+ * spi_message that reads the status block (INT thru TREC) directly,
+ * so that the spi transfer is started without waiting for the irq thread
+ * to get scheduled.
+ * The completion callback then decides if the irq thread needs to get
+ * woken at all - if it does, the thread uses the status already read
+ * for its first loop instead of reading it again synchronously.
+ * The line gets unmasked again when the irq has been handled.
+ */
+static void mcp25xxfd_can_int_unmask(struct mcp25xxfd_can_priv *cpriv)
+{
+	struct mcp25xxfd_can_int_status_read *sr = cpriv->irq.status_read;
+	unsigned long flags;
+	bool masked;
+
+	if (!sr)
+		return;
+
+	spin_lock_irqsave(&sr->lock, flags);
+	masked = sr->masked;
+	sr->masked = false;
+	spin_unlock_irqrestore(&sr->lock, flags);
+
+	if (masked)
+		enable_irq(cpriv->priv->spi->irq);
+}
+
+/* check if there are any interrupt flags that need handling:
+ * while rx coalescing is active the RXIE is cleared, but the first
+ * loop of a cycle kicked by the rx coalescing timer needs to get
+ * handled nevertheless to read the rx fifos
+ */
+static bool mcp25xxfd_can_int_pending(struct mcp25xxfd_can_priv *cpriv,
+				      u32 intf, bool first)
+{
+	if ((intf >> MCP25XXFD_CAN_INT_IE_SHIFT) & intf)
+		return true;
+
+	return first && READ_ONCE(cpriv->rx_coalesce.timed);
+}
+
+#ifdef CONFIG_DEBUG_FS
+static void
+mcp25xxfd_can_int_status_read_latency(struct mcp25xxfd_can_int_status_read *sr)
+{
+	struct mcp25xxfd_can_priv *cpriv = sr->cpriv;
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), sr->irq_ts));
+	u32 us;
+	int i;
+
+	/* estimate the time the first byte got clocked
+	 * by subtracting the duration of the transfer itself
+	 */
+	if (sr->xfer.speed_hz)
+		ns -= div_u64((u64)sr->xfer.len * 8 * NSEC_PER_SEC,
+			      sr->xfer.speed_hz);
+	us = (ns > 0) ? div_u64(ns, NSEC_PER_USEC) : 0;
+
+	/* and account it in the log2 histogram */
+	i = min_t(int, fls(us), MCP25XXFD_CAN_IRQ_SPI_LATENCY_BINS - 1);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, irq_spi_latency[i]);
+}
+#else
+static void
+mcp25xxfd_can_int_status_read_latency(struct mcp25xxfd_can_int_status_read *sr)
+{
+}
+#endif /* CONFIG_DEBUG_FS */
+
+static void mcp25xxfd_can_int_status_read_complete(void *context)
+{
+	struct mcp25xxfd_can_int_status_read *sr = context;
+	struct mcp25xxfd_can_priv *cpriv = sr->cpriv;
+	int irq = cpriv->priv->spi->irq;
+	u32 intf;
+
+	mcp25xxfd_can_int_status_read_latency(sr);
+	mcp25xxfd_can_int_rx_latency_status(cpriv);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, status_reads);
+	MCP25XXFD_CAN_STATS_ADD(cpriv, status_read_bytes, sr->xfer.len);
+
+	/* on spi or crc errors let the thread read the status again */
+	if (sr->msg.status ||
+	    (sr->crc &&
+	     mcp25xxfd_cmd_check_crc(cpriv->priv->spi, sr->tx,
+				     sr->rx + sr->cmd_len,
+				     MCP25XXFD_CAN_INT_STATUS_SIZE,
+				     sr->rx + sr->cmd_len +
+				     MCP25XXFD_CAN_INT_STATUS_SIZE))) {
+		sr->valid = false;
+		irq_wake_thread(irq, cpriv);
+		goto out;
+	}
+
+	/* if no enabled interrupt flag is active then there is nothing
+	 * to handle, so we can unmask the line without waking the thread
+	 */
+	intf = get_unaligned_le32(sr->rx + sr->cmd_len);
+	if (!mcp25xxfd_can_int_pending(cpriv, intf, true)) {
+		MCP25XXFD_CAN_STATS_INCR(cpriv, irq_status_async_idle);
+		mcp25xxfd_can_int_unmask(cpriv);
+		goto out;
+	}
+
+	/* otherwise hand over the status to the thread */
+	sr->valid = true;
+	irq_wake_thread(irq, cpriv);
+
+out:
+	complete_all(&sr->done);
+}
+
+/* start a status read and handling cycle - returns -EBUSY if a cycle
+ * is already in progress
+ */
+static int mcp25xxfd_can_int_status_read_start(struct mcp25xxfd_can_priv *cpriv)
+{
+	struct mcp25xxfd_can_int_status_read *sr = cpriv->irq.status_read;
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&sr->lock, flags);
+	if (sr->masked) {
+		spin_unlock_irqrestore(&sr->lock, flags);
+		return -EBUSY;
+	}
+
+	sr->irq_ts = ktime_get();
+	mcp25xxfd_can_int_rx_latency_irq(cpriv);
+
+	/* mask the line until the status has been read and handled */
+	disable_irq_nosync(cpriv->priv->spi->irq);
+	sr->masked = true;
+	spin_unlock_irqrestore(&sr->lock, flags);
+
+	/* and start the status read */
+	reinit_completion(&sr->done);
+	ret = spi_async(cpriv->priv->spi, &sr->msg);
+	if (ret) {
+		complete_all(&sr->done);
+		return ret;
+	}
+
+	MCP25XXFD_CAN_STATS_INCR(cpriv, irq_status_async);
+
+	return 0;
+}
+
+irqreturn_t mcp25xxfd_can_int_hardirq(int irq, void *dev_id)
+{
+	struct mcp25xxfd_can_priv *cpriv = dev_id;
+	int ret;
+
+	/* without a prepared status read just run the thread */
+	if (!cpriv->irq.status_read) {
+		mcp25xxfd_can_int_rx_latency_irq(cpriv);
+		return IRQ_WAKE_THREAD;
+	}
+
+	ret = mcp25xxfd_can_int_status_read_start(cpriv);
+	switch (ret) {
+	case 0: /* the completion callback takes it from here */
+	case -EBUSY: /* the line has been masked by the running cycle */
+		return IRQ_HANDLED;
+	default: /* let the thread read the status */
+		return IRQ_WAKE_THREAD;
+	}
+}
+
+/* run a status read and handling cycle as if the irq line had fired,
+ * used by the rx coalescing timer - called in hard irq context
+ */
+void mcp25xxfd_can_int_kick(struct mcp25xxfd_can_priv *cpriv)
+{
+	int irq = cpriv->priv->spi->irq;
+	int ret;
+
+	/* polling reads the rx fifos anyway */
+	if (READ_ONCE(cpriv->irq.poll.active))
+		return;
+
+	/* without a prepared status read just run the thread */
+	if (!cpriv->irq.status_read) {
+		mcp25xxfd_can_int_rx_latency_irq(cpriv);
+		irq_wake_thread(irq, cpriv);
+		return;
+	}
+
+	ret = mcp25xxfd_can_int_status_read_start(cpriv);
+	if (ret && ret != -EBUSY)
+		irq_wake_thread(irq, cpriv);
+}
+
+/* polling mode
+ *
+ * Under sustained load the irq thread keeps looping and gets rescheduled
+ * every reschedule_int_thread_after loops, so the cost of waking and
+ * rescheduling the thread dominates.
+ * So - similar to NAPI - when the irq thread has looped poll_enter_loops
+ * times it keeps the irq line masked and hands over to a polling thread
+ * that reads the status block every poll_interval_us and runs the same
+ * status handling.
+ * After poll_exit_empty consecutive polls without any work the polling
+ * thread unmasks the irq line again and goes back to sleep.
+ */
+static bool mcp25xxfd_can_int_poll_enter(struct mcp25xxfd_can_priv *cpriv)
+{
+	struct mcp25xxfd_can_int_status_read *sr = cpriv->irq.status_read;
+	unsigned long flags;
+	bool masked = false;
+
+	if (!cpriv->irq.poll.thread)
+		return false;
+
+	mutex_lock(&cpriv->irq.poll.lock);
+
+	/* mark active first, so that the rx coalescing timer
+	 * does not start a new cycle once the line mask is handed over
+	 */
+	cpriv->irq.poll.empty = 0;
+	WRITE_ONCE(cpriv->irq.poll.active, true);
+
+	/* keep the line masked - the mask is now owned by polling */
+	if (sr) {
+		spin_lock_irqsave(&sr->lock, flags);
+		masked = sr->masked;
+		sr->masked = false;
+		spin_unlock_irqrestore(&sr->lock, flags);
+	}
+	if (!masked)
+		disable_irq_nosync(cpriv->priv->spi->irq);
+
+	mutex_unlock(&cpriv->irq.poll.lock);
+
+	MCP25XXFD_CAN_STATS_INCR(cpriv, poll_enter);
+
+	/* and start polling */
+	wake_up(&cpriv->irq.poll.wait);
+
+	return true;
+}
+
+/* needs to get called with poll.lock held */
+static void mcp25xxfd_can_int_poll_leave(struct mcp25xxfd_can_priv *cpriv)
+{
+	if (!cpriv->irq.poll.active)
+		return;
+
+	WRITE_ONCE(cpriv->irq.poll.active, false);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, poll_exit);
+
+	/* and unmask the irq line again */
+	enable_irq(cpriv->priv->spi->irq);
+}
+
+static void mcp25xxfd_can_int_poll_once(struct mcp25xxfd_can_priv *cpriv)
+{
+	int ret;
+
+	MCP25XXFD_CAN_STATS_INCR(cpriv, poll_calls);
+
+	/* read interrupt status flags */
+	mcp25xxfd_can_int_rx_latency_irq(cpriv);
+	ret = mcp25xxfd_can_int_read_status(cpriv);
+	mcp25xxfd_can_int_rx_latency_status(cpriv);
+	switch (ret) {
+	case 0: /* no errors, so process */
+		break;
+	case -EILSEQ: /* a crc error, so poll again */
+		return;
+	default: /* all other error cases */
+		goto fail;
+	}
+
+	/* check if there is anything to do */
+	if (!mcp25xxfd_can_int_pending(cpriv, cpriv->status.intf, false)) {
+		MCP25XXFD_CAN_STATS_INCR(cpriv, poll_empty);
+		/* go back to interrupts when idle for long enough */
+		if (++cpriv->irq.poll.empty >= poll_exit_empty)
+			mcp25xxfd_can_int_poll_leave(cpriv);
+		return;
+	}
+	cpriv->irq.poll.empty = 0;
+
+	/* handle the interrupts for real */
+	ret = mcp25xxfd_can_int_handle_status(cpriv);
+	switch (ret) {
+	case 0: /* no errors */
+	case -EILSEQ: /* a crc error, so poll again */
+		return;
+	default: /* all other error cases */
+		goto fail;
+	}
+
+fail:
+	netdev_err(cpriv->can.dev,
+		   "experienced unexpected error %i while polling - switching back to interrupts\n",
+		   ret);
+	mcp25xxfd_can_int_poll_leave(cpriv);
+}
+
+static int mcp25xxfd_can_int_poll_thread(void *data)
+{
+	struct mcp25xxfd_can_priv *cpriv = data;
+	unsigned int interval;
+
+	while (!kthread_should_stop()) {
+		/* sleep until polling gets requested */
+		wait_event_interruptible(cpriv->irq.poll.wait,
+					 READ_ONCE(cpriv->irq.poll.active) ||
+					 kthread_should_stop());
+
+		/* poll once */
+		mutex_lock(&cpriv->irq.poll.lock);
+		if (cpriv->irq.poll.active)
+			mcp25xxfd_can_int_poll_once(cpriv);
+		mutex_unlock(&cpriv->irq.poll.lock);
+
+		/* and wait for the next interval */
+		interval = READ_ONCE(poll_interval_us);
+		if (READ_ONCE(cpriv->irq.poll.active) && interval)
+			usleep_range(interval, interval + interval / 4);
+		else
+			cond_resched();
+	}
+
+	return 0;
+}
+
+static int mcp25xxfd_can_int_poll_alloc(struct mcp25xxfd_can_priv *cpriv)
+{
+	struct task_struct *thread;
+
+	init_waitqueue_head(&cpriv->irq.poll.wait);
+	mutex_init(&cpriv->irq.poll.lock);
+	cpriv->irq.poll.active = false;
+	cpriv->irq.poll.thread = NULL;
+
+	/* polling is optional */
+	if (!poll_interval_us)
+		return 0;
+
+	thread = kthread_create(mcp25xxfd_can_int_poll_thread, cpriv,
+				"%s-poll", cpriv->priv->device_name);
+	if (IS_ERR(thread))
+		return PTR_ERR(thread);
+
+	/* pin the thread if requested */
+	if (poll_cpu >= 0 && poll_cpu < nr_cpu_ids && cpu_online(poll_cpu))
+		kthread_bind(thread, poll_cpu);
+
+	cpriv->irq.poll.thread = thread;
+	wake_up_process(thread);
+
+	return 0;
+}
+
+static void mcp25xxfd_can_int_poll_free(struct mcp25xxfd_can_priv *cpriv)
+{
+	if (!cpriv->irq.poll.thread)
+		return;
+
+	kthread_stop(cpriv->irq.poll.thread);
+	cpriv->irq.poll.thread = NULL;
+}
+
+int mcp25xxfd_can_int_alloc(struct mcp25xxfd_can_priv *cpriv)
+{
+	struct mcp25xxfd_priv *priv = cpriv->priv;
+	struct mcp25xxfd_can_int_status_read *sr;
+	int ret;
+
+	/* the polling thread */
+	ret = mcp25xxfd_can_int_poll_alloc(cpriv);
+	if (ret)
+		return ret;
+
+	/* half duplex controllers read the status in the irq thread only */
+	if (priv->spi->master->flags & SPI_MASTER_HALF_DUPLEX)
+		return 0;
+
+	sr = kzalloc(sizeof(*sr), GFP_KERNEL);
+	if (!sr) {
+		mcp25xxfd_can_int_poll_free(cpriv);
+		return -ENOMEM;
+	}
+
+	/* nothing is in flight yet */
+	sr->cpriv = cpriv;
+	spin_lock_init(&sr->lock);
+	init_completion(&sr->done);
+	complete_all(&sr->done);
+
+	/* init the message */
+	spi_message_init(&sr->msg);
+	sr->msg.complete = mcp25xxfd_can_int_status_read_complete;
+	sr->msg.context = sr;
+
+	/* read with crc like mcp25xxfd_cmd_read_regs does - a change of
+	 * use_spi_crc takes effect with the next open
+	 */
+	sr->crc = mcp25xxfd_cmd_use_crc();
+	if (sr->crc) {
+		mcp25xxfd_cmd_calc(MCP25XXFD_INSTRUCTION_READ_CRC,
+				   MCP25XXFD_CAN_INT, sr->tx);
+		sr->tx[2] = MCP25XXFD_CAN_INT_STATUS_SIZE;
+		sr->cmd_len = 3;
+	} else {
+		mcp25xxfd_cmd_calc(MCP25XXFD_INSTRUCTION_READ,
+				   MCP25XXFD_CAN_INT, sr->tx);
+		sr->cmd_len = 2;
+	}
+
+	sr->xfer.speed_hz = priv->spi_use_speed_hz;
+	sr->xfer.tx_buf = sr->tx;
+	sr->xfer.rx_buf = sr->rx;
+	sr->xfer.len = sr->cmd_len + MCP25XXFD_CAN_INT_STATUS_SIZE +
+		(sr->crc ? 2 : 0);
+	spi_message_add_tail(&sr->xfer, &sr->msg);
+
+	cpriv->irq.status_read = sr;
+
+	return 0;
+}
+
+void mcp25xxfd_can_int_free(struct mcp25xxfd_can_priv *cpriv)
+{
+	mcp25xxfd_can_rx_coalesce_stop(cpriv);
+	mcp25xxfd_can_int_poll_free(cpriv);
+
+	kfree(cpriv->irq.status_read);
+	cpriv->irq.status_read = NULL;
+}
+
+/* stop the rx coalescing timer, wait for a status read started by the
+ * hard irq handler to finish as well as for the irq thread it may have
+ * woken and leave polling mode
+ */
+void mcp25xxfd_can_int_sync(struct mcp25xxfd_can_priv *cpriv)
+{
+	struct mcp25xxfd_can_int_status_read *sr = cpriv->irq.status_read;
+
+	mcp25xxfd_can_rx_coalesce_stop(cpriv);
+
+	if (sr)
+		wait_for_completion(&sr->done);
+
+	synchronize_irq(cpriv->priv->spi->irq);
+
+	mutex_lock(&cpriv->irq.poll.lock);
+	mcp25xxfd_can_int_poll_leave(cpriv);
+	mutex_unlock(&cpriv->irq.poll.lock);
+}
+
 irqreturn_t mcp25xxfd_can_int(int irq, void *dev_id)
 {
 	struct mcp25xxfd_can_priv *cpriv = dev_id;
+	struct mcp25xxfd_can_int_status_read *sr = cpriv->irq.status_read;
+	bool prefetched = sr && sr->valid;
 	int loops, ret;
 
+	/* the rx coalescing timer may have woken us while polling */
+	if (READ_ONCE(cpriv->irq.poll.active)) {
+		mcp25xxfd_can_int_unmask(cpriv);
+		return IRQ_HANDLED;
+	}
+
 	/* count interrupt calls */
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, irq_calls);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, irq_calls);
 
 	/* loop forever unless we need to exit */
 	for (loops = 0; true; loops++) {
 		/* count irq loops */
-		MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, irq_loops);
+		MCP25XXFD_CAN_STATS_INCR(cpriv, irq_loops);
 
-		/* read interrupt status flags in bulk */
-		ret = mcp25xxfd_cmd_read_regs(cpriv->priv->spi,
-					      MCP25XXFD_CAN_INT,
-					      &cpriv->status.intf,
-					      sizeof(cpriv->status));
+		/* read interrupt status flags in bulk - unless the hard irq
+		 * handler has read them already for the first loop
+		 */
+		if (prefetched) {
+			prefetched = false;
+			sr->valid = false;
+			memcpy(&cpriv->status, sr->rx + sr->cmd_len,
+			       MCP25XXFD_CAN_INT_STATUS_SIZE);
+			mcp25xxfd_cmd_convert_to_cpu(
+				&cpriv->status.intf,
+				MCP25XXFD_CAN_INT_STATUS_SIZE / sizeof(u32));
+			cpriv->bus.bdiag_valid = false;
+			ret = 0;
+		} else {
+			/* the first loop starts with the hard irq */
+			if (loops)
+				mcp25xxfd_can_int_rx_latency_irq(cpriv);
+			ret = mcp25xxfd_can_int_read_status(cpriv);
+			mcp25xxfd_can_int_rx_latency_status(cpriv);
+		}
 		switch (ret) {
 		case 0: /* no errors, so process */
 			break;
@@ -643,8 +1267,8 @@ irqreturn_t mcp25xxfd_can_int(int irq, void *dev_id)
 		 * otherwise the Interrupt line should be deasserted already
 		 * so we can exit the loop
 		 */
-		if (((cpriv->status.intf >> MCP25XXFD_CAN_INT_IE_SHIFT) &
-		       cpriv->status.intf) == 0)
+		if (!mcp25xxfd_can_int_pending(cpriv, cpriv->status.intf,
+					       loops == 0))
 			break;
 
 		/* handle the interrupts for real */
@@ -662,12 +1286,20 @@ irqreturn_t mcp25xxfd_can_int(int irq, void *dev_id)
 		 * avoiding SERR happening
 		 */
 		if (loops % reschedule_int_thread_after == 0) {
-			MCP25XXFD_DEBUGFS_STATS_INCR(cpriv,
-						     irq_thread_rescheduled);
+			/* under sustained load hand over to polling */
+			if (loops >= poll_enter_loops &&
+			    mcp25xxfd_can_int_poll_enter(cpriv))
+				return IRQ_HANDLED;
+
+			MCP25XXFD_CAN_STATS_INCR(cpriv,
+						   irq_thread_rescheduled);
 			cond_resched();
 		}
 	}
 
+	/* unmask the line if the hard irq handler has masked it */
+	mcp25xxfd_can_int_unmask(cpriv);
+
 	return IRQ_HANDLED;
 
 fail:
@@ -681,6 +1313,8 @@ fail:
 
 	/* we could also put the driver in bus-off mode */
 
+	mcp25xxfd_can_int_unmask(cpriv);
+
 	return IRQ_HANDLED;
 }
 
@@ -7,11 +7,69 @@
 #ifndef __MCP25XXFD_CAN_INT_H
 #define __MCP25XXFD_CAN_INT_H
 
+#include <linux/completion.h>
+#include <linux/interrupt.h>
+#include <linux/ktime.h>
+#include <linux/spi/spi.h>
+#include <linux/spinlock.h>
+
+#include "mcp25xxfd_can_priv.h"
 #include "mcp25xxfd_priv.h"
 
+/* size of the status block read in one go: INT thru TREC */
+#define MCP25XXFD_CAN_INT_STATUS_SIZE					\
+	(MCP25XXFD_CAN_TREC + sizeof(u32) - MCP25XXFD_CAN_INT)
+/* the trimmed status block: INT and RXIF only */
+#define MCP25XXFD_CAN_INT_STATUS_SIZE_SHORT				\
+	(MCP25XXFD_CAN_RXIF + sizeof(u32) - MCP25XXFD_CAN_INT)
+/* the status block including the bus diagnostics: INT thru BDIAG1 */
+#define MCP25XXFD_CAN_INT_STATUS_SIZE_DIAG				\
+	(MCP25XXFD_CAN_BDIAG1 + sizeof(u32) - MCP25XXFD_CAN_INT)
+
+/* a prepared spi_message that reads the status block asynchronously
+ * directly from the hard irq handler
+ */
+struct mcp25xxfd_can_int_status_read {
+	/* the network device this is related to */
+	struct mcp25xxfd_can_priv *cpriv;
+	/* the message and xfer */
+	struct spi_message msg;
+	struct spi_transfer xfer;
+	/* completed while no status read is in flight */
+	struct completion done;
+	/* the time the hard irq handler got called */
+	ktime_t irq_ts;
+	/* protects masked against the hard irq handler
+	 * and the rx coalescing timer starting a read concurrently
+	 */
+	spinlock_t lock;
+	/* the irq line got masked for a status read and handling cycle */
+	bool masked;
+	/* the status in rx is valid and not yet consumed by the thread */
+	bool valid;
+	/* the read uses MCP25XXFD_INSTRUCTION_READ_CRC (use_spi_crc) */
+	bool crc;
+	/* the bytes of the command ahead of the status block:
+	 * 2 for a plain read, 3 with the length byte of a crc read
+	 */
+	u8 cmd_len;
+	/* the buffers: the command followed by the status block and,
+	 * with crc, the 2 bytes crc
+	 */
+	u8 tx[3 + MCP25XXFD_CAN_INT_STATUS_SIZE + 2];
+	u8 rx[3 + MCP25XXFD_CAN_INT_STATUS_SIZE + 2] ____cacheline_aligned;
+};
+
 int mcp25xxfd_can_int_clear(struct mcp25xxfd_priv *priv);
 int mcp25xxfd_can_int_enable(struct mcp25xxfd_priv *priv, bool enable);
 
+int mcp25xxfd_can_int_alloc(struct mcp25xxfd_can_priv *cpriv);
+void mcp25xxfd_can_int_free(struct mcp25xxfd_can_priv *cpriv);
+void mcp25xxfd_can_int_sync(struct mcp25xxfd_can_priv *cpriv);
+
+void mcp25xxfd_can_int_kick(struct mcp25xxfd_can_priv *cpriv);
+
+irqreturn_t mcp25xxfd_can_int_hardirq(int irq, void *dev_id);
 irqreturn_t mcp25xxfd_can_int(int irq, void *dev_id);
 
 #endif /* __MCP25XXFD_CAN_INT_H */
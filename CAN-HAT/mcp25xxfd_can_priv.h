@@ -8,8 +8,19 @@
 #ifndef __MCP25XXFD_CAN_PRIV_H
 #define __MCP25XXFD_CAN_PRIV_H
 
+#include <linux/atomic.h>
 #include <linux/can/dev.h>
 #include <linux/dcache.h>
+#include <linux/hrtimer.h>
+#include <linux/mutex.h>
+#include <linux/net_tstamp.h>
+#include <linux/ptp_clock_kernel.h>
+#include <linux/seqlock.h>
+#include <linux/spinlock.h>
+#include <linux/timecounter.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include "mcp25xxfd_priv.h"
 
@@ -37,12 +48,111 @@ struct mcp25xxfd_obj_ts {
 struct mcp25xxfd_fifo_info {
 	u32 is_rx;
 	u32 offset;
+	/* the FIFOCON configuration written during setup */
+	u32 con;
+	/* the current TXPRI of a tx fifo */
 	u32 priority;
 #ifdef CONFIG_DEBUG_FS
 	u64 use_count;
 #endif /* CONFIG_DEBUG_FS */
 };
 
+/* the statistics counters - kept per cpu and summed up when read
+ * via debugfs or ethtool -S (see mcp25xxfd_can_stats.c)
+ */
+struct mcp25xxfd_can_stats {
+	u64 irq_calls;
+	u64 irq_loops;
+	u64 irq_thread_rescheduled;
+	u64 irq_status_async;
+	u64 irq_status_async_idle;
+	u64 poll_calls;
+	u64 poll_empty;
+	u64 poll_enter;
+	u64 poll_exit;
+	u64 status_reads;
+	u64 status_read_bytes;
+	u64 status_read_chained;
+	u64 status_read_diag;
+#define MCP25XXFD_CAN_IRQ_SPI_LATENCY_BINS 12
+	u64 irq_spi_latency[MCP25XXFD_CAN_IRQ_SPI_LATENCY_BINS];
+
+	u64 int_serr_count;
+	u64 int_serr_rx_count;
+	u64 int_serr_tx_count;
+	u64 int_mod_count;
+	u64 int_rx_count;
+	u64 int_txat_count;
+	u64 int_tef_count;
+	u64 int_rxov_count;
+	u64 int_ecc_count;
+	u64 int_ivm_count;
+	u64 int_cerr_count;
+
+	u64 tx_fd_count;
+	u64 tx_brs_count;
+
+	u64 tef_reads;
+	u64 tef_read_splits;
+	u64 tef_conservative_reads;
+	u64 tef_optimized_reads;
+#define MCP25XXFD_CAN_TEF_READ_BINS 8
+	u64 tef_optimized_read_sizes[MCP25XXFD_CAN_TEF_READ_BINS];
+
+	u64 tx_prio_writes;
+	u64 tx_prio_drains;
+	u64 tx_stage_retries;
+	u64 tx_stage_errors;
+#define MCP25XXFD_CAN_TX_BUS_GAP_BINS 12
+	u64 tx_bus_gap[MCP25XXFD_CAN_TX_BUS_GAP_BINS];
+	/* log2 histograms (in us) of the time a frame spends
+	 * in each stage from start_xmit to the echo
+	 */
+#define MCP25XXFD_CAN_TX_LATENCY_FILL		0
+#define MCP25XXFD_CAN_TX_LATENCY_TRIGGER	1
+#define MCP25XXFD_CAN_TX_LATENCY_BUS		2
+#define MCP25XXFD_CAN_TX_LATENCY_IRQ		3
+#define MCP25XXFD_CAN_TX_LATENCY_TOTAL		4
+#define MCP25XXFD_CAN_TX_LATENCY_STAGES		5
+#define MCP25XXFD_CAN_TX_LATENCY_BINS		16
+	u64 tx_latency[MCP25XXFD_CAN_TX_LATENCY_STAGES]
+		      [MCP25XXFD_CAN_TX_LATENCY_BINS];
+
+	u64 rx_reads;
+	u64 rx_reads_prefetched_too_few;
+	u64 rx_reads_prefetched_too_few_bytes;
+	u64 rx_reads_prefetched_too_many;
+	u64 rx_reads_prefetched_too_many_bytes;
+	u64 rx_single_reads;
+	u64 rx_bulk_reads;
+#define MCP25XXFD_CAN_RX_BULK_READ_BINS 8
+	u64 rx_bulk_read_sizes[MCP25XXFD_CAN_RX_BULK_READ_BINS];
+
+	u64 rx_frames;
+#define MCP25XXFD_CAN_RX_FRAMES_PER_INT_BINS 6
+	u64 rx_frames_per_int[MCP25XXFD_CAN_RX_FRAMES_PER_INT_BINS];
+	u64 rx_coalesce_enter;
+	u64 rx_coalesce_exit;
+	u64 rx_coalesce_timer;
+	/* log2 histograms (in us) of the time a received frame
+	 * spends in each stage from the end of frame on the bus
+	 * to the handoff to the network stack
+	 */
+#define MCP25XXFD_CAN_RX_LATENCY_IRQ		0
+#define MCP25XXFD_CAN_RX_LATENCY_STATUS		1
+#define MCP25XXFD_CAN_RX_LATENCY_FIFO		2
+#define MCP25XXFD_CAN_RX_LATENCY_SUBMIT		3
+#define MCP25XXFD_CAN_RX_LATENCY_NETIF_RX	4
+#define MCP25XXFD_CAN_RX_LATENCY_TOTAL		5
+#define MCP25XXFD_CAN_RX_LATENCY_STAGES		6
+#define MCP25XXFD_CAN_RX_LATENCY_BINS		16
+	u64 rx_latency[MCP25XXFD_CAN_RX_LATENCY_STAGES]
+		      [MCP25XXFD_CAN_RX_LATENCY_BINS];
+
+	/* protecting the counters above against torn reads on 32 bit */
+	struct u64_stats_sync syncp;
+};
+
 struct mcp25xxfd_can_priv {
 	/* can_priv has to be the first one to be usable with alloc_candev
 	 * which expects struct can_priv to be right at the start of the
@@ -59,6 +169,18 @@ struct mcp25xxfd_can_priv {
 	struct {
 		int enabled;
 		int allocated;
+		/* the async status read started by the hard irq handler */
+		struct mcp25xxfd_can_int_status_read *status_read;
+		/* polling mode - used instead of the irq under high load */
+		struct {
+			struct task_struct *thread;
+			wait_queue_head_t wait;
+			/* held while polling, protects active */
+			struct mutex lock;
+			bool active;
+			/* consecutive polls without any interrupt flags */
+			u32 empty;
+		} poll;
 	} irq;
 
 	/* can config registers */
@@ -94,6 +216,8 @@ struct mcp25xxfd_can_priv {
 		u32 txreq;
 		/* ASSERT(CAN_TXREQ + 4 == CAN_TREC) */
 		u32 trec;
+		/* ASSERT(CAN_TREC + 4 == CAN_BDIAG0) */
+		u32 bdiag[2];
 	} status;
 
 	/* information of fifo setup */
@@ -109,6 +233,9 @@ struct mcp25xxfd_can_priv {
 			u32 count;
 			u32 size;
 			u32 index;
+			/* timestamp and minimum bus time of the last entry */
+			u32 last_ts;
+			u32 last_duration_ns;
 		} tef;
 
 		/* info on each fifo */
@@ -131,47 +258,33 @@ struct mcp25xxfd_can_priv {
 		struct mcp25xxfd_tx_spi_message_queue *tx_queue;
 	} fifos;
 
-	/* statistics exposed via debugfs */
+	/* statistics - see mcp25xxfd_can_stats.h */
+	struct mcp25xxfd_can_stats __percpu *stats;
+
+	/* values exposed via debugfs */
 #ifdef CONFIG_DEBUG_FS
 	struct dentry *debugfs_dir;
+	/* the per file data of the stats files */
+	struct mcp25xxfd_can_debugfs_stat *debugfs_stats;
 
 	struct {
-		u64 irq_calls;
-		u64 irq_loops;
-		u64 irq_thread_rescheduled;
-
-		u64 int_serr_count;
-		u64 int_serr_rx_count;
-		u64 int_serr_tx_count;
-		u64 int_mod_count;
-		u64 int_rx_count;
-		u64 int_txat_count;
-		u64 int_tef_count;
-		u64 int_rxov_count;
-		u64 int_ecc_count;
-		u64 int_ivm_count;
-		u64 int_cerr_count;
-
-		u64 tx_fd_count;
-		u64 tx_brs_count;
-
-		u64 tef_reads;
-		u64 tef_read_splits;
-		u64 tef_conservative_reads;
-		u64 tef_optimized_reads;
-#define MCP25XXFD_CAN_TEF_READ_BINS 8
-		u64 tef_optimized_read_sizes[MCP25XXFD_CAN_TEF_READ_BINS];
-
-		u64 rx_reads;
-		u64 rx_reads_prefetched_too_few;
-		u64 rx_reads_prefetched_too_few_bytes;
-		u64 rx_reads_prefetched_too_many;
-		u64 rx_reads_prefetched_too_many_bytes;
-		u64 rx_single_reads;
-		u64 rx_bulk_reads;
-#define MCP25XXFD_CAN_RX_BULK_READ_BINS 8
-		u64 rx_bulk_read_sizes[MCP25XXFD_CAN_RX_BULK_READ_BINS];
-	} stats;
+		u64 ifup_latency_us;
+		u64 restart_latency_us;
+	} gauges;
+
+	/* system time in ns of the steps of the current status handling
+	 * cycle for the rx latency histograms - atomic as the hard irq
+	 * handler and the spi completion of the status read set them while
+	 * the irq thread reads them, which would tear on 32 bit
+	 */
+	struct {
+		/* the hard irq (or start of the loop/poll) */
+		atomic64_t irq;
+		/* the status read has completed */
+		atomic64_t status;
+		/* the rx fifos have been read */
+		atomic64_t fifo;
+	} rx_latency;
 #endif /* CONFIG_DEBUG_FS */
 
 	/* history of rx-dlc */
@@ -183,11 +296,47 @@ struct mcp25xxfd_can_priv {
 		u32 predicted_len;
 	} rx_history;
 
+	/* rx interrupt coalescing */
+	struct {
+		/* the configuration - see ethtool -c */
+		u32 usecs;
+		u32 frames;
+		/* the RXIE is cleared and the timer reads the fifos */
+		bool active;
+		/* the next status read was kicked by the timer */
+		bool timed;
+		/* no (re)arming of the timer during stop/restart */
+		bool stopped;
+		struct hrtimer timer;
+	} rx_coalesce;
+
+	/* the hardware clock derived from the TBC */
+	struct {
+		struct ptp_clock *clock;
+		struct ptp_clock_info info;
+		/* protecting the timecounter - converting timestamps
+		 * only needs to retry if it raced with an update
+		 */
+		seqlock_t lock;
+		struct cyclecounter cc;
+		struct timecounter tc;
+		/* the last TBC value read - what cc.read returns */
+		u32 tbc;
+		/* the timecounter has been initialized - interface is up */
+		bool running;
+		/* refresh of the timecounter before the TBC wraps */
+		struct delayed_work refresh;
+		/* the SIOCSHWTSTAMP configuration */
+		struct hwtstamp_config config;
+	} ptp;
+
 	/* bus state */
 	struct {
 		u32 state;
 		u32 new_state;
 		u32 bdiag[2];
+		/* bdiag got read with the status block of this loop */
+		bool bdiag_valid;
 	} bus;
 
 	/* can error messages */
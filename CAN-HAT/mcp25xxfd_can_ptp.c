@@ -0,0 +1,364 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* CAN bus driver for Microchip 25XXFD CAN Controller with SPI Interface
+ *
+ * Copyright 2019 Martin Sperl <kernel@martin.sperl.org>
+ */
+
+/* hardware clock and timestamps
+ *
+ * The TBC of the controller runs at 1us per tick (see mcp25xxfd_can_config)
+ * and each rx fifo and TEF object carries the TBC at the time of the frame,
+ * so it gets exposed as a PTP hardware clock and used for hw timestamps:
+ * * the 32 bit TBC wraps every ~71 minutes, so it gets extended to 64 bit
+ *   by a timecounter, which is refreshed periodically by a worker
+ * * the timecounter starts at system time when the interface gets brought
+ *   up and can get adjusted via the PHC afterwards (e.g. with phc2sys)
+ * * reading the TBC needs an spi transfer, so gettimex64 records the
+ *   system time before and after it for correlation with system time
+ * * timestamps of received and transmitted (echo) frames are converted
+ *   without any spi transfer
+ */
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/net_tstamp.h>
+#include <linux/netdevice.h>
+#include <linux/ptp_clock_kernel.h>
+#include <linux/seqlock.h>
+#include <linux/skbuff.h>
+#include <linux/spi/spi.h>
+#include <linux/uaccess.h>
+#include <linux/workqueue.h>
+
+#include "mcp25xxfd_can_priv.h"
+#include "mcp25xxfd_can_ptp.h"
+#include "mcp25xxfd_cmd.h"
+#include "mcp25xxfd_regs.h"
+
+/* the nominal mult for 1us ticks - the shift leaves room for adjfine */
+#define MCP25XXFD_CAN_PTP_SHIFT		21
+#define MCP25XXFD_CAN_PTP_MULT		\
+	(NSEC_PER_USEC << MCP25XXFD_CAN_PTP_SHIFT)
+/* the maximum frequency adjustment in ppb */
+#define MCP25XXFD_CAN_PTP_MAX_ADJ	1000000
+/* refresh well within half of the TBC wrap time */
+#define MCP25XXFD_CAN_PTP_REFRESH	(60 * HZ)
+
+static u64 mcp25xxfd_can_ptp_cc_read(const struct cyclecounter *cc)
+{
+	struct mcp25xxfd_can_priv *cpriv =
+		container_of(cc, struct mcp25xxfd_can_priv, ptp.cc);
+
+	/* the TBC itself has been read already by the caller */
+	return cpriv->ptp.tbc;
+}
+
+/* read the TBC and advance the timecounter to it */
+static int mcp25xxfd_can_ptp_read(struct mcp25xxfd_can_priv *cpriv, u64 *ns,
+				  struct ptp_system_timestamp *sts)
+{
+	unsigned long flags;
+	u32 tbc;
+	int ret;
+
+	if (!READ_ONCE(cpriv->ptp.running))
+		return -ENETDOWN;
+
+	ptp_read_system_prets(sts);
+	ret = mcp25xxfd_cmd_read(cpriv->priv->spi, MCP25XXFD_CAN_TBC, &tbc);
+	ptp_read_system_postts(sts);
+	if (ret)
+		return ret;
+
+	write_seqlock_irqsave(&cpriv->ptp.lock, flags);
+
+	/* a concurrent reader may have advanced the timecounter already */
+	if ((s32)(tbc - cpriv->ptp.tbc) > 0)
+		cpriv->ptp.tbc = tbc;
+	*ns = timecounter_read(&cpriv->ptp.tc);
+
+	write_sequnlock_irqrestore(&cpriv->ptp.lock, flags);
+
+	return 0;
+}
+
+static int mcp25xxfd_can_ptp_adjfine(struct ptp_clock_info *info,
+				     long scaled_ppm)
+{
+	struct mcp25xxfd_can_priv *cpriv =
+		container_of(info, struct mcp25xxfd_can_priv, ptp.info);
+	bool neg = scaled_ppm < 0;
+	unsigned long flags;
+	u32 diff;
+	u64 ns;
+	int ret;
+
+	/* scaled_ppm is in ppm with a 16 bit fractional part */
+	if (neg)
+		scaled_ppm = -scaled_ppm;
+	diff = div_u64((u64)MCP25XXFD_CAN_PTP_MULT * scaled_ppm,
+		       1000000ULL << 16);
+
+	/* account the time passed so far with the old rate */
+	ret = mcp25xxfd_can_ptp_read(cpriv, &ns, NULL);
+	if (ret && ret != -ENETDOWN)
+		return ret;
+
+	write_seqlock_irqsave(&cpriv->ptp.lock, flags);
+	cpriv->ptp.cc.mult = neg ? MCP25XXFD_CAN_PTP_MULT - diff :
+		MCP25XXFD_CAN_PTP_MULT + diff;
+	write_sequnlock_irqrestore(&cpriv->ptp.lock, flags);
+
+	return 0;
+}
+
+static int mcp25xxfd_can_ptp_adjtime(struct ptp_clock_info *info, s64 delta)
+{
+	struct mcp25xxfd_can_priv *cpriv =
+		container_of(info, struct mcp25xxfd_can_priv, ptp.info);
+	unsigned long flags;
+
+	if (!READ_ONCE(cpriv->ptp.running))
+		return -ENETDOWN;
+
+	write_seqlock_irqsave(&cpriv->ptp.lock, flags);
+	timecounter_adjtime(&cpriv->ptp.tc, delta);
+	write_sequnlock_irqrestore(&cpriv->ptp.lock, flags);
+
+	return 0;
+}
+
+static int mcp25xxfd_can_ptp_gettimex64(struct ptp_clock_info *info,
+					struct timespec64 *ts,
+					struct ptp_system_timestamp *sts)
+{
+	struct mcp25xxfd_can_priv *cpriv =
+		container_of(info, struct mcp25xxfd_can_priv, ptp.info);
+	u64 ns;
+	int ret;
+
+	ret = mcp25xxfd_can_ptp_read(cpriv, &ns, sts);
+	if (ret)
+		return ret;
+
+	*ts = ns_to_timespec64(ns);
+
+	return 0;
+}
+
+static int mcp25xxfd_can_ptp_settime64(struct ptp_clock_info *info,
+				       const struct timespec64 *ts)
+{
+	struct mcp25xxfd_can_priv *cpriv =
+		container_of(info, struct mcp25xxfd_can_priv, ptp.info);
+	unsigned long flags;
+	u64 ns;
+	int ret;
+
+	/* read the TBC so that the new time applies from now on */
+	ret = mcp25xxfd_can_ptp_read(cpriv, &ns, NULL);
+	if (ret)
+		return ret;
+
+	write_seqlock_irqsave(&cpriv->ptp.lock, flags);
+	timecounter_init(&cpriv->ptp.tc, &cpriv->ptp.cc,
+			 timespec64_to_ns(ts));
+	write_sequnlock_irqrestore(&cpriv->ptp.lock, flags);
+
+	return 0;
+}
+
+static int mcp25xxfd_can_ptp_enable(struct ptp_clock_info *info,
+				    struct ptp_clock_request *rq, int on)
+{
+	return -EOPNOTSUPP;
+}
+
+static const struct ptp_clock_info mcp25xxfd_can_ptp_info = {
+	.owner = THIS_MODULE,
+	.name = "mcp25xxfd",
+	.max_adj = MCP25XXFD_CAN_PTP_MAX_ADJ,
+	.adjfine = mcp25xxfd_can_ptp_adjfine,
+	.adjtime = mcp25xxfd_can_ptp_adjtime,
+	.gettimex64 = mcp25xxfd_can_ptp_gettimex64,
+	.settime64 = mcp25xxfd_can_ptp_settime64,
+	.enable = mcp25xxfd_can_ptp_enable,
+};
+
+/* keep the timecounter from missing a wrap of the TBC */
+static void mcp25xxfd_can_ptp_refresh(struct work_struct *work)
+{
+	struct mcp25xxfd_can_priv *cpriv =
+		container_of(to_delayed_work(work), struct mcp25xxfd_can_priv,
+			     ptp.refresh);
+	u64 ns;
+
+	if (mcp25xxfd_can_ptp_read(cpriv, &ns, NULL) == -ENETDOWN)
+		return;
+
+	schedule_delayed_work(&cpriv->ptp.refresh, MCP25XXFD_CAN_PTP_REFRESH);
+}
+
+/* convert a TBC timestamp of a frame to the time of the clock in ns
+ * - this does not modify the timecounter, so it only needs the read side
+ *   of the seqlock and retries if the refresh or an adjustment races it
+ */
+u64 mcp25xxfd_can_ptp_ts_to_ns(struct mcp25xxfd_can_priv *cpriv, u32 ts)
+{
+	unsigned int seq;
+	u64 ns;
+
+	do {
+		seq = read_seqbegin(&cpriv->ptp.lock);
+		ns = timecounter_cyc2time(&cpriv->ptp.tc, ts);
+	} while (read_seqretry(&cpriv->ptp.lock, seq));
+
+	return ns;
+}
+
+static void mcp25xxfd_can_ptp_hwtstamp(struct mcp25xxfd_can_priv *cpriv,
+				       struct sk_buff *skb, u32 ts)
+{
+	u64 ns = mcp25xxfd_can_ptp_ts_to_ns(cpriv, ts);
+
+	skb_hwtstamps(skb)->hwtstamp = ns_to_ktime(ns);
+}
+
+void mcp25xxfd_can_ptp_rx_hwtstamp(struct mcp25xxfd_can_priv *cpriv,
+				   struct sk_buff *skb, u32 ts)
+{
+	if (READ_ONCE(cpriv->ptp.config.rx_filter) == HWTSTAMP_FILTER_NONE)
+		return;
+
+	mcp25xxfd_can_ptp_hwtstamp(cpriv, skb, ts);
+}
+
+/* mark the skb for a hw tx timestamp if requested by the socket */
+void mcp25xxfd_can_ptp_tx_prepare(struct mcp25xxfd_can_priv *cpriv,
+				  struct sk_buff *skb)
+{
+	if (READ_ONCE(cpriv->ptp.config.tx_type) == HWTSTAMP_TX_ON &&
+	    (skb_shinfo(skb)->tx_flags & SKBTX_HW_TSTAMP))
+		skb_shinfo(skb)->tx_flags |= SKBTX_IN_PROGRESS;
+
+	skb_tx_timestamp(skb);
+}
+
+/* timestamp the echo skb of a transmitted frame with its TEF timestamp
+ * the echo counts as a received frame for the local sockets and the
+ * sending socket gets the timestamp on its error queue if requested
+ */
+void mcp25xxfd_can_ptp_tx_hwtstamp(struct mcp25xxfd_can_priv *cpriv,
+				   struct sk_buff *skb, u32 ts)
+{
+	bool tx = skb_shinfo(skb)->tx_flags & SKBTX_IN_PROGRESS;
+
+	if (!tx &&
+	    READ_ONCE(cpriv->ptp.config.rx_filter) == HWTSTAMP_FILTER_NONE)
+		return;
+
+	mcp25xxfd_can_ptp_hwtstamp(cpriv, skb, ts);
+
+	if (tx)
+		skb_tstamp_tx(skb, skb_hwtstamps(skb));
+}
+
+int mcp25xxfd_can_ptp_ioctl(struct net_device *net, struct ifreq *ifr,
+			    int cmd)
+{
+	struct mcp25xxfd_can_priv *cpriv = netdev_priv(net);
+	struct hwtstamp_config config;
+
+	switch (cmd) {
+	case SIOCSHWTSTAMP:
+		if (copy_from_user(&config, ifr->ifr_data, sizeof(config)))
+			return -EFAULT;
+		if (config.flags)
+			return -EINVAL;
+		if (config.tx_type != HWTSTAMP_TX_OFF &&
+		    config.tx_type != HWTSTAMP_TX_ON)
+			return -ERANGE;
+		/* all frames get a timestamp - there is nothing to filter */
+		if (config.rx_filter != HWTSTAMP_FILTER_NONE)
+			config.rx_filter = HWTSTAMP_FILTER_ALL;
+
+		WRITE_ONCE(cpriv->ptp.config.tx_type, config.tx_type);
+		WRITE_ONCE(cpriv->ptp.config.rx_filter, config.rx_filter);
+		break;
+	case SIOCGHWTSTAMP:
+		config = cpriv->ptp.config;
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	return copy_to_user(ifr->ifr_data, &config, sizeof(config)) ?
+		-EFAULT : 0;
+}
+
+int mcp25xxfd_can_ptp_index(struct mcp25xxfd_can_priv *cpriv)
+{
+	return cpriv->ptp.clock ? ptp_clock_index(cpriv->ptp.clock) : -1;
+}
+
+/* start the clock - the TBC has just been reset by mcp25xxfd_can_config */
+int mcp25xxfd_can_ptp_start(struct mcp25xxfd_can_priv *cpriv)
+{
+	unsigned long flags;
+	u32 tbc;
+	int ret;
+
+	ret = mcp25xxfd_cmd_read(cpriv->priv->spi, MCP25XXFD_CAN_TBC, &tbc);
+	if (ret)
+		return ret;
+
+	write_seqlock_irqsave(&cpriv->ptp.lock, flags);
+	cpriv->ptp.tbc = tbc;
+	timecounter_init(&cpriv->ptp.tc, &cpriv->ptp.cc, ktime_get_real_ns());
+	write_sequnlock_irqrestore(&cpriv->ptp.lock, flags);
+
+	WRITE_ONCE(cpriv->ptp.running, true);
+	schedule_delayed_work(&cpriv->ptp.refresh, MCP25XXFD_CAN_PTP_REFRESH);
+
+	return 0;
+}
+
+void mcp25xxfd_can_ptp_stop(struct mcp25xxfd_can_priv *cpriv)
+{
+	WRITE_ONCE(cpriv->ptp.running, false);
+	cancel_delayed_work_sync(&cpriv->ptp.refresh);
+}
+
+void mcp25xxfd_can_ptp_setup(struct mcp25xxfd_can_priv *cpriv)
+{
+	struct spi_device *spi = cpriv->priv->spi;
+
+	seqlock_init(&cpriv->ptp.lock);
+	INIT_DELAYED_WORK(&cpriv->ptp.refresh, mcp25xxfd_can_ptp_refresh);
+
+	cpriv->ptp.cc.read = mcp25xxfd_can_ptp_cc_read;
+	cpriv->ptp.cc.mask = CYCLECOUNTER_MASK(32);
+	cpriv->ptp.cc.mult = MCP25XXFD_CAN_PTP_MULT;
+	cpriv->ptp.cc.shift = MCP25XXFD_CAN_PTP_SHIFT;
+
+	/* no timestamps by default */
+	cpriv->ptp.config.tx_type = HWTSTAMP_TX_OFF;
+	cpriv->ptp.config.rx_filter = HWTSTAMP_FILTER_NONE;
+
+	/* the clock is optional - timestamps work without it */
+	cpriv->ptp.info = mcp25xxfd_can_ptp_info;
+	cpriv->ptp.clock = ptp_clock_register(&cpriv->ptp.info, &spi->dev);
+	if (IS_ERR(cpriv->ptp.clock)) {
+		dev_warn(&spi->dev, "Failed to register ptp clock - %li\n",
+			 PTR_ERR(cpriv->ptp.clock));
+		cpriv->ptp.clock = NULL;
+	}
+}
+
+void mcp25xxfd_can_ptp_remove(struct mcp25xxfd_can_priv *cpriv)
+{
+	if (cpriv->ptp.clock)
+		ptp_clock_unregister(cpriv->ptp.clock);
+	cpriv->ptp.clock = NULL;
+}
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* CAN bus driver for Microchip 25XXFD CAN Controller with SPI Interface
+ *
+ * Copyright 2019 Martin Sperl <kernel@martin.sperl.org>
+ */
+
+#ifndef __MCP25XXFD_CAN_PTP_H
+#define __MCP25XXFD_CAN_PTP_H
+
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+
+#include "mcp25xxfd_can_priv.h"
+
+u64 mcp25xxfd_can_ptp_ts_to_ns(struct mcp25xxfd_can_priv *cpriv, u32 ts);
+void mcp25xxfd_can_ptp_rx_hwtstamp(struct mcp25xxfd_can_priv *cpriv,
+				   struct sk_buff *skb, u32 ts);
+void mcp25xxfd_can_ptp_tx_prepare(struct mcp25xxfd_can_priv *cpriv,
+				  struct sk_buff *skb);
+void mcp25xxfd_can_ptp_tx_hwtstamp(struct mcp25xxfd_can_priv *cpriv,
+				   struct sk_buff *skb, u32 ts);
+
+int mcp25xxfd_can_ptp_ioctl(struct net_device *net, struct ifreq *ifr,
+			    int cmd);
+int mcp25xxfd_can_ptp_index(struct mcp25xxfd_can_priv *cpriv);
+
+int mcp25xxfd_can_ptp_start(struct mcp25xxfd_can_priv *cpriv);
+void mcp25xxfd_can_ptp_stop(struct mcp25xxfd_can_priv *cpriv);
+
+void mcp25xxfd_can_ptp_setup(struct mcp25xxfd_can_priv *cpriv);
+void mcp25xxfd_can_ptp_remove(struct mcp25xxfd_can_priv *cpriv);
+
+#endif /* __MCP25XXFD_CAN_PTP_H */
@@ -11,7 +11,9 @@
 #include <linux/can/core.h>
 #include <linux/can/dev.h>
 #include <linux/device.h>
+#include <linux/hrtimer.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/netdevice.h>
 #include <linux/skbuff.h>
@@ -22,8 +24,11 @@
 #include "mcp25xxfd_can.h"
 #include "mcp25xxfd_can_debugfs.h"
 #include "mcp25xxfd_can_id.h"
+#include "mcp25xxfd_can_int.h"
 #include "mcp25xxfd_can_priv.h"
+#include "mcp25xxfd_can_ptp.h"
 #include "mcp25xxfd_can_rx.h"
+#include "mcp25xxfd_can_stats.h"
 
 /* module parameters */
 static unsigned int rx_prefetch_bytes = -1;
@@ -31,6 +36,15 @@ module_param(rx_prefetch_bytes, uint, 0664);
 MODULE_PARM_DESC(rx_prefetch_bytes,
 		 "number of bytes to blindly prefetch when reading a rx-fifo");
 
+static unsigned int rx_coalesce_usecs;
+module_param(rx_coalesce_usecs, uint, 0664);
+MODULE_PARM_DESC(rx_coalesce_usecs,
+		 "Default for the maximum delay of rx frames while rx interrupt coalescing is active - 0 disables coalescing (see ethtool -C rx-usecs)\n");
+static unsigned int rx_coalesce_frames = 4;
+module_param(rx_coalesce_frames, uint, 0664);
+MODULE_PARM_DESC(rx_coalesce_frames,
+		 "Default for the number of frames pending in a single rx interrupt that enables rx interrupt coalescing (see ethtool -C rx-frames)\n");
+
 static struct sk_buff *
 mcp25xxfd_can_rx_submit_normal_frame(struct mcp25xxfd_can_priv *cpriv,
 				     u32 id, u32 dlc, u8 **data)
@@ -77,6 +91,65 @@ mcp25xxfd_can_rx_submit_fd_frame(struct mcp25xxfd_can_priv *cpriv,
 	return skb;
 }
 
+/* rx latency: split the time from the end of a received frame on the bus
+ * to the network stack into the steps of the status handling cycle
+ * that handled it (see mcp25xxfd_can_int_handle_status):
+ * * irq: from the end of frame to the hard irq - or to the start of the
+ *   loop/poll that found it (this includes any rx coalescing delay)
+ * * status: reading the status block
+ * * fifo: reading the rx fifos
+ * * submit: handling the rest of the cycle and sorting until submission
+ * * netif_rx: inside netif_rx_ni, which runs the softirq delivery
+ * * total: from the end of frame to the handoff to netif_rx_ni
+ * the rx timestamp is converted to system time via the hardware clock
+ * just like for tx latency - the accounting runs in the single context
+ * handling the controller, the steps are atomic64 as some of them get
+ * marked from the hard irq or the spi completion of the status read
+ */
+#ifdef CONFIG_DEBUG_FS
+static void mcp25xxfd_can_rx_latency_stage(struct mcp25xxfd_can_priv *cpriv,
+					   int stage, u64 start, u64 end)
+{
+	s64 ns = end - start;
+	u32 us = (ns > 0) ? div_u64(ns, NSEC_PER_USEC) : 0;
+	int i = min_t(int, fls(us), MCP25XXFD_CAN_RX_LATENCY_BINS - 1);
+
+	MCP25XXFD_CAN_STATS_INCR(cpriv, rx_latency[stage][i]);
+}
+
+static void mcp25xxfd_can_rx_latency(struct mcp25xxfd_can_priv *cpriv,
+				     struct mcp25xxfd_can_obj_rx *rx,
+				     u64 submit)
+{
+	u64 eof = mcp25xxfd_can_ptp_ts_to_ns(cpriv, rx->ts) +
+		mcp25xxfd_can_frame_duration(cpriv, rx->flags);
+	u64 done = ktime_get_real_ns();
+	u64 irq = atomic64_read(&cpriv->rx_latency.irq);
+	u64 status = atomic64_read(&cpriv->rx_latency.status);
+	u64 fifo = atomic64_read(&cpriv->rx_latency.fifo);
+
+	mcp25xxfd_can_rx_latency_stage(cpriv, MCP25XXFD_CAN_RX_LATENCY_IRQ,
+				       eof, irq);
+	mcp25xxfd_can_rx_latency_stage(cpriv, MCP25XXFD_CAN_RX_LATENCY_STATUS,
+				       irq, status);
+	mcp25xxfd_can_rx_latency_stage(cpriv, MCP25XXFD_CAN_RX_LATENCY_FIFO,
+				       status, fifo);
+	mcp25xxfd_can_rx_latency_stage(cpriv, MCP25XXFD_CAN_RX_LATENCY_SUBMIT,
+				       fifo, submit);
+	mcp25xxfd_can_rx_latency_stage(cpriv,
+				       MCP25XXFD_CAN_RX_LATENCY_NETIF_RX,
+				       submit, done);
+	mcp25xxfd_can_rx_latency_stage(cpriv, MCP25XXFD_CAN_RX_LATENCY_TOTAL,
+				       eof, submit);
+}
+#else
+static void mcp25xxfd_can_rx_latency(struct mcp25xxfd_can_priv *cpriv,
+				     struct mcp25xxfd_can_obj_rx *rx,
+				     u64 submit)
+{
+}
+#endif /* CONFIG_DEBUG_FS */
+
 int mcp25xxfd_can_rx_submit_frame(struct mcp25xxfd_can_priv *cpriv, int fifo)
 {
 	struct net_device *net = cpriv->can.dev;
@@ -86,6 +159,7 @@ int mcp25xxfd_can_rx_submit_frame(struct mcp25xxfd_can_priv *cpriv, int fifo)
 	u8 *data = NULL;
 	struct sk_buff *skb;
 	u32 id, dlc, len, flags;
+	u64 submit;
 
 	/* compute the can_id */
 	mcp25xxfd_can_id_from_mcp25xxfd(rx->id, rx->flags, &id);
@@ -132,8 +206,13 @@ int mcp25xxfd_can_rx_submit_frame(struct mcp25xxfd_can_priv *cpriv, int fifo)
 	/* copy the payload data */
 	memcpy(data, rx->data, len);
 
+	/* the hardware timestamp */
+	mcp25xxfd_can_ptp_rx_hwtstamp(cpriv, skb, rx->ts);
+
 	/* and submit the frame */
+	submit = ktime_get_real_ns();
 	netif_rx_ni(skb);
+	mcp25xxfd_can_rx_latency(cpriv, rx, submit);
 
 	return 0;
 }
@@ -151,7 +230,7 @@ static int mcp25xxfd_can_rx_read_frame(struct mcp25xxfd_can_priv *cpriv,
 
 	/* we read the header plus prefetch_bytes */
 	if (read) {
-		cpriv->stats.rx_single_reads++;
+		MCP25XXFD_CAN_STATS_INCR(cpriv, rx_single_reads);
 		ret = mcp25xxfd_cmd_readn(spi, MCP25XXFD_SRAM_ADDR(addr),
 					  rx, sizeof(*rx) + prefetch_bytes);
 		if (ret)
@@ -171,11 +250,11 @@ static int mcp25xxfd_can_rx_read_frame(struct mcp25xxfd_can_priv *cpriv,
 	/* read the remaining data for canfd frames */
 	if (read && len > prefetch_bytes) {
 		/* update stats */
-		MCP25XXFD_DEBUGFS_STATS_INCR(cpriv,
-					     rx_reads_prefetched_too_few);
-		MCP25XXFD_DEBUGFS_STATS_ADD(cpriv,
-					    rx_reads_prefetched_too_few_bytes,
-					    len - prefetch_bytes);
+		MCP25XXFD_CAN_STATS_INCR(cpriv,
+					   rx_reads_prefetched_too_few);
+		MCP25XXFD_CAN_STATS_ADD(cpriv,
+					  rx_reads_prefetched_too_few_bytes,
+					  len - prefetch_bytes);
 		/* here the extra portion reading data after prefetch */
 		ret = mcp25xxfd_cmd_readn(spi,
 					  MCP25XXFD_SRAM_ADDR(addr) +
@@ -187,13 +266,13 @@ static int mcp25xxfd_can_rx_read_frame(struct mcp25xxfd_can_priv *cpriv,
 	}
 
 	/* update stats */
-	cpriv->stats.rx_reads++;
+	MCP25XXFD_CAN_STATS_INCR(cpriv, rx_reads);
 	if (len < prefetch_bytes) {
-		MCP25XXFD_DEBUGFS_STATS_INCR(cpriv,
-					     rx_reads_prefetched_too_many);
-		MCP25XXFD_DEBUGFS_STATS_ADD(cpriv,
-					    rx_reads_prefetched_too_many,
-					    prefetch_bytes - len);
+		MCP25XXFD_CAN_STATS_INCR(cpriv,
+					   rx_reads_prefetched_too_many);
+		MCP25XXFD_CAN_STATS_ADD(cpriv,
+					  rx_reads_prefetched_too_many_bytes,
+					  prefetch_bytes - len);
 	}
 
 	/* clear the rest of the buffer - just to be safe */
@@ -225,9 +304,9 @@ static int mcp25xxfd_can_read_rx_frame_bulk(struct mcp25xxfd_can_priv *cpriv,
 	int fifo, i, ret;
 
 	/* update stats */
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, rx_bulk_reads);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, rx_bulk_reads);
 	i = min_t(int, MCP25XXFD_CAN_RX_BULK_READ_BINS - 1, count - 1);
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, rx_bulk_read_sizes[i]);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, rx_bulk_read_sizes[i]);
 
 	/* we read the header plus read_min data bytes */
 	ret = mcp25xxfd_cmd_readn(cpriv->priv->spi, MCP25XXFD_SRAM_ADDR(addr),
@@ -475,12 +554,164 @@ static int mcp25xxfd_can_rx_read_frames(struct mcp25xxfd_can_priv *cpriv)
 		return mcp25xxfd_can_rx_read_bulk_frames(cpriv);
 }
 
+/* rx interrupt coalescing
+ *
+ * The rx fifos are only 1 deep, so the half full and full interrupts
+ * coincide with the not empty interrupt and every frame results in
+ * an interrupt of its own.
+ * So once a single rx interrupt finds at least rx-frames frames pending
+ * the RXIE gets cleared in CAN_INT and a hrtimer kicks a status read
+ * and handling cycle every rx-usecs instead, which bounds the latency.
+ * The fifos still set their RXIF bits, so a cycle started for any
+ * other reason reads them as well and overflows still raise RXOVIF.
+ * When a timer kicked cycle finds less than half of rx-frames pending
+ * the RXIE gets set again - so interrupts per frame drop with load.
+ */
+static int mcp25xxfd_can_rx_coalesce_rxie(struct mcp25xxfd_can_priv *cpriv,
+					  bool enable)
+{
+	/* the write covers the whole IE byte, so keep the other IEs */
+	u32 value = cpriv->status.intf & MCP25XXFD_CAN_INT_IE_MASK &
+		~MCP25XXFD_CAN_INT_RXIE;
+
+	if (enable)
+		value |= MCP25XXFD_CAN_INT_RXIE;
+
+	return mcp25xxfd_cmd_write_mask(cpriv->priv->spi, MCP25XXFD_CAN_INT,
+					value, MCP25XXFD_CAN_INT_RXIE);
+}
+
+static enum hrtimer_restart
+mcp25xxfd_can_rx_coalesce_timer(struct hrtimer *timer)
+{
+	struct mcp25xxfd_can_priv *cpriv =
+		container_of(timer, struct mcp25xxfd_can_priv,
+			     rx_coalesce.timer);
+	u32 usecs = READ_ONCE(cpriv->rx_coalesce.usecs);
+
+	if (READ_ONCE(cpriv->rx_coalesce.stopped) ||
+	    !READ_ONCE(cpriv->rx_coalesce.active))
+		return HRTIMER_NORESTART;
+
+	MCP25XXFD_CAN_STATS_INCR(cpriv, rx_coalesce_timer);
+
+	/* read the rx fifos */
+	WRITE_ONCE(cpriv->rx_coalesce.timed, true);
+	mcp25xxfd_can_int_kick(cpriv);
+
+	/* coalescing got disabled - the kicked cycle switches it off */
+	if (!usecs)
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(timer, us_to_ktime(usecs));
+
+	return HRTIMER_RESTART;
+}
+
+static int mcp25xxfd_can_rx_coalesce_update(struct mcp25xxfd_can_priv *cpriv,
+					    int frames)
+{
+	int ret;
+
+	if (cpriv->rx_coalesce.active) {
+		/* only cycles kicked by the timer decide to leave */
+		if (!READ_ONCE(cpriv->rx_coalesce.timed))
+			return 0;
+		WRITE_ONCE(cpriv->rx_coalesce.timed, false);
+
+		if (cpriv->rx_coalesce.usecs &&
+		    frames * 2 >= cpriv->rx_coalesce.frames)
+			return 0;
+
+		/* the load dropped, so switch back to interrupts */
+		WRITE_ONCE(cpriv->rx_coalesce.active, false);
+		hrtimer_cancel(&cpriv->rx_coalesce.timer);
+		MCP25XXFD_CAN_STATS_INCR(cpriv, rx_coalesce_exit);
+
+		return mcp25xxfd_can_rx_coalesce_rxie(cpriv, true);
+	}
+
+	/* switch to coalescing if a single interrupt found enough frames */
+	if (!cpriv->rx_coalesce.usecs ||
+	    READ_ONCE(cpriv->rx_coalesce.stopped) ||
+	    frames < cpriv->rx_coalesce.frames)
+		return 0;
+
+	ret = mcp25xxfd_can_rx_coalesce_rxie(cpriv, false);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(cpriv->rx_coalesce.timed, false);
+	WRITE_ONCE(cpriv->rx_coalesce.active, true);
+	hrtimer_start(&cpriv->rx_coalesce.timer,
+		      us_to_ktime(cpriv->rx_coalesce.usecs), HRTIMER_MODE_REL);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, rx_coalesce_enter);
+
+	return 0;
+}
+
+void mcp25xxfd_can_rx_coalesce_init(struct mcp25xxfd_can_priv *cpriv)
+{
+	hrtimer_init(&cpriv->rx_coalesce.timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_REL);
+	cpriv->rx_coalesce.timer.function = mcp25xxfd_can_rx_coalesce_timer;
+
+	cpriv->rx_coalesce.usecs = rx_coalesce_usecs;
+	cpriv->rx_coalesce.frames = max_t(u32, rx_coalesce_frames, 1);
+	cpriv->rx_coalesce.active = false;
+	cpriv->rx_coalesce.timed = false;
+	cpriv->rx_coalesce.stopped = true;
+}
+
+/* (re)start coalescing with the RXIE set - called while the interrupt
+ * handling is quiesced
+ */
+int mcp25xxfd_can_rx_coalesce_start(struct mcp25xxfd_can_priv *cpriv)
+{
+	int ret = 0;
+
+	if (cpriv->rx_coalesce.active) {
+		cpriv->rx_coalesce.active = false;
+		ret = mcp25xxfd_can_rx_coalesce_rxie(cpriv, true);
+	}
+	cpriv->rx_coalesce.timed = false;
+	WRITE_ONCE(cpriv->rx_coalesce.stopped, false);
+
+	return ret;
+}
+
+/* stop the timer from kicking any further status reads */
+void mcp25xxfd_can_rx_coalesce_stop(struct mcp25xxfd_can_priv *cpriv)
+{
+	WRITE_ONCE(cpriv->rx_coalesce.stopped, true);
+	hrtimer_cancel(&cpriv->rx_coalesce.timer);
+}
+
+static void mcp25xxfd_can_rx_frames_stats(struct mcp25xxfd_can_priv *cpriv,
+					  int frames)
+{
+	int i = min_t(int, fls(frames) - 1,
+		      MCP25XXFD_CAN_RX_FRAMES_PER_INT_BINS - 1);
+
+	MCP25XXFD_CAN_STATS_ADD(cpriv, rx_frames, frames);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, rx_frames_per_int[i]);
+}
+
 int mcp25xxfd_can_rx_handle_int_rxif(struct mcp25xxfd_can_priv *cpriv)
 {
+	int frames = hweight32(cpriv->status.rxif);
+	int ret;
+
+	/* adapt the rx interrupt coalescing to the load */
+	ret = mcp25xxfd_can_rx_coalesce_update(cpriv, frames);
+	if (ret)
+		return ret;
+
 	if (!cpriv->status.rxif)
 		return 0;
 
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, int_rx_count);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, int_rx_count);
+	mcp25xxfd_can_rx_frames_stats(cpriv, frames);
 
 	/* read all the fifos */
 	return mcp25xxfd_can_rx_read_frames(cpriv);
@@ -494,7 +725,7 @@ int mcp25xxfd_can_rx_handle_int_rxovif(struct mcp25xxfd_can_priv *cpriv)
 	if (!cpriv->status.rxovif)
 		return 0;
 
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, int_rxov_count);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, int_rxov_count);
 
 	/* clear all fifos that have an overflow bit set */
 	for (i = 0; i < 32; i++) {
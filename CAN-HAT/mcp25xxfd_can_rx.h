@@ -15,4 +15,8 @@ int mcp25xxfd_can_rx_submit_frame(struct mcp25xxfd_can_priv *cpriv, int fifo);
 int mcp25xxfd_can_rx_handle_int_rxif(struct mcp25xxfd_can_priv *cpriv);
 int mcp25xxfd_can_rx_handle_int_rxovif(struct mcp25xxfd_can_priv *cpriv);
 
+void mcp25xxfd_can_rx_coalesce_init(struct mcp25xxfd_can_priv *cpriv);
+int mcp25xxfd_can_rx_coalesce_start(struct mcp25xxfd_can_priv *cpriv);
+void mcp25xxfd_can_rx_coalesce_stop(struct mcp25xxfd_can_priv *cpriv);
+
 #endif /* __MCP25XXFD_CAN_RX_H */
@@ -0,0 +1,340 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* CAN bus driver for Microchip 25XXFD CAN Controller with SPI Interface
+ *
+ * Copyright 2019 Martin Sperl <kernel@martin.sperl.org>
+ */
+
+/* statistics of the can controller handling
+ *
+ * the counters are kept per cpu so that the irq thread, the spi
+ * completion callbacks and start_xmit running on different cpus
+ * neither lose updates nor bounce the cache lines of the hot tx/rx state
+ * between each other - they only get summed up when read.
+ *
+ * on 32 bit the u64_stats_sync of each cpu makes the reader retry
+ * when it raced with an update, on 64 bit this compiles away.
+ *
+ * all counters and histogram bins are described by a single table
+ * that provides the names for the files in debugfs as well as for
+ * ethtool -S.
+ */
+
+#include <linux/errno.h>
+#include <linux/ethtool.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/stddef.h>
+#include <linux/string.h>
+#include <linux/u64_stats_sync.h>
+
+#include "mcp25xxfd_can_priv.h"
+#include "mcp25xxfd_can_stats.h"
+
+/* how the bins of a histogram are named */
+#define MCP25XXFD_CAN_STATS_HIST_NONE	0
+/* name_lt_<1 << (bin + shift)><unit> - the last is name_ge_... */
+#define MCP25XXFD_CAN_STATS_HIST_LOG2	1
+/* name_<bin + 1> - the last is name_<bin + 1>+ */
+#define MCP25XXFD_CAN_STATS_HIST_COUNT	2
+
+struct mcp25xxfd_can_stats_desc {
+	const char *name;
+	size_t offset;
+	u8 hist;
+	u8 bins;
+	u8 shift;
+	u8 flags;
+	const char *unit;
+};
+
+#define STATS(n, f) {							\
+	.name = n,							\
+	.offset = offsetof(struct mcp25xxfd_can_stats, f),		\
+}
+#define STATS_LOG2(n, f, s, u, fl) {					\
+	.name = n,							\
+	.offset = offsetof(struct mcp25xxfd_can_stats, f),		\
+	.hist = MCP25XXFD_CAN_STATS_HIST_LOG2,				\
+	.bins = ARRAY_SIZE(((struct mcp25xxfd_can_stats *)0)->f),	\
+	.shift = s,							\
+	.unit = u,							\
+	.flags = fl,							\
+}
+#define STATS_COUNT(n, f) {						\
+	.name = n,							\
+	.offset = offsetof(struct mcp25xxfd_can_stats, f),		\
+	.hist = MCP25XXFD_CAN_STATS_HIST_COUNT,				\
+	.bins = ARRAY_SIZE(((struct mcp25xxfd_can_stats *)0)->f),	\
+}
+#define STATS_TX_LATENCY(n, s)						\
+	STATS_LOG2("tx_latency_" n, tx_latency[s], 0, "us",		\
+		   MCP25XXFD_CAN_STATS_TABLE)
+#define STATS_RX_LATENCY(n, s)						\
+	STATS_LOG2("rx_latency_" n, rx_latency[s], 0, "us",		\
+		   MCP25XXFD_CAN_STATS_TABLE)
+
+/* the names have to fit into ETH_GSTRING_LEN including the bin suffix */
+static const struct mcp25xxfd_can_stats_desc mcp25xxfd_can_stats_descs[] = {
+	STATS("irq_calls",			irq_calls),
+	STATS("irq_loops",			irq_loops),
+	STATS("irq_thread_rescheduled",		irq_thread_rescheduled),
+	STATS("irq_status_async",		irq_status_async),
+	STATS("irq_status_async_idle",		irq_status_async_idle),
+	STATS("poll_calls",			poll_calls),
+	STATS("poll_empty",			poll_empty),
+	STATS("poll_enter",			poll_enter),
+	STATS("poll_exit",			poll_exit),
+	STATS("status_reads",			status_reads),
+	STATS("status_read_bytes",		status_read_bytes),
+	STATS("status_read_chained",		status_read_chained),
+	STATS("status_read_diag",		status_read_diag),
+	/* time from the hard irq to the first byte of the status read
+	 * clocked on the spi bus
+	 */
+	STATS_LOG2("irq_spi_latency",		irq_spi_latency, 0, "us", 0),
+
+	STATS("int_system_error",		int_serr_count),
+	STATS("int_system_error_tx",		int_serr_tx_count),
+	STATS("int_system_error_rx",		int_serr_rx_count),
+	STATS("int_mode_switch",		int_mod_count),
+	STATS("int_rx",				int_rx_count),
+	STATS("int_tx_attempt",			int_txat_count),
+	STATS("int_tef",			int_tef_count),
+	STATS("int_rx_overflow",		int_rxov_count),
+	STATS("int_ecc_error",			int_ecc_count),
+	STATS("int_rx_invalid_message",		int_ivm_count),
+	STATS("int_crcerror",			int_cerr_count),
+
+	STATS("tef_reads",			tef_reads),
+	STATS("tef_conservative_reads",		tef_conservative_reads),
+	STATS("tef_optimized_reads",		tef_optimized_reads),
+	STATS("tef_read_splits",		tef_read_splits),
+	STATS_COUNT("tef_optimized_reads",	tef_optimized_read_sizes),
+
+	STATS("tx_prio_writes",			tx_prio_writes),
+	STATS("tx_prio_drains",			tx_prio_drains),
+	STATS("tx_stage_retries",		tx_stage_retries),
+	STATS("tx_stage_errors",		tx_stage_errors),
+	/* the gap on the bus between consecutive transmitted frames */
+	STATS_LOG2("tx_bus_gap",		tx_bus_gap, 0, "us", 0),
+	STATS_TX_LATENCY("fill",	MCP25XXFD_CAN_TX_LATENCY_FILL),
+	STATS_TX_LATENCY("trigger",	MCP25XXFD_CAN_TX_LATENCY_TRIGGER),
+	STATS_TX_LATENCY("bus",		MCP25XXFD_CAN_TX_LATENCY_BUS),
+	STATS_TX_LATENCY("irq",		MCP25XXFD_CAN_TX_LATENCY_IRQ),
+	STATS_TX_LATENCY("total",	MCP25XXFD_CAN_TX_LATENCY_TOTAL),
+
+	STATS("tx_frames_fd",			tx_fd_count),
+	STATS("tx_frames_brs",			tx_brs_count),
+
+	STATS("rx_reads",			rx_reads),
+	STATS("rx_reads_prefetched_few",	rx_reads_prefetched_too_few),
+	STATS("rx_reads_prefetched_few_bytes",
+	      rx_reads_prefetched_too_few_bytes),
+	STATS("rx_reads_prefetched_many",	rx_reads_prefetched_too_many),
+	STATS("rx_reads_prefetched_many_bytes",
+	      rx_reads_prefetched_too_many_bytes),
+	STATS("rx_single_reads",		rx_single_reads),
+	STATS("rx_bulk_reads",			rx_bulk_reads),
+	STATS_COUNT("rx_bulk_reads",		rx_bulk_read_sizes),
+
+	/* interrupt coalescing and the frames read per rx interrupt -
+	 * int_rx / rx_frames gives the interrupts per frame
+	 */
+	STATS("rx_frames",			rx_frames),
+	STATS("rx_coalesce_enter",		rx_coalesce_enter),
+	STATS("rx_coalesce_exit",		rx_coalesce_exit),
+	STATS("rx_coalesce_timer",		rx_coalesce_timer),
+	STATS_LOG2("rx_frames_per_int",		rx_frames_per_int, 1, "", 0),
+	STATS_RX_LATENCY("irq",		MCP25XXFD_CAN_RX_LATENCY_IRQ),
+	STATS_RX_LATENCY("status",	MCP25XXFD_CAN_RX_LATENCY_STATUS),
+	STATS_RX_LATENCY("fifo",	MCP25XXFD_CAN_RX_LATENCY_FIFO),
+	STATS_RX_LATENCY("submit",	MCP25XXFD_CAN_RX_LATENCY_SUBMIT),
+	STATS_RX_LATENCY("netif_rx",	MCP25XXFD_CAN_RX_LATENCY_NETIF_RX),
+	STATS_RX_LATENCY("total",	MCP25XXFD_CAN_RX_LATENCY_TOTAL),
+};
+
+#undef STATS
+#undef STATS_LOG2
+#undef STATS_COUNT
+#undef STATS_TX_LATENCY
+#undef STATS_RX_LATENCY
+
+static int
+mcp25xxfd_can_stats_desc_bins(const struct mcp25xxfd_can_stats_desc *desc)
+{
+	return desc->hist ? desc->bins : 1;
+}
+
+/* find the description of a counter and the histogram bin */
+static const struct mcp25xxfd_can_stats_desc *
+mcp25xxfd_can_stats_find(int index, int *bin)
+{
+	const struct mcp25xxfd_can_stats_desc *desc;
+	int i, bins;
+
+	for (i = 0; i < ARRAY_SIZE(mcp25xxfd_can_stats_descs); i++) {
+		desc = &mcp25xxfd_can_stats_descs[i];
+		bins = mcp25xxfd_can_stats_desc_bins(desc);
+		if (index < bins) {
+			*bin = index;
+			return desc;
+		}
+		index -= bins;
+	}
+
+	return NULL;
+}
+
+static void
+mcp25xxfd_can_stats_desc_name(const struct mcp25xxfd_can_stats_desc *desc,
+			      int bin, char *name, size_t len)
+{
+	bool last = (bin == desc->bins - 1);
+
+	switch (desc->hist) {
+	case MCP25XXFD_CAN_STATS_HIST_LOG2:
+		if (last)
+			snprintf(name, len, "%s_ge_%u%s", desc->name,
+				 1U << (bin - 1 + desc->shift), desc->unit);
+		else
+			snprintf(name, len, "%s_lt_%u%s", desc->name,
+				 1U << (bin + desc->shift), desc->unit);
+		break;
+	case MCP25XXFD_CAN_STATS_HIST_COUNT:
+		snprintf(name, len, "%s_%i%s", desc->name, bin + 1,
+			 last ? "+" : "");
+		break;
+	default:
+		strscpy(name, desc->name, len);
+		break;
+	}
+}
+
+u64 mcp25xxfd_can_stats_sum(struct mcp25xxfd_can_priv *cpriv, size_t offset)
+{
+	const struct mcp25xxfd_can_stats *stats;
+	unsigned int start;
+	u64 sum = 0, val;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(cpriv->stats, cpu);
+		do {
+			start = u64_stats_fetch_begin_irq(&stats->syncp);
+			val = *(const u64 *)((const u8 *)stats + offset);
+		} while (u64_stats_fetch_retry_irq(&stats->syncp, start));
+		sum += val;
+	}
+
+	return sum;
+}
+
+int mcp25xxfd_can_stats_count(void)
+{
+	const struct mcp25xxfd_can_stats_desc *desc;
+	int i, count = 0;
+
+	for (i = 0; i < ARRAY_SIZE(mcp25xxfd_can_stats_descs); i++) {
+		desc = &mcp25xxfd_can_stats_descs[i];
+		count += mcp25xxfd_can_stats_desc_bins(desc);
+	}
+
+	return count;
+}
+
+u32 mcp25xxfd_can_stats_flags(int index)
+{
+	const struct mcp25xxfd_can_stats_desc *desc;
+	int bin;
+
+	desc = mcp25xxfd_can_stats_find(index, &bin);
+
+	return desc ? desc->flags : 0;
+}
+
+void mcp25xxfd_can_stats_name(int index, char *name, size_t len)
+{
+	const struct mcp25xxfd_can_stats_desc *desc;
+	int bin;
+
+	desc = mcp25xxfd_can_stats_find(index, &bin);
+	if (desc)
+		mcp25xxfd_can_stats_desc_name(desc, bin, name, len);
+	else
+		strscpy(name, "", len);
+}
+
+u64 mcp25xxfd_can_stats_read(struct mcp25xxfd_can_priv *cpriv, int index)
+{
+	const struct mcp25xxfd_can_stats_desc *desc;
+	int bin;
+
+	desc = mcp25xxfd_can_stats_find(index, &bin);
+	if (!desc)
+		return 0;
+
+	return mcp25xxfd_can_stats_sum(cpriv,
+				       desc->offset + bin * sizeof(u64));
+}
+
+void mcp25xxfd_can_stats_strings(u8 *data)
+{
+	const struct mcp25xxfd_can_stats_desc *desc;
+	int i, bin;
+
+	for (i = 0; i < ARRAY_SIZE(mcp25xxfd_can_stats_descs); i++) {
+		desc = &mcp25xxfd_can_stats_descs[i];
+		for (bin = 0; bin < mcp25xxfd_can_stats_desc_bins(desc);
+		     bin++, data += ETH_GSTRING_LEN)
+			mcp25xxfd_can_stats_desc_name(desc, bin, (char *)data,
+						      ETH_GSTRING_LEN);
+	}
+}
+
+void mcp25xxfd_can_stats_values(struct mcp25xxfd_can_priv *cpriv, u64 *data)
+{
+	const struct mcp25xxfd_can_stats_desc *desc;
+	int i, bin;
+
+	for (i = 0; i < ARRAY_SIZE(mcp25xxfd_can_stats_descs); i++) {
+		desc = &mcp25xxfd_can_stats_descs[i];
+		for (bin = 0; bin < mcp25xxfd_can_stats_desc_bins(desc); bin++)
+			*data++ = mcp25xxfd_can_stats_sum(cpriv, desc->offset +
+							  bin * sizeof(u64));
+	}
+}
+
+void mcp25xxfd_can_stats_clear(struct mcp25xxfd_can_priv *cpriv)
+{
+	struct mcp25xxfd_can_stats *stats;
+	int cpu;
+
+	/* the interface is down, so there are no concurrent updates
+	 * and the syncp is left untouched
+	 */
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(cpriv->stats, cpu);
+		memset(stats, 0, offsetof(struct mcp25xxfd_can_stats, syncp));
+	}
+}
+
+int mcp25xxfd_can_stats_alloc(struct mcp25xxfd_can_priv *cpriv)
+{
+	int cpu;
+
+	cpriv->stats = alloc_percpu(struct mcp25xxfd_can_stats);
+	if (!cpriv->stats)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu)
+		u64_stats_init(&per_cpu_ptr(cpriv->stats, cpu)->syncp);
+
+	return 0;
+}
+
+void mcp25xxfd_can_stats_free(struct mcp25xxfd_can_priv *cpriv)
+{
+	free_percpu(cpriv->stats);
+	cpriv->stats = NULL;
+}
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* CAN bus driver for Microchip 25XXFD CAN Controller with SPI Interface
+ *
+ * Copyright 2019 Martin Sperl <kernel@martin.sperl.org>
+ */
+
+#ifndef __MCP25XXFD_CAN_STATS_H
+#define __MCP25XXFD_CAN_STATS_H
+
+#include <linux/ethtool.h>
+#include <linux/irqflags.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+
+#include "mcp25xxfd_can_priv.h"
+
+/* the counters get updated from the irq thread, the spi completion
+ * callbacks, the hard irq handler and start_xmit, so interrupts are
+ * disabled while the counter of the local cpu is updated
+ */
+#define MCP25XXFD_CAN_STATS_ADD(cpriv, counter, val)			\
+	do {								\
+		struct mcp25xxfd_can_stats *__stats;			\
+		unsigned long __flags;					\
+									\
+		local_irq_save(__flags);				\
+		__stats = this_cpu_ptr((cpriv)->stats);			\
+		u64_stats_update_begin(&__stats->syncp);		\
+		__stats->counter += (val);				\
+		u64_stats_update_end(&__stats->syncp);			\
+		local_irq_restore(__flags);				\
+	} while (0)
+#define MCP25XXFD_CAN_STATS_INCR(cpriv, counter)			\
+	MCP25XXFD_CAN_STATS_ADD(cpriv, counter, 1)
+
+/* the sum of a counter over all cpus - offset into the stats structure */
+u64 mcp25xxfd_can_stats_sum(struct mcp25xxfd_can_priv *cpriv, size_t offset);
+
+/* the flat list of all counters and histogram bins */
+#define MCP25XXFD_CAN_STATS_TABLE	BIT(0)
+int mcp25xxfd_can_stats_count(void);
+u32 mcp25xxfd_can_stats_flags(int index);
+void mcp25xxfd_can_stats_name(int index, char *name, size_t len);
+u64 mcp25xxfd_can_stats_read(struct mcp25xxfd_can_priv *cpriv, int index);
+
+/* ethtool -S */
+void mcp25xxfd_can_stats_strings(u8 *data);
+void mcp25xxfd_can_stats_values(struct mcp25xxfd_can_priv *cpriv, u64 *data);
+
+/* clear all counters when the interface comes up */
+void mcp25xxfd_can_stats_clear(struct mcp25xxfd_can_priv *cpriv);
+
+int mcp25xxfd_can_stats_alloc(struct mcp25xxfd_can_priv *cpriv);
+void mcp25xxfd_can_stats_free(struct mcp25xxfd_can_priv *cpriv);
+
+#endif /* __MCP25XXFD_CAN_STATS_H */
@@ -12,23 +12,67 @@
 #include <linux/can/dev.h>
 #include <linux/device.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/netdevice.h>
 #include <linux/slab.h>
 #include <linux/spi/spi.h>
 
+#include <asm/unaligned.h>
+
 #include "mcp25xxfd_can.h"
+#include "mcp25xxfd_can_debugfs.h"
 #include "mcp25xxfd_can_id.h"
+#include "mcp25xxfd_can_ptp.h"
+#include "mcp25xxfd_can_stats.h"
 #include "mcp25xxfd_can_tx.h"
 #include "mcp25xxfd_cmd.h"
 #include "mcp25xxfd_regs.h"
+#include "mcp25xxfd_trace.h"
+
+/* mostly bit manipulations to move between stages
+ *
+ * each fifo only ever moves forward through the stages and every move is
+ * done by exactly one context:
+ *  * idle -> in_fill_fifo_transfer: start_xmit (serialized by the
+ *    network stack)
+ *  * in_fill_fifo_transfer -> in_trigger_fifo_transfer and
+ *    in_trigger_fifo_transfer -> in_can_transfer: the spi completion
+ *    callbacks
+ *  * in_can_transfer -> idle: the interrupt thread
+ * so a cmpxchg on the packed stage word is all that is needed.
+ * every move names the stages it may start from: a move from any other
+ * stage (e.g. a trigger completion arriving after the TEF has recycled
+ * the fifo already) is refused and counted instead of moving the fifo
+ * back, which would stall it until the interface gets restarted
+ */
+static u32 mcp25xxfd_can_tx_queue_stage_fifos(u32 fifos, s64 stages,
+					      int stage)
+{
+	u32 lo = (u64)stages;
+	u32 hi = (u64)stages >> 32;
+
+	if (!(stage & 1))
+		lo = ~lo;
+	if (!(stage & 2))
+		hi = ~hi;
+
+	return lo & hi & fifos;
+}
+
+u32 mcp25xxfd_can_tx_queue_fifos(struct mcp25xxfd_tx_spi_message_queue *q,
+				 int stage)
+{
+	return mcp25xxfd_can_tx_queue_stage_fifos(q->fifos,
+						  atomic64_read(&q->stages),
+						  stage);
+}
 
-/* mostly bit manipulations to move between stages */
 static struct mcp25xxfd_tx_spi_message *
 mcp25xxfd_can_tx_queue_first_spi_message(struct mcp25xxfd_tx_spi_message_queue *
-					 queue, u32 *bitmap)
+					 queue, u32 bitmap)
 {
-	u32 first = ffs(*bitmap);
+	u32 first = ffs(bitmap);
 
 	if (!first)
 		return NULL;
@@ -36,65 +80,87 @@ mcp25xxfd_can_tx_queue_first_spi_message(struct mcp25xxfd_tx_spi_message_queue *
 	return queue->fifo2message[first - 1];
 }
 
-static void mcp25xxfd_can_tx_queue_remove_spi_message(u32 *bitmap, int fifo)
+static int mcp25xxfd_can_tx_queue_stage(s64 stages, int fifo)
 {
-	*bitmap &= ~BIT(fifo);
+	return (((u64)stages >> fifo) & 1) |
+		((((u64)stages >> (fifo + 32)) & 1) << 1);
 }
 
-static void mcp25xxfd_can_tx_queue_add_spi_message(u32 *bitmap, int fifo)
+/* move fifo to stage if it is in one of the stages in from (a bitmap
+ * of BIT(stage)) - returns false if it was not
+ */
+static bool
+mcp25xxfd_can_tx_queue_move_spi_message(struct mcp25xxfd_can_priv *cpriv,
+					int fifo, u32 from, int stage)
 {
-	*bitmap |= BIT(fifo);
-}
+	struct mcp25xxfd_tx_spi_message_queue *q = cpriv->fifos.tx_queue;
+	u64 mask = BIT_ULL(fifo) | BIT_ULL(fifo + 32);
+	u64 bits = ((stage & 1) ? BIT_ULL(fifo) : 0) |
+		((stage & 2) ? BIT_ULL(fifo + 32) : 0);
+	s64 old, cur;
+	int prev;
+
+	/* this is a full barrier, which the queue wakeup relies on */
+	cur = atomic64_read(&q->stages);
+	do {
+		old = cur;
+		prev = mcp25xxfd_can_tx_queue_stage(old, fifo);
+		if (!(from & BIT(prev))) {
+			MCP25XXFD_CAN_STATS_INCR(cpriv, tx_stage_errors);
+			netdev_warn_once(cpriv->can.dev,
+					 "tx fifo %i moved to stage %i from unexpected stage %i\n",
+					 fifo, stage, prev);
+			return false;
+		}
+		cur = atomic64_cmpxchg(&q->stages, old,
+				       ((u64)old & ~mask) | bits);
+		if (cur != old)
+			MCP25XXFD_CAN_STATS_INCR(cpriv, tx_stage_retries);
+	} while (cur != old);
 
-static void mcp25xxfd_can_tx_queue_move_spi_message(u32 *src, u32 *dest,
-						    int fifo)
-{
-	mcp25xxfd_can_tx_queue_remove_spi_message(src, fifo);
-	mcp25xxfd_can_tx_queue_add_spi_message(dest, fifo);
+	return true;
 }
 
 static void mcp25xxfd_can_tx_spi_message_fill_fifo_complete(void *context)
 {
 	struct mcp25xxfd_tx_spi_message *msg = context;
 	struct mcp25xxfd_can_priv *cpriv = msg->cpriv;
-	struct mcp25xxfd_tx_spi_message_queue *q = cpriv->fifos.tx_queue;
-	unsigned long flags;
 
 	/* reset transfer length to without data (DLC = 0) */
 	msg->fill_fifo.xfer.len = sizeof(msg->fill_fifo.data.cmd) +
 		sizeof(msg->fill_fifo.data.header);
-
-	/* we need to hold this lock to protect us from
-	 * concurrent access by start_xmit
-	 */
-	spin_lock_irqsave(&cpriv->fifos.tx_queue->lock, flags);
+	msg->ts_filled = ktime_get_real_ns();
+	mcp25xxfd_cmd_trace_async(&msg->fill_fifo.msg,
+				  MCP25XXFD_CMD_OP_TX_FILL, msg->ts_submit);
 
 	/* move to in_trigger_fifo_transfer */
-	mcp25xxfd_can_tx_queue_move_spi_message(&q->in_fill_fifo_transfer,
-						&q->in_trigger_fifo_transfer,
-						msg->fifo);
-
-	spin_unlock_irqrestore(&cpriv->fifos.tx_queue->lock, flags);
+	mcp25xxfd_can_tx_queue_move_spi_message(cpriv, msg->fifo,
+		BIT(MCP25XXFD_CAN_TX_STAGE_IN_FILL_FIFO_TRANSFER),
+		MCP25XXFD_CAN_TX_STAGE_IN_TRIGGER_FIFO_TRANSFER);
 }
 
 static void mcp25xxfd_can_tx_spi_message_trigger_fifo_complete(void *context)
 {
 	struct mcp25xxfd_tx_spi_message *msg = context;
 	struct mcp25xxfd_can_priv *cpriv = msg->cpriv;
-	struct mcp25xxfd_tx_spi_message_queue *q = cpriv->fifos.tx_queue;
-	unsigned long flags;
 
-	/* we need to hold this lock to protect us from
-	 * concurrent access by the interrupt thread
-	 */
-	spin_lock_irqsave(&cpriv->fifos.tx_queue->lock, flags);
+	msg->ts_triggered = ktime_get_real_ns();
+	mcp25xxfd_cmd_trace_async(&msg->trigger_fifo.msg,
+				  MCP25XXFD_CMD_OP_TX_TRIGGER, msg->ts_submit);
 
-	/* move to can_transfer */
-	mcp25xxfd_can_tx_queue_move_spi_message(&q->in_trigger_fifo_transfer,
-						&q->in_can_transfer,
-						msg->fifo);
+	/* move to can_transfer - unless the TEF got handled already */
+	mcp25xxfd_can_tx_queue_move_spi_message(cpriv, msg->fifo,
+		BIT(MCP25XXFD_CAN_TX_STAGE_IN_TRIGGER_FIFO_TRANSFER),
+		MCP25XXFD_CAN_TX_STAGE_IN_CAN_TRANSFER);
+}
 
-	spin_unlock_irqrestore(&cpriv->fifos.tx_queue->lock, flags);
+static void mcp25xxfd_can_tx_spi_message_prio_fifo_complete(void *context)
+{
+	struct mcp25xxfd_tx_spi_message *msg = context;
+
+	/* the fill transfer follows, so there is nothing else to do */
+	mcp25xxfd_cmd_trace_async(&msg->prio_fifo.msg,
+				  MCP25XXFD_CMD_OP_TX_PRIO, msg->ts_submit);
 }
 
 static
@@ -105,12 +171,17 @@ void mcp25xxfd_can_tx_message_init(struct mcp25xxfd_can_priv *cpriv,
 	const u32 trigger = MCP25XXFD_CAN_FIFOCON_TXREQ |
 		MCP25XXFD_CAN_FIFOCON_UINC;
 	const int first_byte = mcp25xxfd_cmd_first_byte(trigger);
+	int prio_byte;
 	u32 addr;
 
 	/* and initialize the structure */
 	msg->cpriv = cpriv;
 	msg->fifo = fifo;
 
+	/* the flags templates - the fifo number is used as seq */
+	msg->flags_can = fifo << MCP25XXFD_CAN_OBJ_FLAGS_SEQ_SHIFT;
+	msg->flags_canfd = msg->flags_can | MCP25XXFD_CAN_OBJ_FLAGS_FDF;
+
 	/* init fill_fifo */
 	spi_message_init(&msg->fill_fifo.msg);
 	msg->fill_fifo.msg.complete =
@@ -144,9 +215,25 @@ void mcp25xxfd_can_tx_message_init(struct mcp25xxfd_can_priv *cpriv,
 			   msg->trigger_fifo.data.cmd);
 	msg->trigger_fifo.data.data = trigger >> (8 * first_byte);
 
-	/* and add to idle tx transfers */
-	mcp25xxfd_can_tx_queue_add_spi_message(&cpriv->fifos.tx_queue->idle,
-					       fifo);
+	/* init prio_fifo - writing the byte of FIFOCON containing TXPRI */
+	spi_message_init(&msg->prio_fifo.msg);
+	msg->prio_fifo.msg.complete =
+		mcp25xxfd_can_tx_spi_message_prio_fifo_complete;
+	msg->prio_fifo.msg.context = msg;
+
+	msg->prio_fifo.xfer.speed_hz = cpriv->priv->spi_use_speed_hz;
+	msg->prio_fifo.xfer.tx_buf = msg->prio_fifo.data.cmd;
+	msg->prio_fifo.xfer.len = sizeof(msg->prio_fifo.data.cmd) +
+		sizeof(msg->prio_fifo.data.data);
+	spi_message_add_tail(&msg->prio_fifo.xfer, &msg->prio_fifo.msg);
+
+	prio_byte = mcp25xxfd_cmd_first_byte(MCP25XXFD_CAN_FIFOCON_TXPRI_MASK);
+	mcp25xxfd_cmd_calc(MCP25XXFD_INSTRUCTION_WRITE,
+			   MCP25XXFD_CAN_FIFOCON(fifo) + prio_byte,
+			   msg->prio_fifo.data.cmd);
+
+	/* and add to the tx transfers - the stage is idle already */
+	cpriv->fifos.tx_queue->fifos |= BIT(fifo);
 }
 
 static
@@ -206,30 +293,162 @@ void mcp25xxfd_can_tx_queue_manage(struct mcp25xxfd_can_priv *cpriv, int state)
 	spin_unlock_irqrestore(&cpriv->fifos.tx_queue->lock, flags);
 }
 
+/* tx fifo recycling
+ *
+ * The tx fifos are 1 deep, so originally all fifos were used once in
+ * order of their (fixed) priority and only after all of them had been
+ * transmitted they were returned to idle - leaving a gap on the bus
+ * until the interrupt handler had restarted the queue and the next
+ * frames had been filled.
+ * Now each fifo returns to idle as soon as its frame has been
+ * transmitted, so the next frame gets filled while the others are still
+ * pending on the bus.
+ * The controller transmits the pending fifo with the highest TXPRI
+ * first, so only frames with the same can id need to be kept in
+ * submission order: each frame gets a TXPRI lower than all pending
+ * frames with the same can id - frames with different ids may overtake
+ * each other just like they would when sent from different fifos.
+ * The idle fifo with the highest TXPRI that satisfies this is used,
+ * so that the TXPRI only needs to get written if no idle fifo fits or
+ * the headroom for the following frames with the same id gets low.
+ * Only if priority 0 is pending for the same can id the queue needs
+ * to wait for that fifo to get transmitted first.
+ */
+static u32
+mcp25xxfd_can_tx_queue_pending(struct mcp25xxfd_tx_spi_message_queue *q)
+{
+	return q->fifos & ~mcp25xxfd_can_tx_queue_fifos(q,
+			MCP25XXFD_CAN_TX_STAGE_IDLE);
+}
+
+static bool
+mcp25xxfd_can_tx_queue_can_submit(struct mcp25xxfd_tx_spi_message_queue *q)
+{
+	u32 pending = mcp25xxfd_can_tx_queue_pending(q);
+
+	if (pending == q->fifos)
+		return false;
+
+	return !(READ_ONCE(q->blocked) & pending);
+}
+
+/* wake the network queue if it got stopped because no frame could get
+ * submitted and this has changed since
+ * the lock only gets taken when the queue really is stopped, so in the
+ * fast path the interrupt thread does not contend with start_xmit
+ */
 void mcp25xxfd_can_tx_queue_restart(struct mcp25xxfd_can_priv *cpriv)
 {
 	u32 state = MCP25XXFD_CAN_TX_QUEUE_STATE_RESTART;
+	struct mcp25xxfd_tx_spi_message_queue *q = cpriv->fifos.tx_queue;
 	unsigned long flags;
-	u32 mask;
 
-	spin_lock_irqsave(&cpriv->fifos.tx_queue->lock, flags);
+	if (READ_ONCE(q->state) != MCP25XXFD_CAN_TX_QUEUE_STATE_RUNABLE)
+		return;
 
-	/* only move if there is nothing pending or idle */
-	mask = cpriv->fifos.tx_queue->idle |
-		cpriv->fifos.tx_queue->in_fill_fifo_transfer |
-		cpriv->fifos.tx_queue->in_trigger_fifo_transfer |
-		cpriv->fifos.tx_queue->in_can_transfer;
-	if (mask)
-		goto out;
+	spin_lock_irqsave(&q->lock, flags);
 
-	/* move all items from transferred to idle */
-	cpriv->fifos.tx_queue->idle |= cpriv->fifos.tx_queue->transferred;
-	cpriv->fifos.tx_queue->transferred = 0;
+	if (mcp25xxfd_can_tx_queue_can_submit(q))
+		mcp25xxfd_can_tx_queue_manage_nolock(cpriv, state);
 
-	/* and enable queue */
-	mcp25xxfd_can_tx_queue_manage_nolock(cpriv, state);
-out:
-	spin_unlock_irqrestore(&cpriv->fifos.tx_queue->lock, flags);
+	spin_unlock_irqrestore(&q->lock, flags);
+}
+
+/* stop the network queue because the next frame can not get submitted
+ * - a fifo may have been recycled concurrently just before, so check
+ * again after the stop
+ */
+static void mcp25xxfd_can_tx_queue_stop(struct mcp25xxfd_can_priv *cpriv)
+{
+	mcp25xxfd_can_tx_queue_manage(cpriv,
+				      MCP25XXFD_CAN_TX_QUEUE_STATE_RUNABLE);
+
+	/* pairs with the cmpxchg in mcp25xxfd_can_tx_queue_move_spi_message */
+	smp_mb();
+
+	mcp25xxfd_can_tx_queue_restart(cpriv);
+}
+
+/* abort all pending transmissions on the controller and return all
+ * fifos to idle - the fifo layout and the prepared spi_messages are kept
+ * so that this can get used to restart quickly after a bus-off
+ * note: the echo skbs have already been flushed by the can framework
+ */
+int mcp25xxfd_can_tx_queue_flush(struct mcp25xxfd_can_priv *cpriv)
+{
+	struct mcp25xxfd_tx_spi_message_queue *q = cpriv->fifos.tx_queue;
+	struct spi_device *spi = cpriv->priv->spi;
+	u32 fifos = q->fifos;
+	unsigned long flags;
+	u32 txreq, pending;
+	int i, f, ret;
+
+	/* abort all pending transmissions - as spi_messages get processed
+	 * in order this also guarantees that all fill/trigger spi_messages
+	 * submitted by start_xmit have finished when this returns
+	 */
+	ret = mcp25xxfd_cmd_write_mask(spi, MCP25XXFD_CAN_CON,
+				       cpriv->regs.con | MCP25XXFD_CAN_CON_ABAT,
+				       MCP25XXFD_CAN_CON_ABAT);
+	if (ret)
+		return ret;
+
+	/* wait for the controller to clear all transmit requests */
+	for (i = 0; i < 256; i++) {
+		ret = mcp25xxfd_cmd_read(spi, MCP25XXFD_CAN_TXREQ, &txreq);
+		if (ret)
+			return ret;
+		if (!(txreq & fifos))
+			break;
+	}
+	if (txreq & fifos) {
+		netdev_err(cpriv->can.dev,
+			   "Failed to abort pending transmissions in time - txreq: %08x\n",
+			   txreq);
+		return -ETIMEDOUT;
+	}
+
+	/* reset the tx fifos and clear their abort flags */
+	for (i = 0, f = cpriv->fifos.tx.start; i < cpriv->fifos.tx.count;
+	     i++, f++) {
+		ret = mcp25xxfd_cmd_write_mask(spi, MCP25XXFD_CAN_FIFOCON(f),
+					       MCP25XXFD_CAN_FIFOCON_FRESET,
+					       MCP25XXFD_CAN_FIFOCON_FRESET);
+		if (ret)
+			return ret;
+		ret = mcp25xxfd_cmd_write_mask(spi, MCP25XXFD_CAN_FIFOSTA(f), 0,
+					       MCP25XXFD_CAN_FIFOSTA_TXABT |
+					       MCP25XXFD_CAN_FIFOSTA_TXLARB |
+					       MCP25XXFD_CAN_FIFOSTA_TXERR |
+					       MCP25XXFD_CAN_FIFOSTA_TXATIF);
+		if (ret)
+			return ret;
+	}
+
+	/* and reset the TEF as well */
+	ret = mcp25xxfd_cmd_write_mask(spi, MCP25XXFD_CAN_TEFCON,
+				       MCP25XXFD_CAN_TEFCON_FRESET,
+				       MCP25XXFD_CAN_TEFCON_FRESET);
+	if (ret)
+		return ret;
+	cpriv->fifos.tef.index = 0;
+
+	/* now move all fifos back to idle */
+	pending = mcp25xxfd_can_tx_queue_pending(q);
+	for (i = 0, f = cpriv->fifos.tx.start; i < cpriv->fifos.tx.count;
+	     i++, f++)
+		if (pending & BIT(f))
+			can_free_echo_skb(cpriv->can.dev, f);
+
+	atomic64_set(&q->stages, 0);
+	WRITE_ONCE(q->blocked, 0);
+
+	/* the network queue has been stopped by the caller */
+	spin_lock_irqsave(&q->lock, flags);
+	q->state = MCP25XXFD_CAN_TX_QUEUE_STATE_STOPPED;
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	return 0;
 }
 
 static
@@ -257,7 +476,7 @@ int mcp25xxfd_can_tx_tef_read(struct mcp25xxfd_can_priv *cpriv,
 	/* and read a second part on wrap */
 	if (read != count) {
 		/* update stats */
-		MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, tef_read_splits);
+		MCP25XXFD_CAN_STATS_INCR(cpriv, tef_read_splits);
 		/* compute the addresses  */
 		read = count - read;
 		tef = (struct mcp25xxfd_can_obj_tef *)(cpriv->sram);
@@ -271,6 +490,77 @@ int mcp25xxfd_can_tx_tef_read(struct mcp25xxfd_can_priv *cpriv,
 	return ret;
 }
 
+/* account the idle time on the bus between the end of the last
+ * transmitted frame and this one in a log2 histogram - under saturation
+ * back to back transmission shows up in the lowest bins
+ * (the TEF timestamps are in us - see TSCON setup)
+ */
+static void mcp25xxfd_can_tx_bus_gap(struct mcp25xxfd_can_priv *cpriv,
+				     struct mcp25xxfd_can_obj_tef *tef)
+{
+	s64 gap = (s64)(u32)(tef->ts - cpriv->fifos.tef.last_ts) *
+		NSEC_PER_USEC - cpriv->fifos.tef.last_duration_ns;
+	u32 us = (gap > 0) ? div_u64(gap, NSEC_PER_USEC) : 0;
+	int i = min_t(int, fls(us), MCP25XXFD_CAN_TX_BUS_GAP_BINS - 1);
+
+	/* skip the very first frame */
+	if (cpriv->fifos.tef.last_duration_ns)
+		MCP25XXFD_CAN_STATS_INCR(cpriv, tx_bus_gap[i]);
+
+	cpriv->fifos.tef.last_ts = tef->ts;
+	cpriv->fifos.tef.last_duration_ns =
+		mcp25xxfd_can_frame_duration(cpriv, tef->flags);
+}
+
+/* tx latency: account the time between two points in the life of a frame
+ * in the log2 histogram of the stage
+ */
+static void mcp25xxfd_can_tx_latency_stage(struct mcp25xxfd_can_priv *cpriv,
+					   int stage, u64 start, u64 end)
+{
+	s64 ns = end - start;
+	u32 us = (ns > 0) ? div_u64(ns, NSEC_PER_USEC) : 0;
+	int i = min_t(int, fls(us), MCP25XXFD_CAN_TX_LATENCY_BINS - 1);
+
+	MCP25XXFD_CAN_STATS_INCR(cpriv, tx_latency[stage][i]);
+}
+
+/* split the time from start_xmit to the echo of a frame into:
+ * * fill: spi queueing and the fill transfer
+ * * trigger: the trigger transfer
+ * * bus: waiting for the bus (arbitration against other frames)
+ *   until the start of frame
+ * * irq: from the end of frame thru the TEF interrupt and read
+ *   to the echo
+ * the TEF timestamp is converted to system time via the hardware clock,
+ * which starts at system time - so for exact bus and irq numbers keep it
+ * in sync with the system time (e.g. with phc2sys)
+ */
+static void mcp25xxfd_can_tx_latency(struct mcp25xxfd_can_priv *cpriv,
+				     struct mcp25xxfd_tx_spi_message *smsg,
+				     u32 ts, u32 flags)
+{
+	u64 sof = mcp25xxfd_can_ptp_ts_to_ns(cpriv, ts);
+	u64 eof = sof + mcp25xxfd_can_frame_duration(cpriv, flags);
+	u64 echo = ktime_get_real_ns();
+
+	trace_mcp25xxfd_can_tx_latency(cpriv->can.dev, smsg->fifo,
+				       smsg->can_id, smsg->ts_xmit,
+				       smsg->ts_filled, smsg->ts_triggered,
+				       sof, echo);
+
+	mcp25xxfd_can_tx_latency_stage(cpriv, MCP25XXFD_CAN_TX_LATENCY_FILL,
+				       smsg->ts_xmit, smsg->ts_filled);
+	mcp25xxfd_can_tx_latency_stage(cpriv, MCP25XXFD_CAN_TX_LATENCY_TRIGGER,
+				       smsg->ts_filled, smsg->ts_triggered);
+	mcp25xxfd_can_tx_latency_stage(cpriv, MCP25XXFD_CAN_TX_LATENCY_BUS,
+				       smsg->ts_triggered, sof);
+	mcp25xxfd_can_tx_latency_stage(cpriv, MCP25XXFD_CAN_TX_LATENCY_IRQ,
+				       eof, echo);
+	mcp25xxfd_can_tx_latency_stage(cpriv, MCP25XXFD_CAN_TX_LATENCY_TOTAL,
+				       smsg->ts_xmit, echo);
+}
+
 static
 int mcp25xxfd_can_tx_handle_int_tefif_fifo(struct mcp25xxfd_can_priv *cpriv,
 					   bool read_data)
@@ -279,7 +569,6 @@ int mcp25xxfd_can_tx_handle_int_tefif_fifo(struct mcp25xxfd_can_priv *cpriv,
 	struct mcp25xxfd_can_obj_tef *tef =
 		(struct mcp25xxfd_can_obj_tef *)(cpriv->sram + tef_offset);
 	int fifo, ret;
-	unsigned long flags;
 
 	/* read the next TEF entry to get the transmit timestamp and fifo */
 	if (read_data) {
@@ -294,15 +583,15 @@ int mcp25xxfd_can_tx_handle_int_tefif_fifo(struct mcp25xxfd_can_priv *cpriv,
 		MCP25XXFD_CAN_OBJ_FLAGS_SEQ_SHIFT;
 
 	/* check that the fifo is valid */
-	spin_lock_irqsave(&cpriv->fifos.tx_queue->lock, flags);
-	if ((cpriv->fifos.tx_queue->in_can_transfer & BIT(fifo)) == 0)
+	if (!(mcp25xxfd_can_tx_queue_fifos(cpriv->fifos.tx_queue,
+			MCP25XXFD_CAN_TX_STAGE_IN_CAN_TRANSFER) & BIT(fifo)))
 		netdev_err(cpriv->can.dev,
 			   "tefif: fifo %i not pending - tef data: id: %08x flags: %08x, ts: %08x - this may be a problem with spi signal quality- try reducing spi-clock speed if this can get reproduced",
 			   fifo, tef->id, tef->flags, tef->ts);
-	spin_unlock_irqrestore(&cpriv->fifos.tx_queue->lock, flags);
 
 	/* update stats */
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, tef_reads);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, tef_reads);
+	mcp25xxfd_can_tx_bus_gap(cpriv, tef);
 
 	/* now we can schedule the fifo for echo submission */
 	mcp25xxfd_can_queue_frame(cpriv, fifo, tef->ts, false);
@@ -344,7 +633,7 @@ mcp25xxfd_can_tx_handle_int_tefif_conservative(struct mcp25xxfd_can_priv *cpriv)
 		if (ret)
 			return ret;
 
-		MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, tef_conservative_reads);
+		MCP25XXFD_CAN_STATS_INCR(cpriv, tef_conservative_reads);
 
 		/* read the TEF status */
 		ret = mcp25xxfd_cmd_read_mask(cpriv->priv->spi,
@@ -379,9 +668,9 @@ mcp25xxfd_can_tx_handle_int_tefif_optimized(struct mcp25xxfd_can_priv *cpriv,
 		return ret;
 
 	/* update stats */
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, tef_optimized_reads);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, tef_optimized_reads);
 	i = min_t(int, MCP25XXFD_CAN_TEF_READ_BINS - 1, count - 1);
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, tef_optimized_read_sizes[i]);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, tef_optimized_read_sizes[i]);
 
 	/* now iterate those */
 	for (i = 0, fifo = cpriv->fifos.tx.start; i < cpriv->fifos.tx.count;
@@ -405,7 +694,7 @@ int mcp25xxfd_can_tx_handle_int_tefif(struct mcp25xxfd_can_priv *cpriv)
 	if (!(cpriv->status.intf & MCP25XXFD_CAN_INT_TEFIF))
 		return 0;
 
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, int_tef_count);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, int_tef_count);
 
 	/* otherwise play it safe */
 	netdev_warn(cpriv->can.dev,
@@ -413,40 +702,46 @@ int mcp25xxfd_can_tx_handle_int_tefif(struct mcp25xxfd_can_priv *cpriv)
 	return mcp25xxfd_can_tx_handle_int_tefif_conservative(cpriv);
 }
 
+/* build the tx object in controller format directly in the spi buffer
+ * the sram shadow of the fifo only keeps the flags in cpu format as
+ * needed by mcp25xxfd_can_tx_submit_frame - the TEF provides the rest
+ */
 static
 void mcp25xxfd_can_tx_fill_fifo_common(struct mcp25xxfd_can_priv *cpriv,
 				       struct mcp25xxfd_tx_spi_message *smsg,
 				       struct mcp25xxfd_can_obj_tx *tx,
-				       int dlc, u8 *data)
+				       u32 id, u32 flags, int dlc,
+				       const u8 *data)
 {
+	u8 *header = smsg->fill_fifo.data.header;
+	u8 *payload = smsg->fill_fifo.data.data;
 	int len = can_dlc2len(dlc);
+	int padded = round_up(len, sizeof(u32));
 
 	/* update statistics */
 	MCP25XXFD_DEBUGFS_INCR(cpriv->fifos.tx.dlc_usage[dlc]);
 	MCP25XXFD_DEBUGFS_INCR(cpriv->fifos.info[smsg->fifo].use_count);
 
-	/* add fifo number as seq */
-	tx->flags |= smsg->fifo << MCP25XXFD_CAN_OBJ_FLAGS_SEQ_SHIFT;
+	/* the flags template of the fifo already contains seq (and FDF) */
+	flags |= dlc << MCP25XXFD_CAN_OBJ_FLAGS_DLC_SHIFT;
 
-	/* copy data to tx->data for future reference */
-	memcpy(tx->data, data, len);
+	/* write the header in controller format */
+	put_unaligned_le32(id, header);
+	put_unaligned_le32(flags, header + sizeof(u32));
 
-	/* transform header to controller format */
-	mcp25xxfd_cmd_convert_from_cpu(&tx->id, sizeof(*tx) / sizeof(u32));
-
-	/* copy header + data to final location - we are not aligned */
-	memcpy(smsg->fill_fifo.data.header, &tx->id, sizeof(*tx) + len);
-
-	/* transfers to sram should be a multiple of 4 and be zero padded */
-	for (; len & 3; len++)
-		*(smsg->fill_fifo.data.header + sizeof(*tx) + len) = 0;
+	/* transfers to sram should be a multiple of 4 and be zero padded
+	 * so clear the last word before copying the data
+	 */
+	if (len != padded)
+		put_unaligned_le32(0, payload + padded - sizeof(u32));
+	memcpy(payload, data, len);
 
-	/* convert it back to CPU format */
-	mcp25xxfd_cmd_convert_to_cpu(&tx->id, sizeof(*tx) / sizeof(u32));
+	/* keep the flags for reference */
+	tx->flags = flags;
 
 	/* set up size of transfer */
 	smsg->fill_fifo.xfer.len = sizeof(smsg->fill_fifo.data.cmd) +
-		sizeof(smsg->fill_fifo.data.header) + len;
+		sizeof(smsg->fill_fifo.data.header) + padded;
 }
 
 static
@@ -456,29 +751,26 @@ void mcp25xxfd_can_tx_fill_fifo_fd(struct mcp25xxfd_can_priv *cpriv,
 				   struct mcp25xxfd_can_obj_tx *tx)
 {
 	int dlc = can_len2dlc(frame->len);
+	u32 id, flags;
 
 	/* update some statistics */
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, tx_fd_count);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, tx_fd_count);
 
-	/* compute can id */
-	mcp25xxfd_can_id_to_mcp25xxfd(frame->can_id, &tx->id, &tx->flags);
+	/* compute can id - this also sets up IDE and RTR */
+	mcp25xxfd_can_id_to_mcp25xxfd(frame->can_id, &id, &flags);
 
 	/* setup flags */
-	tx->flags |= dlc << MCP25XXFD_CAN_OBJ_FLAGS_DLC_SHIFT;
-	tx->flags |= (frame->can_id & CAN_EFF_FLAG) ?
-		MCP25XXFD_CAN_OBJ_FLAGS_IDE : 0;
-	tx->flags |= (frame->can_id & CAN_RTR_FLAG) ?
-		MCP25XXFD_CAN_OBJ_FLAGS_RTR : 0;
+	flags |= smsg->flags_canfd;
 	if (frame->flags & CANFD_BRS) {
-		tx->flags |= MCP25XXFD_CAN_OBJ_FLAGS_BRS;
-		MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, tx_brs_count);
+		flags |= MCP25XXFD_CAN_OBJ_FLAGS_BRS;
+		MCP25XXFD_CAN_STATS_INCR(cpriv, tx_brs_count);
 	}
-	tx->flags |= (frame->flags & CANFD_ESI) ?
+	flags |= (frame->flags & CANFD_ESI) ?
 		MCP25XXFD_CAN_OBJ_FLAGS_ESI : 0;
-	tx->flags |= MCP25XXFD_CAN_OBJ_FLAGS_FDF;
 
 	/* and do common processing */
-	mcp25xxfd_can_tx_fill_fifo_common(cpriv, smsg, tx, dlc, frame->data);
+	mcp25xxfd_can_tx_fill_fifo_common(cpriv, smsg, tx, id, flags, dlc,
+					  frame->data);
 }
 
 static
@@ -487,56 +779,152 @@ void mcp25xxfd_can_tx_fill_fifo(struct mcp25xxfd_can_priv *cpriv,
 				struct mcp25xxfd_tx_spi_message *smsg,
 				struct mcp25xxfd_can_obj_tx *tx)
 {
+	u32 id, flags;
+
 	/* set frame to valid dlc */
 	if (frame->can_dlc > 8)
 		frame->can_dlc = 8;
 
-	/* compute can id */
-	mcp25xxfd_can_id_to_mcp25xxfd(frame->can_id, &tx->id, &tx->flags);
+	/* compute can id - this also sets up IDE and RTR */
+	mcp25xxfd_can_id_to_mcp25xxfd(frame->can_id, &id, &flags);
 
 	/* setup flags */
-	tx->flags |= frame->can_dlc << MCP25XXFD_CAN_OBJ_FLAGS_DLC_SHIFT;
-	tx->flags |= (frame->can_id & CAN_EFF_FLAG) ?
-		MCP25XXFD_CAN_OBJ_FLAGS_IDE : 0;
-	tx->flags |= (frame->can_id & CAN_RTR_FLAG) ?
-		MCP25XXFD_CAN_OBJ_FLAGS_RTR : 0;
+	flags |= smsg->flags_can;
 
 	/* and do common processing */
-	mcp25xxfd_can_tx_fill_fifo_common(cpriv, smsg, tx, frame->can_dlc,
-					  frame->data);
+	mcp25xxfd_can_tx_fill_fifo_common(cpriv, smsg, tx, id, flags,
+					  frame->can_dlc, frame->data);
+}
+
+/* returns the lowest TXPRI of the pending frames with the same can id
+ * and sets *fifo to the fifo holding it
+ */
+static u32 mcp25xxfd_can_tx_queue_prio_floor(struct mcp25xxfd_can_priv *cpriv,
+					     u32 pending, canid_t can_id,
+					     int *fifo)
+{
+	struct mcp25xxfd_tx_spi_message_queue *q = cpriv->fifos.tx_queue;
+	u32 floor = MCP25XXFD_CAN_TX_QUEUE_PRIO_NONE;
+	int i, f;
+
+	for (i = 0, f = cpriv->fifos.tx.start; i < cpriv->fifos.tx.count;
+	     i++, f++) {
+		if (!(pending & BIT(f)) || q->fifo2message[f]->can_id != can_id)
+			continue;
+		if (cpriv->fifos.info[f].priority < floor) {
+			floor = cpriv->fifos.info[f].priority;
+			*fifo = f;
+		}
+	}
+
+	return floor;
+}
+
+static struct mcp25xxfd_tx_spi_message *
+mcp25xxfd_can_tx_queue_prio_fifo(struct mcp25xxfd_can_priv *cpriv,
+				 u32 idle, u32 floor, bool *write_prio)
+{
+	struct mcp25xxfd_tx_spi_message_queue *q = cpriv->fifos.tx_queue;
+	struct mcp25xxfd_tx_spi_message *smsg = NULL;
+	u32 prio, best = 0;
+	int i, f;
+
+	/* find the idle fifo with the highest priority below floor */
+	for (i = 0, f = cpriv->fifos.tx.start; i < cpriv->fifos.tx.count;
+	     i++, f++) {
+		if (!(idle & BIT(f)))
+			continue;
+		prio = cpriv->fifos.info[f].priority;
+		if (prio < floor && (!smsg || prio > best)) {
+			smsg = q->fifo2message[f];
+			best = prio;
+		}
+	}
+
+	/* use it unless it leaves too little headroom */
+	*write_prio = false;
+	if (smsg && (best == floor - 1 ||
+		     best >= MCP25XXFD_CAN_TX_QUEUE_PRIO_LOW))
+		return smsg;
+
+	/* otherwise rewrite the priority just below floor */
+	if (!smsg)
+		smsg = mcp25xxfd_can_tx_queue_first_spi_message(q, idle);
+	cpriv->fifos.info[smsg->fifo].priority = floor - 1;
+	*write_prio = true;
+
+	return smsg;
 }
 
 static struct mcp25xxfd_tx_spi_message *
-mcp25xxfd_can_tx_queue_get_next_fifo(struct mcp25xxfd_can_priv *cpriv)
+mcp25xxfd_can_tx_queue_get_next_fifo(struct mcp25xxfd_can_priv *cpriv,
+				     canid_t can_id, bool *write_prio)
 {
-	u32 state = MCP25XXFD_CAN_TX_QUEUE_STATE_RUNABLE;
 	struct mcp25xxfd_tx_spi_message_queue *q = cpriv->fifos.tx_queue;
 	struct mcp25xxfd_tx_spi_message *smsg;
-	unsigned long flags;
+	u32 floor, idle, pending;
+	int fifo = 0;
 
-	/* we need to hold this lock to protect us against
-	 * concurrent modifications of cpriv->fifos.tx_queue->idle
-	 * in the interrupt thread
+	/* only start_xmit takes fifos out of idle, so the fifos seen idle
+	 * here stay idle - others may just get recycled concurrently
 	 */
-	spin_lock_irqsave(&q->lock, flags);
+	pending = mcp25xxfd_can_tx_queue_pending(q);
+	idle = q->fifos & ~pending;
 
-	/* get the first entry from idle */
-	smsg = mcp25xxfd_can_tx_queue_first_spi_message(q, &q->idle);
-	if (!smsg)
+	/* the fifos we waited for may have been transmitted by now */
+	WRITE_ONCE(q->blocked, q->blocked & pending);
+
+	if (!idle)
 		goto out_busy;
 
+	/* if priority 0 is pending for this can id then we need to wait
+	 * for that fifo to get transmitted - the skb gets requeued
+	 */
+	floor = mcp25xxfd_can_tx_queue_prio_floor(cpriv, pending, can_id,
+						  &fifo);
+	if (!floor) {
+		WRITE_ONCE(q->blocked, BIT(fifo));
+		MCP25XXFD_CAN_STATS_INCR(cpriv, tx_prio_drains);
+		goto out_busy;
+	}
+
+	/* get the entry from idle */
+	smsg = mcp25xxfd_can_tx_queue_prio_fifo(cpriv, idle, floor,
+						write_prio);
+	smsg->can_id = can_id;
+
 	/* and move the fifo to next stage */
-	mcp25xxfd_can_tx_queue_move_spi_message(&q->idle,
-						&q->in_fill_fifo_transfer,
-						smsg->fifo);
+	mcp25xxfd_can_tx_queue_move_spi_message(cpriv, smsg->fifo,
+		BIT(MCP25XXFD_CAN_TX_STAGE_IDLE),
+		MCP25XXFD_CAN_TX_STAGE_IN_FILL_FIFO_TRANSFER);
 
 	/* if queue is empty then stop the network queue immediately */
-	if (!q->idle)
-		mcp25xxfd_can_tx_queue_manage_nolock(cpriv, state);
-out_busy:
-	spin_unlock_irqrestore(&q->lock, flags);
+	if (idle == BIT(smsg->fifo))
+		mcp25xxfd_can_tx_queue_stop(cpriv);
 
 	return smsg;
+
+out_busy:
+	mcp25xxfd_can_tx_queue_stop(cpriv);
+
+	return NULL;
+}
+
+static void mcp25xxfd_can_tx_prio_fifo(struct mcp25xxfd_can_priv *cpriv,
+				       struct mcp25xxfd_tx_spi_message *smsg)
+{
+	u32 con = cpriv->fifos.info[smsg->fifo].con;
+	int shift;
+
+	shift = 8 * mcp25xxfd_cmd_first_byte(MCP25XXFD_CAN_FIFOCON_TXPRI_MASK);
+
+	/* keep the other bits in that byte of FIFOCON (TXAT) */
+	con &= ~MCP25XXFD_CAN_FIFOCON_TXPRI_MASK;
+	con |= cpriv->fifos.info[smsg->fifo].priority <<
+		MCP25XXFD_CAN_FIFOCON_TXPRI_SHIFT;
+	smsg->prio_fifo.data.data = con >> shift;
+
+	MCP25XXFD_CAN_STATS_INCR(cpriv, tx_prio_writes);
 }
 
 /* submit the can message to the can-bus */
@@ -545,28 +933,33 @@ netdev_tx_t mcp25xxfd_can_tx_start_xmit(struct sk_buff *skb,
 {
 	u32 state = MCP25XXFD_CAN_TX_QUEUE_STATE_STOPPED;
 	struct mcp25xxfd_can_priv *cpriv = netdev_priv(net);
-	struct mcp25xxfd_tx_spi_message_queue *q = cpriv->fifos.tx_queue;
 	struct mcp25xxfd_priv *priv = cpriv->priv;
 	struct spi_device *spi = priv->spi;
 	struct mcp25xxfd_tx_spi_message *smsg;
 	struct mcp25xxfd_can_obj_tx *tx;
-	unsigned long flags;
+	bool write_prio;
+	canid_t can_id;
 	int ret;
 
 	/* invalid skb we can ignore */
 	if (can_dropped_invalid_skb(net, skb))
 		return NETDEV_TX_OK;
 
-	/* acquire lock on spi so that we are are not risking
-	 * some reordering of spi messages when we are running
-	 * start_xmit in multiple threads (on multiple cores)
+	/* no lock is needed to keep the spi messages in order:
+	 * start_xmit does not run concurrently on multiple cores as the
+	 * network stack serializes it with the tx queue lock (no LLTX)
 	 */
-	spin_lock_irqsave(&q->spi_lock, flags);
 
-	/* get the fifo message structure to process now */
-	smsg = mcp25xxfd_can_tx_queue_get_next_fifo(cpriv);
+	/* get the fifo message structure to process now
+	 * - the can_id is at the same place in can_frame and canfd_frame
+	 */
+	can_id = ((struct can_frame *)skb->data)->can_id &
+		(CAN_EFF_FLAG | CAN_EFF_MASK);
+	smsg = mcp25xxfd_can_tx_queue_get_next_fifo(cpriv, can_id,
+						    &write_prio);
 	if (!smsg)
 		goto out_busy;
+	smsg->ts_xmit = ktime_get_real_ns();
 
 	/* compute the fifo in sram */
 	tx = (struct mcp25xxfd_can_obj_tx *)
@@ -582,6 +975,18 @@ netdev_tx_t mcp25xxfd_can_tx_start_xmit(struct sk_buff *skb,
 					   (struct can_frame *)skb->data,
 					   smsg, tx);
 
+	/* mark the hw timestamp as pending (and take the sw one) before
+	 * the first transfer: the frame may be on the bus and its TEF be
+	 * handled before spi_async even returns
+	 */
+	mcp25xxfd_can_ptp_tx_prepare(cpriv, skb);
+
+	/* keep it for reference until the message really got transmitted
+	 * - for the same reason before the first transfer, otherwise the
+	 * TEF finds no echo and the late one sticks to the recycled fifo
+	 */
+	can_put_echo_skb(skb, net, smsg->fifo);
+
 	/* submit the two messages asyncronously
 	 * the reason why we separate transfers into two spi_messages is:
 	 *  * because the spi framework (currently) does add a 10us delay
@@ -593,7 +998,17 @@ netdev_tx_t mcp25xxfd_can_tx_start_xmit(struct sk_buff *skb,
 	 *    so reducing latencies a bit and to allow for better concurrency
 	 *  * this separation - in the future - may get used to fill fifos
 	 *    early and reduce the delay on "rollover"
+	 * if the fifo needs a different priority to keep the frames with
+	 * the same can id in order then this gets written first with a
+	 * third spi_message
 	 */
+	smsg->ts_submit = mcp25xxfd_cmd_trace_async_start();
+	if (write_prio) {
+		mcp25xxfd_can_tx_prio_fifo(cpriv, smsg);
+		ret = spi_async(spi, &smsg->prio_fifo.msg);
+		if (ret)
+			goto out_async_failed;
+	}
 	ret = spi_async(spi, &smsg->fill_fifo.msg);
 	if (ret)
 		goto out_async_failed;
@@ -601,55 +1016,62 @@ netdev_tx_t mcp25xxfd_can_tx_start_xmit(struct sk_buff *skb,
 	if (ret)
 		goto out_async_failed;
 
-	/* unlock the spi bus */
-	spin_unlock_irqrestore(&q->spi_lock, flags);
-
-	/* keep it for reference until the message really got transmitted */
-	can_put_echo_skb(skb, net, smsg->fifo);
-
 	return NETDEV_TX_OK;
 out_async_failed:
 	netdev_err(net, "spi_async submission of fifo %i failed - %i\n",
 		   smsg->fifo, ret);
 
-out_busy:
+	/* the echo owns the skb now - drop the frame with it */
+	can_free_echo_skb(net, smsg->fifo);
+	net->stats.tx_dropped++;
+
 	/* stop the queue */
-	mcp25xxfd_can_tx_queue_manage_nolock(cpriv, state);
+	mcp25xxfd_can_tx_queue_manage(cpriv, state);
 
-	spin_unlock_irqrestore(&q->spi_lock, flags);
+	return NETDEV_TX_OK;
 
+out_busy:
+	/* the queue has been stopped already */
 	return NETDEV_TX_BUSY;
 }
 
 /* submit the fifo back to the network stack */
-int mcp25xxfd_can_tx_submit_frame(struct mcp25xxfd_can_priv *cpriv, int fifo)
+int mcp25xxfd_can_tx_submit_frame(struct mcp25xxfd_can_priv *cpriv, int fifo,
+				  u32 ts)
 {
-	struct mcp25xxfd_tx_spi_message_queue *q = cpriv->fifos.tx_queue;
+	struct mcp25xxfd_tx_spi_message *smsg =
+		cpriv->fifos.tx_queue->fifo2message[fifo];
 	struct mcp25xxfd_can_obj_tx *tx = (struct mcp25xxfd_can_obj_tx *)
 		(cpriv->sram + cpriv->fifos.info[fifo].offset);
 	int dlc = (tx->flags & MCP25XXFD_CAN_OBJ_FLAGS_DLC_MASK) >>
 		MCP25XXFD_CAN_OBJ_FLAGS_DLC_SHIFT;
-	unsigned long flags;
 
 	/* update counters */
 	cpriv->can.dev->stats.tx_packets++;
 	cpriv->can.dev->stats.tx_bytes += can_dlc2len(dlc);
 	MCP25XXFD_DEBUGFS_INCR(cpriv->fifos.tx.dlc_usage[dlc]);
 	if (tx->flags & MCP25XXFD_CAN_OBJ_FLAGS_FDF)
-		MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, tx_fd_count);
+		MCP25XXFD_CAN_STATS_INCR(cpriv, tx_fd_count);
 	if (tx->flags & MCP25XXFD_CAN_OBJ_FLAGS_BRS)
-		MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, tx_brs_count);
+		MCP25XXFD_CAN_STATS_INCR(cpriv, tx_brs_count);
 
-	spin_lock_irqsave(&cpriv->fifos.tx_queue->lock, flags);
+	/* a corrupted TEF entry may point to a fifo that is not for tx */
+	if (smsg)
+		mcp25xxfd_can_tx_latency(cpriv, smsg, ts, tx->flags);
 
-	/* release the echo buffer */
+	/* timestamp and release the echo buffer
+	 * - the fifo is still owned by us
+	 */
+	if (cpriv->can.echo_skb[fifo])
+		mcp25xxfd_can_ptp_tx_hwtstamp(cpriv, cpriv->can.echo_skb[fifo],
+					      ts);
 	can_get_echo_skb(cpriv->can.dev, fifo);
 
-	/* move from in_can_transfer to transferred */
-	mcp25xxfd_can_tx_queue_move_spi_message(&q->in_can_transfer,
-						&q->transferred, fifo);
-
-	spin_unlock_irqrestore(&cpriv->fifos.tx_queue->lock, flags);
+	/* recycle the fifo immediately */
+	mcp25xxfd_can_tx_queue_move_spi_message(cpriv, fifo,
+		MCP25XXFD_CAN_TX_STAGE_DONE_FROM,
+		MCP25XXFD_CAN_TX_STAGE_IDLE);
+	mcp25xxfd_can_tx_queue_restart(cpriv);
 
 	return 0;
 }
@@ -659,9 +1081,7 @@ static
 int mcp25xxfd_can_tx_handle_int_txatif_fifo(struct mcp25xxfd_can_priv *cpriv,
 					    int fifo)
 {
-	struct mcp25xxfd_tx_spi_message_queue *q = cpriv->fifos.tx_queue;
 	u32 val;
-	unsigned long flags;
 	int ret;
 
 	/* read fifo status */
@@ -680,7 +1100,6 @@ int mcp25xxfd_can_tx_handle_int_txatif_fifo(struct mcp25xxfd_can_priv *cpriv,
 	if (ret)
 		return ret;
 
-	spin_lock_irqsave(&q->lock, flags);
 	/* for specific cases we probably could trigger a retransmit
 	 * instead of an abort.
 	 */
@@ -692,10 +1111,10 @@ int mcp25xxfd_can_tx_handle_int_txatif_fifo(struct mcp25xxfd_can_priv *cpriv,
 	 */
 	can_get_echo_skb(cpriv->can.dev, fifo);
 
-	mcp25xxfd_can_tx_queue_move_spi_message(&q->in_can_transfer,
-						&q->transferred, fifo);
-
-	spin_unlock_irqrestore(&q->lock, flags);
+	mcp25xxfd_can_tx_queue_move_spi_message(cpriv, fifo,
+		MCP25XXFD_CAN_TX_STAGE_DONE_FROM,
+		MCP25XXFD_CAN_TX_STAGE_IDLE);
+	mcp25xxfd_can_tx_queue_restart(cpriv);
 
 	/* but we need to run a bit of cleanup */
 	cpriv->status.txif &= ~BIT(fifo);
@@ -729,7 +1148,7 @@ int mcp25xxfd_can_tx_handle_int_txatif(struct mcp25xxfd_can_priv *cpriv)
 	 */
 	if (!cpriv->status.txatif)
 		return 0;
-	MCP25XXFD_DEBUGFS_STATS_INCR(cpriv, int_txat_count);
+	MCP25XXFD_CAN_STATS_INCR(cpriv, int_txat_count);
 
 	/* process all the fifos with that flag set */
 	for (i = 0, f = cpriv->fifos.tx.start; i < cpriv->fifos.tx.count;
@@ -758,7 +1177,7 @@ int mcp25xxfd_can_tx_queue_alloc(struct mcp25xxfd_can_priv *cpriv)
 
 	/* initialize the tx_queue structure */
 	spin_lock_init(&cpriv->fifos.tx_queue->lock);
-	spin_lock_init(&cpriv->fifos.tx_queue->spi_lock);
+	atomic64_set(&cpriv->fifos.tx_queue->stages, 0);
 
 	/* initialize the individual spi_message structures */
 	for (i = 0, f = cpriv->fifos.tx.start; i < cpriv->fifos.tx.count;
@@ -8,6 +8,7 @@
 #ifndef __MCP25XXFD_CAN_TX_H
 #define __MCP25XXFD_CAN_TX_H
 
+#include <linux/atomic.h>
 #include <linux/spinlock.h>
 #include <linux/spi/spi.h>
 
@@ -19,6 +20,19 @@ struct mcp25xxfd_tx_spi_message {
 	struct mcp25xxfd_can_priv *cpriv;
 	/* the fifo this fills */
 	u32 fifo;
+	/* the can id (incl. CAN_EFF_FLAG) of the frame in this fifo */
+	canid_t can_id;
+	/* the precomputed tx object flags for can2.0 and canfd frames */
+	u32 flags_can;
+	u32 flags_canfd;
+	/* system time in ns when the frame passed start_xmit and when
+	 * the fill and trigger transfers completed - see tx latency
+	 */
+	u64 ts_xmit;
+	u64 ts_filled;
+	u64 ts_triggered;
+	/* when the spi messages got submitted, for the async trace */
+	u64 ts_submit;
 	/* the xfer to fill in the fifo data */
 	struct {
 		struct spi_message msg;
@@ -38,20 +52,50 @@ struct mcp25xxfd_tx_spi_message {
 			u8 data;
 		} data;
 	} trigger_fifo;
+	/* the xfer to set the TXPRI before filling - only used if needed */
+	struct {
+		struct spi_message msg;
+		struct spi_transfer xfer;
+		struct {
+			u8 cmd[2];
+			u8 data;
+		} data;
+	} prio_fifo;
 };
 
 struct mcp25xxfd_tx_spi_message_queue {
-	/* spinlock protecting the bitmaps
-	 * as well as state and the skb_echo_* functions
+	/* the stage each fifo is in - packed into a single word, so that
+	 * a fifo can get moved to the next stage with a single cmpxchg
+	 * without any locking between start_xmit, the spi completion
+	 * callbacks and the interrupt thread:
+	 * bit f of the lower and of the upper 32 bit form the stage of fifo f
 	 */
-	spinlock_t lock;
-	/* bitmap of which fifo is in which stage */
-	u32 idle;
-	u32 in_fill_fifo_transfer;
-	u32 in_trigger_fifo_transfer;
-	u32 in_can_transfer;
-	u32 transferred;
+	atomic64_t stages;
+#define MCP25XXFD_CAN_TX_STAGE_IDLE			0
+#define MCP25XXFD_CAN_TX_STAGE_IN_FILL_FIFO_TRANSFER	1
+#define MCP25XXFD_CAN_TX_STAGE_IN_TRIGGER_FIFO_TRANSFER	2
+#define MCP25XXFD_CAN_TX_STAGE_IN_CAN_TRANSFER		3
+/* the stages a transmitted or aborted fifo gets recycled from: the
+ * completion of its trigger transfer may not have been seen yet
+ */
+#define MCP25XXFD_CAN_TX_STAGE_DONE_FROM				\
+	(BIT(MCP25XXFD_CAN_TX_STAGE_IN_TRIGGER_FIFO_TRANSFER) |		\
+	 BIT(MCP25XXFD_CAN_TX_STAGE_IN_CAN_TRANSFER))
 
+	/* bitmap of the fifos handled by the queue */
+	u32 fifos;
+
+	/* the pending fifos that need to get transmitted before
+	 * the queue may continue - set when the next frame can not get
+	 * a TXPRI below the frames with the same can id still pending
+	 */
+	u32 blocked;
+#define MCP25XXFD_CAN_TX_QUEUE_PRIO_NONE 32
+/* rewrite TXPRI if an idle fifo would leave less headroom than this */
+#define MCP25XXFD_CAN_TX_QUEUE_PRIO_LOW 8
+
+	/* spinlock protecting state transitions of the network queue */
+	spinlock_t lock;
 	/* the queue state as seen per controller */
 	int state;
 #define MCP25XXFD_CAN_TX_QUEUE_STATE_STOPPED 0
@@ -59,9 +103,6 @@ struct mcp25xxfd_tx_spi_message_queue {
 #define MCP25XXFD_CAN_TX_QUEUE_STATE_RUNABLE 2
 #define MCP25XXFD_CAN_TX_QUEUE_STATE_RESTART 3
 
-	/* spinlock protecting spi submission order */
-	spinlock_t spi_lock;
-
 	/* map each fifo to a mcp25xxfd_tx_spi_message */
 	struct mcp25xxfd_tx_spi_message *fifo2message[32];
 
@@ -69,8 +110,12 @@ struct mcp25xxfd_tx_spi_message_queue {
 	struct mcp25xxfd_tx_spi_message message[];
 };
 
-int mcp25xxfd_can_tx_submit_frame(struct mcp25xxfd_can_priv *cpriv, int fifo);
+int mcp25xxfd_can_tx_submit_frame(struct mcp25xxfd_can_priv *cpriv, int fifo,
+				  u32 ts);
+u32 mcp25xxfd_can_tx_queue_fifos(struct mcp25xxfd_tx_spi_message_queue *q,
+				 int stage);
 void mcp25xxfd_can_tx_queue_restart(struct mcp25xxfd_can_priv *cpriv);
+int mcp25xxfd_can_tx_queue_flush(struct mcp25xxfd_can_priv *cpriv);
 
 int mcp25xxfd_can_tx_handle_int_txatif(struct mcp25xxfd_can_priv *cpriv);
 int mcp25xxfd_can_tx_handle_int_tefif(struct mcp25xxfd_can_priv *cpriv);
@@ -5,6 +5,8 @@
  * Copyright 2019 Martin Sperl <kernel@martin.sperl.org>
  */
 
+#include <linux/kernel.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/slab.h>
@@ -13,6 +15,7 @@
 #include "mcp25xxfd_cmd.h"
 #include "mcp25xxfd_crc.h"
 #include "mcp25xxfd_priv.h"
+#include "mcp25xxfd_trace.h"
 
 /* module parameter */
 static bool use_spi_crc;
@@ -183,22 +186,79 @@ static int mcp25xxfd_cmd_write_then_write(struct spi_device *spi,
 	return ret;
 }
 
+/* tracing of the spi commands
+ * the time only gets taken while the tracepoint is enabled
+ * and each command is traced once with the call site in the driver
+ */
+static u64 mcp25xxfd_cmd_trace_start(void)
+{
+	return trace_mcp25xxfd_cmd_enabled() ? ktime_get_ns() : 0;
+}
+
+static void mcp25xxfd_cmd_trace(struct spi_device *spi, int op, u32 reg,
+				u32 len, u64 start, int ret,
+				unsigned long caller)
+{
+	/* skip if the tracepoint got enabled during the command */
+	if (start)
+		trace_mcp25xxfd_cmd(spi, op, reg & MCP25XXFD_ADDRESS_MASK, len,
+				    ktime_get_ns() - start, ret, caller);
+}
+
+/* the submission time of prepared async messages - 0 unless traced */
+u64 mcp25xxfd_cmd_trace_async_start(void)
+{
+	return trace_mcp25xxfd_cmd_async_enabled() ? ktime_get_ns() : 0;
+}
+
+/* trace a prepared async message on completion
+ * - start is from mcp25xxfd_cmd_trace_async_start before its spi_async
+ * - the register is taken from the command of the first transfer
+ */
+void mcp25xxfd_cmd_trace_async(struct spi_message *msg, int op, u64 start)
+{
+	struct spi_transfer *xfer;
+	const u8 *cmd;
+
+	/* skip if the tracepoint got enabled after the submission */
+	if (!start || !trace_mcp25xxfd_cmd_async_enabled())
+		return;
+
+	xfer = list_first_entry(&msg->transfers, struct spi_transfer,
+				transfer_list);
+	cmd = xfer->tx_buf;
+
+	trace_mcp25xxfd_cmd_async(msg->spi, op,
+				  ((cmd[0] << 8) | cmd[1]) &
+				  MCP25XXFD_ADDRESS_MASK,
+				  msg->actual_length, ktime_get_ns() - start,
+				  msg->status);
+}
+
 /* mcp25xxfd spi command/protocol helper */
 
 /* read multiple bytes, transform some registers */
-int mcp25xxfd_cmd_readn(struct spi_device *spi, u32 reg,
-			void *data, int n)
+static int mcp25xxfd_cmd_do_readn(struct spi_device *spi, u32 reg,
+				  void *data, int n, int op,
+				  unsigned long caller)
 {
+	u64 start = mcp25xxfd_cmd_trace_start();
 	u8 cmd[2];
 	int ret;
 
 	mcp25xxfd_cmd_calc(MCP25XXFD_INSTRUCTION_READ, reg, cmd);
 
 	ret = mcp25xxfd_cmd_write_then_read(spi, &cmd, 2, data, n, NULL);
-	if (ret)
-		return ret;
+	mcp25xxfd_cmd_trace(spi, op, reg, n, start, ret, caller);
 
-	return 0;
+	return ret;
+}
+
+int mcp25xxfd_cmd_readn(struct spi_device *spi, u32 reg,
+			void *data, int n)
+{
+	return mcp25xxfd_cmd_do_readn(spi, reg, data, n,
+				      MCP25XXFD_CMD_OP_READN, _RET_IP_);
 }
 
 static u16 _mcp25xxfd_cmd_compute_crc(u8 *cmd, u8 *data, int n)
@@ -211,26 +271,15 @@ static u16 _mcp25xxfd_cmd_compute_crc(u8 *cmd, u8 *data, int n)
 	return crc;
 }
 
-static int _mcp25xxfd_cmd_readn_crc(struct spi_device *spi, u32 reg,
-				    void *data, int n)
+bool mcp25xxfd_cmd_use_crc(void)
 {
-	u8 cmd[3], crcd[2];
-	u16 crcc, crcr;
-	int ret;
-
-	/* prepare command */
-	mcp25xxfd_cmd_calc(MCP25XXFD_INSTRUCTION_READ_CRC, reg, cmd);
-	/* count depends on word (=RAM) or byte access (Registers) */
-	if (reg < MCP25XXFD_SRAM_ADDR(0) ||
-	    reg >= MCP25XXFD_SRAM_ADDR(MCP25XXFD_SRAM_SIZE))
-		cmd[2] = n;
-	else
-		cmd[2] = n / 4;
+	return use_spi_crc;
+}
 
-	/* now read for real */
-	ret = mcp25xxfd_cmd_write_then_read(spi, &cmd, 3, data, n, crcd);
-	if (ret)
-		return ret;
+int mcp25xxfd_cmd_check_crc(struct spi_device *spi, u8 *cmd,
+			    u8 *data, int n, u8 *crcd)
+{
+	u16 crcc, crcr;
 
 	/* the received crc */
 	crcr = (crcd[0] << 8) + crcd[1];
@@ -249,11 +298,42 @@ static int _mcp25xxfd_cmd_readn_crc(struct spi_device *spi, u32 reg,
 			    "CRC read error: computed: %04x received: %04x - data: %*ph %*ph%s\n",
 			    crcc, crcr, 3, cmd, min_t(int, 64, n), data,
 			    (n > 64) ? "..." : "");
+
 	return -EILSEQ;
 }
 
+static int _mcp25xxfd_cmd_readn_crc(struct spi_device *spi, u32 reg,
+				    void *data, int n, unsigned long caller)
+{
+	u64 start = mcp25xxfd_cmd_trace_start();
+	u8 cmd[3], crcd[2];
+	int ret;
+
+	/* prepare command */
+	mcp25xxfd_cmd_calc(MCP25XXFD_INSTRUCTION_READ_CRC, reg, cmd);
+	/* count depends on word (=RAM) or byte access (Registers) */
+	if (reg < MCP25XXFD_SRAM_ADDR(0) ||
+	    reg >= MCP25XXFD_SRAM_ADDR(MCP25XXFD_SRAM_SIZE))
+		cmd[2] = n;
+	else
+		cmd[2] = n / 4;
+
+	/* now read for real */
+	ret = mcp25xxfd_cmd_write_then_read(spi, &cmd, 3, data, n, crcd);
+	if (ret)
+		goto out;
+
+	ret = mcp25xxfd_cmd_check_crc(spi, cmd, data, n, crcd);
+
+out:
+	mcp25xxfd_cmd_trace(spi, MCP25XXFD_CMD_OP_READN_CRC, reg, n, start,
+			    ret, caller);
+
+	return ret;
+}
+
 static int mcp25xxfd_cmd_readn_crc(struct spi_device *spi, u32 reg,
-				   void *data, int n)
+				   void *data, int n, unsigned long caller)
 {
 	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
 	int ret;
@@ -264,7 +344,7 @@ static int mcp25xxfd_cmd_readn_crc(struct spi_device *spi, u32 reg,
 		if (n > 254)
 			priv->stats.spi_crc_read_split++;
 #endif
-		ret = _mcp25xxfd_cmd_readn_crc(spi, reg, data, n);
+		ret = _mcp25xxfd_cmd_readn_crc(spi, reg, data, n, caller);
 		if (ret)
 			return ret;
 	}
@@ -291,8 +371,9 @@ int mcp25xxfd_cmd_read_mask(struct spi_device *spi, u32 reg,
 	mcp25xxfd_cmd_convert_from_cpu(data, 1);
 
 	/* do a partial read */
-	ret = mcp25xxfd_cmd_readn(spi, reg + first_byte,
-				  ((void *)data + first_byte), len_byte);
+	ret = mcp25xxfd_cmd_do_readn(spi, reg + first_byte,
+				     ((void *)data + first_byte), len_byte,
+				     MCP25XXFD_CMD_OP_READ_MASK, _RET_IP_);
 	if (ret)
 		return ret;
 
@@ -301,27 +382,36 @@ int mcp25xxfd_cmd_read_mask(struct spi_device *spi, u32 reg,
 	return 0;
 }
 
-int mcp25xxfd_cmd_writen(struct spi_device *spi, u32 reg,
-			 void *data, int n)
+static int mcp25xxfd_cmd_do_writen(struct spi_device *spi, u32 reg,
+				   void *data, int n, unsigned long caller)
 {
+	u64 start = mcp25xxfd_cmd_trace_start();
 	u8 cmd[2];
 	int ret;
 
 	mcp25xxfd_cmd_calc(MCP25XXFD_INSTRUCTION_WRITE, reg, cmd);
 
 	ret = mcp25xxfd_cmd_write_then_write(spi, &cmd, 2, data, n);
-	if (ret)
-		return ret;
+	mcp25xxfd_cmd_trace(spi, MCP25XXFD_CMD_OP_WRITEN, reg, n, start, ret,
+			    caller);
 
-	return 0;
+	return ret;
+}
+
+int mcp25xxfd_cmd_writen(struct spi_device *spi, u32 reg,
+			 void *data, int n)
+{
+	return mcp25xxfd_cmd_do_writen(spi, reg, data, n, _RET_IP_);
 }
 
 /* read a register, but we are only interrested in a few bytes */
 int mcp25xxfd_cmd_write_mask(struct spi_device *spi, u32 reg,
 			     u32 data, u32 mask)
 {
+	u64 start = mcp25xxfd_cmd_trace_start();
 	int first_byte, last_byte, len_byte;
 	u8 cmd[2];
+	int ret;
 
 	/* check that at least one bit is set */
 	if (!mask)
@@ -338,10 +428,14 @@ int mcp25xxfd_cmd_write_mask(struct spi_device *spi, u32 reg,
 
 	mcp25xxfd_cmd_convert_from_cpu(&data, 1);
 
-	return mcp25xxfd_cmd_write_then_write(spi,
-					      cmd, sizeof(cmd),
-					      ((void *)&data + first_byte),
-					      len_byte);
+	ret = mcp25xxfd_cmd_write_then_write(spi,
+					     cmd, sizeof(cmd),
+					     ((void *)&data + first_byte),
+					     len_byte);
+	mcp25xxfd_cmd_trace(spi, MCP25XXFD_CMD_OP_WRITE_MASK,
+			    reg + first_byte, len_byte, start, ret, _RET_IP_);
+
+	return ret;
 }
 
 int mcp25xxfd_cmd_write_regs(struct spi_device *spi, u32 reg,
@@ -353,7 +447,7 @@ int mcp25xxfd_cmd_write_regs(struct spi_device *spi, u32 reg,
 	mcp25xxfd_cmd_convert_from_cpu(data, bytes / sizeof(bytes));
 
 	/* now write it */
-	ret = mcp25xxfd_cmd_writen(spi, reg, data, bytes);
+	ret = mcp25xxfd_cmd_do_writen(spi, reg, data, bytes, _RET_IP_);
 
 	/* and convert it back to cpu format even if it fails */
 	mcp25xxfd_cmd_convert_to_cpu(data, bytes / sizeof(bytes));
@@ -370,9 +464,10 @@ int mcp25xxfd_cmd_read_regs(struct spi_device *spi, u32 reg,
 	if ((use_spi_crc) || (reg & MCP25XXFD_ADDRESS_WITH_CRC))
 		ret = mcp25xxfd_cmd_readn_crc(spi,
 					      reg & MCP25XXFD_ADDRESS_MASK,
-					      data, bytes);
+					      data, bytes, _RET_IP_);
 	else
-		ret = mcp25xxfd_cmd_readn(spi, reg, data, bytes);
+		ret = mcp25xxfd_cmd_do_readn(spi, reg, data, bytes,
+					     MCP25XXFD_CMD_OP_READN, _RET_IP_);
 
 	/* and convert it to cpu format */
 	mcp25xxfd_cmd_convert_to_cpu((u32 *)data, bytes / sizeof(bytes));
@@ -23,6 +23,16 @@
 /* a bit to use CRC commands if possible */
 #define MCP25XXFD_ADDRESS_WITH_CRC		BIT(31)
 
+/* the spi operations as reported by the tracepoints */
+#define MCP25XXFD_CMD_OP_READN			0
+#define MCP25XXFD_CMD_OP_READN_CRC		1
+#define MCP25XXFD_CMD_OP_READ_MASK		2
+#define MCP25XXFD_CMD_OP_WRITEN			3
+#define MCP25XXFD_CMD_OP_WRITE_MASK		4
+#define MCP25XXFD_CMD_OP_TX_PRIO		5
+#define MCP25XXFD_CMD_OP_TX_FILL		6
+#define MCP25XXFD_CMD_OP_TX_TRIGGER		7
+
 static inline void mcp25xxfd_cmd_convert_to_cpu(u32 *data, int n)
 {
 	le32_to_cpu_array(data, n);
@@ -57,6 +67,15 @@ static inline int mcp25xxfd_cmd_last_byte(u32 mask)
 
 int mcp25xxfd_cmd_readn(struct spi_device *spi, u32 reg,
 			void *data, int n);
+
+/* whether register reads use MCP25XXFD_INSTRUCTION_READ_CRC */
+bool mcp25xxfd_cmd_use_crc(void);
+/* check a READ_CRC transfer prepared outside of mcp25xxfd_cmd:
+ * the 3 bytes command, the n bytes read and the 2 bytes crc received
+ * returns -EILSEQ on a mismatch
+ */
+int mcp25xxfd_cmd_check_crc(struct spi_device *spi, u8 *cmd,
+			    u8 *data, int n, u8 *crcd);
 int mcp25xxfd_cmd_read_mask(struct spi_device *spi, u32 reg,
 			    u32 *data, u32 mask);
 static inline int mcp25xxfd_cmd_read(struct spi_device *spi, u32 reg,
@@ -83,4 +102,7 @@ int mcp25xxfd_cmd_write_regs(struct spi_device *spi, u32 reg,
 
 int mcp25xxfd_cmd_reset(struct spi_device *spi);
 
+u64 mcp25xxfd_cmd_trace_async_start(void);
+void mcp25xxfd_cmd_trace_async(struct spi_message *msg, int op, u64 start);
+
 #endif /* __MCP25XXFD_CMD_H */
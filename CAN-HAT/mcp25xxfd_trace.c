@@ -0,0 +1,10 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* CAN bus driver for Microchip 25XXFD CAN Controller with SPI Interface
+ *
+ * Copyright 2019 Martin Sperl <kernel@martin.sperl.org>
+ */
+
+/* instantiate the tracepoints of the driver */
+#define CREATE_TRACE_POINTS
+#include "mcp25xxfd_trace.h"
@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/* CAN bus driver for Microchip 25XXFD CAN Controller with SPI Interface
+ *
+ * Copyright 2019 Martin Sperl <kernel@martin.sperl.org>
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mcp25xxfd
+
+#if !defined(__MCP25XXFD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define __MCP25XXFD_TRACE_H
+
+#include <linux/can.h>
+#include <linux/netdevice.h>
+#include <linux/spi/spi.h>
+#include <linux/tracepoint.h>
+
+#include "mcp25xxfd_cmd.h"
+
+#define MCP25XXFD_TRACE_CMD_OPS					\
+	{ MCP25XXFD_CMD_OP_READN,	"readn" },		\
+	{ MCP25XXFD_CMD_OP_READN_CRC,	"readn_crc" },		\
+	{ MCP25XXFD_CMD_OP_READ_MASK,	"read_mask" },		\
+	{ MCP25XXFD_CMD_OP_WRITEN,	"writen" },		\
+	{ MCP25XXFD_CMD_OP_WRITE_MASK,	"write_mask" },		\
+	{ MCP25XXFD_CMD_OP_TX_PRIO,	"tx_prio" },		\
+	{ MCP25XXFD_CMD_OP_TX_FILL,	"tx_fill" },		\
+	{ MCP25XXFD_CMD_OP_TX_TRIGGER,	"tx_trigger" }
+
+/* a synchronous spi command - the duration is in ns and includes
+ * waiting for the spi bus, caller is the call site in the driver
+ */
+TRACE_EVENT(mcp25xxfd_cmd,
+	TP_PROTO(struct spi_device *spi, int op, u32 reg, u32 len,
+		 u64 duration, int ret, unsigned long caller),
+
+	TP_ARGS(spi, op, reg, len, duration, ret, caller),
+
+	TP_STRUCT__entry(
+		__string(name, dev_name(&spi->dev))
+		__field(int, op)
+		__field(u32, reg)
+		__field(u32, len)
+		__field(u64, duration)
+		__field(int, ret)
+		__field(unsigned long, caller)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, dev_name(&spi->dev));
+		__entry->op = op;
+		__entry->reg = reg;
+		__entry->len = len;
+		__entry->duration = duration;
+		__entry->ret = ret;
+		__entry->caller = caller;
+	),
+
+	TP_printk("%s %s reg=%03x len=%u duration=%llu ret=%d caller=%pS",
+		  __get_str(name),
+		  __print_symbolic(__entry->op, MCP25XXFD_TRACE_CMD_OPS),
+		  __entry->reg, __entry->len, __entry->duration,
+		  __entry->ret, (void *)__entry->caller)
+);
+
+/* a prepared spi message submitted with spi_async - the duration is
+ * in ns from its submission to its completion, so it includes the wait
+ * for the messages queued before it (e.g. the fill for the trigger)
+ */
+TRACE_EVENT(mcp25xxfd_cmd_async,
+	TP_PROTO(struct spi_device *spi, int op, u32 reg, u32 len,
+		 u64 duration, int status),
+
+	TP_ARGS(spi, op, reg, len, duration, status),
+
+	TP_STRUCT__entry(
+		__string(name, dev_name(&spi->dev))
+		__field(int, op)
+		__field(u32, reg)
+		__field(u32, len)
+		__field(u64, duration)
+		__field(int, status)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, dev_name(&spi->dev));
+		__entry->op = op;
+		__entry->reg = reg;
+		__entry->len = len;
+		__entry->duration = duration;
+		__entry->status = status;
+	),
+
+	TP_printk("%s %s reg=%03x len=%u duration=%llu status=%d",
+		  __get_str(name),
+		  __print_symbolic(__entry->op, MCP25XXFD_TRACE_CMD_OPS),
+		  __entry->reg, __entry->len, __entry->duration,
+		  __entry->status)
+);
+
+/* the life of a transmitted frame - all times are system time in ns
+ * (sof is the TEF timestamp of the start of frame on the bus)
+ */
+TRACE_EVENT(mcp25xxfd_can_tx_latency,
+	TP_PROTO(struct net_device *net, int fifo, canid_t can_id,
+		 u64 xmit, u64 filled, u64 triggered, u64 sof, u64 echo),
+
+	TP_ARGS(net, fifo, can_id, xmit, filled, triggered, sof, echo),
+
+	TP_STRUCT__entry(
+		__string(name, netdev_name(net))
+		__field(int, fifo)
+		__field(canid_t, can_id)
+		__field(u64, xmit)
+		__field(u64, filled)
+		__field(u64, triggered)
+		__field(u64, sof)
+		__field(u64, echo)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, netdev_name(net));
+		__entry->fifo = fifo;
+		__entry->can_id = can_id;
+		__entry->xmit = xmit;
+		__entry->filled = filled;
+		__entry->triggered = triggered;
+		__entry->sof = sof;
+		__entry->echo = echo;
+	),
+
+	TP_printk("%s fifo=%d can_id=%08x xmit=%llu fill=%lld trigger=%lld bus=%lld echo=%lld",
+		  __get_str(name), __entry->fifo, __entry->can_id,
+		  __entry->xmit,
+		  (s64)(__entry->filled - __entry->xmit),
+		  (s64)(__entry->triggered - __entry->filled),
+		  (s64)(__entry->sof - __entry->triggered),
+		  (s64)(__entry->echo - __entry->sof))
+);
+
+#endif /* __MCP25XXFD_TRACE_H */
+
+/* this is an out of tree header - so tell define_trace.h where it is */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mcp25xxfd_trace
+#include <trace/define_trace.h>
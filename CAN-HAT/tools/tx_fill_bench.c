@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* userspace microbenchmark of building a tx object for the
+ * Microchip 25XXFD CAN Controller - comparing the original
+ * shadow/convert/copy/convert-back way with the direct build
+ * in the spi transfer buffer used by mcp25xxfd_can_tx_fill_fifo_common
+ *
+ * the fills are not inlined, so the dlc is only known at run time as in
+ * the driver, and -fno-builtin-memcpy makes the copies call memcpy as
+ * the kernel does: gcc on x86 otherwise inlines a copy of a run time
+ * length as "rep movsq", whose startup cost of ~50ns swamps everything
+ * measured here for 8 bytes and more.
+ *
+ * build and run with:
+ *   gcc -O2 -Wall -fno-builtin-memcpy -o tx_fill_bench tx_fill_bench.c
+ *   ./tx_fill_bench
+ */
+
+#include <endian.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+
+#define OBJ_FLAGS_DLC_SHIFT	0
+#define OBJ_FLAGS_IDE		(1 << 4)
+#define OBJ_FLAGS_RTR		(1 << 5)
+#define OBJ_FLAGS_BRS		(1 << 6)
+#define OBJ_FLAGS_FDF		(1 << 7)
+#define OBJ_FLAGS_SEQ_SHIFT	9
+
+#define LOOPS			10000000
+/* the fastest of so many runs is reported */
+#define ROUNDS			5
+
+static const u8 dlc2len[] = {0, 1, 2, 3, 4, 5, 6, 7, 8,
+			     12, 16, 20, 24, 32, 48, 64};
+
+struct obj_tx {
+	u32 id;
+	u32 flags;
+	u8 data[];
+};
+
+/* the shadow of the fifo in sram */
+static u32 sram[(sizeof(struct obj_tx) + 64) / sizeof(u32)];
+
+/* the spi transfer buffer - unaligned as in mcp25xxfd_tx_spi_message */
+static struct {
+	u8 cmd[2];
+	u8 header[sizeof(struct obj_tx)];
+	u8 data[64];
+} buf;
+
+static u32 xfer_len;
+
+static void convert_array(u32 *data, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		data[i] = htole32(data[i]);
+}
+
+static void put_unaligned_le32(u32 val, u8 *p)
+{
+	val = htole32(val);
+	__builtin_memcpy(p, &val, sizeof(val));
+}
+
+#define noinline __attribute__((noinline))
+
+static noinline void fill_original(int fifo, u32 id, u32 flags, int dlc,
+				   const u8 *data)
+{
+	struct obj_tx *tx = (struct obj_tx *)sram;
+	int len = dlc2len[dlc];
+
+	tx->id = id;
+	tx->flags = flags | (dlc << OBJ_FLAGS_DLC_SHIFT);
+	tx->flags |= fifo << OBJ_FLAGS_SEQ_SHIFT;
+	memcpy(tx->data, data, len);
+	convert_array(&tx->id, sizeof(*tx) / sizeof(u32));
+	memcpy(buf.header, &tx->id, sizeof(*tx) + len);
+	for (; len & 3; len++)
+		*(buf.header + sizeof(*tx) + len) = 0;
+	convert_array(&tx->id, sizeof(*tx) / sizeof(u32));
+	xfer_len = sizeof(buf.cmd) + sizeof(buf.header) + len;
+}
+
+static noinline void fill_direct(u32 template, u32 id, u32 flags, int dlc,
+				 const u8 *data)
+{
+	struct obj_tx *tx = (struct obj_tx *)sram;
+	int len = dlc2len[dlc];
+	int padded = (len + 3) & ~3;
+
+	flags |= template | (dlc << OBJ_FLAGS_DLC_SHIFT);
+	put_unaligned_le32(id, buf.header);
+	put_unaligned_le32(flags, buf.header + sizeof(u32));
+	if (len != padded)
+		put_unaligned_le32(0, buf.data + padded - sizeof(u32));
+	memcpy(buf.data, data, len);
+	tx->flags = flags;
+	xfer_len = sizeof(buf.cmd) + sizeof(buf.header) + padded;
+}
+
+/* the buffers are read after every fill, so no store to them is dead */
+#define consume()							\
+	__asm__ __volatile__("" : : "r"(&buf), "r"(sram) : "memory")
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(const char *name, int dlc, u32 flags)
+{
+	volatile u32 sink = 0;
+	u8 data[64];
+	double start, ns, orig = 1e9, direct = 1e9;
+	size_t i;
+	int round;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i;
+
+	for (round = 0; round < ROUNDS; round++) {
+		start = now_ns();
+		for (i = 0; i < LOOPS; i++) {
+			fill_original(i & 7, i & 0x7ff, flags, dlc, data);
+			consume();
+			sink = xfer_len;
+		}
+		ns = (now_ns() - start) / LOOPS;
+		if (ns < orig)
+			orig = ns;
+
+		start = now_ns();
+		for (i = 0; i < LOOPS; i++) {
+			fill_direct((i & 7) << OBJ_FLAGS_SEQ_SHIFT |
+				    (flags & OBJ_FLAGS_FDF), i & 0x7ff,
+				    flags & ~OBJ_FLAGS_FDF, dlc, data);
+			consume();
+			sink = xfer_len;
+		}
+		ns = (now_ns() - start) / LOOPS;
+		if (ns < direct)
+			direct = ns;
+	}
+
+	printf("%-20s original: %6.2f ns/frame  direct: %6.2f ns/frame\n",
+	       name, orig, direct);
+	(void)sink;
+}
+
+int main(void)
+{
+	bench("classic, 8 bytes", 8, 0);
+	bench("classic, 3 bytes", 3, 0);
+	bench("fd, 64 bytes", 15, OBJ_FLAGS_FDF | OBJ_FLAGS_BRS);
+	bench("fd, 12 bytes", 9, OBJ_FLAGS_FDF | OBJ_FLAGS_BRS);
+
+	return 0;
+}
@@ -0,0 +1,451 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* userspace stress test of the tx fifo stage handling of the
+ * Microchip 25XXFD CAN Controller driver
+ *
+ * several start_xmit threads (serialized by the tx queue lock, as the
+ * network stack does) fill fifos, one thread runs the spi completion
+ * callbacks in submission order and one the interrupt thread recycling
+ * the fifos on TEF. the stage moves are done in one of three ways:
+ *  * locked:    under one spinlock, as with the former q->lock
+ *  * atomic:    with a cmpxchg on the packed stage word, refusing moves
+ *               from an unexpected stage (mcp25xxfd_can_tx.c)
+ *  * unchecked: with a cmpxchg that moves from any stage
+ * and the hold and wait times of the locks are reported.
+ *
+ * with -e N every Nth frame gets its TEF handled before the completion
+ * of its trigger transfer was seen: a move that does not check the stage
+ * (locked or unchecked) then puts the idle fifo back into
+ * in_can_transfer and it is lost for good.
+ *
+ * build and run with:
+ *   gcc -O2 -Wall -pthread -o tx_stage_stress tx_stage_stress.c
+ *   ./tx_stage_stress -m locked && ./tx_stage_stress -m atomic
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define FIFOS			8
+#define SENDERS_MAX		16
+#define RING_SIZE		64
+
+#define STAGE_IDLE		0
+#define STAGE_IN_FILL		1
+#define STAGE_IN_TRIGGER	2
+#define STAGE_IN_CAN		3
+#define BIT(nr)			(1U << (nr))
+
+/* histograms of 16ns bins, the last one collects everything above */
+#define HIST_SHIFT		4
+#define HIST_BINS		4096
+
+enum { MODE_LOCKED, MODE_ATOMIC, MODE_UNCHECKED };
+
+struct hist {
+	u64 bins[HIST_BINS];
+	u64 count;
+	u64 max;
+};
+
+/* the lock times of one thread, merged at the end */
+struct thread_stats {
+	struct hist tx_hold;
+	struct hist q_hold;
+	struct hist q_wait;
+	u64 frames;
+	u64 busy;
+	u64 retries;
+	u64 errors;
+};
+
+/* single producer, single consumer: fifo numbers in submission order */
+struct ring {
+	int buf[RING_SIZE];
+	unsigned int head;
+	unsigned int tail;
+};
+
+static int mode = MODE_ATOMIC;
+static int early_every;
+static volatile int stop;
+
+static u64 stages;
+static int tx_lock;
+static int q_lock;
+static struct ring spi_ring, irq_ring;
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void hist_add(struct hist *h, u64 ns)
+{
+	u64 bin = ns >> HIST_SHIFT;
+
+	h->bins[bin < HIST_BINS ? bin : HIST_BINS - 1]++;
+	h->count++;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+static void hist_merge(struct hist *to, const struct hist *from)
+{
+	int i;
+
+	for (i = 0; i < HIST_BINS; i++)
+		to->bins[i] += from->bins[i];
+	to->count += from->count;
+	if (from->max > to->max)
+		to->max = from->max;
+}
+
+static u64 hist_percentile(const struct hist *h, double p)
+{
+	u64 want = h->count * p / 100, seen = 0;
+	int i;
+
+	for (i = 0; i < HIST_BINS; i++) {
+		seen += h->bins[i];
+		if (seen > want)
+			return (u64)(i + 1) << HIST_SHIFT;
+	}
+
+	return h->max;
+}
+
+/* userspace can not disable preemption, so yield instead of spinning
+ * for a whole time slice on a preempted holder
+ */
+static void lock(int *l)
+{
+	int spins = 0;
+
+	while (__atomic_exchange_n(l, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(l, __ATOMIC_RELAXED)) {
+			if (++spins == 100) {
+				sched_yield();
+				spins = 0;
+			}
+		}
+	}
+}
+
+static void unlock(int *l)
+{
+	__atomic_store_n(l, 0, __ATOMIC_RELEASE);
+}
+
+static int ring_push(struct ring *r, int fifo)
+{
+	unsigned int head = r->head;
+
+	if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == RING_SIZE)
+		return 0;
+	r->buf[head % RING_SIZE] = fifo;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+static int ring_pop(struct ring *r)
+{
+	unsigned int tail = r->tail;
+	int fifo;
+
+	if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)
+		return -1;
+	fifo = r->buf[tail % RING_SIZE];
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return fifo;
+}
+
+static int stage_of(u64 s, int fifo)
+{
+	return ((s >> fifo) & 1) | (((s >> (fifo + 32)) & 1) << 1);
+}
+
+static u64 stage_set(u64 s, int fifo, int stage)
+{
+	u64 mask = (1ULL << fifo) | (1ULL << (fifo + 32));
+
+	return (s & ~mask) | ((stage & 1) ? 1ULL << fifo : 0) |
+		((stage & 2) ? 1ULL << (fifo + 32) : 0);
+}
+
+/* mcp25xxfd_can_tx_queue_move_spi_message - from is ignored unless
+ * the mode is MODE_ATOMIC
+ */
+static int move(struct thread_stats *st, int fifo, u32 from, int stage)
+{
+	u64 old, cur, start, locked;
+
+	if (mode == MODE_LOCKED) {
+		start = now_ns();
+		lock(&q_lock);
+		locked = now_ns();
+		stages = stage_set(stages, fifo, stage);
+		unlock(&q_lock);
+		hist_add(&st->q_wait, locked - start);
+		hist_add(&st->q_hold, now_ns() - locked);
+		return 1;
+	}
+
+	cur = __atomic_load_n(&stages, __ATOMIC_RELAXED);
+	do {
+		old = cur;
+		if (mode == MODE_ATOMIC &&
+		    !(from & BIT(stage_of(old, fifo)))) {
+			st->errors++;
+			return 0;
+		}
+		if (!__atomic_compare_exchange_n(&stages, &cur,
+						 stage_set(old, fifo, stage),
+						 0, __ATOMIC_SEQ_CST,
+						 __ATOMIC_RELAXED))
+			st->retries++;
+	} while (cur != old);
+
+	return 1;
+}
+
+/* the first idle fifo, or -1 */
+static int first_idle(void)
+{
+	u64 s = __atomic_load_n(&stages, __ATOMIC_ACQUIRE);
+	int f;
+
+	for (f = 0; f < FIFOS; f++)
+		if (stage_of(s, f) == STAGE_IDLE)
+			return f;
+
+	return -1;
+}
+
+static void *sender(void *arg)
+{
+	struct thread_stats *st = arg;
+	u64 start, locked;
+	int fifo;
+
+	while (!stop) {
+		lock(&tx_lock);
+		locked = now_ns();
+
+		/* mcp25xxfd_can_tx_queue_get_next_fifo */
+		if (mode == MODE_LOCKED) {
+			lock(&q_lock);
+			start = now_ns();
+			hist_add(&st->q_wait, start - locked);
+			fifo = first_idle();
+			if (fifo >= 0)
+				stages = stage_set(stages, fifo,
+						   STAGE_IN_FILL);
+			unlock(&q_lock);
+			hist_add(&st->q_hold, now_ns() - start);
+		} else {
+			fifo = first_idle();
+			if (fifo >= 0 && !move(st, fifo, BIT(STAGE_IDLE),
+					       STAGE_IN_FILL))
+				fifo = -1;
+		}
+		if (fifo >= 0) {
+			while (!ring_push(&spi_ring, fifo))
+				sched_yield();
+			st->frames++;
+		} else {
+			st->busy++;
+		}
+
+		unlock(&tx_lock);
+		hist_add(&st->tx_hold, now_ns() - locked);
+		if (fifo < 0)
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+/* until the interrupt thread has recycled the fifo */
+static void wait_recycled(int fifo)
+{
+	while (stage_of(__atomic_load_n(&stages, __ATOMIC_ACQUIRE), fifo) ==
+	       STAGE_IN_TRIGGER)
+		sched_yield();
+}
+
+/* the spi completion callbacks, in submission order */
+static void *spi(void *arg)
+{
+	struct thread_stats *st = arg;
+	u64 n = 0;
+	int fifo, early;
+
+	while (!stop || __atomic_load_n(&spi_ring.head, __ATOMIC_ACQUIRE) !=
+	       spi_ring.tail) {
+		fifo = ring_pop(&spi_ring);
+		if (fifo < 0) {
+			sched_yield();
+			continue;
+		}
+		early = early_every && !(++n % early_every);
+
+		move(st, fifo, BIT(STAGE_IN_FILL), STAGE_IN_TRIGGER);
+		if (!early) {
+			move(st, fifo, BIT(STAGE_IN_TRIGGER), STAGE_IN_CAN);
+			while (!ring_push(&irq_ring, fifo))
+				sched_yield();
+			continue;
+		}
+
+		/* the TEF overtakes the trigger completion, while no
+		 * start_xmit reuses the fifo (the spi ring never fills up,
+		 * so holding the tx lock here can not dead lock)
+		 */
+		lock(&tx_lock);
+		while (!ring_push(&irq_ring, fifo))
+			sched_yield();
+		wait_recycled(fifo);
+		move(st, fifo, BIT(STAGE_IN_TRIGGER), STAGE_IN_CAN);
+		unlock(&tx_lock);
+	}
+
+	return NULL;
+}
+
+static volatile int spi_done;
+
+/* the interrupt thread handling the TEF */
+static void *irq(void *arg)
+{
+	struct thread_stats *st = arg;
+	int fifo;
+
+	while (!spi_done || __atomic_load_n(&irq_ring.head, __ATOMIC_ACQUIRE)
+	       != irq_ring.tail) {
+		fifo = ring_pop(&irq_ring);
+		if (fifo < 0) {
+			sched_yield();
+			continue;
+		}
+		move(st, fifo, BIT(STAGE_IN_TRIGGER) | BIT(STAGE_IN_CAN),
+		     STAGE_IDLE);
+	}
+
+	return NULL;
+}
+
+static void print_hist(const char *name, const struct hist *h)
+{
+	if (!h->count)
+		return;
+	printf("  %-14s %10llu  p50 %6llu  p99 %6llu  p99.9 %6llu",
+	       name, (unsigned long long)h->count,
+	       (unsigned long long)hist_percentile(h, 50),
+	       (unsigned long long)hist_percentile(h, 99),
+	       (unsigned long long)hist_percentile(h, 99.9));
+	printf("  max %8llu ns\n", (unsigned long long)h->max);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-m locked|atomic|unchecked] [-s senders] "
+		"[-t secs] [-e N]\n", prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	static struct thread_stats stats[SENDERS_MAX + 2], total;
+	static const char * const modes[] = {"locked", "atomic", "unchecked"};
+	pthread_t threads[SENDERS_MAX + 2];
+	int senders = 4, secs = 5, stuck = 0;
+	double elapsed;
+	u64 start;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "m:s:t:e:")) != -1) {
+		switch (opt) {
+		case 'm':
+			for (mode = 0; mode < 3; mode++)
+				if (!strcmp(optarg, modes[mode]))
+					break;
+			if (mode == 3)
+				usage(argv[0]);
+			break;
+		case 's':
+			senders = atoi(optarg);
+			if (senders < 1 || senders > SENDERS_MAX)
+				usage(argv[0]);
+			break;
+		case 't':
+			secs = atoi(optarg);
+			if (secs < 1)
+				usage(argv[0]);
+			break;
+		case 'e':
+			early_every = atoi(optarg);
+			if (early_every < 0)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	start = now_ns();
+	for (i = 0; i < senders; i++)
+		pthread_create(&threads[i], NULL, sender, &stats[i]);
+	pthread_create(&threads[senders], NULL, spi, &stats[senders]);
+	pthread_create(&threads[senders + 1], NULL, irq,
+		       &stats[senders + 1]);
+
+	sleep(secs);
+	stop = 1;
+	for (i = 0; i <= senders; i++)
+		pthread_join(threads[i], NULL);
+	spi_done = 1;
+	pthread_join(threads[senders + 1], NULL);
+	elapsed = (now_ns() - start) / 1e9;
+
+	for (i = 0; i < senders + 2; i++) {
+		hist_merge(&total.tx_hold, &stats[i].tx_hold);
+		hist_merge(&total.q_hold, &stats[i].q_hold);
+		hist_merge(&total.q_wait, &stats[i].q_wait);
+		total.frames += stats[i].frames;
+		total.busy += stats[i].busy;
+		total.retries += stats[i].retries;
+		total.errors += stats[i].errors;
+	}
+	/* everything got drained, so every fifo should be idle again */
+	for (i = 0; i < FIFOS; i++)
+		if (stage_of(stages, i) != STAGE_IDLE)
+			stuck++;
+
+	printf("%s: %d senders, %ld cpus, %.0f frames/s, %llu busy\n",
+	       modes[mode], senders, sysconf(_SC_NPROCESSORS_ONLN),
+	       total.frames / elapsed, (unsigned long long)total.busy);
+	print_hist("tx lock hold", &total.tx_hold);
+	print_hist("q->lock hold", &total.q_hold);
+	print_hist("q->lock wait", &total.q_wait);
+	printf("  cmpxchg retries %llu, stage errors %llu, stuck fifos %d\n",
+	       (unsigned long long)total.retries,
+	       (unsigned long long)total.errors, stuck);
+
+	return stuck ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+# decoder of the batched stream of native/can_gateway - see
+# CAN_APP/native/can_proto.h for the format
+import struct
+
+MAGIC = b'CB'
+VERSION = 1
+HEADER_FMT = '<2sBBHHIQ'
+HEADER_LEN = struct.calcsize(HEADER_FMT)
+RECORD_MAX = 2 + 10 + 4 + 64
+
+FLAG_FD = 0x01
+FLAG_BRS = 0x02
+FLAG_ESI = 0x04
+FLAG_EFF = 0x08
+FLAG_RTR = 0x10
+FLAG_ERR = 0x20
+
+SUB_MAGIC = b'CS'
+SUB_HEADER_FMT = '<2sBBHH'
+SUB_MAX = 512
+
+CAN_EFF_FLAG = 0x80000000
+CAN_RTR_FLAG = 0x40000000
+CAN_INV_FILTER = 0x20000000
+CAN_SFF_MASK = 0x7FF
+CAN_EFF_MASK = 0x1FFFFFFF
+
+
+def subscription(filters):
+    """the message that limits the stream to filters, a list of
+    (can_id, can_mask) with the semantics of socketcan - extended ids
+    need CAN_EFF_FLAG in both. [] stops the stream, [(0, 0)] gets
+    everything again"""
+    if len(filters) > SUB_MAX:
+        raise ValueError('at most %d filters' % SUB_MAX)
+    msg = struct.pack(SUB_HEADER_FMT, SUB_MAGIC, VERSION, 0, len(filters), 0)
+    for can_id, can_mask in filters:
+        msg = msg + struct.pack('<II', can_id, can_mask)
+    return msg
+
+
+class frame(object):
+    __slots__ = ('timestamp', 'arbitration_id', 'flags', 'data')
+
+    def __init__(self, timestamp, arbitration_id, flags, data):
+        # timestamp in s, flags are the FLAG_* above
+        self.timestamp = timestamp
+        self.arbitration_id = arbitration_id
+        self.flags = flags
+        self.data = data
+
+    def __repr__(self):
+        return '%.6f %*X [%2d]%s %s' % (
+            self.timestamp, 8 if self.flags & FLAG_EFF else 3,
+            self.arbitration_id, len(self.data),
+            ' fd' if self.flags & FLAG_FD else '   ',
+            self.data.hex())
+
+
+class decoder(object):
+    def __init__(self):
+        self.buf = b''
+        self.skipped = 0
+        self.bad = 0
+
+    def feed(self, data):
+        """returns the list of frames completed by data"""
+        frames = []
+        buf = self.buf + data
+        pos = 0
+        while len(buf) - pos >= HEADER_LEN:
+            magic, version, flags, header_len, count, length, base_ts = \
+                struct.unpack_from(HEADER_FMT, buf, pos)
+            if magic != MAGIC or header_len < HEADER_LEN or \
+               length > count * RECORD_MAX:
+                # out of sync - look for the next batch
+                pos = pos + 1
+                self.skipped = self.skipped + 1
+                continue
+            if len(buf) - pos < header_len + length:
+                break
+            start = pos + header_len
+            pos = start + length
+            if version != VERSION:
+                self.bad = self.bad + 1
+                continue
+            try:
+                self.decode_batch(buf[start:pos], count, base_ts, frames)
+            except (IndexError, struct.error):
+                self.bad = self.bad + 1
+        self.buf = buf[pos:]
+        return frames
+
+    def decode_batch(self, data, count, base_ts, frames):
+        pos = 0
+        us = 0
+        for i in range(count):
+            flags = data[pos]
+            length = data[pos + 1]
+            pos = pos + 2
+            delta = 0
+            shift = 0
+            while True:
+                byte = data[pos]
+                pos = pos + 1
+                delta = delta | (byte & 0x7F) << shift
+                shift = shift + 7
+                if not byte & 0x80:
+                    break
+            us = us + ((delta >> 1) ^ -(delta & 1))
+            if flags & FLAG_EFF:
+                can_id = struct.unpack_from('<I', data, pos)[0]
+                pos = pos + 4
+            else:
+                can_id = struct.unpack_from('<H', data, pos)[0]
+                pos = pos + 2
+            if pos + length > len(data):
+                raise IndexError('truncated frame')
+            frames.append(frame((base_ts + us * 1000) / 1e9, can_id, flags,
+                                data[pos:pos + length]))
+            pos = pos + length
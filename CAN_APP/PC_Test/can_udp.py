@@ -0,0 +1,141 @@
+# receiver of the udp stream of native/can_gateway -u - see
+# CAN_APP/native/can_proto.h for the format
+# every datagram carries a sequence number, so a receiver that falls behind
+# loses datagrams instead of stalling the pi. with BACKFILL the missing
+# ones are fetched over tcp from the history of the gateway.
+#   gateway: ./native/can_gateway -i can1 -u 239.1.1.1:5000
+#   pc:      python3 can_udp.py
+import socket
+import struct
+from can_proto import decoder, subscription, VERSION
+
+GROUP = "239.1.1.1"     # multicast group, '' for unicast
+PORT = 5000
+# the tcp port of the gateway for lossless receiving, None to skip it
+BACKFILL = ("192.168.10.116", 8000)
+
+DGRAM_MAGIC = b'CD'
+DGRAM_HEADER_FMT = '<2sBBHHQ'
+DGRAM_HEADER_LEN = struct.calcsize(DGRAM_HEADER_FMT)
+DGRAM_GONE = 0x01
+DGRAM_END = 0x02
+REQ_MAGIC = b'CR'
+REQ_FMT = '<2sBBIQ'
+
+
+class backfill(object):
+    """a tcp connection to the gateway that gets nothing but answers"""
+
+    def __init__(self, address, timeout=1.0):
+        self.sock = socket.create_connection(address, timeout)
+        self.sock.sendall(subscription([]))
+        self.buf = b''
+
+    def header(self):
+        while len(self.buf) < DGRAM_HEADER_LEN:
+            self.fill()
+        return struct.unpack_from(DGRAM_HEADER_FMT, self.buf, 0)
+
+    def fill(self):
+        data = self.sock.recv(65536)
+        if not data:
+            raise EOFError('gateway closed the backfill connection')
+        self.buf = self.buf + data
+
+    def fetch(self, seq, count):
+        """returns a dict seq -> batch (None if the gateway lost it)
+        of up to count datagrams from seq on"""
+        got = {}
+        while count:
+            self.sock.sendall(struct.pack(REQ_FMT, REQ_MAGIC, VERSION, 0,
+                                          count, seq))
+            while True:
+                magic, version, flags, length, reserved, dseq = self.header()
+                if magic != DGRAM_MAGIC:
+                    raise ValueError('backfill out of sync')
+                while len(self.buf) < DGRAM_HEADER_LEN + length:
+                    self.fill()
+                batch = self.buf[DGRAM_HEADER_LEN:DGRAM_HEADER_LEN + length]
+                self.buf = self.buf[DGRAM_HEADER_LEN + length:]
+                if flags & DGRAM_END:
+                    break
+                got[dseq] = None if flags & DGRAM_GONE else batch
+            # the answer ends early when the tcp buffer was full
+            if dseq == seq:
+                break
+            count = count - (dseq - seq)
+            seq = dseq
+        return got
+
+
+class receiver(object):
+    def __init__(self, group=GROUP, port=PORT, backfill_address=None):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 << 20)
+        self.sock.bind((group, port))
+        if group:
+            mreq = socket.inet_aton(group) + socket.inet_aton('0.0.0.0')
+            self.sock.setsockopt(socket.IPPROTO_IP,
+                                 socket.IP_ADD_MEMBERSHIP, mreq)
+        self.backfill = backfill(backfill_address) \
+            if backfill_address else None
+        self.expected = None
+        self.datagrams = 0
+        self.lost = 0
+        self.backfilled = 0
+
+    def frames(self, batch):
+        # a datagram holds a whole batch, a fresh decoder takes it
+        return decoder().feed(batch)
+
+    def recv(self, timeout=None):
+        """returns the frames of the next datagram(s), in order"""
+        self.sock.settimeout(timeout)
+        try:
+            data = self.sock.recv(65536)
+        except socket.timeout:
+            return []
+        if len(data) < DGRAM_HEADER_LEN:
+            return []
+        magic, version, flags, length, reserved, seq = \
+            struct.unpack_from(DGRAM_HEADER_FMT, data, 0)
+        if magic != DGRAM_MAGIC or version != VERSION:
+            return []
+        self.datagrams = self.datagrams + 1
+
+        frames = []
+        if self.expected is not None and seq > self.expected:
+            missing = seq - self.expected
+            got = {}
+            if self.backfill:
+                try:
+                    got = self.backfill.fetch(self.expected, missing)
+                except (OSError, EOFError, ValueError):
+                    # lossy from now on
+                    self.backfill = None
+            for s in range(self.expected, seq):
+                if got.get(s) is None:
+                    self.lost = self.lost + 1
+                else:
+                    self.backfilled = self.backfilled + 1
+                    frames.extend(self.frames(got[s]))
+        elif self.expected is not None and seq < self.expected:
+            # late duplicate or the gateway restarted
+            if self.expected - seq < 1 << 16:
+                return []
+        self.expected = seq + 1
+        frames.extend(self.frames(data[DGRAM_HEADER_LEN:
+                                       DGRAM_HEADER_LEN + length]))
+        return frames
+
+
+if __name__ == '__main__':
+    r = receiver(GROUP, PORT, BACKFILL)
+    try:
+        while True:
+            for frame in r.recv(1.0):
+                print(frame)
+    except KeyboardInterrupt:
+        print('%d datagrams, %d lost, %d backfilled'
+              % (r.datagrams, r.lost, r.backfilled))
@@ -1,16 +1,21 @@
 import socket
+from can_proto import decoder, subscription
 
 s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
 host ="192.168.10.116"
 port =8000
+# (can_id, can_mask) pairs to receive only those frames, [] for all
+FILTERS = []
 s.connect((host,port))
+if FILTERS:
+   s.sendall(subscription(FILTERS))
 
-def ts(str):
-   data = ''
-   data = s.recv(128)
-   print (data)
-
+d = decoder()
 while 2:
-   ts(s)
+   data = s.recv(65536)
+   if not data:
+      break
+   for frame in d.feed(data):
+      print (frame)
 
-s.close ()
\ No newline at end of file
+s.close ()
@@ -0,0 +1,129 @@
+# cpu time of native/can_gateway streaming over tcp versus udp
+# native/can_generator sends RATES frames/s on vcan0, the gateway serves
+# CLIENTS tcp clients or CLIENTS receivers of one multicast udp stream.
+# reported is the cpu time of the gateway process per 10k frames/s - the
+# clients only count bytes, so python does not become the bottleneck.
+# build the tools first: make -C native
+# on the pi the same runs on can1 with CHANNEL = 'can1' and the generator
+# on can0 (GENERATOR_CHANNEL)
+import os
+import time
+import socket
+import threading
+import subprocess
+
+CHANNEL = 'vcan0'
+GENERATOR_CHANNEL = 'vcan0'
+PORT = 8000
+# a multicast group reaches every receiver with a single datagram
+UDP_GROUP = '239.1.1.1'
+UDP_PORT = 5000
+CLIENTS = 4
+DURATION = 10
+RATES = [10000, 20000, 40000]
+TRANSPORTS = ['tcp', 'udp']
+
+NATIVE = os.path.join(os.path.dirname(__file__) or '.', 'native')
+
+# Init VCAN0
+if CHANNEL.startswith('vcan'):
+    os.system("sudo ip link add dev " + CHANNEL + " type vcan 2>/dev/null")
+    os.system("sudo ip link set " + CHANNEL + " mtu 72 up")
+
+
+class consumer(threading.Thread):
+    def __init__(self, transport):
+        threading.Thread.__init__(self)
+        if transport == 'tcp':
+            self.sock = socket.create_connection(('127.0.0.1', PORT))
+        else:
+            self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+            self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+            self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF,
+                                 4 << 20)
+            self.sock.bind((UDP_GROUP, UDP_PORT))
+            mreq = socket.inet_aton(UDP_GROUP) + socket.inet_aton('0.0.0.0')
+            self.sock.setsockopt(socket.IPPROTO_IP,
+                                 socket.IP_ADD_MEMBERSHIP, mreq)
+        self.sock.settimeout(0.5)
+        self.bytes = 0
+        self.running = True
+        self.start()
+
+    def run(self):
+        while self.running:
+            try:
+                data = self.sock.recv(65536)
+            except socket.timeout:
+                continue
+            if not data:
+                break
+            self.bytes = self.bytes + len(data)
+
+
+def cpu_seconds(pid):
+    # utime and stime, fields 14 and 15 of /proc/<pid>/stat
+    with open('/proc/%d/stat' % pid) as f:
+        fields = f.read().rsplit(')', 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / \
+        float(os.sysconf('SC_CLK_TCK'))
+
+
+def gateway_frames(stats):
+    # the statistics the gateway prints when it ends
+    frames = 0
+    drops = 0
+    for line in stats.splitlines():
+        words = line.replace(',', '').split()
+        if line.startswith(CHANNEL + ':'):
+            frames = int(words[1])
+        elif 'drops' in words:
+            drops = drops + int(words[words.index('drops') - 1])
+        elif 'dropped' in words:
+            drops = drops + int(words[words.index('dropped') - 1])
+    return frames, drops
+
+
+def run(transport, rate):
+    args = [os.path.join(NATIVE, 'can_gateway'), '-i', CHANNEL,
+            '-l', '127.0.0.1', '-p', str(PORT)]
+    if transport == 'udp':
+        args = args + ['-u', '%s:%d' % (UDP_GROUP, UDP_PORT)]
+    gw = subprocess.Popen(args, stderr=subprocess.PIPE,
+                          universal_newlines=True)
+    time.sleep(0.5)
+    clients = [consumer(transport) for i in range(CLIENTS)]
+    time.sleep(0.2)
+
+    cpu = cpu_seconds(gw.pid)
+    start = time.time()
+    subprocess.call([os.path.join(NATIVE, 'can_generator'),
+                     '-i', GENERATOR_CHANNEL, '-r', str(rate),
+                     '-t', str(DURATION), '-I', '0x100-0x10f', '-L', '8'],
+                    stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    elapsed = time.time() - start
+    cpu = cpu_seconds(gw.pid) - cpu
+
+    time.sleep(0.5)
+    gw.terminate()
+    stats = gw.communicate()[1]
+    for c in clients:
+        c.running = False
+        c.join()
+
+    frames, drops = gateway_frames(stats)
+    fps = frames / elapsed
+    load = 100.0 * cpu / elapsed
+    print("%-4s %8d %10.0f %8.1f %10.2f %10d %12.0f"
+          % (transport, rate, fps, load,
+             load * 10000 / fps if fps else 0, drops,
+             sum(c.bytes for c in clients) / float(len(clients))))
+
+
+print("%d clients, %ds per run" % (CLIENTS, DURATION))
+print("%-4s %8s %10s %8s %10s %10s %12s"
+      % ('', 'rate', 'frames/s', 'cpu %', 'cpu %/10k', 'drops',
+         'bytes/client'))
+for transport in TRANSPORTS:
+    for rate in RATES:
+        run(transport, rate)
@@ -0,0 +1,110 @@
+# checks native/can_gateway on a virtual can bus without hardware
+# a synthetic generator sends sequenced classic and fd frames on vcan0 at
+# the rate of a fully loaded 1 Mbit/s classic plus 8 Mbit/s fd bus, while
+# CLIENTS tcp clients check that each of them gets every frame in order
+# build the gateway first: make -C native
+import os
+import sys
+import time
+import socket
+import struct
+import threading
+import subprocess
+
+CHANNEL = 'vcan0'
+PORT = 8000
+CLIENTS = 4
+DURATION = 10
+# ~8k classic frames/s at 1 Mbit/s plus ~12k fd frames/s at 8 Mbit/s
+CLASSIC_RATE = 8000
+FD_RATE = 12000
+
+CAN_RAW_FD_FRAMES = 5
+CANFD_FRAME_FMT = '=IBBBB64s'
+CAN_FRAME_FMT = '=IB3x8s'
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__) or '.', 'PC_Test'))
+from can_proto import decoder
+
+# Init VCAN0
+os.system("sudo ip link add dev " + CHANNEL + " type vcan 2>/dev/null")
+os.system("sudo ip link set " + CHANNEL + " mtu 72 up")
+
+
+class client(threading.Thread):
+    def __init__(self):
+        threading.Thread.__init__(self)
+        self.sock = socket.create_connection(('127.0.0.1', PORT))
+        self.frames = 0
+        self.lost = 0
+        self.running = True
+        self.start()
+
+    def run(self):
+        d = decoder()
+        expected = None
+        self.sock.settimeout(0.5)
+        while self.running:
+            try:
+                data = self.sock.recv(65536)
+            except socket.timeout:
+                continue
+            if not data:
+                break
+            for frame in d.feed(data):
+                seq = struct.unpack('<I', frame.data[:4])[0]
+                if expected is not None and seq != expected:
+                    self.lost = self.lost + (seq - expected)
+                expected = seq + 1
+                self.frames = self.frames + 1
+
+
+gw = subprocess.Popen([os.path.join(os.path.dirname(__file__) or '.',
+                                    'native', 'can_gateway'),
+                       '-i', CHANNEL, '-l', '127.0.0.1', '-p', str(PORT)])
+time.sleep(0.5)
+clients = [client() for i in range(CLIENTS)]
+
+tx = socket.socket(socket.AF_CAN, socket.SOCK_RAW, socket.CAN_RAW)
+tx.setsockopt(socket.SOL_CAN_RAW, CAN_RAW_FD_FRAMES, 1)
+tx.bind((CHANNEL,))
+
+# alternate classic and fd frames in the ratio of their rates
+sent = 0
+rate = CLASSIC_RATE + FD_RATE
+start = time.time()
+while time.time() - start < DURATION:
+    seq = struct.pack('<I', sent)
+    if (sent * CLASSIC_RATE) % rate < CLASSIC_RATE:
+        frame = struct.pack(CAN_FRAME_FMT, 0x123, 8, seq + b'\0' * 4)
+    else:
+        frame = struct.pack(CANFD_FRAME_FMT, 0x456, 64, 0x01, 0, 0,
+                            seq + b'\0' * 60)
+    try:
+        tx.send(frame)
+    except OSError:
+        # ENOBUFS - the tx queue of vcan0 is full
+        time.sleep(0.0001)
+        continue
+    sent = sent + 1
+    # pace the generator to the target rate
+    ahead = sent / rate - (time.time() - start)
+    if ahead > 0.001:
+        time.sleep(ahead)
+elapsed = time.time() - start
+
+time.sleep(1)
+for c in clients:
+    c.running = False
+    c.join()
+gw.terminate()
+gw.wait()
+
+print("sent:   %d frames in %.2fs - %.0f frames/s"
+      % (sent, elapsed, sent / elapsed))
+for i, c in enumerate(clients):
+    print("client %d: %d frames, %d lost" % (i, c.frames, c.lost))
+
+# every client has to get every frame that was sent
+if any(c.lost or c.frames != sent for c in clients):
+    sys.exit(1)
@@ -0,0 +1,164 @@
+# checks that stalled clients cannot hurt native/can_gateway or the others
+# native/can_generator sends sequenced frames on vcan0 while HEALTHY tcp
+# clients read everything and STALLED clients connect and never read. for
+# every policy of the gateway (-D) it checks that
+#  - the healthy clients lose nothing
+#  - the stalled ones lose frames (drop-newest/-oldest) or get
+#    disconnected (disconnect)
+#  - the stream of a stalled client that reads again is still framed
+#  - the memory of the gateway stays within CLIENTS times BUFFER
+# build the tools first: make -C native
+import os
+import sys
+import time
+import socket
+import struct
+import threading
+import subprocess
+
+CHANNEL = 'vcan0'
+PORT = 8000
+HEALTHY = 2
+STALLED = 16
+# small client buffers, so the stalled clients fill them quickly
+BUFFER = 65536
+RATE = 5000
+DURATION = 10
+POLICIES = ['drop-newest', 'drop-oldest', 'disconnect']
+
+NATIVE = os.path.join(os.path.dirname(__file__) or '.', 'native')
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__) or '.', 'PC_Test'))
+from can_proto import decoder
+
+# Init VCAN0
+os.system("sudo ip link add dev " + CHANNEL + " type vcan 2>/dev/null")
+os.system("sudo ip link set " + CHANNEL + " mtu 72 up")
+
+
+class client(threading.Thread):
+    def __init__(self, stalled):
+        threading.Thread.__init__(self)
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        if stalled:
+            # fill up with as little as possible in the kernel
+            self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+        self.sock.connect(('127.0.0.1', PORT))
+        self.stalled = stalled
+        self.decoder = decoder()
+        self.frames = 0
+        self.lost = 0
+        self.closed = False
+        self.expected = None
+        self.running = True
+        self.start()
+
+    def read(self, timeout):
+        self.sock.settimeout(timeout)
+        try:
+            data = self.sock.recv(65536)
+        except socket.timeout:
+            return True
+        except OSError:
+            data = b''
+        if not data:
+            self.closed = True
+            return False
+        for frame in self.decoder.feed(data):
+            seq = struct.unpack('<I', frame.data[:4])[0]
+            if self.expected is not None and seq != self.expected:
+                self.lost = self.lost + (seq - self.expected)
+            self.expected = seq + 1
+            self.frames = self.frames + 1
+        return True
+
+    def run(self):
+        while self.running:
+            if self.stalled:
+                time.sleep(0.1)
+            elif not self.read(0.5):
+                break
+
+    def wake(self):
+        """read again for a second - what is left has to decode"""
+        self.running = False
+        self.join()
+        end = time.time() + 1
+        while time.time() < end and self.read(0.1):
+            pass
+
+
+def rss_kb(pid):
+    with open('/proc/%d/status' % pid) as f:
+        for line in f:
+            if line.startswith('VmRSS:'):
+                return int(line.split()[1])
+    return 0
+
+
+def run(policy):
+    gw = subprocess.Popen([os.path.join(NATIVE, 'can_gateway'),
+                           '-i', CHANNEL, '-l', '127.0.0.1',
+                           '-p', str(PORT), '-b', str(BUFFER),
+                           '-D', policy],
+                          stderr=subprocess.PIPE, universal_newlines=True)
+    time.sleep(0.5)
+    base = rss_kb(gw.pid)
+    healthy = [client(False) for i in range(HEALTHY)]
+    stalled = [client(True) for i in range(STALLED)]
+
+    generator = subprocess.Popen([os.path.join(NATIVE, 'can_generator'),
+                                  '-i', CHANNEL, '-r', str(RATE),
+                                  '-t', str(DURATION), '-L', '8'],
+                                 stdout=subprocess.DEVNULL)
+    peak = base
+    while generator.poll() is None:
+        time.sleep(0.2)
+        peak = max(peak, rss_kb(gw.pid))
+    time.sleep(0.5)
+
+    for c in stalled:
+        c.wake()
+    for c in healthy:
+        c.running = False
+        c.join()
+    gw.terminate()
+    log = gw.communicate()[1]
+
+    errors = []
+    for c in healthy:
+        if c.lost or not c.frames or c.closed:
+            errors.append('healthy client lost %d of %d frames%s'
+                          % (c.lost, c.frames + c.lost,
+                             ', disconnected' if c.closed else ''))
+    for c in stalled:
+        if c.decoder.skipped or c.decoder.bad:
+            errors.append('stalled client got a broken stream')
+        if policy == 'disconnect' and not c.closed:
+            errors.append('stalled client still connected')
+        if policy != 'disconnect' and (c.closed or not c.lost):
+            errors.append('stalled client lost nothing or got closed')
+    # the rings of all clients plus what a socket buffer may hold
+    bound = (HEALTHY + STALLED) * (BUFFER // 1024) * 2
+    if peak - base > bound:
+        errors.append('gateway grew by %d kB, more than %d kB'
+                      % (peak - base, bound))
+
+    print('%-12s healthy %6d frames %4d lost, stalled %6d frames %8d lost,'
+          ' %3d closed, rss +%d kB %s'
+          % (policy, sum(c.frames for c in healthy),
+             sum(c.lost for c in healthy), sum(c.frames for c in stalled),
+             sum(c.lost for c in stalled),
+             sum(1 for c in stalled if c.closed), peak - base,
+             'ok' if not errors else 'FAILED'))
+    for e in sorted(set(errors)):
+        print('  ' + e)
+    if errors:
+        sys.stdout.write(log)
+    return not errors
+
+
+ok = True
+for policy in POLICIES:
+    ok = run(policy) and ok
+sys.exit(0 if ok else 1)
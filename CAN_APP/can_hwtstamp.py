@@ -0,0 +1,104 @@
+# hardware timestamps of transmitted and received frames
+# can0 transmits, can1 receives - both stamped by the TBC of their
+# controller (see mcp25xxfd_can_ptp.c)
+# the clocks of both controllers start at system time when the interface
+# comes up; to compare them precisely keep them in sync with phc2sys, e.g.:
+#   sudo phc2sys -s CLOCK_REALTIME -c can0 -O 0 &
+#   sudo phc2sys -s CLOCK_REALTIME -c can1 -O 0 &
+import os
+import time
+import fcntl
+import array
+import socket
+import struct
+
+TX_CHANNEL = 'can0'
+RX_CHANNEL = 'can1'
+COUNT = 100
+
+SIOCSHWTSTAMP = 0x89b0
+HWTSTAMP_TX_ON = 1
+HWTSTAMP_FILTER_ALL = 1
+
+SO_TIMESTAMPING = 37
+SCM_TIMESTAMPING = SO_TIMESTAMPING
+SOF_TIMESTAMPING_TX_HARDWARE = 1 << 0
+SOF_TIMESTAMPING_RX_HARDWARE = 1 << 2
+SOF_TIMESTAMPING_RAW_HARDWARE = 1 << 6
+
+# struct scm_timestamping - 3 x struct timespec, [2] is the hardware one
+SCM_TIMESTAMPING_FMT = '@' + 'l' * 6
+CAN_FRAME_FMT = '=IB3x8s'
+
+# Init CAN0 and CAN1
+os.system("sudo ip link set " + TX_CHANNEL + " up type can bitrate 1000000")
+os.system("sudo ip link set " + RX_CHANNEL + " up type can bitrate 1000000")
+
+
+def enable_hwtstamp(sock, channel):
+    # struct hwtstamp_config referenced by struct ifreq
+    config = array.array('i', [0, HWTSTAMP_TX_ON, HWTSTAMP_FILTER_ALL])
+    addr, _ = config.buffer_info()
+    ifreq = struct.pack('16sP', channel.encode(), addr)
+    ifreq = ifreq + b'\0' * (40 - len(ifreq))
+    fcntl.ioctl(sock.fileno(), SIOCSHWTSTAMP, ifreq)
+
+
+def open_socket(channel, flags):
+    sock = socket.socket(socket.AF_CAN, socket.SOCK_RAW, socket.CAN_RAW)
+    sock.bind((channel,))
+    sock.setsockopt(socket.SOL_SOCKET, SO_TIMESTAMPING, flags)
+    return sock
+
+
+def hw_timestamp(ancdata):
+    for level, kind, data in ancdata:
+        if level == socket.SOL_SOCKET and kind == SCM_TIMESTAMPING:
+            ts = struct.unpack(SCM_TIMESTAMPING_FMT,
+                               data[:struct.calcsize(SCM_TIMESTAMPING_FMT)])
+            return ts[4] + ts[5] * 1e-9
+    return None
+
+
+tx = open_socket(TX_CHANNEL,
+                 SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE)
+rx = open_socket(RX_CHANNEL,
+                 SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE)
+enable_hwtstamp(tx, TX_CHANNEL)
+enable_hwtstamp(rx, RX_CHANNEL)
+rx.settimeout(1)
+
+size = struct.calcsize(CAN_FRAME_FMT)
+latency = []
+for cnt in range(COUNT):
+    tx.send(struct.pack(CAN_FRAME_FMT, 0x123, 8,
+                        bytes([cnt & 0xFF] + [0] * 7)))
+
+    # the frame as received by can1
+    msg, ancdata, flags, addr = rx.recvmsg(size, 1024)
+    rx_ts = hw_timestamp(ancdata)
+
+    # the transmit timestamp from the error queue of the sending socket
+    tx_ts = None
+    for retry in range(100):
+        try:
+            msg, ancdata, flags, addr = tx.recvmsg(size, 1024,
+                                                   socket.MSG_ERRQUEUE |
+                                                   socket.MSG_DONTWAIT)
+            tx_ts = hw_timestamp(ancdata)
+            break
+        except BlockingIOError:
+            time.sleep(0.001)
+
+    if rx_ts is None or tx_ts is None:
+        print("%3d: missing timestamp - tx: %s rx: %s" % (cnt, tx_ts, rx_ts))
+        continue
+    latency.append(rx_ts - tx_ts)
+    print("%3d: tx %.6f rx %.6f delta %8.1f us"
+          % (cnt, tx_ts, rx_ts, (rx_ts - tx_ts) * 1e6))
+
+if latency:
+    latency.sort()
+    print("delta us: min %.1f median %.1f max %.1f"
+          % (latency[0] * 1e6, latency[len(latency) // 2] * 1e6,
+             latency[-1] * 1e6))
@@ -32,10 +32,18 @@ class client(Thread):
     def run(self):
         while 1:
             msg = bus.recv(0.5)
-            self.sock.send(struct.pack('!d', msg.timestamp))
-            self.sock.send(struct.pack('!i', msg.arbitration_id))
-            self.sock.send(struct.pack('!i', msg.dlc))
-            self.sock.send(msg.data)
+            # nothing arrived within the timeout
+            if msg is None:
+                continue
+            try:
+                self.sock.send(struct.pack('!d', msg.timestamp))
+                self.sock.send(struct.pack('!i', msg.arbitration_id))
+                self.sock.send(struct.pack('!i', msg.dlc))
+                self.sock.send(msg.data)
+            except OSError:
+                # the client went away
+                self.sock.close()
+                break
             #self.sock.send(b'aasdsdsad')
 
 
@@ -0,0 +1,111 @@
+# reader of the shared memory frame ring of native/can_gateway -S
+# local processes get every frame the gateway receives without a can socket
+# of their own - see CAN_APP/native/shm_ring.h for the layout
+#   sudo ./native/can_gateway -i can1 -S - &
+#   python3 can_shm.py can1
+import mmap
+import sys
+import time
+import struct
+
+MAGIC = 0x4d485343
+VERSION = 1
+HEADER_FMT = '<IHHHHI'
+HEAD_OFFSET = 64
+SLOT_FMT = '<QQIBB2x'
+SLOT_DATA = struct.calcsize(SLOT_FMT)
+
+FLAG_FD = 0x01
+FLAG_BRS = 0x02
+FLAG_ESI = 0x04
+
+CAN_EFF_FLAG = 0x80000000
+CAN_EFF_MASK = 0x1FFFFFFF
+
+
+class frame(object):
+    __slots__ = ('timestamp', 'arbitration_id', 'is_extended_id', 'flags',
+                 'data')
+
+    def __init__(self, timestamp, can_id, flags, data):
+        # timestamp in s, flags are the FLAG_* above
+        self.timestamp = timestamp
+        self.arbitration_id = can_id & CAN_EFF_MASK
+        self.is_extended_id = bool(can_id & CAN_EFF_FLAG)
+        self.flags = flags
+        self.data = data
+
+    def __repr__(self):
+        return '%.6f %*X [%2d]%s %s' % (
+            self.timestamp, 8 if self.is_extended_id else 3,
+            self.arbitration_id, len(self.data),
+            ' fd' if self.flags & FLAG_FD else '   ',
+            self.data.hex())
+
+
+class reader(object):
+    def __init__(self, name='/can_app.can1'):
+        # the ring is only read - python cannot wait on the futex, so
+        # wait() polls
+        with open('/dev/shm' + name, 'rb') as f:
+            self.mm = mmap.mmap(f.fileno(), 0, mmap.MAP_SHARED,
+                                mmap.PROT_READ)
+        magic, version, self.header_size, self.slot_size, reserved, \
+            self.slots = struct.unpack_from(HEADER_FMT, self.mm, 0)
+        if magic != MAGIC or version != VERSION:
+            raise ValueError(name + ': not a frame ring')
+        self.cursor = self.head()
+        self.lost = 0
+
+    def head(self):
+        return struct.unpack_from('<Q', self.mm, HEAD_OFFSET)[0]
+
+    def pending(self):
+        return self.head() - self.cursor
+
+    def read(self, max_frames=64):
+        """returns the list of up to max_frames new frames"""
+        frames = []
+        head = self.head()
+        if head - self.cursor > self.slots:
+            # lapped - skip to the oldest frame that is still there
+            self.lost = self.lost + head - self.slots - self.cursor
+            self.cursor = head - self.slots
+        while self.cursor < head and len(frames) < max_frames:
+            pos = self.header_size + \
+                (self.cursor % self.slots) * self.slot_size
+            seq = 2 * self.cursor + 2
+            self.cursor = self.cursor + 1
+            # seqlock - the slot must carry this frame before and after
+            # copying it, otherwise the writer lapped us
+            slot_seq, ts, can_id, flags, length = \
+                struct.unpack_from(SLOT_FMT, self.mm, pos)
+            data = self.mm[pos + SLOT_DATA:pos + SLOT_DATA + min(length, 64)]
+            if slot_seq != seq or \
+               struct.unpack_from('<Q', self.mm, pos)[0] != seq:
+                self.lost = self.lost + 1
+                continue
+            frames.append(frame(ts / 1e9, can_id, flags, data))
+        return frames
+
+    def wait(self, timeout=None, interval=0.001):
+        """sleeps until there are frames to read - returns whether
+        there are"""
+        end = None if timeout is None else time.time() + timeout
+        while not self.pending():
+            if end is not None and time.time() >= end:
+                return False
+            time.sleep(interval)
+        return True
+
+
+if __name__ == '__main__':
+    channel = sys.argv[1] if len(sys.argv) > 1 else 'can1'
+    ring = reader('/can_app.' + channel)
+    try:
+        while True:
+            if ring.wait(1.0):
+                for msg in ring.read():
+                    print(msg)
+    except KeyboardInterrupt:
+        print('lost %d frames' % ring.lost)
@@ -0,0 +1,126 @@
+# sustained TX throughput with mixed priorities
+# can0 transmits as fast as the driver accepts frames, can1 receives and
+# checks that frames with the same id arrive in the order they were sent
+# with SENDERS > 1 several threads (each owning some of the ids) hammer
+# the driver concurrently, stressing the tx stage handling
+# install "python-can" package
+# sudo pip3 install python-can
+import os
+import glob
+import time
+import random
+import threading
+import can
+
+TX_CHANNEL = 'can0'
+RX_CHANNEL = 'can1'
+DURATION = 10
+SENDERS = 4
+# (id, weight) - low ids win the arbitration on the bus
+IDS = [(0x010, 1), (0x0A5, 2), (0x123, 4), (0x456, 4), (0x7FF, 8)]
+DEBUGFS_STATS = ['tx_prio_writes', 'tx_prio_drains', 'tx_stage_retries']
+
+# Init CAN0 and CAN1
+os.system("sudo ip link set " + TX_CHANNEL + " down")
+os.system("sudo ip link set " + RX_CHANNEL + " down")
+os.system("sudo ip link set " + TX_CHANNEL + " up type can bitrate 1000000")
+os.system("sudo ip link set " + RX_CHANNEL + " up type can bitrate 1000000")
+os.system("sudo ifconfig " + TX_CHANNEL + " txqueuelen 1000")
+
+bustype = 'socketcan_native'
+
+
+def read_stats():
+    stats = {}
+    for path in glob.glob('/sys/kernel/debug/mcp25xxfd-*/can/stats'):
+        for name in DEBUGFS_STATS + ['tx_bus_gap_lt_1us']:
+            try:
+                with open(os.path.join(path, name)) as f:
+                    stats[name] = stats.get(name, 0) + int(f.read())
+            except (IOError, ValueError):
+                pass
+    return stats
+
+
+class receiver(threading.Thread):
+    def __init__(self):
+        threading.Thread.__init__(self)
+        self.bus = can.interface.Bus(channel=RX_CHANNEL, bustype=bustype)
+        self.expected = {}
+        self.frames = 0
+        self.reordered = 0
+        self.running = True
+        self.start()
+
+    def run(self):
+        while self.running:
+            msg = self.bus.recv(0.5)
+            if msg is None:
+                continue
+            seq = msg.data[0]
+            if msg.arbitration_id in self.expected:
+                if seq != self.expected[msg.arbitration_id]:
+                    self.reordered = self.reordered + 1
+            self.expected[msg.arbitration_id] = (seq + 1) & 0xFF
+            self.frames = self.frames + 1
+
+
+class sender(threading.Thread):
+    def __init__(self, ids):
+        threading.Thread.__init__(self)
+        self.bus = can.interface.Bus(channel=TX_CHANNEL, bustype=bustype)
+        self.ids = ids
+        self.seq = dict((can_id, 0) for can_id in ids)
+        self.sent = 0
+        self.busy = 0
+
+    def run(self):
+        start = time.time()
+        while time.time() - start < DURATION:
+            can_id = random.choice(self.ids)
+            msg = can.Message(arbitration_id=can_id,
+                              data=[self.seq[can_id], 0, 0, 0, 0, 0, 0, 0],
+                              extended_id=False)
+            try:
+                self.bus.send(msg, timeout=0.1)
+            except can.CanError:
+                self.busy = self.busy + 1
+                continue
+            self.seq[can_id] = (self.seq[can_id] + 1) & 0xFF
+            self.sent = self.sent + 1
+
+
+rx = receiver()
+
+# every id is owned by a single sender, so its frames are sent in order
+senders = []
+for i in range(SENDERS):
+    ids = []
+    for can_id, weight in IDS[i::SENDERS]:
+        ids = ids + [can_id] * weight
+    if ids:
+        senders.append(sender(ids))
+
+before = read_stats()
+start = time.time()
+for s in senders:
+    s.start()
+for s in senders:
+    s.join()
+elapsed = time.time() - start
+sent = sum(s.sent for s in senders)
+busy = sum(s.busy for s in senders)
+
+# let the receiver catch up
+time.sleep(1)
+rx.running = False
+rx.join()
+after = read_stats()
+
+print("sent:      %d frames in %.2fs - %.0f frames/s (%d senders)"
+      % (sent, elapsed, sent / elapsed, len(senders)))
+print("received:  %d frames" % rx.frames)
+print("busy:      %d" % busy)
+print("reordered: %d (frames with the same id out of order)" % rx.reordered)
+for name in sorted(after):
+    print("%-18s %d" % (name + ':', after[name] - before.get(name, 0)))
@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* bounded byte ring holding the encoded stream of a single client
+ *
+ * records are pushed whole or not at all, so the stream stays framed
+ * when a client falls behind - the pending bytes are handed to writev
+ * as (at most) two iovecs without copying
+ */
+
+#ifndef __BYTE_RING_H
+#define __BYTE_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <vector>
+
+namespace can_app {
+
+class byte_ring {
+public:
+	/* the size gets rounded up to a power of 2 */
+	explicit byte_ring(size_t size)
+		: mask(round_up(size) - 1), head(0), tail(0)
+	{
+		buf.resize(mask + 1);
+	}
+
+	size_t size() const { return mask + 1; }
+	size_t used() const { return head - tail; }
+	size_t space() const { return size() - used(); }
+	bool empty() const { return head == tail; }
+
+	bool push(const uint8_t *data, size_t len)
+	{
+		size_t pos = head & mask;
+		size_t first = size() - pos;
+
+		if (len > space())
+			return false;
+
+		if (first > len)
+			first = len;
+		memcpy(&buf[pos], data, first);
+		memcpy(&buf[0], data + first, len - first);
+		head += len;
+
+		return true;
+	}
+
+	/* the pending bytes in up to two iovecs - returns the count */
+	int peek(struct iovec *iov) const
+	{
+		size_t pos = tail & mask;
+		size_t len = used();
+		size_t first = size() - pos;
+
+		if (!len)
+			return 0;
+
+		iov[0].iov_base = const_cast<uint8_t *>(&buf[pos]);
+		if (first >= len) {
+			iov[0].iov_len = len;
+			return 1;
+		}
+		iov[0].iov_len = first;
+		iov[1].iov_base = const_cast<uint8_t *>(&buf[0]);
+		iov[1].iov_len = len - first;
+
+		return 2;
+	}
+
+	void consume(size_t len) { tail += len; }
+
+	/* drop everything pending */
+	void clear() { tail = head; }
+
+	/* drop len bytes behind the first keep pending ones - those move
+	 * up, keep is the rest of a record writev sent in part
+	 */
+	void drop(size_t keep, size_t len)
+	{
+		size_t i;
+
+		for (i = keep; i-- > 0;)
+			buf[(tail + len + i) & mask] = buf[(tail + i) & mask];
+		tail += len;
+	}
+
+private:
+	static size_t round_up(size_t size)
+	{
+		size_t n = 1;
+
+		while (n < size)
+			n <<= 1;
+
+		return n;
+	}
+
+	std::vector<uint8_t> buf;
+	size_t mask;
+	/* free running byte counts */
+	uint64_t head;
+	uint64_t tail;
+};
+
+} /* namespace can_app */
+
+#endif /* __BYTE_RING_H */
@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* CAN to TCP (and UDP) gateway - replaces can_receiver.py
+ *
+ * usage: can_gateway [-i can1] [-l 0.0.0.0] [-p 8000] [-b client_buffer]
+ *                    [-n batch] [-r rcvbuf] [-c max_clients] [-s seconds]
+ *                    [-P batch|legacy] [-S shm_name] [-N shm_slots]
+ *                    [-m shm_mode] [-R]
+ *                    [-u addr:port] [-U datagram_size] [-H history]
+ *                    [-T ttl] [-D drop-newest|drop-oldest|disconnect]
+ *                    [-w client_sndbuf]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <exception>
+
+#include "gateway.h"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -i <ifname>  can interface to read (default can1)\n"
+		"  -l <addr>    address to listen on (default 0.0.0.0)\n"
+		"  -p <port>    tcp port (default 8000)\n"
+		"  -b <bytes>   buffer per client (default 1048576)\n"
+		"  -D <policy>  when the buffer of a client is full:\n"
+		"               drop-newest (default), drop-oldest or\n"
+		"               disconnect\n"
+		"  -w <bytes>   socket send buffer per client (default\n"
+		"               131072, 0 leaves it to the kernel)\n"
+		"  -n <frames>  frames per recvmmsg, up to 65535 (default\n"
+		"               64)\n"
+		"  -r <bytes>   can socket receive buffer (default 4194304)\n"
+		"  -c <count>   maximum number of clients (default 64)\n"
+		"  -s <secs>    print statistics every secs seconds\n"
+		"  -P <proto>   stream format: batch (default, see\n"
+		"               can_proto.h) or legacy (the format of\n"
+		"               can_receiver.py)\n"
+		"  -S <name>    publish the frames to the shared memory\n"
+		"               ring name for local readers, - for\n"
+		"               /can_app.<ifname>\n"
+		"  -N <slots>   frames the shared memory ring holds (default\n"
+		"               16384)\n"
+		"  -m <mode>    access mode of the ring (default 0660) -\n"
+		"               readers need read and write access\n"
+		"  -R           replace an existing ring of that name,\n"
+		"               e.g. one left by a crashed gateway\n"
+		"  -u <a:port>  send the frames in udp datagrams to a unicast\n"
+		"               or multicast address as well\n"
+		"  -U <bytes>   largest udp datagram (default 1472)\n"
+		"  -H <count>   datagrams held for tcp backfill requests\n"
+		"               (default 4096)\n"
+		"  -T <ttl>     multicast ttl (default 1)\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	can_app::gateway_config config;
+	int opt;
+
+	while ((opt = getopt(argc, argv,
+			     "i:l:p:b:D:w:n:r:c:s:P:S:N:m:Ru:U:H:T:h")) != -1) {
+		switch (opt) {
+		case 'i':
+			config.ifname = optarg;
+			break;
+		case 'l':
+			config.host = optarg;
+			break;
+		case 'p':
+			config.port = atoi(optarg);
+			break;
+		case 'b':
+			config.client_buffer = strtoul(optarg, NULL, 0);
+			break;
+		case 'D':
+			if (!strcmp(optarg, "drop-newest"))
+				config.policy = can_app::GATEWAY_DROP_NEWEST;
+			else if (!strcmp(optarg, "drop-oldest"))
+				config.policy = can_app::GATEWAY_DROP_OLDEST;
+			else if (!strcmp(optarg, "disconnect"))
+				config.policy = can_app::GATEWAY_DISCONNECT;
+			else
+				usage(argv[0]);
+			break;
+		case 'w':
+			config.client_sndbuf = atoi(optarg);
+			break;
+		case 'n':
+			/* a recvmmsg batch goes out as one batch of
+			 * can_proto.h, its count is a u16
+			 */
+			if (strtoul(optarg, NULL, 0) > CAN_PROTO_BATCH_MAX)
+				usage(argv[0]);
+			config.batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			config.rcvbuf = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			config.max_clients = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			config.stats_interval = strtoul(optarg, NULL, 0);
+			break;
+		case 'P':
+			if (!strcmp(optarg, "batch"))
+				config.protocol = can_app::GATEWAY_PROTO_BATCH;
+			else if (!strcmp(optarg, "legacy"))
+				config.protocol = can_app::GATEWAY_PROTO_LEGACY;
+			else
+				usage(argv[0]);
+			break;
+		case 'S':
+			config.shm_name = optarg;
+			break;
+		case 'N':
+			config.shm_slots = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			config.shm_mode = strtoul(optarg, NULL, 8) & 0777;
+			break;
+		case 'R':
+			config.shm_replace = true;
+			break;
+		case 'u':
+			config.udp_dest = optarg;
+			break;
+		case 'U':
+			config.udp_mtu = strtoul(optarg, NULL, 0);
+			break;
+		case 'H':
+			config.udp_history = strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			config.udp_ttl = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (config.shm_name == "-")
+		config.shm_name = can_app::shm_ring_name(config.ifname);
+	if (!config.batch || !config.client_buffer)
+		usage(argv[0]);
+
+	try {
+		can_app::gateway gw(config);
+
+		return gw.run();
+	} catch (const std::exception &e) {
+		fprintf(stderr, "can_gateway: %s\n", e.what());
+		return 1;
+	}
+}
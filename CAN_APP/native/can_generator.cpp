@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* can traffic generator - replaces can_transmit.py
+ *
+ * sends the frames of traffic.h with sendmmsg, paced to a target rate
+ * (or as fast as the interface takes them), optionally in bursts.
+ * a full socket buffer (EAGAIN) or a full tx queue of the interface
+ * (ENOBUFS) is backpressure: the generator waits and retries, counting
+ * the events, so no frame (and no sequence number) gets skipped.
+ *
+ * works on vcan as well as on can0, e.g. to saturate a 1M/8M fd bus:
+ *   can_generator -i can0 -I 0x100-0x10f -L 8:1,64:1 -f 100 -t 10
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <exception>
+#include <stdexcept>
+
+#include "can_socket.h"
+#include "traffic.h"
+
+struct generator_config {
+	std::string ifname = "can0";
+	can_app::traffic_config traffic;
+	/* frames per second, 0 is as fast as possible */
+	double rate = 0;
+	/* frames sent back to back and the pause after them */
+	unsigned int burst = 0;
+	unsigned int burst_gap_us = 0;
+	/* stop after frames or seconds - whatever comes first */
+	uint64_t frames = 0;
+	double duration = 0;
+	unsigned int batch = 32;
+	unsigned int stats_interval = 0;
+	/* wait this long after ENOBUFS */
+	unsigned int backoff_us = 100;
+};
+
+struct generator_stats {
+	uint64_t frames;
+	uint64_t fd_frames;
+	uint64_t bytes;
+	uint64_t calls;
+	uint64_t eagain;
+	uint64_t enobufs;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static uint64_t mono_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+	       EINTR && !stop)
+		;
+}
+
+static void print_stats(FILE *out, const struct generator_stats *s,
+			uint64_t elapsed_ns)
+{
+	double secs = elapsed_ns / 1e9;
+
+	fprintf(out, "%llu frames (%llu fd) in %.2fs: %.0f frames/s, "
+		"%.0f payload bytes/s, %.1f frames/sendmmsg, "
+		"%llu EAGAIN, %llu ENOBUFS\n",
+		(unsigned long long)s->frames,
+		(unsigned long long)s->fd_frames, secs,
+		secs > 0 ? s->frames / secs : 0,
+		secs > 0 ? s->bytes / secs : 0,
+		s->calls ? (double)s->frames / s->calls : 0,
+		(unsigned long long)s->eagain,
+		(unsigned long long)s->enobufs);
+	fflush(out);
+}
+
+static int run(const struct generator_config &config)
+{
+	can_app::traffic traffic(config.traffic);
+	int sock = can_app::can_socket_open_tx(config.ifname, traffic.fd(), 0);
+	can_app::can_writer writer(sock, config.batch);
+	struct generator_stats stats = {};
+	unsigned int pending = 0, pos = 0, in_burst = 0, i;
+	uint64_t start = mono_ns(), now = start;
+	uint64_t next_stats = start + config.stats_interval * 1000000000ULL;
+	uint64_t end = config.duration ?
+		start + (uint64_t)(config.duration * 1e9) : 0;
+	int ret;
+
+	while (!stop) {
+		unsigned int n;
+
+		now = mono_ns();
+		if (end && now >= end)
+			break;
+		if (config.frames && stats.frames >= config.frames)
+			break;
+		if (config.stats_interval && now >= next_stats) {
+			print_stats(stderr, &stats, now - start);
+			next_stats += config.stats_interval * 1000000000ULL;
+		}
+
+		/* refill the batch once it is sent completely */
+		if (pos == pending) {
+			pending = config.batch;
+			if (config.frames &&
+			    config.frames - stats.frames < pending)
+				pending = config.frames - stats.frames;
+			for (i = 0; i < pending; i++)
+				writer.set_fd(i,
+					      traffic.next(writer.frame(i)));
+			pos = 0;
+		}
+		n = pending - pos;
+
+		/* pacing - wait until the next frame (or burst) is due */
+		if (config.rate > 0) {
+			double due = (now - start) / 1e9 * config.rate -
+				stats.frames;
+			unsigned int need = config.burst && !in_burst ?
+				config.burst : 1;
+
+			if (due < need) {
+				sleep_until(start + (uint64_t)((stats.frames +
+					need) / config.rate * 1e9));
+				continue;
+			}
+			if (n > due)
+				n = due;
+		}
+		if (config.burst && n > config.burst - in_burst)
+			n = config.burst - in_burst;
+
+		ret = writer.write(pos, n);
+		stats.calls++;
+		if (ret == -EAGAIN) {
+			struct pollfd pfd = { sock, POLLOUT, 0 };
+
+			stats.eagain++;
+			poll(&pfd, 1, 10);
+			continue;
+		} else if (ret == -ENOBUFS) {
+			stats.enobufs++;
+			usleep(config.backoff_us);
+			continue;
+		} else if (ret < 0) {
+			fprintf(stderr, "can_generator: sendmmsg: %s\n",
+				strerror(-ret));
+			close(sock);
+			return 1;
+		}
+
+		for (i = pos; i < pos + ret; i++) {
+			stats.bytes += writer.frame(i)->len;
+			if (writer.fd(i))
+				stats.fd_frames++;
+		}
+		pos += ret;
+		stats.frames += ret;
+
+		/* the burst is complete - pause unless paced by the rate */
+		if (config.burst) {
+			in_burst += ret;
+			if (in_burst >= config.burst) {
+				in_burst = 0;
+				if (config.burst_gap_us && config.rate <= 0)
+					usleep(config.burst_gap_us);
+			}
+		}
+	}
+
+	print_stats(stdout, &stats, mono_ns() - start);
+	printf("next sequence number: %u\n", traffic.seq());
+	close(sock);
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -i <ifname>    can interface (default can0)\n"
+		"  -I <ids>       ids, e.g. 0x123,0x200-0x20f,0x1234e\n"
+		"                 (e: extended, default 0x123)\n"
+		"  -L <lens>      payload lengths with weights, e.g. 8 or\n"
+		"                 0:1,8:4,64:2 (default 8)\n"
+		"  -f <percent>   share of fd frames (default 0, lengths\n"
+		"                 above 8 are always fd)\n"
+		"  -B <percent>   share of fd frames with bit rate switch\n"
+		"                 (default 100)\n"
+		"  -r <rate>      frames per second (default: as fast as\n"
+		"                 the interface accepts them)\n"
+		"  -b <n>[:<us>]  bursts of n frames back to back - paced\n"
+		"                 by -r or followed by a pause of us\n"
+		"  -n <frames>    stop after frames\n"
+		"  -t <secs>      stop after secs\n"
+		"  -m <frames>    frames per sendmmsg (default 32)\n"
+		"  -s <secs>      print statistics every secs seconds\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	struct generator_config config;
+	char *end;
+	int opt;
+
+	try {
+		while ((opt = getopt(argc, argv,
+				     "i:I:L:f:B:r:b:n:t:m:s:h")) != -1) {
+			switch (opt) {
+			case 'i':
+				config.ifname = optarg;
+				break;
+			case 'I':
+				config.traffic.ids =
+					can_app::traffic_parse_ids(optarg);
+				break;
+			case 'L':
+				config.traffic.lens =
+					can_app::traffic_parse_lens(optarg);
+				break;
+			case 'f':
+				config.traffic.fd_percent = atoi(optarg);
+				break;
+			case 'B':
+				config.traffic.brs_percent = atoi(optarg);
+				break;
+			case 'r':
+				config.rate = atof(optarg);
+				break;
+			case 'b':
+				config.burst = strtoul(optarg, &end, 0);
+				if (*end == ':')
+					config.burst_gap_us =
+						strtoul(end + 1, NULL, 0);
+				break;
+			case 'n':
+				config.frames = strtoull(optarg, NULL, 0);
+				break;
+			case 't':
+				config.duration = atof(optarg);
+				break;
+			case 'm':
+				config.batch = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				config.stats_interval =
+					strtoul(optarg, NULL, 0);
+				break;
+			default:
+				usage(argv[0]);
+			}
+		}
+		if (!config.batch)
+			usage(argv[0]);
+
+		signal(SIGINT, on_signal);
+		signal(SIGTERM, on_signal);
+
+		return run(config);
+	} catch (const std::exception &e) {
+		fprintf(stderr, "can_generator: %s\n", e.what());
+		return 1;
+	}
+}
@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* can interface configuration over rtnetlink */
+
+#include <errno.h>
+#include <linux/can/netlink.h>
+#include <linux/can/vxcan.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <system_error>
+#include <vector>
+
+#include "can_link.h"
+
+namespace can_app {
+
+/* a RTM_NEWLINK request - struct ifinfomsg followed by the attributes,
+ * nested ones are opened with nest and closed with end
+ */
+class can_link_request {
+public:
+	explicit can_link_request(uint16_t flags)
+		: buf(NLMSG_SPACE(sizeof(struct ifinfomsg)))
+	{
+		struct nlmsghdr *nlh = hdr();
+
+		nlh->nlmsg_type = RTM_NEWLINK;
+		nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+		nlh->nlmsg_seq = 1;
+		ifi()->ifi_family = AF_UNSPEC;
+	}
+
+	struct nlmsghdr *hdr()
+	{
+		return reinterpret_cast<struct nlmsghdr *>(buf.data());
+	}
+
+	struct ifinfomsg *ifi()
+	{
+		return static_cast<struct ifinfomsg *>(NLMSG_DATA(hdr()));
+	}
+
+	void put(uint16_t type, const void *data, size_t len)
+	{
+		struct rtattr rta;
+
+		rta.rta_len = RTA_LENGTH(len);
+		rta.rta_type = type;
+		put_raw(&rta, sizeof(rta));
+		put_raw(data, len);
+	}
+
+	void put(uint16_t type, const std::string &str)
+	{
+		put(type, str.c_str(), str.size() + 1);
+	}
+
+	/* raw data inside a nest, e.g. the ifinfomsg of a vxcan peer */
+	void put_raw(const void *data, size_t len)
+	{
+		const uint8_t *p = static_cast<const uint8_t *>(data);
+
+		buf.insert(buf.end(), p, p + len);
+		buf.resize(RTA_ALIGN(buf.size()));
+	}
+
+	size_t nest(uint16_t type)
+	{
+		size_t off = buf.size();
+
+		put(type, nullptr, 0);
+
+		return off;
+	}
+
+	void end(size_t off)
+	{
+		reinterpret_cast<struct rtattr *>(&buf[off])->rta_len =
+			buf.size() - off;
+	}
+
+	/* send the request and wait for its ack
+	 * throws std::system_error with what on failure
+	 */
+	void send(const std::string &what);
+
+private:
+	std::vector<uint8_t> buf;
+};
+
+void can_link_request::send(const std::string &what)
+{
+	struct sockaddr_nl addr = {};
+	uint8_t reply[4096];
+	int sock, err = 0;
+	ssize_t len;
+
+	hdr()->nlmsg_len = buf.size();
+	addr.nl_family = AF_NETLINK;
+
+	sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (sock < 0)
+		throw std::system_error(errno, std::generic_category(),
+					"socket(AF_NETLINK)");
+
+	if (sendto(sock, buf.data(), buf.size(), 0,
+		   reinterpret_cast<struct sockaddr *>(&addr),
+		   sizeof(addr)) < 0) {
+		err = errno;
+		goto out;
+	}
+
+	/* with NLM_F_ACK the kernel answers with an error message, its
+	 * error is 0 on success
+	 */
+	for (;;) {
+		struct nlmsghdr *nlh;
+
+		len = recv(sock, reply, sizeof(reply), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			err = errno;
+			goto out;
+		}
+
+		nlh = reinterpret_cast<struct nlmsghdr *>(reply);
+		for (; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			const struct nlmsgerr *e;
+
+			if (nlh->nlmsg_type != NLMSG_ERROR)
+				continue;
+			e = static_cast<const struct nlmsgerr *>(
+				NLMSG_DATA(nlh));
+			err = -e->error;
+			goto out;
+		}
+	}
+
+out:
+	close(sock);
+	if (err)
+		throw std::system_error(err, std::generic_category(), what);
+}
+
+static int can_link_index(const std::string &ifname)
+{
+	int index = if_nametoindex(ifname.c_str());
+
+	if (!index)
+		throw std::system_error(errno, std::generic_category(), ifname);
+
+	return index;
+}
+
+void can_link_add(const std::string &ifname, const std::string &kind,
+		  const std::string &peer)
+{
+	can_link_request req(NLM_F_CREATE | NLM_F_EXCL);
+	size_t linkinfo, data, info_peer;
+
+	req.put(IFLA_IFNAME, ifname);
+	linkinfo = req.nest(IFLA_LINKINFO);
+	req.put(IFLA_INFO_KIND, kind);
+	if (!peer.empty()) {
+		struct ifinfomsg peer_ifi = {};
+
+		data = req.nest(IFLA_INFO_DATA);
+		info_peer = req.nest(VXCAN_INFO_PEER);
+		req.put_raw(&peer_ifi, sizeof(peer_ifi));
+		req.put(IFLA_IFNAME, peer);
+		req.end(info_peer);
+		req.end(data);
+	}
+	req.end(linkinfo);
+
+	req.send("add " + kind + " " + ifname);
+}
+
+void can_link_set_up(const std::string &ifname, bool up, unsigned int mtu)
+{
+	can_link_request req(0);
+
+	req.ifi()->ifi_index = can_link_index(ifname);
+	req.ifi()->ifi_flags = up ? IFF_UP : 0;
+	req.ifi()->ifi_change = IFF_UP;
+	if (mtu)
+		req.put(IFLA_MTU, &mtu, sizeof(mtu));
+
+	req.send("set " + ifname + (up ? " up" : " down"));
+}
+
+void can_link_set_bitrate(const std::string &ifname, unsigned long bitrate,
+			  unsigned long dbitrate)
+{
+	struct can_ctrlmode ctrlmode = {};
+	struct can_bittiming bt = {};
+	can_link_request req(0);
+	size_t linkinfo, data;
+
+	req.ifi()->ifi_index = can_link_index(ifname);
+	linkinfo = req.nest(IFLA_LINKINFO);
+	req.put(IFLA_INFO_KIND, "can");
+	data = req.nest(IFLA_INFO_DATA);
+
+	/* only the bitrate - the driver calculates the bit timing */
+	bt.bitrate = bitrate;
+	req.put(IFLA_CAN_BITTIMING, &bt, sizeof(bt));
+	ctrlmode.mask = CAN_CTRLMODE_FD;
+	if (dbitrate) {
+		ctrlmode.flags = CAN_CTRLMODE_FD;
+		bt.bitrate = dbitrate;
+		req.put(IFLA_CAN_DATA_BITTIMING, &bt, sizeof(bt));
+	}
+	req.put(IFLA_CAN_CTRLMODE, &ctrlmode, sizeof(ctrlmode));
+
+	req.end(data);
+	req.end(linkinfo);
+
+	req.send("set " + ifname + " bitrate " + std::to_string(bitrate));
+}
+
+} /* namespace can_app */
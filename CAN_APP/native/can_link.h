@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* can interface configuration over rtnetlink - what "ip link" does for
+ * the benchmarks, without running it. all of it needs CAP_NET_ADMIN.
+ */
+
+#ifndef __CAN_LINK_H
+#define __CAN_LINK_H
+
+#include <string>
+
+namespace can_app {
+
+/* create ifname of kind "vcan" or "vxcan" - peer names the other end of a
+ * vxcan pair
+ * throws std::system_error on failure
+ */
+void can_link_add(const std::string &ifname, const std::string &kind,
+		  const std::string &peer = "");
+
+/* set ifname up or down - a non zero mtu gets set as well, CANFD_MTU
+ * allows fd frames on virtual interfaces
+ * throws std::system_error on failure
+ */
+void can_link_set_up(const std::string &ifname, bool up,
+		     unsigned int mtu = 0);
+
+/* set the bitrate of a down can interface - a non zero dbitrate turns
+ * on fd mode with that data bitrate, 0 turns it off
+ * throws std::system_error on failure
+ */
+void can_link_set_bitrate(const std::string &ifname, unsigned long bitrate,
+			  unsigned long dbitrate);
+
+} /* namespace can_app */
+
+#endif /* __CAN_LINK_H */
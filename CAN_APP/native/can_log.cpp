@@ -0,0 +1,457 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* block based binary log of can frames - see can_log.h */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <system_error>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "can_log.h"
+
+namespace can_app {
+
+static void put_le16(uint8_t *p, uint16_t val)
+{
+	p[0] = val;
+	p[1] = val >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t val)
+{
+	put_le16(p, val);
+	put_le16(p + 2, val >> 16);
+}
+
+static void put_le64(uint8_t *p, uint64_t val)
+{
+	put_le32(p, val);
+	put_le32(p + 4, val >> 32);
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return get_le16(p) | (uint32_t)get_le16(p + 2) << 16;
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+	return get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+bool can_log_codec_available(enum can_log_codec codec)
+{
+	switch (codec) {
+	case CAN_LOG_RAW:
+		return true;
+	case CAN_LOG_LZ4:
+#ifdef HAVE_LZ4
+		return true;
+#else
+		return false;
+#endif
+	case CAN_LOG_ZSTD:
+#ifdef HAVE_ZSTD
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	return false;
+}
+
+bool can_log_codec_parse(const char *name, enum can_log_codec *codec)
+{
+	if (!strcmp(name, "raw"))
+		*codec = CAN_LOG_RAW;
+	else if (!strcmp(name, "lz4"))
+		*codec = CAN_LOG_LZ4;
+	else if (!strcmp(name, "zstd"))
+		*codec = CAN_LOG_ZSTD;
+	else
+		return false;
+
+	return true;
+}
+
+void can_log_block::clear()
+{
+	data.clear();
+	frames = 0;
+	first_ts = 0;
+	last_ts = 0;
+}
+
+void can_log_block::add(const can_proto_frame &frame)
+{
+	int64_t diff = frames ? (int64_t)(frame.ts_ns - last_ts) : 0;
+	/* zigzag - timestamps of different sources may go backwards */
+	uint64_t delta = ((uint64_t)diff << 1) ^ (uint64_t)(diff >> 63);
+	size_t pos = data.size();
+	uint8_t *p;
+
+	if (!frames)
+		first_ts = frame.ts_ns;
+	last_ts = frame.ts_ns;
+	frames++;
+
+	data.resize(pos + CAN_LOG_RECORD_MAX);
+	p = &data[pos];
+	*p++ = frame.flags;
+	*p++ = frame.len;
+	do {
+		*p++ = (delta & 0x7f) | (delta > 0x7f ? 0x80 : 0);
+		delta >>= 7;
+	} while (delta);
+	put_le32(p, frame.can_id);
+	p += 4;
+	memcpy(p, frame.data, frame.len);
+	p += frame.len;
+	data.resize(p - data.data());
+}
+
+/* returns the compressed size, 0 if it does not fit */
+static size_t compress(enum can_log_codec codec, int level,
+		       const std::vector<uint8_t> &src, uint8_t *dst,
+		       size_t max)
+{
+	/* unused without any codec compiled in */
+	(void)level;
+	(void)src;
+	(void)dst;
+	(void)max;
+
+	switch (codec) {
+#ifdef HAVE_LZ4
+	case CAN_LOG_LZ4: {
+		int ret = LZ4_compress_fast(
+			reinterpret_cast<const char *>(src.data()),
+			reinterpret_cast<char *>(dst), src.size(), max,
+			level > 0 ? level : 1);
+
+		return ret > 0 ? ret : 0;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case CAN_LOG_ZSTD: {
+		size_t ret = ZSTD_compress(dst, max, src.data(), src.size(),
+					   level ? level : 3);
+
+		return ZSTD_isError(ret) ? 0 : ret;
+	}
+#endif
+	default:
+		return 0;
+	}
+}
+
+void can_log_block::seal(enum can_log_codec codec, int level,
+			 std::vector<uint8_t> &out) const
+{
+	size_t stored = 0;
+	uint8_t *hdr;
+
+	/* anything bigger than raw gets stored raw */
+	out.resize(CAN_LOG_BLOCK_HEADER_LEN + data.size());
+	if (codec != CAN_LOG_RAW)
+		stored = compress(codec, level, data,
+				  &out[CAN_LOG_BLOCK_HEADER_LEN],
+				  data.size() - 1);
+	if (!stored) {
+		codec = CAN_LOG_RAW;
+		stored = data.size();
+		memcpy(&out[CAN_LOG_BLOCK_HEADER_LEN], data.data(), stored);
+	}
+	out.resize(CAN_LOG_BLOCK_HEADER_LEN + stored);
+
+	hdr = out.data();
+	memset(hdr, 0, CAN_LOG_BLOCK_HEADER_LEN);
+	put_le32(hdr, CAN_LOG_BLOCK_MAGIC);
+	hdr[4] = codec;
+	put_le32(hdr + 8, frames);
+	put_le32(hdr + 12, data.size());
+	put_le32(hdr + 16, stored);
+	put_le64(hdr + 24, first_ts);
+	put_le64(hdr + 32, last_ts);
+}
+
+can_log_writer::can_log_writer(const std::string &path,
+			       const std::string &ifname, uint64_t created)
+	: path(path), fd(-1), offset(0)
+{
+	uint8_t hdr[CAN_LOG_HEADER_LEN] = {};
+
+	fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0)
+		throw std::system_error(errno, std::generic_category(),
+					"open " + path);
+
+	memcpy(hdr, CAN_LOG_MAGIC, 8);
+	put_le16(hdr + 8, CAN_LOG_VERSION);
+	put_le16(hdr + 10, CAN_LOG_HEADER_LEN);
+	put_le64(hdr + 16, created);
+	strncpy(reinterpret_cast<char *>(hdr + 24), ifname.c_str(), 15);
+	write_all(hdr, sizeof(hdr));
+}
+
+can_log_writer::~can_log_writer()
+{
+	if (fd >= 0)
+		::close(fd);
+}
+
+void can_log_writer::write_all(const uint8_t *data, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = ::write(fd, data, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			throw std::system_error(errno, std::generic_category(),
+						"write " + path);
+		}
+		data += ret;
+		len -= ret;
+		offset += ret;
+	}
+}
+
+void can_log_writer::write(const std::vector<uint8_t> &block)
+{
+	const uint8_t *hdr = block.data();
+
+	index.push_back({ offset, get_le64(hdr + 24), get_le64(hdr + 32),
+			  get_le32(hdr + 8) });
+	write_all(block.data(), block.size());
+}
+
+void can_log_writer::close()
+{
+	std::vector<uint8_t> buf(index.size() * CAN_LOG_INDEX_ENTRY_LEN +
+				 CAN_LOG_TRAILER_LEN);
+	uint64_t start = offset;
+	uint8_t *p = buf.data();
+
+	if (fd < 0)
+		return;
+
+	for (const can_log_index_entry &e : index) {
+		put_le64(p, e.offset);
+		put_le64(p + 8, e.first_ts);
+		put_le64(p + 16, e.last_ts);
+		put_le32(p + 24, e.frames);
+		put_le32(p + 28, 0);
+		p += CAN_LOG_INDEX_ENTRY_LEN;
+	}
+	put_le32(p, CAN_LOG_INDEX_MAGIC);
+	put_le32(p + 4, index.size());
+	put_le64(p + 8, start);
+	write_all(buf.data(), buf.size());
+
+	if (::close(fd) < 0) {
+		fd = -1;
+		throw std::system_error(errno, std::generic_category(),
+					"close " + path);
+	}
+	fd = -1;
+}
+
+can_log_reader::can_log_reader(const std::string &path)
+	: path(path), file(nullptr), created_ns(0), walked(false)
+{
+	uint8_t hdr[CAN_LOG_HEADER_LEN], trailer[CAN_LOG_TRAILER_LEN];
+	uint64_t size, start;
+	uint32_t count, i;
+	struct stat st;
+	char name[17];
+
+	file = fopen(path.c_str(), "rb");
+	if (!file)
+		throw std::system_error(errno, std::generic_category(),
+					"open " + path);
+	if (fstat(fileno(file), &st) < 0 ||
+	    fread(hdr, sizeof(hdr), 1, file) != 1 ||
+	    memcmp(hdr, CAN_LOG_MAGIC, 8) ||
+	    get_le16(hdr + 8) != CAN_LOG_VERSION) {
+		fclose(file);
+		throw std::runtime_error(path + ": not a can log");
+	}
+	created_ns = get_le64(hdr + 16);
+	memcpy(name, hdr + 24, 16);
+	name[16] = '\0';
+	interface = name;
+	size = st.st_size;
+
+	/* the index if the recorder got to write it */
+	if (size >= CAN_LOG_HEADER_LEN + CAN_LOG_TRAILER_LEN &&
+	    fseeko(file, size - CAN_LOG_TRAILER_LEN, SEEK_SET) == 0 &&
+	    fread(trailer, sizeof(trailer), 1, file) == 1 &&
+	    get_le32(trailer) == CAN_LOG_INDEX_MAGIC) {
+		count = get_le32(trailer + 4);
+		start = get_le64(trailer + 8);
+		if (start >= CAN_LOG_HEADER_LEN &&
+		    start + (uint64_t)count * CAN_LOG_INDEX_ENTRY_LEN +
+		    CAN_LOG_TRAILER_LEN == size &&
+		    fseeko(file, start, SEEK_SET) == 0) {
+			uint8_t e[CAN_LOG_INDEX_ENTRY_LEN];
+
+			for (i = 0; i < count; i++) {
+				if (fread(e, sizeof(e), 1, file) != 1)
+					break;
+				index.push_back({ get_le64(e),
+						  get_le64(e + 8),
+						  get_le64(e + 16),
+						  get_le32(e + 24) });
+			}
+			if (i == count)
+				return;
+			index.clear();
+		}
+	}
+
+	walk(size);
+}
+
+can_log_reader::~can_log_reader()
+{
+	fclose(file);
+}
+
+/* no index - find the blocks by their headers */
+void can_log_reader::walk(uint64_t size)
+{
+	uint8_t hdr[CAN_LOG_BLOCK_HEADER_LEN];
+	uint64_t offset = CAN_LOG_HEADER_LEN;
+	uint32_t stored;
+
+	walked = true;
+	while (offset + CAN_LOG_BLOCK_HEADER_LEN <= size &&
+	       fseeko(file, offset, SEEK_SET) == 0 &&
+	       fread(hdr, sizeof(hdr), 1, file) == 1 &&
+	       get_le32(hdr) == CAN_LOG_BLOCK_MAGIC) {
+		stored = get_le32(hdr + 16);
+		if (offset + CAN_LOG_BLOCK_HEADER_LEN + stored > size)
+			break;
+		index.push_back({ offset, get_le64(hdr + 24),
+				  get_le64(hdr + 32), get_le32(hdr + 8) });
+		offset += CAN_LOG_BLOCK_HEADER_LEN + stored;
+	}
+}
+
+/* returns false if it does not decompress to exactly raw.size() bytes */
+static bool decompress(enum can_log_codec codec,
+		       const std::vector<uint8_t> &src,
+		       std::vector<uint8_t> &raw)
+{
+	switch (codec) {
+	case CAN_LOG_RAW:
+		if (src.size() != raw.size())
+			return false;
+		memcpy(raw.data(), src.data(), src.size());
+		return true;
+#ifdef HAVE_LZ4
+	case CAN_LOG_LZ4:
+		return LZ4_decompress_safe(
+			reinterpret_cast<const char *>(src.data()),
+			reinterpret_cast<char *>(raw.data()), src.size(),
+			raw.size()) == (int)raw.size();
+#endif
+#ifdef HAVE_ZSTD
+	case CAN_LOG_ZSTD:
+		return ZSTD_decompress(raw.data(), raw.size(), src.data(),
+				       src.size()) == raw.size();
+#endif
+	default:
+		return false;
+	}
+}
+
+static bool get_varint(const uint8_t **pp, const uint8_t *end, uint64_t *val)
+{
+	const uint8_t *p = *pp;
+	int shift = 0;
+
+	*val = 0;
+	do {
+		if (p == end || shift > 63)
+			return false;
+		*val |= (uint64_t)(*p & 0x7f) << shift;
+		shift += 7;
+	} while (*p++ & 0x80);
+	*pp = p;
+
+	return true;
+}
+
+void can_log_reader::read(size_t i, std::vector<can_proto_frame> &frames)
+{
+	uint8_t hdr[CAN_LOG_BLOCK_HEADER_LEN];
+	enum can_log_codec codec;
+	uint32_t count, n;
+	const uint8_t *p, *end;
+	uint64_t ts;
+
+	frames.clear();
+	if (fseeko(file, index[i].offset, SEEK_SET) != 0 ||
+	    fread(hdr, sizeof(hdr), 1, file) != 1 ||
+	    get_le32(hdr) != CAN_LOG_BLOCK_MAGIC)
+		throw std::runtime_error(path + ": corrupt block");
+
+	codec = static_cast<enum can_log_codec>(hdr[4]);
+	count = get_le32(hdr + 8);
+	raw.resize(get_le32(hdr + 12));
+	stored.resize(get_le32(hdr + 16));
+	ts = get_le64(hdr + 24);
+	if (!can_log_codec_available(codec))
+		throw std::runtime_error(path + ": block compressed with a "
+					 "codec that is not compiled in");
+	if (fread(stored.data(), stored.size(), 1, file) != 1 ||
+	    !decompress(codec, stored, raw))
+		throw std::runtime_error(path + ": corrupt block");
+
+	frames.resize(count);
+	p = raw.data();
+	end = p + raw.size();
+	for (n = 0; n < count; n++) {
+		can_proto_frame &f = frames[n];
+		uint64_t delta;
+
+		if (end - p < 2)
+			break;
+		f.flags = *p++;
+		f.len = *p++;
+		if (f.len > CANFD_MAX_DLEN || !get_varint(&p, end, &delta))
+			break;
+		ts += (int64_t)((delta >> 1) ^ -(delta & 1));
+		f.ts_ns = ts;
+		if (end - p < 4 + f.len)
+			break;
+		f.can_id = get_le32(p);
+		p += 4;
+		memcpy(f.data, p, f.len);
+		p += f.len;
+	}
+	if (n != count)
+		throw std::runtime_error(path + ": corrupt block");
+}
+
+} /* namespace can_app */
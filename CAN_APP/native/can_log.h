@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* block based binary log of can frames - version 1
+ *
+ * a file header, blocks of frames (each compressed on its own) and, once
+ * the file got closed properly, an index of the blocks. all values little
+ * endian:
+ *
+ * file header (64 bytes):
+ *   u8  magic[8]    "CANLOG\r\n"
+ *   u16 version     1
+ *   u16 header_len  64
+ *   u32 reserved
+ *   u64 created     CLOCK_REALTIME in ns when the file was opened
+ *   char ifname[16] the interface it was recorded on
+ *   u8  reserved[24]
+ *
+ * block header (40 bytes):
+ *   u32 magic       CAN_LOG_BLOCK_MAGIC ("CBLK")
+ *   u8  codec       CAN_LOG_RAW, CAN_LOG_LZ4 or CAN_LOG_ZSTD
+ *   u8  reserved[3]
+ *   u32 frames      number of frame records
+ *   u32 raw_len     bytes of frame records once decompressed
+ *   u32 stored_len  bytes following the header
+ *   u32 reserved
+ *   u64 first_ts    timestamp of the first frame
+ *   u64 last_ts     timestamp of the last frame
+ *
+ * frame record:
+ *   u8  flags       CAN_PROTO_FLAG_FD/BRS/ESI, see can_proto.h
+ *   u8  len         payload length (0..64)
+ *   var delta       zigzag LEB128 of the timestamp in ns relative to the
+ *                   previous frame (the first one: to first_ts)
+ *   u32 can_id      with the socketcan EFF/RTR/ERR bits
+ *   u8  data[len]
+ *
+ * index entry (32 bytes), one per block:
+ *   u64 offset      of the block header in the file
+ *   u64 first_ts
+ *   u64 last_ts
+ *   u32 frames
+ *   u32 reserved
+ *
+ * trailer (16 bytes), the last bytes of the file:
+ *   u32 magic       CAN_LOG_INDEX_MAGIC ("CIDX")
+ *   u32 count       number of index entries
+ *   u64 offset      of the first index entry
+ *
+ * a file without trailer (the recorder died) is read by walking the
+ * block headers - a truncated last block is dropped.
+ */
+
+#ifndef __CAN_LOG_H
+#define __CAN_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "can_proto.h"
+
+namespace can_app {
+
+#define CAN_LOG_MAGIC		"CANLOG\r\n"
+#define CAN_LOG_VERSION		1
+#define CAN_LOG_HEADER_LEN	64
+#define CAN_LOG_BLOCK_MAGIC	0x4b4c4243
+#define CAN_LOG_BLOCK_HEADER_LEN	40
+#define CAN_LOG_INDEX_MAGIC	0x58444943
+#define CAN_LOG_INDEX_ENTRY_LEN	32
+#define CAN_LOG_TRAILER_LEN	16
+
+/* the largest frame record: flags, len, 10 byte varint, id, payload */
+#define CAN_LOG_RECORD_MAX	(2 + 10 + 4 + CANFD_MAX_DLEN)
+
+enum can_log_codec {
+	CAN_LOG_RAW,
+	CAN_LOG_LZ4,
+	CAN_LOG_ZSTD,
+};
+
+/* whether codec got compiled in (HAVE_LZ4, HAVE_ZSTD) */
+bool can_log_codec_available(enum can_log_codec codec);
+
+/* "raw", "lz4" or "zstd" - returns false for anything else */
+bool can_log_codec_parse(const char *name, enum can_log_codec *codec);
+
+/* the frames of one block, uncompressed */
+class can_log_block {
+public:
+	void clear();
+	void add(const can_proto_frame &frame);
+
+	size_t size() const { return data.size(); }
+	uint32_t count() const { return frames; }
+	uint64_t first() const { return first_ts; }
+	uint64_t last() const { return last_ts; }
+
+	/* the header and the (compressed) records as they go to the file -
+	 * falls back to CAN_LOG_RAW when compressing does not pay off
+	 */
+	void seal(enum can_log_codec codec, int level,
+		  std::vector<uint8_t> &out) const;
+
+private:
+	std::vector<uint8_t> data;
+	uint32_t frames = 0;
+	uint64_t first_ts = 0;
+	uint64_t last_ts = 0;
+};
+
+struct can_log_index_entry {
+	uint64_t offset;
+	uint64_t first_ts;
+	uint64_t last_ts;
+	uint32_t frames;
+};
+
+/* writes a single file - sealed blocks in, index on close */
+class can_log_writer {
+public:
+	/* throws std::system_error on failure */
+	can_log_writer(const std::string &path, const std::string &ifname,
+		       uint64_t created);
+	/* closes without index on failure */
+	~can_log_writer();
+
+	/* a block as produced by can_log_block::seal */
+	void write(const std::vector<uint8_t> &block);
+
+	/* append index and trailer */
+	void close();
+
+	const std::string &name() const { return path; }
+	uint64_t size() const { return offset; }
+
+private:
+	void write_all(const uint8_t *data, size_t len);
+
+	std::string path;
+	int fd;
+	uint64_t offset;
+	std::vector<can_log_index_entry> index;
+};
+
+/* reads a file block by block */
+class can_log_reader {
+public:
+	/* throws std::system_error or std::runtime_error */
+	explicit can_log_reader(const std::string &path);
+	~can_log_reader();
+
+	const std::string &ifname() const { return interface; }
+	uint64_t created() const { return created_ns; }
+
+	/* the blocks, from the index or by walking the file */
+	const std::vector<can_log_index_entry> &blocks() const
+	{
+		return index;
+	}
+	/* the file had no index - it was not closed properly */
+	bool recovered() const { return walked; }
+
+	/* the frames of block i - throws std::runtime_error if it is
+	 * corrupt or compressed with a codec that is not compiled in
+	 */
+	void read(size_t i, std::vector<can_proto_frame> &frames);
+
+private:
+	void walk(uint64_t size);
+
+	std::string path;
+	FILE *file;
+	std::string interface;
+	uint64_t created_ns;
+	std::vector<can_log_index_entry> index;
+	bool walked;
+	std::vector<uint8_t> stored;
+	std::vector<uint8_t> raw;
+};
+
+} /* namespace can_app */
+
+#endif /* __CAN_LOG_H */
@@ -0,0 +1,907 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* can0 <-> can1 loopback benchmark
+ *
+ * sends sequenced frames (see traffic.h) on one interface and receives
+ * them on the other, for every combination of bitrate, data bitrate,
+ * frame type (classic, fd, fd with bit rate switch) and payload length
+ * given. per combination it reports the throughput, the loss, the
+ * reordering and the one-way latency from the transmit to the receive
+ * timestamp of every frame.
+ *
+ * the receive timestamps are the hardware ones where the interface
+ * provides them (see mcp25xxfd_can_ptp.c), otherwise the software ones.
+ * the transmit timestamps come from the error queue of the sending socket
+ * (hardware or software), without them the time of the sendmmsg call is
+ * used. the hardware clocks of both controllers start at system time -
+ * keep them in sync with phc2sys for precise latencies, see
+ * can_hwtstamp.py.
+ *
+ * the interfaces get configured for every case over rtnetlink (see
+ * can_link.h), which needs root or CAP_NET_ADMIN. with -k they are used
+ * as they are - set them up beforehand, e.g.
+ *   ip link set can0 up type can bitrate 1000000 dbitrate 2000000 fd on
+ * and give a single bitrate and data bitrate matching that setup.
+ *
+ * in vcan and vxcan mode the same runs without hardware (bitrates do not
+ * apply there), e.g. to check the benchmark itself:
+ *   can_loopback -M vcan -F classic,fd -L 4,8,64 -c
+ */
+
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "can_link.h"
+#include "can_socket.h"
+#include "traffic.h"
+
+enum loopback_mode {
+	LOOPBACK_CAN,
+	LOOPBACK_VCAN,
+	LOOPBACK_VXCAN,
+};
+
+enum loopback_type {
+	LOOPBACK_CLASSIC,
+	LOOPBACK_FD,
+	LOOPBACK_BRS,
+};
+
+enum loopback_output {
+	LOOPBACK_OUTPUT_TABLE,
+	LOOPBACK_OUTPUT_CSV,
+	LOOPBACK_OUTPUT_JSON,
+};
+
+static const char *const mode_names[] = { "can", "vcan", "vxcan" };
+static const char *const type_names[] = { "classic", "fd", "brs" };
+
+struct loopback_config {
+	enum loopback_mode mode = LOOPBACK_CAN;
+	std::string tx_ifname;
+	std::string rx_ifname;
+	std::vector<unsigned long> bitrates = { 1000000 };
+	std::vector<unsigned long> dbitrates = { 2000000 };
+	std::vector<unsigned long> lens = { 8 };
+	std::vector<enum loopback_type> types = { LOOPBACK_CLASSIC };
+	std::vector<can_app::traffic_id_range> ids;
+	/* frames per case, sent at rate frames/s - 0 is as fast as possible */
+	unsigned long frames = 10000;
+	double rate = 0;
+	unsigned int batch = 32;
+	/* end a case after this long without progress */
+	unsigned int drain_ms = 1000;
+	/* set the bitrates with ip link, create vcan and vxcan interfaces */
+	bool configure = true;
+	/* fail unless every frame arrived once and in order */
+	bool check = false;
+	enum loopback_output output = LOOPBACK_OUTPUT_TABLE;
+};
+
+struct loopback_case {
+	unsigned long bitrate;
+	unsigned long dbitrate;
+	enum loopback_type type;
+	uint8_t len;
+};
+
+struct loopback_result {
+	struct loopback_case c;
+	uint64_t sent;
+	uint64_t received;
+	uint64_t lost;
+	uint64_t reordered;
+	uint64_t duplicates;
+	/* frames on the bus that were not sent by this case */
+	uint64_t foreign;
+	uint64_t enobufs;
+	uint32_t kernel_drops;
+	double tx_fps;
+	double rx_fps;
+	double rx_bytes_per_s;
+	/* the timestamps the latencies were taken from */
+	const char *rx_ts;
+	const char *tx_ts;
+	/* latency in us - min, p50, p90, p99, p99.9, max and mean */
+	double latency[7];
+};
+
+static const char *const latency_names[] = {
+	"min", "p50", "p90", "p99", "p999", "max", "mean"
+};
+
+/* where the transmit timestamp of a frame came from */
+enum tx_source {
+	TX_SOURCE_SEND,
+	TX_SOURCE_SW,
+	TX_SOURCE_HW,
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+class loopback_run {
+public:
+	loopback_run(const loopback_config &config, const loopback_case &c);
+	~loopback_run();
+
+	void run(struct loopback_result *result);
+
+private:
+	void send(uint64_t now);
+	void receive();
+	void read_tx_timestamps();
+	uint64_t next_due(uint64_t now) const;
+	void summarize(struct loopback_result *result) const;
+
+	const loopback_config &config;
+	loopback_case c;
+	can_app::traffic traffic;
+	int tx_sock;
+	int rx_sock;
+	can_app::can_writer writer;
+	can_app::can_reader reader;
+	can_app::can_reader errqueue;
+
+	/* per sequence number - the time of the sendmmsg call, the transmit
+	 * timestamp and the receive timestamp (0 until received)
+	 */
+	std::vector<uint64_t> tx_ns;
+	std::vector<uint64_t> tx_stamp;
+	std::vector<uint8_t> tx_source;
+	std::vector<uint64_t> rx_ns;
+
+	/* the batch of the writer, pos frames of it are sent */
+	unsigned int pending;
+	unsigned int pos;
+	uint32_t batch_seq;
+	bool blocked;
+	uint64_t backoff_until;
+
+	uint64_t start;
+	uint64_t last_tx;
+	uint64_t first_rx;
+	uint64_t last_rx;
+	uint64_t sent;
+	uint64_t received;
+	uint64_t rx_hw;
+	int64_t highest;
+	uint32_t last_stamp;
+	uint64_t reordered;
+	uint64_t duplicates;
+	uint64_t foreign;
+	uint64_t enobufs;
+};
+
+static int open_rx(const loopback_config &config, bool fd, int tx_sock)
+{
+	try {
+		return can_app::can_socket_open(config.rx_ifname, fd, 4 << 20);
+	} catch (...) {
+		close(tx_sock);
+		throw;
+	}
+}
+
+loopback_run::loopback_run(const loopback_config &config,
+			   const loopback_case &c)
+	: config(config), c(c),
+	  traffic({ config.ids, { { c.len, 1 } },
+		    c.type != LOOPBACK_CLASSIC ? 100U : 0U,
+		    c.type == LOOPBACK_BRS ? 100U : 0U }),
+	  tx_sock(can_app::can_socket_open_tx(config.tx_ifname,
+					      c.type != LOOPBACK_CLASSIC, 0)),
+	  rx_sock(open_rx(config, c.type != LOOPBACK_CLASSIC, tx_sock)),
+	  writer(tx_sock, config.batch), reader(rx_sock, config.batch),
+	  errqueue(tx_sock, config.batch),
+	  tx_ns(config.frames), tx_stamp(config.frames),
+	  tx_source(config.frames), rx_ns(config.frames),
+	  pending(0), pos(0), batch_seq(0), blocked(false), backoff_until(0),
+	  start(0), last_tx(0), first_rx(0), last_rx(0), sent(0),
+	  received(0), rx_hw(0), highest(-1), last_stamp(0), reordered(0),
+	  duplicates(0), foreign(0), enobufs(0)
+{
+	can_app::can_socket_tx_timestamps(tx_sock, config.tx_ifname);
+}
+
+loopback_run::~loopback_run()
+{
+	close(tx_sock);
+	close(rx_sock);
+}
+
+void loopback_run::send(uint64_t now)
+{
+	unsigned int i, n;
+	int ret;
+
+	if (sent == config.frames || blocked || now < backoff_until)
+		return;
+
+	if (pos == pending) {
+		pending = std::min<uint64_t>(config.batch,
+					     config.frames - sent);
+		batch_seq = traffic.seq();
+		for (i = 0; i < pending; i++)
+			writer.set_fd(i, traffic.next(writer.frame(i)));
+		pos = 0;
+	}
+	n = pending - pos;
+
+	/* frames due by now on the schedule of the rate */
+	if (config.rate > 0) {
+		uint64_t due = (now - start) / 1e9 * config.rate + 1;
+
+		if (due <= sent)
+			return;
+		if (n > due - sent)
+			n = due - sent;
+	}
+
+	now = can_app::can_time_ns();
+	ret = writer.write(pos, n);
+	if (ret == -EAGAIN) {
+		blocked = true;
+		return;
+	} else if (ret == -ENOBUFS) {
+		/* the tx queue of the interface is full */
+		enobufs++;
+		backoff_until = now + 100000;
+		return;
+	} else if (ret < 0) {
+		throw std::system_error(-ret, std::generic_category(),
+					"sendmmsg");
+	}
+
+	for (i = 0; i < (unsigned int)ret; i++)
+		tx_ns[batch_seq + pos + i] = now;
+	pos += ret;
+	sent += ret;
+	last_tx = now;
+}
+
+void loopback_run::receive()
+{
+	int count, i;
+
+	while ((count = reader.read()) > 0) {
+		for (i = 0; i < count; i++) {
+			const can_app::can_rx_frame &rx = reader[i];
+			uint32_t seq;
+
+			if (rx.frame.len != c.len ||
+			    rx.fd != (c.type != LOOPBACK_CLASSIC)) {
+				foreign++;
+				continue;
+			}
+
+			seq = can_app::traffic_seq(rx.frame.data, rx.frame.len,
+						   highest + 1);
+			if (seq >= sent) {
+				foreign++;
+				continue;
+			}
+			if (rx_ns[seq]) {
+				duplicates++;
+				continue;
+			}
+			if ((int64_t)seq < highest)
+				reordered++;
+			else
+				highest = seq;
+
+			rx_ns[seq] = rx.ts_ns;
+			if (!received || rx.ts_ns < first_rx)
+				first_rx = rx.ts_ns;
+			if (rx.ts_ns > last_rx)
+				last_rx = rx.ts_ns;
+			if (rx.hwts)
+				rx_hw++;
+			received++;
+		}
+		if ((unsigned int)count < config.batch)
+			break;
+	}
+	if (count < 0)
+		throw std::system_error(-count, std::generic_category(),
+					"recvmmsg");
+}
+
+void loopback_run::read_tx_timestamps()
+{
+	int count, i;
+
+	while ((count = errqueue.read(MSG_ERRQUEUE)) > 0) {
+		for (i = 0; i < count; i++) {
+			const can_app::can_rx_frame &tx = errqueue[i];
+			uint32_t seq;
+
+			if (!tx.ts_ns)
+				continue;
+
+			/* software and hardware timestamps of a frame are
+			 * reported separately, in the order of sending
+			 */
+			seq = can_app::traffic_seq(tx.frame.data, tx.frame.len,
+						   last_stamp);
+			if (seq >= sent)
+				continue;
+			last_stamp = seq;
+
+			if (tx.hwts) {
+				tx_stamp[seq] = tx.ts_ns;
+				tx_source[seq] = TX_SOURCE_HW;
+			} else if (tx_source[seq] != TX_SOURCE_HW) {
+				tx_stamp[seq] = tx.ts_ns;
+				tx_source[seq] = TX_SOURCE_SW;
+			}
+		}
+		if ((unsigned int)count < config.batch)
+			break;
+	}
+}
+
+/* the time until the next frame is due on the schedule of the rate */
+uint64_t loopback_run::next_due(uint64_t now) const
+{
+	uint64_t due = start + (uint64_t)((sent + 1) / config.rate * 1e9);
+
+	return due > now ? due - now : 0;
+}
+
+void loopback_run::run(struct loopback_result *result)
+{
+	uint64_t drain_ns = config.drain_ms * 1000000ULL;
+	uint64_t now, last_event;
+
+	start = last_event = can_app::can_time_ns();
+	while (!stop) {
+		struct pollfd pfd[2] = {
+			{ rx_sock, POLLIN, 0 },
+			{ tx_sock, (short)(blocked ? POLLOUT : 0), 0 },
+		};
+		uint64_t timeout = 0, progress = sent + received;
+		struct timespec ts;
+
+		now = can_app::can_time_ns();
+		send(now);
+
+		if (sent < config.frames) {
+			if (blocked)
+				timeout = 10000000;
+			else if (now < backoff_until)
+				timeout = backoff_until - now;
+			else if (config.rate > 0)
+				timeout = next_due(now);
+		} else if (received == sent) {
+			break;
+		} else if (now - last_event >= drain_ns) {
+			break;
+		} else {
+			timeout = drain_ns - (now - last_event);
+		}
+
+		ts.tv_sec = timeout / 1000000000ULL;
+		ts.tv_nsec = timeout % 1000000000ULL;
+		if (ppoll(pfd, 2, &ts, nullptr) < 0 && errno != EINTR)
+			throw std::system_error(errno, std::generic_category(),
+						"ppoll");
+
+		if (pfd[1].revents & POLLOUT)
+			blocked = false;
+		if (pfd[1].revents & POLLERR)
+			read_tx_timestamps();
+		if (pfd[0].revents & POLLIN)
+			receive();
+
+		if (sent + received != progress)
+			last_event = can_app::can_time_ns();
+	}
+
+	/* the transmit timestamps may trail the received frames */
+	receive();
+	read_tx_timestamps();
+
+	summarize(result);
+}
+
+static double percentile(const std::vector<int64_t> &sorted, double q)
+{
+	size_t i = q * sorted.size();
+
+	return sorted[std::min(i, sorted.size() - 1)] / 1000.0;
+}
+
+void loopback_run::summarize(struct loopback_result *r) const
+{
+	uint64_t tx_sources[3] = { 0, 0, 0 };
+	std::vector<int64_t> latencies;
+	double sum = 0;
+	uint64_t seq;
+
+	memset(r, 0, sizeof(*r));
+	r->c = c;
+	r->sent = sent;
+	r->received = received;
+	r->lost = sent - received;
+	r->reordered = reordered;
+	r->duplicates = duplicates;
+	r->foreign = foreign;
+	r->enobufs = enobufs;
+	r->kernel_drops = reader.kernel_drops();
+	if (last_tx > start)
+		r->tx_fps = sent / ((last_tx - start) / 1e9);
+	if (received > 1 && last_rx > first_rx) {
+		r->rx_fps = (received - 1) / ((last_rx - first_rx) / 1e9);
+		r->rx_bytes_per_s = r->rx_fps * c.len;
+	}
+
+	latencies.reserve(received);
+	for (seq = 0; seq < sent; seq++) {
+		uint64_t ref;
+
+		if (!rx_ns[seq])
+			continue;
+		ref = tx_source[seq] == TX_SOURCE_SEND ?
+			tx_ns[seq] : tx_stamp[seq];
+		latencies.push_back(rx_ns[seq] - ref);
+		tx_sources[tx_source[seq]]++;
+		sum += latencies.back();
+	}
+
+	r->rx_ts = !received ? "none" : rx_hw == received ? "hw" :
+		rx_hw ? "mixed" : "sw";
+	if (!received)
+		r->tx_ts = "none";
+	else if (tx_sources[TX_SOURCE_HW] == received)
+		r->tx_ts = "hw";
+	else if (tx_sources[TX_SOURCE_SW] == received)
+		r->tx_ts = "sw";
+	else if (tx_sources[TX_SOURCE_SEND] == received)
+		r->tx_ts = "send";
+	else
+		r->tx_ts = "mixed";
+
+	if (latencies.empty())
+		return;
+	std::sort(latencies.begin(), latencies.end());
+	r->latency[0] = latencies.front() / 1000.0;
+	r->latency[1] = percentile(latencies, 0.5);
+	r->latency[2] = percentile(latencies, 0.9);
+	r->latency[3] = percentile(latencies, 0.99);
+	r->latency[4] = percentile(latencies, 0.999);
+	r->latency[5] = latencies.back() / 1000.0;
+	r->latency[6] = sum / latencies.size() / 1000.0;
+}
+
+/* create the virtual interfaces if needed and allow fd frames on them */
+static void setup_virtual(const loopback_config &config)
+{
+	if (!if_nametoindex(config.tx_ifname.c_str())) {
+		if (config.mode == LOOPBACK_VCAN)
+			can_app::can_link_add(config.tx_ifname, "vcan");
+		else
+			can_app::can_link_add(config.tx_ifname, "vxcan",
+					      config.rx_ifname);
+	}
+
+	for (const std::string &ifname :
+	     { config.tx_ifname, config.rx_ifname }) {
+		can_app::can_link_set_up(ifname, false);
+		can_app::can_link_set_up(ifname, true, CANFD_MTU);
+	}
+}
+
+static void setup_can(const std::string &ifname, const loopback_case &c)
+{
+	can_app::can_link_set_up(ifname, false);
+	can_app::can_link_set_bitrate(ifname, c.bitrate,
+				      c.type == LOOPBACK_CLASSIC ?
+				      0 : c.dbitrate);
+	can_app::can_link_set_up(ifname, true);
+}
+
+static void add_cases(const loopback_config &config, unsigned long bitrate,
+		      unsigned long dbitrate, enum loopback_type type,
+		      std::vector<loopback_case> *cases)
+{
+	for (unsigned long len : config.lens) {
+		uint8_t l = can_app::traffic_fd_len(len);
+
+		/* classic frames carry at most 8 bytes */
+		if (type == LOOPBACK_CLASSIC && l > CAN_MAX_DLEN)
+			continue;
+		cases->push_back({ bitrate, dbitrate, type, l });
+	}
+}
+
+static std::vector<loopback_case> make_cases(const loopback_config &config)
+{
+	std::vector<unsigned long> bitrates = config.bitrates;
+	std::vector<unsigned long> dbitrates = config.dbitrates;
+	std::vector<loopback_case> cases;
+
+	if (config.mode != LOOPBACK_CAN)
+		bitrates = dbitrates = { 0 };
+
+	for (unsigned long bitrate : bitrates) {
+		for (enum loopback_type type : config.types) {
+			/* the data bitrate applies to fd frames only */
+			if (type == LOOPBACK_CLASSIC)
+				add_cases(config, bitrate, 0, type, &cases);
+			else
+				for (unsigned long dbitrate : dbitrates)
+					add_cases(config, bitrate, dbitrate,
+						  type, &cases);
+		}
+	}
+
+	return cases;
+}
+
+struct result_field {
+	const char *name;
+	std::string value;
+	bool text;
+};
+
+static std::string format_double(double val)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%.1f", val);
+
+	return buf;
+}
+
+static std::vector<result_field>
+result_fields(const loopback_config &config, const loopback_result &r)
+{
+	std::vector<result_field> fields = {
+		{ "mode", mode_names[config.mode], true },
+		{ "tx", config.tx_ifname, true },
+		{ "rx", config.rx_ifname, true },
+		{ "bitrate", std::to_string(r.c.bitrate), false },
+		{ "dbitrate", std::to_string(r.c.dbitrate), false },
+		{ "type", type_names[r.c.type], true },
+		{ "len", std::to_string(r.c.len), false },
+		{ "sent", std::to_string(r.sent), false },
+		{ "received", std::to_string(r.received), false },
+		{ "lost", std::to_string(r.lost), false },
+		{ "reordered", std::to_string(r.reordered), false },
+		{ "duplicates", std::to_string(r.duplicates), false },
+		{ "foreign", std::to_string(r.foreign), false },
+		{ "enobufs", std::to_string(r.enobufs), false },
+		{ "kernel_drops", std::to_string(r.kernel_drops), false },
+		{ "tx_fps", format_double(r.tx_fps), false },
+		{ "rx_fps", format_double(r.rx_fps), false },
+		{ "rx_bytes_per_s", format_double(r.rx_bytes_per_s), false },
+		{ "rx_ts", r.rx_ts, true },
+		{ "tx_ts", r.tx_ts, true },
+	};
+	static const char *const latency_fields[] = {
+		"latency_min_us", "latency_p50_us", "latency_p90_us",
+		"latency_p99_us", "latency_p999_us", "latency_max_us",
+		"latency_mean_us"
+	};
+	unsigned int i;
+
+	for (i = 0; i < 7; i++)
+		fields.push_back({ latency_fields[i],
+				   format_double(r.latency[i]), false });
+
+	return fields;
+}
+
+static void print_case(FILE *out, const loopback_result &r)
+{
+	unsigned int i;
+
+	fprintf(out, "%lu/%lu %s len %u: %llu sent, %llu received, "
+		"%llu lost, %llu reordered, %.0f frames/s\n",
+		r.c.bitrate, r.c.dbitrate, type_names[r.c.type], r.c.len,
+		(unsigned long long)r.sent, (unsigned long long)r.received,
+		(unsigned long long)r.lost, (unsigned long long)r.reordered,
+		r.rx_fps);
+	fprintf(out, "  latency (rx %s, tx %s):", r.rx_ts, r.tx_ts);
+	for (i = 0; i < 7; i++)
+		fprintf(out, " %s %.1fus", latency_names[i], r.latency[i]);
+	fprintf(out, "\n");
+	fflush(out);
+}
+
+static void print_csv(const loopback_config &config,
+		      const std::vector<loopback_result> &results)
+{
+	bool header = true;
+
+	for (const loopback_result &r : results) {
+		std::vector<result_field> fields = result_fields(config, r);
+		size_t i;
+
+		if (header) {
+			for (i = 0; i < fields.size(); i++)
+				printf("%s%s", i ? "," : "", fields[i].name);
+			printf("\n");
+			header = false;
+		}
+		for (i = 0; i < fields.size(); i++)
+			printf("%s%s", i ? "," : "", fields[i].value.c_str());
+		printf("\n");
+	}
+}
+
+static void print_json(const loopback_config &config,
+		       const std::vector<loopback_result> &results)
+{
+	size_t n, i;
+
+	printf("[\n");
+	for (n = 0; n < results.size(); n++) {
+		std::vector<result_field> fields =
+			result_fields(config, results[n]);
+
+		printf("  {");
+		for (i = 0; i < fields.size(); i++)
+			printf(fields[i].text ? "%s\"%s\": \"%s\"" :
+			       "%s\"%s\": %s", i ? ", " : "",
+			       fields[i].name, fields[i].value.c_str());
+		printf("}%s\n", n + 1 < results.size() ? "," : "");
+	}
+	printf("]\n");
+}
+
+static std::vector<unsigned long> parse_list(const std::string &spec)
+{
+	std::vector<unsigned long> list;
+	std::stringstream ss(spec);
+	std::string item;
+
+	while (std::getline(ss, item, ',')) {
+		char *end;
+
+		errno = 0;
+		list.push_back(strtoul(item.c_str(), &end, 0));
+		if (errno || end == item.c_str() || *end)
+			throw std::invalid_argument("invalid number: " + item);
+	}
+	if (list.empty())
+		throw std::invalid_argument("empty list: " + spec);
+
+	return list;
+}
+
+/* every frame carries its full sequence number - see traffic.h */
+static std::vector<unsigned long> parse_lens(const std::string &spec)
+{
+	std::vector<unsigned long> lens = parse_list(spec);
+
+	for (unsigned long len : lens)
+		if (len < 4 || len > CANFD_MAX_DLEN)
+			throw std::invalid_argument("invalid payload length " +
+						    std::to_string(len) +
+						    ", use 4 to 64");
+
+	return lens;
+}
+
+static std::vector<enum loopback_type> parse_types(const std::string &spec)
+{
+	std::vector<enum loopback_type> types;
+	std::stringstream ss(spec);
+	std::string item;
+
+	while (std::getline(ss, item, ',')) {
+		unsigned int i;
+
+		for (i = 0; i < 3; i++)
+			if (item == type_names[i])
+				break;
+		if (i == 3)
+			throw std::invalid_argument("invalid frame type: " +
+						    item);
+		types.push_back((enum loopback_type)i);
+	}
+	if (types.empty())
+		throw std::invalid_argument("empty list: " + spec);
+
+	return types;
+}
+
+static int run(loopback_config &config)
+{
+	std::vector<loopback_case> cases = make_cases(config);
+	std::vector<loopback_result> results;
+	FILE *progress = config.output == LOOPBACK_OUTPUT_TABLE ?
+		stdout : stderr;
+	bool failed = false;
+
+	if (config.configure && config.mode != LOOPBACK_CAN)
+		setup_virtual(config);
+
+	for (const loopback_case &c : cases) {
+		loopback_result result;
+
+		if (stop)
+			break;
+
+		if (config.configure && config.mode == LOOPBACK_CAN) {
+			setup_can(config.tx_ifname, c);
+			setup_can(config.rx_ifname, c);
+			/* let both controllers join the bus */
+			usleep(100000);
+		}
+
+		loopback_run(config, c).run(&result);
+		print_case(progress, result);
+		results.push_back(result);
+
+		if (!result.received || result.lost || result.reordered ||
+		    result.duplicates)
+			failed = true;
+	}
+
+	if (config.output == LOOPBACK_OUTPUT_CSV)
+		print_csv(config, results);
+	else if (config.output == LOOPBACK_OUTPUT_JSON)
+		print_json(config, results);
+
+	if (config.check && failed) {
+		fprintf(stderr, "can_loopback: frames were lost, duplicated "
+			"or reordered\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -M <mode>      can (default), vcan or vxcan\n"
+		"  -t <ifname>    sending interface (default can0, vcan0\n"
+		"                 or vxcan0)\n"
+		"  -r <ifname>    receiving interface (default can1, vcan0\n"
+		"                 or vxcan1)\n"
+		"  -b <bitrates>  e.g. 125000,500000,1000000 (default\n"
+		"                 1000000)\n"
+		"  -d <bitrates>  data bitrates of fd frames (default\n"
+		"                 2000000)\n"
+		"  -F <types>     classic, fd and/or brs (default classic)\n"
+		"  -L <lens>      payload lengths 4 to 64, e.g. 4,8,64\n"
+		"                 (default 8)\n"
+		"  -I <ids>       ids, e.g. 0x123,0x200-0x20f,0x1234e\n"
+		"  -n <frames>    frames per case (default 10000)\n"
+		"  -R <rate>      frames per second (default: as fast as\n"
+		"                 the interface accepts them)\n"
+		"  -m <frames>    frames per sendmmsg (default 32)\n"
+		"  -w <ms>        end a case after ms without progress\n"
+		"                 (default 1000)\n"
+		"  -k             keep the interface configuration - without\n"
+		"                 it the interfaces get configured, which\n"
+		"                 needs root or CAP_NET_ADMIN\n"
+		"  -o <format>    table (default), csv or json\n"
+		"  -c             exit with 1 unless all frames arrived\n"
+		"                 once and in order\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	loopback_config config;
+	int opt;
+
+	try {
+		while ((opt = getopt(argc, argv,
+				     "M:t:r:b:d:F:L:I:n:R:m:w:ko:ch")) != -1) {
+			switch (opt) {
+			case 'M':
+				if (!strcmp(optarg, "can"))
+					config.mode = LOOPBACK_CAN;
+				else if (!strcmp(optarg, "vcan"))
+					config.mode = LOOPBACK_VCAN;
+				else if (!strcmp(optarg, "vxcan"))
+					config.mode = LOOPBACK_VXCAN;
+				else
+					usage(argv[0]);
+				break;
+			case 't':
+				config.tx_ifname = optarg;
+				break;
+			case 'r':
+				config.rx_ifname = optarg;
+				break;
+			case 'b':
+				config.bitrates = parse_list(optarg);
+				break;
+			case 'd':
+				config.dbitrates = parse_list(optarg);
+				break;
+			case 'F':
+				config.types = parse_types(optarg);
+				break;
+			case 'L':
+				config.lens = parse_lens(optarg);
+				break;
+			case 'I':
+				config.ids = can_app::traffic_parse_ids(optarg);
+				break;
+			case 'n':
+				config.frames = strtoul(optarg, NULL, 0);
+				break;
+			case 'R':
+				config.rate = atof(optarg);
+				break;
+			case 'm':
+				config.batch = strtoul(optarg, NULL, 0);
+				break;
+			case 'w':
+				config.drain_ms = strtoul(optarg, NULL, 0);
+				break;
+			case 'k':
+				config.configure = false;
+				break;
+			case 'o':
+				if (!strcmp(optarg, "table"))
+					config.output = LOOPBACK_OUTPUT_TABLE;
+				else if (!strcmp(optarg, "csv"))
+					config.output = LOOPBACK_OUTPUT_CSV;
+				else if (!strcmp(optarg, "json"))
+					config.output = LOOPBACK_OUTPUT_JSON;
+				else
+					usage(argv[0]);
+				break;
+			case 'c':
+				config.check = true;
+				break;
+			default:
+				usage(argv[0]);
+			}
+		}
+		if (!config.batch || !config.frames)
+			usage(argv[0]);
+		/* the bitrates of a kept configuration are just labels */
+		if (!config.configure && config.mode == LOOPBACK_CAN &&
+		    (config.bitrates.size() > 1 || config.dbitrates.size() > 1))
+			throw std::invalid_argument("-k takes a single bitrate "
+						    "and data bitrate");
+
+		if (config.tx_ifname.empty())
+			config.tx_ifname = config.mode == LOOPBACK_CAN ?
+				"can0" : config.mode == LOOPBACK_VCAN ?
+				"vcan0" : "vxcan0";
+		if (config.rx_ifname.empty())
+			config.rx_ifname = config.mode == LOOPBACK_CAN ?
+				"can1" : config.mode == LOOPBACK_VCAN ?
+				"vcan0" : "vxcan1";
+
+		signal(SIGINT, on_signal);
+		signal(SIGTERM, on_signal);
+
+		return run(config);
+	} catch (const std::exception &e) {
+		fprintf(stderr, "can_loopback: %s\n", e.what());
+		return 1;
+	}
+}
@@ -0,0 +1,303 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* batched binary stream of can frames - see can_proto.h */
+
+#include <string.h>
+
+#include "can_proto.h"
+
+namespace can_app {
+
+static void put_le16(uint8_t *p, uint16_t val)
+{
+	p[0] = val;
+	p[1] = val >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t val)
+{
+	put_le16(p, val);
+	put_le16(p + 2, val >> 16);
+}
+
+static void put_le64(uint8_t *p, uint64_t val)
+{
+	put_le32(p, val);
+	put_le32(p + 4, val >> 32);
+}
+
+void can_proto_encoder::begin(std::vector<uint8_t> &out, uint64_t base_ts_ns)
+{
+	uint8_t *hdr;
+
+	this->out = &out;
+	this->base_ts_ns = base_ts_ns;
+	start = out.size();
+	frames = 0;
+	last_us = 0;
+
+	out.resize(start + CAN_PROTO_HEADER_LEN);
+	hdr = &out[start];
+	hdr[0] = CAN_PROTO_MAGIC0;
+	hdr[1] = CAN_PROTO_MAGIC1;
+	hdr[2] = CAN_PROTO_VERSION;
+	hdr[3] = 0;
+	put_le16(hdr + 4, CAN_PROTO_HEADER_LEN);
+	put_le64(hdr + 12, base_ts_ns);
+}
+
+void can_proto_encoder::add(const can_proto_frame &frame)
+{
+	int64_t us = (int64_t)(frame.ts_ns - base_ts_ns) / 1000;
+	/* zigzag, so small negative deltas stay short as well */
+	uint64_t delta = ((uint64_t)(us - last_us) << 1) ^
+		(uint64_t)((us - last_us) >> 63);
+	size_t pos = out->size();
+	uint8_t flags = frame.flags &
+		(CAN_PROTO_FLAG_FD | CAN_PROTO_FLAG_BRS | CAN_PROTO_FLAG_ESI);
+	uint8_t *p;
+
+	if (frame.can_id & CAN_EFF_FLAG)
+		flags |= CAN_PROTO_FLAG_EFF;
+	if (frame.can_id & CAN_RTR_FLAG)
+		flags |= CAN_PROTO_FLAG_RTR;
+	if (frame.can_id & CAN_ERR_FLAG)
+		flags |= CAN_PROTO_FLAG_ERR;
+
+	out->resize(pos + CAN_PROTO_RECORD_MAX);
+	p = &(*out)[pos];
+	*p++ = flags;
+	*p++ = frame.len;
+	do {
+		*p++ = (delta & 0x7f) | (delta > 0x7f ? 0x80 : 0);
+		delta >>= 7;
+	} while (delta);
+	if (flags & CAN_PROTO_FLAG_EFF) {
+		put_le32(p, frame.can_id & CAN_EFF_MASK);
+		p += 4;
+	} else {
+		put_le16(p, frame.can_id & CAN_SFF_MASK);
+		p += 2;
+	}
+	memcpy(p, frame.data, frame.len);
+	p += frame.len;
+	out->resize(p - out->data());
+
+	last_us = us;
+	frames++;
+}
+
+size_t can_proto_encoder::finish()
+{
+	uint8_t *hdr = &(*out)[start];
+	size_t len = out->size() - start;
+
+	put_le16(hdr + 6, frames);
+	put_le32(hdr + 8, len - CAN_PROTO_HEADER_LEN);
+
+	return len;
+}
+
+void can_proto_subscription(std::vector<uint8_t> &out,
+			    const std::vector<struct can_filter> &filters)
+{
+	size_t pos = out.size();
+	uint8_t *p;
+
+	out.resize(pos + CAN_PROTO_SUB_HEADER_LEN + 8 * filters.size());
+	p = &out[pos];
+	p[0] = CAN_PROTO_SUB_MAGIC0;
+	p[1] = CAN_PROTO_SUB_MAGIC1;
+	p[2] = CAN_PROTO_VERSION;
+	p[3] = 0;
+	put_le16(p + 4, filters.size());
+	put_le16(p + 6, 0);
+	p += CAN_PROTO_SUB_HEADER_LEN;
+
+	for (const struct can_filter &f : filters) {
+		put_le32(p, f.can_id);
+		put_le32(p + 4, f.can_mask);
+		p += 8;
+	}
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+long can_proto_parse_subscription(const uint8_t *data, size_t len,
+				  std::vector<struct can_filter> *filters)
+{
+	unsigned int count, i;
+	size_t size;
+
+	if (len < CAN_PROTO_SUB_HEADER_LEN)
+		return 0;
+	if (data[0] != CAN_PROTO_SUB_MAGIC0 ||
+	    data[1] != CAN_PROTO_SUB_MAGIC1 ||
+	    data[2] != CAN_PROTO_VERSION)
+		return -1;
+
+	count = data[4] | data[5] << 8;
+	if (count > CAN_PROTO_SUB_MAX)
+		return -1;
+	size = CAN_PROTO_SUB_HEADER_LEN + 8 * count;
+	if (len < size)
+		return 0;
+
+	filters->resize(count);
+	data += CAN_PROTO_SUB_HEADER_LEN;
+	for (i = 0; i < count; i++, data += 8) {
+		(*filters)[i].can_id = get_le32(data);
+		(*filters)[i].can_mask = get_le32(data + 4);
+	}
+
+	return size;
+}
+
+void can_proto_dgram_header(uint8_t *p, uint64_t seq, uint8_t flags,
+			    uint16_t length)
+{
+	p[0] = CAN_PROTO_DGRAM_MAGIC0;
+	p[1] = CAN_PROTO_DGRAM_MAGIC1;
+	p[2] = CAN_PROTO_VERSION;
+	p[3] = flags;
+	put_le16(p + 4, length);
+	put_le16(p + 6, 0);
+	put_le64(p + 8, seq);
+}
+
+void can_proto_backfill_request(std::vector<uint8_t> &out, uint64_t seq,
+				uint32_t count)
+{
+	size_t pos = out.size();
+	uint8_t *p;
+
+	out.resize(pos + CAN_PROTO_REQ_LEN);
+	p = &out[pos];
+	p[0] = CAN_PROTO_REQ_MAGIC0;
+	p[1] = CAN_PROTO_REQ_MAGIC1;
+	p[2] = CAN_PROTO_VERSION;
+	p[3] = 0;
+	put_le32(p + 4, count);
+	put_le64(p + 8, seq);
+}
+
+long can_proto_parse_backfill(const uint8_t *data, size_t len,
+			      uint64_t *seq, uint32_t *count)
+{
+	if (len < CAN_PROTO_REQ_LEN)
+		return 0;
+	if (data[0] != CAN_PROTO_REQ_MAGIC0 ||
+	    data[1] != CAN_PROTO_REQ_MAGIC1 ||
+	    data[2] != CAN_PROTO_VERSION)
+		return -1;
+
+	*count = get_le32(data + 4);
+	*seq = get_le32(data + 8) | (uint64_t)get_le32(data + 12) << 32;
+
+	return CAN_PROTO_REQ_LEN;
+}
+
+bool can_proto_decoder::decode_record(const uint8_t **pp, const uint8_t *end,
+				      can_proto_frame *frame, int64_t *last_us)
+{
+	const uint8_t *p = *pp;
+	uint64_t delta = 0;
+	int shift = 0;
+	uint8_t flags;
+
+	if (end - p < 2)
+		return false;
+	flags = *p++;
+	frame->len = *p++;
+	if (frame->len > CANFD_MAX_DLEN)
+		return false;
+
+	do {
+		if (p == end || shift > 63)
+			return false;
+		delta |= (uint64_t)(*p & 0x7f) << shift;
+		shift += 7;
+	} while (*p++ & 0x80);
+	*last_us += (int64_t)(delta >> 1) ^ -(int64_t)(delta & 1);
+	frame->ts_ns = base_ts_ns + *last_us * 1000;
+
+	if (flags & CAN_PROTO_FLAG_EFF) {
+		if (end - p < 4)
+			return false;
+		frame->can_id = get_le32(p) | CAN_EFF_FLAG;
+		p += 4;
+	} else {
+		if (end - p < 2)
+			return false;
+		frame->can_id = p[0] | p[1] << 8;
+		p += 2;
+	}
+	if (flags & CAN_PROTO_FLAG_RTR)
+		frame->can_id |= CAN_RTR_FLAG;
+	if (flags & CAN_PROTO_FLAG_ERR)
+		frame->can_id |= CAN_ERR_FLAG;
+	frame->flags = flags &
+		(CAN_PROTO_FLAG_FD | CAN_PROTO_FLAG_BRS | CAN_PROTO_FLAG_ESI);
+
+	if (end - p < frame->len)
+		return false;
+	memcpy(frame->data, p, frame->len);
+	*pp = p + frame->len;
+
+	return true;
+}
+
+/* the next complete batch of the current version - skipping garbage
+ * and batches of other versions
+ */
+const uint8_t *can_proto_decoder::next_batch(size_t *used)
+{
+	for (;;) {
+		const uint8_t *p = buf.data() + pos;
+		size_t avail = buf.size() - pos;
+		uint16_t header_len, count;
+		uint32_t length;
+
+		if (avail < CAN_PROTO_HEADER_LEN)
+			return nullptr;
+
+		header_len = p[4] | p[5] << 8;
+		count = p[6] | p[7] << 8;
+		length = get_le32(p + 8);
+		if (p[0] != CAN_PROTO_MAGIC0 || p[1] != CAN_PROTO_MAGIC1 ||
+		    header_len < CAN_PROTO_HEADER_LEN ||
+		    length > (size_t)count * CAN_PROTO_RECORD_MAX) {
+			pos++;
+			skipped++;
+			continue;
+		}
+
+		if (avail < (size_t)header_len + length)
+			return nullptr;
+
+		if (p[2] != CAN_PROTO_VERSION) {
+			pos += header_len + length;
+			bad++;
+			continue;
+		}
+
+		*used = header_len + length;
+		return p;
+	}
+}
+
+void can_proto_decoder::compact()
+{
+	if (pos == buf.size()) {
+		buf.clear();
+		pos = 0;
+	} else if (pos > 65536) {
+		buf.erase(buf.begin(), buf.begin() + pos);
+		pos = 0;
+	}
+}
+
+} /* namespace can_app */
@@ -0,0 +1,246 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* batched binary stream of can frames - version 1
+ *
+ * the stream is a sequence of batches, all values little endian:
+ *
+ * batch header (20 bytes):
+ *   u8  magic[2]    'C' 'B'
+ *   u8  version     1
+ *   u8  flags       0 - reserved
+ *   u16 header_len  20 - decoders skip anything beyond what they know
+ *   u16 count       number of frame records
+ *   u32 length      bytes of frame records following the header
+ *   u64 base_ts     timestamp in ns (CLOCK_REALTIME) of the batch
+ *
+ * frame record:
+ *   u8  flags       see CAN_PROTO_FLAG_*
+ *   u8  len         payload length (0..64)
+ *   var delta       zigzag LEB128 of the timestamp in us relative to
+ *                   the previous frame (the first one: to base_ts)
+ *   u16/u32 id      u32 with CAN_PROTO_FLAG_EFF, u16 otherwise -
+ *                   without the socketcan EFF/RTR/ERR bits
+ *   u8  data[len]
+ *
+ * the length in the header lets a decoder skip a batch it cannot parse,
+ * the magic lets it resynchronize on a corrupted stream.
+ *
+ * in the other direction a client may send subscriptions, each replacing
+ * the previous one:
+ *
+ * subscription (8 bytes + 8 per filter):
+ *   u8  magic[2]    'C' 'S'
+ *   u8  version     1
+ *   u8  flags       0 - reserved
+ *   u16 count       number of filters (0..CAN_PROTO_SUB_MAX)
+ *   u16 reserved
+ *   u32 can_id      count times struct can_filter, with the semantics
+ *   u32 can_mask    of CAN_RAW_FILTER (including CAN_INV_FILTER)
+ *
+ * clients start out with all frames, an empty list stops them all and
+ * the filter { 0, 0 } gets all of them again.
+ *
+ * over udp every datagram carries a single batch behind a header with
+ * a sequence number, so receivers see what they lost:
+ *
+ * datagram header (16 bytes):
+ *   u8  magic[2]    'C' 'D'
+ *   u8  version     1
+ *   u8  flags       see CAN_PROTO_DGRAM_*
+ *   u16 length      bytes of the batch following the header
+ *   u16 reserved
+ *   u64 seq         counts the datagrams from 0
+ *
+ * a tcp client asks for datagrams it missed with a backfill request,
+ * usually on a connection subscribed to nothing:
+ *
+ * backfill request (16 bytes):
+ *   u8  magic[2]    'C' 'R'
+ *   u8  version     1
+ *   u8  flags       0 - reserved
+ *   u32 count       number of datagrams
+ *   u64 seq         the first one
+ *
+ * the answer are the datagrams, header included, in order - those the
+ * gateway does not hold anymore with CAN_PROTO_DGRAM_GONE and no batch -
+ * and a header with CAN_PROTO_DGRAM_END and the seq of the first one not
+ * answered. that is short of seq + count when the tcp buffer of the
+ * client was full.
+ * see PC_Test/can_proto.py for the python decoder and subscriptions,
+ * PC_Test/can_udp.py for the udp receiver.
+ */
+
+#ifndef __CAN_PROTO_H
+#define __CAN_PROTO_H
+
+#include <linux/can.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace can_app {
+
+#define CAN_PROTO_MAGIC0	'C'
+#define CAN_PROTO_MAGIC1	'B'
+#define CAN_PROTO_VERSION	1
+#define CAN_PROTO_HEADER_LEN	20
+/* the count of a batch is a u16 */
+#define CAN_PROTO_BATCH_MAX	65535
+
+#define CAN_PROTO_FLAG_FD	0x01
+#define CAN_PROTO_FLAG_BRS	0x02
+#define CAN_PROTO_FLAG_ESI	0x04
+#define CAN_PROTO_FLAG_EFF	0x08
+#define CAN_PROTO_FLAG_RTR	0x10
+#define CAN_PROTO_FLAG_ERR	0x20
+
+/* the largest frame record: flags, len, 10 byte varint, id, payload */
+#define CAN_PROTO_RECORD_MAX	(2 + 10 + 4 + CANFD_MAX_DLEN)
+
+#define CAN_PROTO_SUB_MAGIC0	'C'
+#define CAN_PROTO_SUB_MAGIC1	'S'
+#define CAN_PROTO_SUB_HEADER_LEN	8
+/* CAN_RAW_FILTER_MAX */
+#define CAN_PROTO_SUB_MAX	512
+
+#define CAN_PROTO_DGRAM_MAGIC0	'C'
+#define CAN_PROTO_DGRAM_MAGIC1	'D'
+#define CAN_PROTO_DGRAM_HEADER_LEN	16
+/* no longer held - only in backfill answers */
+#define CAN_PROTO_DGRAM_GONE	0x01
+/* the end of a backfill answer */
+#define CAN_PROTO_DGRAM_END	0x02
+
+#define CAN_PROTO_REQ_MAGIC0	'C'
+#define CAN_PROTO_REQ_MAGIC1	'R'
+#define CAN_PROTO_REQ_LEN	16
+
+/* a frame as carried by the stream */
+struct can_proto_frame {
+	uint64_t ts_ns;
+	/* with the socketcan EFF/RTR/ERR bits */
+	canid_t can_id;
+	/* CAN_PROTO_FLAG_FD/BRS/ESI - the others follow from can_id */
+	uint8_t flags;
+	uint8_t len;
+	uint8_t data[CANFD_MAX_DLEN];
+};
+
+/* appends batches to a byte vector */
+class can_proto_encoder {
+public:
+	/* start a new batch at the end of out */
+	void begin(std::vector<uint8_t> &out, uint64_t base_ts_ns);
+	void add(const can_proto_frame &frame);
+	/* patch count and length into the header - returns the batch size
+	 * a batch holds at most CAN_PROTO_BATCH_MAX frames
+	 */
+	size_t finish();
+
+	unsigned int count() const { return frames; }
+
+private:
+	std::vector<uint8_t> *out = nullptr;
+	size_t start = 0;
+	unsigned int frames = 0;
+	/* the timestamp of the previous frame in us since base_ts */
+	int64_t last_us = 0;
+	uint64_t base_ts_ns = 0;
+};
+
+/* append a subscription to filters to out */
+void can_proto_subscription(std::vector<uint8_t> &out,
+			    const std::vector<struct can_filter> &filters);
+
+/* parse the subscription at the start of data - returns the bytes it
+ * takes, 0 if it is incomplete and -1 if data is no valid subscription
+ */
+long can_proto_parse_subscription(const uint8_t *data, size_t len,
+				  std::vector<struct can_filter> *filters);
+
+/* fill in a datagram header at p */
+void can_proto_dgram_header(uint8_t *p, uint64_t seq, uint8_t flags,
+			    uint16_t length);
+
+/* append a backfill request to out */
+void can_proto_backfill_request(std::vector<uint8_t> &out, uint64_t seq,
+				uint32_t count);
+
+/* parse the backfill request at the start of data - returns like
+ * can_proto_parse_subscription
+ */
+long can_proto_parse_backfill(const uint8_t *data, size_t len,
+			      uint64_t *seq, uint32_t *count);
+
+/* incremental decoder of a byte stream - feed it whatever recv returns */
+class can_proto_decoder {
+public:
+	/* calls fn(const can_proto_frame &) for every complete frame */
+	template <typename Fn>
+	void feed(const uint8_t *data, size_t len, Fn fn)
+	{
+		const uint8_t *batch;
+		size_t used;
+
+		buf.insert(buf.end(), data, data + len);
+		while ((batch = next_batch(&used)) != nullptr) {
+			decode_batch(batch, fn);
+			pos += used;
+		}
+		compact();
+	}
+
+	/* bytes skipped while resynchronizing and batches not understood */
+	uint64_t skipped_bytes() const { return skipped; }
+	uint64_t bad_batches() const { return bad; }
+
+private:
+	const uint8_t *next_batch(size_t *used);
+	void compact();
+	bool decode_record(const uint8_t **p, const uint8_t *end,
+			   can_proto_frame *frame, int64_t *last_us);
+
+	template <typename Fn>
+	void decode_batch(const uint8_t *batch, Fn fn)
+	{
+		can_proto_frame frame;
+		const uint8_t *p, *end;
+		uint16_t header_len, count, i;
+		int64_t last_us = 0;
+
+		header_len = batch[4] | batch[5] << 8;
+		count = batch[6] | batch[7] << 8;
+		p = batch + header_len;
+		end = p + get_le32(batch + 8);
+		base_ts_ns = get_le64(batch + 12);
+
+		for (i = 0; i < count; i++) {
+			if (!decode_record(&p, end, &frame, &last_us)) {
+				bad++;
+				return;
+			}
+			fn(frame);
+		}
+	}
+
+	static uint32_t get_le32(const uint8_t *p)
+	{
+		return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+	}
+
+	static uint64_t get_le64(const uint8_t *p)
+	{
+		return get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+	}
+
+	std::vector<uint8_t> buf;
+	size_t pos = 0;
+	uint64_t base_ts_ns = 0;
+	uint64_t skipped = 0;
+	uint64_t bad = 0;
+};
+
+} /* namespace can_app */
+
+#endif /* __CAN_PROTO_H */
@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* records a can interface to block logs (see can_log.h) - replaces
+ * candump -l, which drops frames at full fd bus load
+ *
+ * usage: can_recorder [-i can1] [-o prefix] [-z raw|lz4|zstd[:level]]
+ *                     [-S MB] [-T secs] [-B block_size] [-Q blocks]
+ *                     [-n batch] [-r rcvbuf] [-F flush_ms] [-s seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <exception>
+#include <string>
+
+#include "recorder.h"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -i <ifname>  can interface to record (default can1)\n"
+		"  -o <prefix>  files are <prefix>-<date>-<time>-<n>.canlog\n"
+		"               (default can)\n"
+		"  -z <codec>   block compression: raw (default), lz4 or\n"
+		"               zstd, optionally with :level\n"
+		"  -S <MB>      start a new file after MB megabytes\n"
+		"  -T <secs>    start a new file after secs seconds\n"
+		"  -B <bytes>   uncompressed bytes per block (default\n"
+		"               262144)\n"
+		"  -Q <blocks>  blocks in memory (default 16)\n"
+		"  -n <frames>  frames per recvmmsg (default 256)\n"
+		"  -r <bytes>   can socket receive buffer (default 8388608)\n"
+		"  -F <ms>      write a block that is not full after ms\n"
+		"               (default 1000)\n"
+		"  -s <secs>    print statistics every secs seconds\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	can_app::recorder_config config;
+	std::string codec;
+	size_t colon;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "i:o:z:S:T:B:Q:n:r:F:s:h")) != -1) {
+		switch (opt) {
+		case 'i':
+			config.ifname = optarg;
+			break;
+		case 'o':
+			config.prefix = optarg;
+			break;
+		case 'z':
+			codec = optarg;
+			colon = codec.find(':');
+			if (colon != std::string::npos) {
+				config.level = atoi(codec.c_str() + colon + 1);
+				codec.erase(colon);
+			}
+			if (!can_app::can_log_codec_parse(codec.c_str(),
+							  &config.codec))
+				usage(argv[0]);
+			if (!can_app::can_log_codec_available(config.codec)) {
+				fprintf(stderr, "can_recorder: built without "
+					"%s support\n", codec.c_str());
+				return 2;
+			}
+			break;
+		case 'S':
+			config.max_size = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 'T':
+			config.max_secs = strtoul(optarg, NULL, 0);
+			break;
+		case 'B':
+			config.block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'Q':
+			config.blocks = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			config.batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			config.rcvbuf = strtoul(optarg, NULL, 0);
+			break;
+		case 'F':
+			config.flush_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			config.stats_interval = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	/* a block holds at least a few frames, the writer needs one */
+	if (!config.batch || config.blocks < 2 ||
+	    config.block_size < 16 * CAN_LOG_RECORD_MAX)
+		usage(argv[0]);
+
+	try {
+		can_app::recorder rec(config);
+
+		return rec.run();
+	} catch (const std::exception &e) {
+		fprintf(stderr, "can_recorder: %s\n", e.what());
+		return 1;
+	}
+}
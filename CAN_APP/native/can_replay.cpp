@@ -0,0 +1,542 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* replays recorded can traffic with its original timing
+ *
+ * usage: can_replay [-i vcan0] [-x speed] [-f filters] [-g ms] [-l loops]
+ *                   [-n frames] [-W spin_us] [-P priority] [-c us]
+ *                   [-s seconds] file...
+ *
+ * reads the block logs of can_recorder and the logs of candump -l (see
+ * replay_source.h) and sends every frame when it is due: at its offset to
+ * the first frame of the log, divided by the speed factor. clock_nanosleep
+ * alone wakes up tens of microseconds late, so the replay sleeps until
+ * spin_us before a frame is due and busy-waits for the rest.
+ *
+ * the timing error of a frame is the time it was handed to the socket
+ * minus the time it was due. its percentiles are reported at the end and
+ * -c fails the replay when the 99th percentile is above a limit, e.g. in
+ * a regression test against a recorded drive:
+ *   can_replay -i vcan0 -P 50 -c 50 drive-20240101-120000-0.canlog
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "can_socket.h"
+#include "dispatch.h"
+#include "replay_source.h"
+
+struct replay_config {
+	std::string ifname = "vcan0";
+	std::vector<std::string> files;
+	/* 2 replays twice as fast, 0 as fast as the interface takes it */
+	double speed = 1;
+	/* only frames matching one of the filters, none: all frames */
+	std::vector<struct can_filter> filters;
+	/* idle gaps of the log longer than this are cut short, 0 keeps them */
+	unsigned int max_gap_ms = 0;
+	/* replay the files this many times, 0 until interrupted */
+	unsigned int loops = 1;
+	/* stop after frames, 0 at the end of the files */
+	uint64_t limit = 0;
+	/* busy-wait this long before a frame is due - more than the wake up
+	 * latency of the system, less than the usual gap between frames
+	 */
+	unsigned int spin_us = 50;
+	/* SCHED_FIFO priority (and locked memory), 0 keeps the scheduler */
+	int priority = 0;
+	/* fail when the 99th percentile of the timing error is above */
+	double check_us = 0;
+	unsigned int stats_interval = 0;
+	/* wait this long after ENOBUFS */
+	unsigned int backoff_us = 100;
+};
+
+/* the timing errors in buckets of 100ns up to 10ms, so the memory does
+ * not grow with the length of the log
+ */
+class error_histogram {
+public:
+	error_histogram()
+		: buckets(bucket_count + 1), count(0), sum(0), max(0) {}
+
+	void add(uint64_t ns)
+	{
+		buckets[std::min<uint64_t>(ns / bucket_ns, bucket_count)]++;
+		count++;
+		sum += ns;
+		max = std::max(max, ns);
+	}
+
+	uint64_t size() const { return count; }
+	double mean_us() const { return count ? sum / 1e3 / count : 0; }
+	double max_us() const { return max / 1e3; }
+
+	/* the upper bound of the q quantile in us */
+	double percentile(double q) const
+	{
+		uint64_t rank = std::max<uint64_t>(q * count, 1), seen = 0;
+		size_t i;
+
+		if (!count)
+			return 0;
+		for (i = 0; i < bucket_count; i++) {
+			seen += buckets[i];
+			if (seen >= rank)
+				return std::min((i + 1) * bucket_ns, max) / 1e3;
+		}
+
+		return max_us();
+	}
+
+private:
+	static const uint64_t bucket_ns = 100;
+	static const size_t bucket_count = 100000;
+
+	std::vector<uint64_t> buckets;
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+};
+
+struct replay_stats {
+	uint64_t frames;
+	uint64_t filtered;
+	uint64_t skipped;
+	/* the log went back in time (next file or loop) or had a gap */
+	uint64_t rebased;
+	uint64_t eagain;
+	uint64_t enobufs;
+	error_histogram errors;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static uint64_t mono_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+	       EINTR && !stop)
+		;
+}
+
+/* sleep until spin_ns before due, then busy-wait */
+static void wait_until(uint64_t due, uint64_t spin_ns)
+{
+	uint64_t now = mono_ns();
+
+	if (now + spin_ns < due) {
+		sleep_until(due - spin_ns);
+		now = mono_ns();
+	}
+	while (now < due && !stop)
+		now = mono_ns();
+}
+
+static void print_stats(FILE *out, const struct replay_stats *s,
+			uint64_t elapsed_ns, bool timed)
+{
+	double secs = elapsed_ns / 1e9;
+
+	fprintf(out, "%llu frames in %.2fs: %.0f frames/s, %llu filtered, "
+		"%llu skipped, %llu rebased, %llu EAGAIN, %llu ENOBUFS\n",
+		(unsigned long long)s->frames, secs,
+		secs > 0 ? s->frames / secs : 0,
+		(unsigned long long)s->filtered,
+		(unsigned long long)s->skipped,
+		(unsigned long long)s->rebased,
+		(unsigned long long)s->eagain,
+		(unsigned long long)s->enobufs);
+	if (timed && s->errors.size())
+		fprintf(out, "timing error (us): p50 %.1f p90 %.1f p99 %.1f "
+			"p99.9 %.1f max %.1f mean %.1f\n",
+			s->errors.percentile(0.5), s->errors.percentile(0.9),
+			s->errors.percentile(0.99),
+			s->errors.percentile(0.999), s->errors.max_us(),
+			s->errors.mean_us());
+	fflush(out);
+}
+
+static void fill_frame(const can_app::can_proto_frame &f,
+		       can_app::can_writer &writer)
+{
+	struct canfd_frame *frame = writer.frame(0);
+	bool fd = f.flags & CAN_PROTO_FLAG_FD;
+
+	memset(frame, 0, sizeof(*frame));
+	frame->can_id = f.can_id;
+	frame->len = f.len;
+	if (fd) {
+		if (f.flags & CAN_PROTO_FLAG_BRS)
+			frame->flags |= CANFD_BRS;
+		if (f.flags & CAN_PROTO_FLAG_ESI)
+			frame->flags |= CANFD_ESI;
+	}
+	/* the data of a remote frame is not sent */
+	if (!(f.can_id & CAN_RTR_FLAG))
+		memcpy(frame->data, f.data, f.len);
+	writer.set_fd(0, fd);
+}
+
+/* send the frame in the writer, retrying on backpressure - returns the
+ * time of the attempt that got it out
+ */
+static uint64_t send_frame(int sock, can_app::can_writer &writer,
+			   const struct replay_config &config,
+			   struct replay_stats *stats)
+{
+	uint64_t now;
+	int ret;
+
+	for (;;) {
+		now = mono_ns();
+		ret = writer.write(0, 1);
+		if (ret == 1)
+			return now;
+
+		if (ret == -EAGAIN) {
+			struct pollfd pfd = { sock, POLLOUT, 0 };
+
+			stats->eagain++;
+			poll(&pfd, 1, 10);
+		} else if (ret == -ENOBUFS) {
+			stats->enobufs++;
+			usleep(config.backoff_us);
+		} else if (ret != -EINTR) {
+			throw std::system_error(-ret, std::generic_category(),
+						"sendmmsg");
+		}
+		if (stop)
+			return now;
+	}
+}
+
+static void set_realtime(int priority)
+{
+	struct sched_param sp = {};
+
+	sp.sched_priority = priority;
+	if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
+		throw std::system_error(errno, std::generic_category(),
+					"sched_setscheduler");
+	/* no page faults while a frame is due */
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+		throw std::system_error(errno, std::generic_category(),
+					"mlockall");
+}
+
+/* when the frames of the log are due on CLOCK_MONOTONIC */
+class replay_schedule {
+public:
+	replay_schedule(double speed, uint64_t max_gap_ns)
+		: speed(speed), max_gap_ns(max_gap_ns), started(false),
+		  base_ts(0), base_ns(0), last_ts(0), last_due(0) {}
+
+	/* the schedule restarts where the log goes back in time (the next
+	 * file or loop) or pauses for longer than max_gap_ns - returns
+	 * whether it did
+	 */
+	bool rebase(uint64_t ts)
+	{
+		bool back = ts < last_ts;
+		bool gap = !back && max_gap_ns &&
+			(ts - last_ts) / speed > max_gap_ns;
+		bool first = !started;
+
+		if (first) {
+			started = true;
+			base_ns = mono_ns();
+		} else if (back || gap) {
+			base_ns = last_due + (gap ? max_gap_ns : 0);
+		} else {
+			last_ts = ts;
+			return false;
+		}
+		base_ts = last_ts = ts;
+
+		return !first;
+	}
+
+	uint64_t due(uint64_t ts)
+	{
+		last_due = base_ns + (uint64_t)((ts - base_ts) / speed);
+
+		return last_due;
+	}
+
+private:
+	double speed;
+	uint64_t max_gap_ns;
+	bool started;
+	uint64_t base_ts;
+	uint64_t base_ns;
+	uint64_t last_ts;
+	uint64_t last_due;
+};
+
+static int run(const struct replay_config &config)
+{
+	std::vector<std::unique_ptr<can_app::replay_source>> sources;
+	replay_schedule schedule(config.speed, config.max_gap_ms * 1000000ULL);
+	uint64_t spin_ns = config.spin_us * 1000ULL;
+	uint64_t start, next_stats, due = 0, now;
+	can_app::can_dispatch filter(1);
+	can_app::can_proto_frame frame;
+	struct replay_stats stats = {};
+	bool timed = config.speed > 0;
+	uint64_t read = 0;
+	unsigned int loop;
+	size_t i = 0;
+	int sock;
+	bool pass;
+
+	for (const std::string &path : config.files)
+		sources.emplace_back(new can_app::replay_source(path));
+
+	if (!config.filters.empty()) {
+		filter.set(0, config.filters);
+		filter.compile();
+	}
+
+	sock = can_app::can_socket_open_tx(config.ifname, true, 0);
+	can_app::can_writer writer(sock, 1);
+
+	/* the default slack of 50us would delay every wake up by as much */
+	prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+	if (config.priority)
+		set_realtime(config.priority);
+
+	start = mono_ns();
+	next_stats = start + config.stats_interval * 1000000000ULL;
+	for (loop = 0; !stop && (!config.loops || loop < config.loops);) {
+		if (!sources[i]->next(&frame)) {
+			/* on to the next file, or the next loop */
+			if (++i == sources.size()) {
+				/* nothing to replay in the files */
+				if (!read)
+					break;
+				i = 0;
+				loop++;
+				read = 0;
+			}
+			sources[i]->rewind();
+			continue;
+		}
+		read++;
+
+		if (timed) {
+			if (schedule.rebase(frame.ts_ns))
+				stats.rebased++;
+			due = schedule.due(frame.ts_ns);
+		}
+
+		if (!config.filters.empty()) {
+			pass = filter.match(filter.lookup(frame.can_id), 0);
+			filter.trim();
+			if (!pass) {
+				stats.filtered++;
+				continue;
+			}
+		}
+
+		fill_frame(frame, writer);
+		if (timed)
+			wait_until(due, spin_ns);
+		if (stop)
+			break;
+		now = send_frame(sock, writer, config, &stats);
+		if (stop)
+			break;
+		if (timed)
+			stats.errors.add(now - due);
+		stats.frames++;
+
+		if (config.stats_interval && now >= next_stats) {
+			print_stats(stderr, &stats, now - start, timed);
+			next_stats = now + config.stats_interval *
+				1000000000ULL;
+		}
+		if (config.limit && stats.frames >= config.limit)
+			break;
+	}
+	for (auto &source : sources)
+		stats.skipped += source->skipped();
+
+	print_stats(stdout, &stats, mono_ns() - start, timed);
+	close(sock);
+
+	if (timed && config.check_us > 0 &&
+	    stats.errors.percentile(0.99) > config.check_us) {
+		fprintf(stderr, "can_replay: p99 timing error %.1fus above "
+			"%.1fus\n", stats.errors.percentile(0.99),
+			config.check_us);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* candump style: <id>:<mask> or <id>~<mask> (inverted), hex, an id of 8
+ * digits is an extended one
+ */
+static std::vector<struct can_filter> parse_filters(const std::string &spec)
+{
+	std::vector<struct can_filter> filters;
+	std::stringstream ss(spec);
+	std::string item;
+
+	while (std::getline(ss, item, ',')) {
+		struct can_filter f;
+		size_t sep = item.find_first_of(":~");
+		char *end;
+
+		if (sep == std::string::npos || !sep)
+			throw std::invalid_argument("invalid filter: " + item);
+		errno = 0;
+		f.can_id = strtoul(item.c_str(), &end, 16);
+		if (errno || end != item.c_str() + sep)
+			throw std::invalid_argument("invalid filter: " + item);
+		f.can_mask = strtoul(item.c_str() + sep + 1, &end, 16);
+		if (errno || end == item.c_str() + sep + 1 || *end)
+			throw std::invalid_argument("invalid filter: " + item);
+
+		f.can_mask &= ~CAN_ERR_FLAG;
+		if (sep == 8)
+			f.can_id |= CAN_EFF_FLAG;
+		if (item[sep] == '~')
+			f.can_id |= CAN_INV_FILTER;
+		filters.push_back(f);
+	}
+	if (filters.empty())
+		throw std::invalid_argument("no filters: " + spec);
+
+	return filters;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] file...\n"
+		"  file           can_recorder block log or candump -l log,\n"
+		"                 several are replayed one after another\n"
+		"  -i <ifname>    can interface (default vcan0)\n"
+		"  -x <factor>    speed: 2 twice as fast, 0.5 half as fast,\n"
+		"                 0 as fast as possible (default 1)\n"
+		"  -f <filters>   only ids matching one of the candump style\n"
+		"                 filters, e.g. 123:7FF,18DA00F1:1FFFFF00\n"
+		"                 or 100~700 (all but 0x100-0x1ff)\n"
+		"  -g <ms>        cut idle gaps of the log to ms\n"
+		"  -l <loops>     replay the files loops times, 0 until\n"
+		"                 interrupted (default 1)\n"
+		"  -n <frames>    stop after frames\n"
+		"  -W <us>        busy-wait before a frame is due (default\n"
+		"                 50) - one cpu is busy while frames are\n"
+		"                 closer than this\n"
+		"  -P <priority>  run with SCHED_FIFO priority and locked\n"
+		"                 memory - keep -W below the gaps between\n"
+		"                 frames, a replay that never sleeps gets\n"
+		"                 throttled by the kernel\n"
+		"  -c <us>        fail when the 99th percentile of the timing\n"
+		"                 error is above us\n"
+		"  -b <us>        wait after ENOBUFS (default 100)\n"
+		"  -s <secs>      print statistics every secs\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	struct replay_config config;
+	int opt;
+
+	try {
+		while ((opt = getopt(argc, argv,
+				     "i:x:f:g:l:n:W:P:c:b:s:h")) != -1) {
+			switch (opt) {
+			case 'i':
+				config.ifname = optarg;
+				break;
+			case 'x':
+				config.speed = atof(optarg);
+				break;
+			case 'f':
+				config.filters = parse_filters(optarg);
+				break;
+			case 'g':
+				config.max_gap_ms = strtoul(optarg, NULL, 0);
+				break;
+			case 'l':
+				config.loops = strtoul(optarg, NULL, 0);
+				break;
+			case 'n':
+				config.limit = strtoull(optarg, NULL, 0);
+				break;
+			case 'W':
+				config.spin_us = strtoul(optarg, NULL, 0);
+				break;
+			case 'P':
+				config.priority = atoi(optarg);
+				break;
+			case 'c':
+				config.check_us = atof(optarg);
+				break;
+			case 'b':
+				config.backoff_us = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				config.stats_interval =
+					strtoul(optarg, NULL, 0);
+				break;
+			default:
+				usage(argv[0]);
+			}
+		}
+		if (optind == argc || config.speed < 0)
+			usage(argv[0]);
+		config.files.assign(argv + optind, argv + argc);
+
+		signal(SIGINT, on_signal);
+		signal(SIGTERM, on_signal);
+
+		return run(config);
+	} catch (const std::exception &e) {
+		fprintf(stderr, "can_replay: %s\n", e.what());
+		return 1;
+	}
+}
@@ -0,0 +1,279 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* raw socketcan access shared by the native CAN_APP tools */
+
+#include <errno.h>
+#include <linux/can/raw.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <system_error>
+
+#include "can_socket.h"
+
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+
+namespace can_app {
+
+/* the hardware timestamping config is per interface and shared by all
+ * sockets on it - a negative tx or rx keeps what is set, so a reader does
+ * not turn off the tx timestamps another tool enabled and vice versa
+ */
+static void can_socket_hwtstamp(int sock, const std::string &ifname,
+				int tx, int rx)
+{
+	struct hwtstamp_config config = {};
+	struct ifreq ifr = {};
+
+	strncpy(ifr.ifr_name, ifname.c_str(), IFNAMSIZ - 1);
+	ifr.ifr_data = reinterpret_cast<char *>(&config);
+
+	/* without SIOCGHWTSTAMP nothing is known to be on */
+	if (ioctl(sock, SIOCGHWTSTAMP, &ifr) < 0) {
+		config.flags = 0;
+		config.tx_type = HWTSTAMP_TX_OFF;
+		config.rx_filter = HWTSTAMP_FILTER_NONE;
+	}
+	if (tx >= 0)
+		config.tx_type = tx;
+	if (rx >= 0)
+		config.rx_filter = rx;
+
+	/* needs CAP_NET_ADMIN and a driver that supports it - otherwise
+	 * the software timestamps are used
+	 */
+	ioctl(sock, SIOCSHWTSTAMP, &ifr);
+}
+
+/* a non-blocking raw can socket for ifname - returns the socket and
+ * the address to bind it to once it is configured
+ */
+static int can_socket_create(const std::string &ifname, bool fd,
+			     struct sockaddr_can *addr)
+{
+	int sock, on = 1;
+
+	sock = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		      CAN_RAW);
+	if (sock < 0)
+		throw std::system_error(errno, std::generic_category(),
+					"socket(PF_CAN)");
+
+	memset(addr, 0, sizeof(*addr));
+	addr->can_family = AF_CAN;
+	addr->can_ifindex = if_nametoindex(ifname.c_str());
+	if (!addr->can_ifindex) {
+		int err = errno;
+
+		close(sock);
+		throw std::system_error(err, std::generic_category(), ifname);
+	}
+
+	if (fd && setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FD_FRAMES,
+			     &on, sizeof(on)) < 0) {
+		int err = errno;
+
+		close(sock);
+		throw std::system_error(err, std::generic_category(),
+					"CAN_RAW_FD_FRAMES");
+	}
+
+	return sock;
+}
+
+static void can_socket_bind(int sock, const std::string &ifname,
+			    const struct sockaddr_can *addr)
+{
+	if (bind(sock, reinterpret_cast<const struct sockaddr *>(addr),
+		 sizeof(*addr)) < 0) {
+		int err = errno;
+
+		close(sock);
+		throw std::system_error(err, std::generic_category(),
+					"bind(" + ifname + ")");
+	}
+}
+
+int can_socket_open(const std::string &ifname, bool fd, int rcvbuf)
+{
+	struct sockaddr_can addr;
+	int sock, on = 1;
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+		SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+	sock = can_socket_create(ifname, fd, &addr);
+
+	/* a large receive queue rides out scheduling hiccups at full
+	 * bus load - SO_RCVBUFFORCE ignores rmem_max but needs
+	 * CAP_NET_ADMIN
+	 */
+	if (rcvbuf > 0 &&
+	    setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE,
+		       &rcvbuf, sizeof(rcvbuf)) < 0)
+		setsockopt(sock, SOL_SOCKET, SO_RCVBUF,
+			   &rcvbuf, sizeof(rcvbuf));
+
+	setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+	setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+	can_socket_hwtstamp(sock, ifname, -1, HWTSTAMP_FILTER_ALL);
+
+	can_socket_bind(sock, ifname, &addr);
+
+	return sock;
+}
+
+int can_socket_open_tx(const std::string &ifname, bool fd, int sndbuf)
+{
+	struct sockaddr_can addr;
+	int sock;
+
+	sock = can_socket_create(ifname, fd, &addr);
+
+	/* no filters - the frames on the bus do not pile up unread */
+	setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, nullptr, 0);
+	if (sndbuf > 0)
+		setsockopt(sock, SOL_SOCKET, SO_SNDBUF,
+			   &sndbuf, sizeof(sndbuf));
+
+	can_socket_bind(sock, ifname, &addr);
+
+	return sock;
+}
+
+void can_socket_tx_timestamps(int sock, const std::string &ifname)
+{
+	int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+		SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+	setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+	can_socket_hwtstamp(sock, ifname, HWTSTAMP_TX_ON, -1);
+}
+
+can_reader::can_reader(int sock, unsigned int batch)
+	: sock(sock), frames(batch), msgs(batch), iovs(batch),
+	  cmsgs(batch * cmsg_size), drops(0), old_drops(0)
+{
+}
+
+void can_reader::reset(int sock)
+{
+	this->sock = sock;
+	old_drops += drops;
+	drops = 0;
+}
+
+static uint64_t can_reader_ts(struct msghdr *msg, bool *hw)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		const struct timespec *ts;
+
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SO_TIMESTAMPING)
+			continue;
+
+		/* [0] is the software, [2] the raw hardware timestamp */
+		ts = reinterpret_cast<const struct timespec *>(CMSG_DATA(cmsg));
+		*hw = ts[2].tv_sec || ts[2].tv_nsec;
+		if (*hw)
+			ts += 2;
+		return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+	}
+
+	return 0;
+}
+
+static bool can_reader_drops(struct msghdr *msg, uint32_t *drops)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SO_RXQ_OVFL) {
+			memcpy(drops, CMSG_DATA(cmsg), sizeof(*drops));
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int can_reader::read(int flags)
+{
+	unsigned int i;
+	int count;
+
+	for (i = 0; i < msgs.size(); i++) {
+		struct msghdr *hdr = &msgs[i].msg_hdr;
+
+		iovs[i].iov_base = &frames[i].frame;
+		iovs[i].iov_len = sizeof(frames[i].frame);
+		memset(hdr, 0, sizeof(*hdr));
+		hdr->msg_iov = &iovs[i];
+		hdr->msg_iovlen = 1;
+		hdr->msg_control = &cmsgs[i * cmsg_size];
+		hdr->msg_controllen = cmsg_size;
+	}
+
+	count = recvmmsg(sock, msgs.data(), msgs.size(),
+			 MSG_DONTWAIT | flags, nullptr);
+	if (count < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -errno;
+
+	for (i = 0; i < (unsigned int)count; i++) {
+		struct msghdr *hdr = &msgs[i].msg_hdr;
+
+		frames[i].fd = (msgs[i].msg_len == CANFD_MTU);
+		frames[i].hwts = false;
+		frames[i].ts_ns = can_reader_ts(hdr, &frames[i].hwts);
+		/* ts_ns stays 0 for sent frames without a timestamp */
+		if (!frames[i].ts_ns && !(flags & MSG_ERRQUEUE))
+			frames[i].ts_ns = can_time_ns();
+		can_reader_drops(hdr, &drops);
+	}
+
+	return count;
+}
+
+can_writer::can_writer(int sock, unsigned int batch)
+	: sock(sock), frames(batch), msgs(batch), iovs(batch)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch; i++) {
+		iovs[i].iov_base = &frames[i];
+		iovs[i].iov_len = CAN_MTU;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+int can_writer::write(unsigned int first, unsigned int count)
+{
+	int ret;
+
+	ret = sendmmsg(sock, &msgs[first], count, MSG_DONTWAIT);
+	if (ret < 0)
+		return -errno;
+
+	return ret;
+}
+
+uint64_t can_time_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+} /* namespace can_app */
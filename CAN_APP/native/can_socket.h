@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* raw socketcan access shared by the native CAN_APP tools
+ *
+ * frames are read in batches with recvmmsg, each with its receive
+ * timestamp (the hardware one when the interface provides it, see
+ * mcp25xxfd_can_ptp.c, otherwise the software one) and the kernel drop
+ * counter of the socket (SO_RXQ_OVFL)
+ */
+
+#ifndef __CAN_SOCKET_H
+#define __CAN_SOCKET_H
+
+#include <linux/can.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <string>
+#include <vector>
+
+namespace can_app {
+
+/* a received frame - len is the payload length for classic and fd
+ * frames, fd is set when the frame was received as struct canfd_frame,
+ * hwts when ts_ns is a hardware timestamp
+ */
+struct can_rx_frame {
+	struct canfd_frame frame;
+	uint64_t ts_ns;
+	bool fd;
+	bool hwts;
+};
+
+/* open a raw can socket bound to ifname - with fd set canfd frames are
+ * received as well, rcvbuf (bytes) gets forced if permitted
+ * throws std::system_error on failure
+ */
+int can_socket_open(const std::string &ifname, bool fd, int rcvbuf);
+
+/* open a raw can socket bound to ifname for sending only - nothing gets
+ * received on it, sndbuf (bytes) sets the socket send buffer if non zero
+ * throws std::system_error on failure
+ */
+int can_socket_open_tx(const std::string &ifname, bool fd, int sndbuf);
+
+/* report the transmit timestamps (hardware ones if the interface
+ * supports them, see mcp25xxfd_can_ptp.c) of the frames sent on sock on
+ * its error queue - read them with can_reader::read(MSG_ERRQUEUE)
+ */
+void can_socket_tx_timestamps(int sock, const std::string &ifname);
+
+/* batched non-blocking reads from a raw can socket */
+class can_reader {
+public:
+	can_reader(int sock, unsigned int batch);
+
+	/* read up to batch frames without blocking - with flags
+	 * MSG_ERRQUEUE the sent frames with their transmit timestamps
+	 * returns the number of frames read, 0 if there were none
+	 * and -errno on errors
+	 */
+	int read(int flags = 0);
+
+	const can_rx_frame &operator[](unsigned int i) const
+	{
+		return frames[i];
+	}
+
+	/* frames dropped by the kernel because the socket queue was full */
+	uint32_t kernel_drops() const { return old_drops + drops; }
+
+	/* continue on a reopened socket - the drops so far are kept */
+	void reset(int sock);
+
+private:
+	/* room for struct scm_timestamping and the SO_RXQ_OVFL counter
+	 * or the struct sock_extended_err of the error queue
+	 */
+	static const size_t cmsg_size = 128;
+
+	int sock;
+	std::vector<can_rx_frame> frames;
+	std::vector<struct mmsghdr> msgs;
+	std::vector<struct iovec> iovs;
+	std::vector<uint8_t> cmsgs;
+	uint32_t drops;
+	/* the drops of the sockets before a reset */
+	uint32_t old_drops;
+};
+
+/* batched non-blocking writes to a raw can socket */
+class can_writer {
+public:
+	can_writer(int sock, unsigned int batch);
+
+	unsigned int size() const { return frames.size(); }
+
+	struct canfd_frame *frame(unsigned int i) { return &frames[i]; }
+
+	/* send the frame as canfd_frame or as can_frame */
+	void set_fd(unsigned int i, bool fd)
+	{
+		iovs[i].iov_len = fd ? CANFD_MTU : CAN_MTU;
+	}
+
+	bool fd(unsigned int i) const { return iovs[i].iov_len == CANFD_MTU; }
+
+	/* send count frames starting at first without blocking
+	 * returns the number of frames sent or -errno - -EAGAIN when the
+	 * socket buffer is full, -ENOBUFS when the tx queue of the
+	 * interface is full
+	 */
+	int write(unsigned int first, unsigned int count);
+
+private:
+	int sock;
+	std::vector<struct canfd_frame> frames;
+	std::vector<struct mmsghdr> msgs;
+	std::vector<struct iovec> iovs;
+};
+
+/* current CLOCK_REALTIME in ns - the clock of the receive timestamps */
+uint64_t can_time_ns();
+
+} /* namespace can_app */
+
+#endif /* __CAN_SOCKET_H */
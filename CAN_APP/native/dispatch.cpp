@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* which clients of the gateway a frame goes to - see dispatch.h */
+
+#include <linux/can/raw.h>
+
+#include <algorithm>
+
+#include "dispatch.h"
+
+namespace can_app {
+
+#define SFF_IDS	(CAN_SFF_MASK + 1)
+
+can_dispatch::can_dispatch(unsigned int max_clients)
+	: slots(max_clients), words((max_clients + 63) / 64),
+	  filters(max_clients), active(max_clients), dirty(max_clients),
+	  everything(true), pool(SFF_IDS * words)
+{
+}
+
+void can_dispatch::set(unsigned int slot,
+		       const std::vector<struct can_filter> &f)
+{
+	filters[slot] = f;
+	active[slot] = true;
+	dirty[slot] = true;
+}
+
+void can_dispatch::clear(unsigned int slot)
+{
+	filters[slot].clear();
+	active[slot] = false;
+	dirty[slot] = true;
+}
+
+/* the bits of the mask the kernel compares, see find_rcv_list() in
+ * net/can/af_can.c
+ */
+#define FILTER_MASK	(CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_EFF_MASK)
+
+/* the semantics of the raw socket filters */
+static bool filter_match(const struct can_filter &f, canid_t can_id)
+{
+	bool match = ((can_id ^ f.can_id) & f.can_mask & FILTER_MASK) == 0;
+
+	return f.can_id & CAN_INV_FILTER ? !match : match;
+}
+
+static bool filter_all(const struct can_filter &f)
+{
+	return !(f.can_mask & FILTER_MASK) && !(f.can_id & CAN_INV_FILTER);
+}
+
+bool can_dispatch::matches(unsigned int slot, canid_t can_id) const
+{
+	for (const struct can_filter &f : filters[slot])
+		if (filter_match(f, can_id))
+			return true;
+
+	return false;
+}
+
+/* the bit of slot in the bitmaps of the standard ids and of the ids in
+ * the hash - on a resubscription only that slot gets evaluated again
+ */
+void can_dispatch::compile_slot(unsigned int slot)
+{
+	uint64_t bit = 1ULL << (slot % 64);
+	size_t word = slot / 64, set;
+	canid_t id;
+
+	for (set = 0; set < pool.size(); set += words)
+		pool[set + word] &= ~bit;
+	if (!active[slot])
+		return;
+
+	for (id = 0; id < SFF_IDS; id++)
+		if (matches(slot, id))
+			pool[id * words + word] |= bit;
+	for (const auto &entry : hash)
+		if (matches(slot, entry.first))
+			pool[entry.second + word] |= bit;
+}
+
+void can_dispatch::compile()
+{
+	unsigned int slot;
+
+	everything = true;
+	for (slot = 0; slot < slots; slot++) {
+		if (dirty[slot]) {
+			compile_slot(slot);
+			dirty[slot] = false;
+		}
+
+		if (active[slot] &&
+		    std::none_of(filters[slot].begin(), filters[slot].end(),
+				 filter_all))
+			everything = false;
+	}
+}
+
+size_t can_dispatch::add(canid_t can_id)
+{
+	size_t set = pool.size();
+	unsigned int slot;
+
+	pool.resize(set + words);
+	for (slot = 0; slot < slots; slot++)
+		if (active[slot] && matches(slot, can_id))
+			pool[set + slot / 64] |= 1ULL << (slot % 64);
+	hash[can_id] = set;
+
+	return set;
+}
+
+void can_dispatch::trim()
+{
+	if (hash.size() < max_cached)
+		return;
+
+	hash.clear();
+	pool.resize(SFF_IDS * words);
+}
+
+static bool filter_less(const struct can_filter &a, const struct can_filter &b)
+{
+	return a.can_id != b.can_id ? a.can_id < b.can_id :
+		a.can_mask < b.can_mask;
+}
+
+static bool filter_equal(const struct can_filter &a,
+			 const struct can_filter &b)
+{
+	return a.can_id == b.can_id && a.can_mask == b.can_mask;
+}
+
+bool can_dispatch::kernel_filter(std::vector<struct can_filter> *out) const
+{
+	unsigned int slot;
+
+	out->clear();
+	for (slot = 0; slot < slots; slot++) {
+		if (!active[slot])
+			continue;
+		for (const struct can_filter &f : filters[slot]) {
+			if (filter_all(f))
+				return false;
+			out->push_back(f);
+		}
+	}
+
+	std::sort(out->begin(), out->end(), filter_less);
+	out->erase(std::unique(out->begin(), out->end(), filter_equal),
+		   out->end());
+
+	return out->size() <= CAN_RAW_FILTER_MAX;
+}
+
+} /* namespace can_app */
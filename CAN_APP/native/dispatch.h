@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* which clients of the gateway a frame goes to
+ *
+ * every client slot holds a list of socketcan filters (struct can_filter,
+ * the semantics of CAN_RAW_FILTER including CAN_INV_FILTER). compile()
+ * turns them into a bitmap of client slots per 11-bit id, so dispatching
+ * a standard frame is a table lookup. extended (and rtr/error) frames go
+ * through a hash of the ids seen so far - the first frame of an id
+ * evaluates the filters, every later one is a lookup. a change of one
+ * slot only re-evaluates the filters of that slot.
+ */
+
+#ifndef __DISPATCH_H
+#define __DISPATCH_H
+
+#include <linux/can.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
+namespace can_app {
+
+class can_dispatch {
+public:
+	explicit can_dispatch(unsigned int max_clients);
+
+	/* replace the filters of slot - an empty list matches nothing,
+	 * { 0, 0 } everything. takes effect with compile()
+	 */
+	void set(unsigned int slot, const std::vector<struct can_filter> &f);
+	void clear(unsigned int slot);
+
+	/* update the lookup tables for the slots set or cleared since the
+	 * last call - the others keep their bits
+	 */
+	void compile();
+
+	/* whether every active slot gets every frame */
+	bool all() const { return everything; }
+
+	/* the union of all filters for CAN_RAW_FILTER - returns false
+	 * when it cannot narrow down what the socket has to receive
+	 */
+	bool kernel_filter(std::vector<struct can_filter> *out) const;
+
+	/* the slots a frame goes to - for match(), valid until trim() */
+	size_t lookup(canid_t can_id)
+	{
+		if (!(can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_ERR_FLAG)))
+			return (can_id & CAN_SFF_MASK) * words;
+
+		auto it = hash.find(can_id);
+		if (it != hash.end())
+			return it->second;
+
+		return add(can_id);
+	}
+
+	bool match(size_t set, unsigned int slot) const
+	{
+		return pool[set + slot / 64] >> (slot % 64) & 1;
+	}
+
+	/* bound the memory of the hash - call between batches */
+	void trim();
+
+	/* filters of slot match can_id - the slow path */
+	bool matches(unsigned int slot, canid_t can_id) const;
+
+private:
+	/* ids kept in the hash before it starts over */
+	static const size_t max_cached = 1 << 16;
+
+	size_t add(canid_t can_id);
+	void compile_slot(unsigned int slot);
+
+	unsigned int slots;
+	size_t words;
+	std::vector<std::vector<struct can_filter>> filters;
+	std::vector<bool> active;
+	/* set or cleared since the last compile() */
+	std::vector<bool> dirty;
+	bool everything;
+
+	/* the bitmaps of the 2048 standard ids, then those in the hash */
+	std::vector<uint64_t> pool;
+	std::unordered_map<canid_t, size_t> hash;
+};
+
+} /* namespace can_app */
+
+#endif /* __DISPATCH_H */
@@ -0,0 +1,205 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* the cost of picking the clients of a frame - per client filter lists
+ * evaluated for every frame versus the lookup of dispatch.h
+ *
+ * every client subscribes to two standard ids, a range of standard ids
+ * and a block of extended ids. the traffic mixes 11-bit ids over the
+ * whole range with 29-bit ids of a few hundred diagnostic and j1939 like
+ * senders, the way a busy vehicle bus looks. both ways have to agree on
+ * the recipients of every frame before anything gets timed.
+ *
+ * compile is the first build of the tables, update the resubscription
+ * of one client with the hash of the extended ids filled.
+ *
+ * usage: dispatch_bench [frames]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <vector>
+
+#include "dispatch.h"
+
+#define MAX_CLIENTS	128
+#define BATCH		64
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int next(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+
+	return *seed >> 8;
+}
+
+/* three out of four frames standard, the rest from 400 extended ids */
+static std::vector<canid_t> make_ids(int count)
+{
+	std::vector<canid_t> ids(count);
+	unsigned int seed = 1;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (next(&seed) % 4)
+			ids[i] = next(&seed) % (CAN_SFF_MASK + 1);
+		else
+			ids[i] = CAN_EFF_FLAG | 0x18000000 |
+				(next(&seed) % 400) << 8 | 0xF1;
+	}
+
+	return ids;
+}
+
+static std::vector<struct can_filter> make_filters(unsigned int client)
+{
+	return {
+		{ (0x100 + client * 7) & CAN_SFF_MASK, CAN_SFF_MASK },
+		{ (0x500 + client * 3) & CAN_SFF_MASK, CAN_SFF_MASK },
+		/* 16 ids */
+		{ (client * 16) & CAN_SFF_MASK, CAN_SFF_MASK & ~0xF },
+		/* 4 senders */
+		{ CAN_EFF_FLAG | 0x18000000 | (client * 4 % 400) << 8,
+		  CAN_EFF_FLAG | (CAN_EFF_MASK & ~0x3FF) },
+	};
+}
+
+static uint64_t naive(const can_app::can_dispatch &dispatch,
+		      const std::vector<canid_t> &ids, unsigned int clients)
+{
+	uint64_t recipients = 0;
+	unsigned int slot;
+
+	for (canid_t id : ids)
+		for (slot = 0; slot < clients; slot++)
+			recipients += dispatch.matches(slot, id);
+
+	return recipients;
+}
+
+static uint64_t lookup(can_app::can_dispatch &dispatch,
+		       const std::vector<canid_t> &ids, unsigned int clients)
+{
+	uint64_t recipients = 0;
+	unsigned int slot;
+	size_t i, set;
+
+	for (i = 0; i < ids.size(); i++) {
+		/* what the gateway does between recvmmsg batches */
+		if (i % BATCH == 0)
+			dispatch.trim();
+		set = dispatch.lookup(ids[i]);
+		for (slot = 0; slot < clients; slot++)
+			recipients += dispatch.match(set, slot);
+	}
+
+	return recipients;
+}
+
+static bool check(can_app::can_dispatch &dispatch,
+		  const std::vector<canid_t> &ids, unsigned int clients)
+{
+	unsigned int slot;
+	size_t set;
+
+	for (canid_t id : ids) {
+		set = dispatch.lookup(id);
+		for (slot = 0; slot < clients; slot++) {
+			if (dispatch.match(set, slot) ==
+			    dispatch.matches(slot, id))
+				continue;
+			fprintf(stderr, "mismatch: id %08x client %u\n",
+				id, slot);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [frames]\n", prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	long count = 1000000;
+	static const unsigned int client_counts[] = { 1, 10, 100 };
+	std::vector<canid_t> ids;
+	uint64_t start, compile_ns, update_ns, naive_ns, lookup_ns;
+	uint64_t expect, got;
+	unsigned int clients, slot;
+	char *end;
+
+	if (argc > 2)
+		usage(argv[0]);
+	if (argc > 1) {
+		count = strtol(argv[1], &end, 0);
+		if (*end || end == argv[1] || count <= 0 ||
+		    count > 100000000)
+			usage(argv[0]);
+	}
+	ids = make_ids(count);
+
+	printf("%ld frames, 3/4 11-bit ids, 1/4 from 400 29-bit ids\n\n",
+	       count);
+	printf("%8s %11s %10s %13s %13s %11s\n", "clients", "compile ms",
+	       "update ms", "naive ns/frm", "lookup ns/frm", "recipients");
+
+	for (unsigned int c : client_counts) {
+		can_app::can_dispatch dispatch(MAX_CLIENTS);
+
+		clients = c;
+		for (slot = 0; slot < clients; slot++)
+			dispatch.set(slot, make_filters(slot));
+
+		start = now_ns();
+		dispatch.compile();
+		compile_ns = now_ns() - start;
+
+		if (!check(dispatch, ids, clients))
+			return 1;
+
+		/* the filters of the last client go to the first */
+		dispatch.set(0, make_filters(clients - 1));
+		start = now_ns();
+		dispatch.compile();
+		update_ns = now_ns() - start;
+
+		if (!check(dispatch, ids, clients))
+			return 1;
+
+		start = now_ns();
+		expect = naive(dispatch, ids, clients);
+		naive_ns = now_ns() - start;
+
+		start = now_ns();
+		got = lookup(dispatch, ids, clients);
+		lookup_ns = now_ns() - start;
+
+		if (got != expect) {
+			fprintf(stderr, "recipients differ: %llu != %llu\n",
+				(unsigned long long)got,
+				(unsigned long long)expect);
+			return 1;
+		}
+
+		printf("%8u %11.2f %10.3f %13.1f %13.1f %11.2f\n", clients,
+		       compile_ns / 1e6, update_ns / 1e6,
+		       (double)naive_ns / count, (double)lookup_ns / count,
+		       (double)got / count);
+	}
+
+	return 0;
+}
@@ -0,0 +1,739 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* CAN to TCP (and UDP) gateway - see gateway.h */
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <linux/can/raw.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <system_error>
+
+#include "gateway.h"
+
+namespace can_app {
+
+static void throw_errno(const char *what)
+{
+	throw std::system_error(errno, std::generic_category(), what);
+}
+
+static int listen_socket(const std::string &host, uint16_t port)
+{
+	struct sockaddr_in addr = {};
+	int fd, on = 1;
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+		throw std::system_error(EINVAL, std::generic_category(), host);
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		throw_errno("socket");
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr),
+		 sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+		int err = errno;
+
+		close(fd);
+		throw std::system_error(err, std::generic_category(),
+					"listen " + host);
+	}
+
+	return fd;
+}
+
+gateway::gateway(const gateway_config &config)
+	: config(config), epfd(-1), can_fd(-1), listen_fd(-1),
+	  signal_fd(-1), timer_fd(-1),
+	  reader((can_fd = can_socket_open(config.ifname, true,
+					   config.rcvbuf)), config.batch),
+	  slots(config.max_clients), dispatch(config.max_clients),
+	  filtered(false), sets(config.batch), frames(0), wakeups(0),
+	  can_errors(0), can_reopens(0)
+{
+	sigset_t mask;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+		throw_errno("epoll_create1");
+
+	listen_fd = listen_socket(config.host, config.port);
+
+	/* SIGINT and SIGTERM end the loop */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, nullptr);
+	signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd < 0)
+		throw_errno("signalfd");
+
+	if (config.stats_interval) {
+		struct itimerspec its = {};
+
+		its.it_interval.tv_sec = config.stats_interval;
+		its.it_value.tv_sec = config.stats_interval;
+		timer_fd = timerfd_create(CLOCK_MONOTONIC,
+					  TFD_NONBLOCK | TFD_CLOEXEC);
+		if (timer_fd < 0 ||
+		    timerfd_settime(timer_fd, 0, &its, nullptr) < 0)
+			throw_errno("timerfd");
+		epoll_add(timer_fd, EPOLLIN);
+	}
+
+	if (!config.shm_name.empty())
+		shm.reset(new shm_ring_writer(config.shm_name,
+					      config.shm_slots,
+					      config.shm_mode,
+					      config.shm_replace));
+	if (!config.udp_dest.empty())
+		udp.reset(new udp_sender(config.udp_dest, config.udp_mtu,
+					 config.udp_history, config.udp_ttl));
+	update_filters();
+
+	epoll_add(can_fd, EPOLLIN);
+	epoll_add(listen_fd, EPOLLIN);
+	epoll_add(signal_fd, EPOLLIN);
+}
+
+gateway::~gateway()
+{
+	for (auto &it : clients)
+		close(it.first);
+	if (timer_fd >= 0)
+		close(timer_fd);
+	if (signal_fd >= 0)
+		close(signal_fd);
+	if (listen_fd >= 0)
+		close(listen_fd);
+	if (epfd >= 0)
+		close(epfd);
+	if (can_fd >= 0)
+		close(can_fd);
+}
+
+void gateway::epoll_add(int fd, uint32_t events)
+{
+	struct epoll_event ev = {};
+
+	ev.events = events;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		throw_errno("epoll_ctl");
+}
+
+void gateway::epoll_mod(int fd, uint32_t events)
+{
+	struct epoll_event ev = {};
+
+	ev.events = events;
+	ev.data.fd = fd;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void gateway::accept_clients()
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	char name[INET_ADDRSTRLEN + 8];
+	bool accepted = false;
+	unsigned int slot;
+	int fd, on = 1;
+
+	while ((fd = accept4(listen_fd,
+			     reinterpret_cast<struct sockaddr *>(&addr),
+			     &len, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		len = sizeof(addr);
+		for (slot = 0; slot < slots.size() && slots[slot]; slot++)
+			;
+		if (slot == slots.size()) {
+			close(fd);
+			continue;
+		}
+
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		if (config.client_sndbuf > 0)
+			setsockopt(fd, SOL_SOCKET, SO_SNDBUF,
+				   &config.client_sndbuf,
+				   sizeof(config.client_sndbuf));
+		inet_ntop(AF_INET, &addr.sin_addr, name, sizeof(name));
+		snprintf(name + strlen(name), sizeof(name) - strlen(name),
+			 ":%u", ntohs(addr.sin_port));
+
+		clients[fd].reset(new client(fd, slot, name,
+					     config.client_buffer));
+		slots[slot] = clients[fd].get();
+		/* everything until the client subscribes */
+		dispatch.set(slot, { { 0, 0 } });
+		accepted = true;
+		epoll_add(fd, EPOLLIN | EPOLLRDHUP);
+		fprintf(stderr, "client %s connected\n", name);
+	}
+
+	if (accepted)
+		update_filters();
+}
+
+void gateway::close_client(client *c)
+{
+	int fd = c->fd;
+
+	dispatch.clear(c->slot);
+	slots[c->slot] = nullptr;
+	fprintf(stderr,
+		"client %s %s - %llu frames, %llu drops, max lag %llu\n",
+		c->name.c_str(), c->overflow ? "too slow" : "disconnected",
+		(unsigned long long)c->frames, (unsigned long long)c->drops,
+		(unsigned long long)c->max_lag);
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+	close(fd);
+	clients.erase(fd);
+	update_filters();
+}
+
+/* narrow the socket down to what the clients subscribed to */
+void gateway::update_filters()
+{
+	std::vector<struct can_filter> filters;
+
+	dispatch.compile();
+	filtered = !dispatch.all();
+
+	/* the shared memory ring and the udp stream get every frame -
+	 * without clients, ring and stream nothing needs to be received
+	 */
+	if (shm || udp || !dispatch.kernel_filter(&filters))
+		filters.assign(1, { 0, 0 });
+	/* a lost socket gets them when it is reopened */
+	if (can_fd < 0)
+		return;
+	if (setsockopt(can_fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters.data(),
+		       filters.size() * sizeof(filters[0])) < 0)
+		throw_errno("CAN_RAW_FILTER");
+}
+
+/* writev whatever is pending - returns false if the client is gone */
+bool gateway::flush_client(client *c)
+{
+	struct iovec iov[2];
+	ssize_t ret;
+	int n;
+
+	while ((n = c->ring.peek(iov)) > 0) {
+		ret = writev(c->fd, iov, n);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return false;
+		}
+		c->ring.consume(ret);
+		c->bytes += ret;
+
+		/* the records that went out completely */
+		c->sent += ret;
+		while (!c->pending.empty() &&
+		       c->sent >= c->pending.front().bytes) {
+			c->sent -= c->pending.front().bytes;
+			c->frames += c->pending.front().frames;
+			c->lag -= c->pending.front().frames;
+			c->pending.pop_front();
+		}
+	}
+
+	/* wait for room in the socket buffer only while data is pending */
+	if (c->ring.empty() == c->blocked) {
+		c->blocked = !c->ring.empty();
+		epoll_mod(c->fd, EPOLLIN | EPOLLRDHUP |
+			  (c->blocked ? (uint32_t)EPOLLOUT : 0));
+	}
+
+	return true;
+}
+
+/* read what the client sends - returns false if it is gone or sent
+ * something invalid
+ */
+bool gateway::read_client(client *c)
+{
+	/* the largest message of a client, a full subscription - a client
+	 * never has more than that pending without a complete message
+	 */
+	static const size_t input_max = CAN_PROTO_SUB_HEADER_LEN +
+		8 * CAN_PROTO_SUB_MAX;
+	uint8_t buf[4096];
+	ssize_t ret;
+
+	for (;;) {
+		ret = read(c->fd, buf, sizeof(buf));
+		/* a subscription may come right before the client hangs up
+		 * - it is parsed already
+		 */
+		if (ret == 0)
+			return false;
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+			return false;
+		}
+
+		/* parse as it comes, so a client sending without end does
+		 * not grow the input without bound
+		 */
+		c->input.insert(c->input.end(), buf, buf + ret);
+		if (!parse_client(c))
+			return false;
+		if (c->input.size() >= input_max) {
+			fprintf(stderr, "client %s: message too long\n",
+				c->name.c_str());
+			return false;
+		}
+	}
+}
+
+/* handle the complete subscriptions and backfill requests of a client */
+bool gateway::parse_client(client *c)
+{
+	std::vector<struct can_filter> filters;
+	bool subscribed = false;
+	size_t pos = 0, len;
+	const uint8_t *p;
+	uint32_t count;
+	uint64_t seq;
+	long used = 0;
+
+	while (c->input.size() - pos >= 2) {
+		p = &c->input[pos];
+		len = c->input.size() - pos;
+
+		if (udp && p[0] == CAN_PROTO_REQ_MAGIC0 &&
+		    p[1] == CAN_PROTO_REQ_MAGIC1) {
+			used = can_proto_parse_backfill(p, len, &seq, &count);
+			if (used > 0) {
+				/* as far as the ring of the client takes it */
+				reply.clear();
+				udp->backfill(seq, count, reply,
+					      c->ring.space());
+				enqueue(c, reply.data(), reply.size(), 0);
+			}
+		} else {
+			used = can_proto_parse_subscription(p, len, &filters);
+			if (used > 0)
+				subscribed = true;
+		}
+		if (used <= 0)
+			break;
+		pos += used;
+	}
+	c->input.erase(c->input.begin(), c->input.begin() + pos);
+
+	if (used < 0) {
+		fprintf(stderr, "client %s: invalid message\n",
+			c->name.c_str());
+		return false;
+	}
+
+	/* only the last one counts */
+	if (subscribed) {
+		dispatch.set(c->slot, filters);
+		update_filters();
+		fprintf(stderr, "client %s subscribed to %zu filters\n",
+			c->name.c_str(), filters.size());
+	}
+
+	return true;
+}
+
+void gateway::client_event(client *c, uint32_t events)
+{
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		close_client(c);
+		return;
+	}
+
+	/* a backfill answer goes out right away */
+	if ((events & (EPOLLIN | EPOLLRDHUP)) &&
+	    (!read_client(c) || (!c->blocked && !flush_client(c)))) {
+		close_client(c);
+		return;
+	}
+
+	if ((events & EPOLLOUT) && !flush_client(c))
+		close_client(c);
+}
+
+/* the stream format of can_receiver.py, so existing clients keep working:
+ * timestamp (double, s), id (int32), length (int32), data - big endian
+ */
+void gateway::encode_legacy(const can_rx_frame &rx)
+{
+	size_t pos = staging.size();
+	double ts = rx.ts_ns / 1e9;
+	uint64_t ts_bits;
+	uint32_t id = htonl(rx.frame.can_id & CAN_EFF_MASK);
+	uint32_t len = htonl(rx.frame.len);
+
+	memcpy(&ts_bits, &ts, sizeof(ts_bits));
+	ts_bits = htobe64(ts_bits);
+
+	staging.resize(pos + 16 + rx.frame.len);
+	memcpy(&staging[pos], &ts_bits, 8);
+	memcpy(&staging[pos + 8], &id, 4);
+	memcpy(&staging[pos + 12], &len, 4);
+	memcpy(&staging[pos + 16], rx.frame.data, rx.frame.len);
+	records.push_back({ staging.size(), 1 });
+}
+
+static void proto_frame(const can_rx_frame &rx, can_proto_frame *frame)
+{
+	frame->ts_ns = rx.ts_ns;
+	frame->can_id = rx.frame.can_id;
+	frame->flags = 0;
+	if (rx.fd) {
+		frame->flags |= CAN_PROTO_FLAG_FD;
+		if (rx.frame.flags & CANFD_BRS)
+			frame->flags |= CAN_PROTO_FLAG_BRS;
+		if (rx.frame.flags & CANFD_ESI)
+			frame->flags |= CAN_PROTO_FLAG_ESI;
+	}
+	frame->len = rx.frame.len;
+	memcpy(frame->data, rx.frame.data, rx.frame.len);
+}
+
+/* the frames of a single recvmmsg as one batch - with sets only those
+ * dispatched to slot
+ */
+void gateway::encode(int count, const size_t *sets, unsigned int slot)
+{
+	can_proto_frame frame;
+	int i, first;
+
+	for (first = 0; first < count; first++)
+		if (!sets || dispatch.match(sets[first], slot))
+			break;
+	if (first == count)
+		return;
+
+	if (config.protocol == GATEWAY_PROTO_LEGACY) {
+		for (i = first; i < count; i++)
+			if (!sets || dispatch.match(sets[i], slot))
+				encode_legacy(reader[i]);
+		return;
+	}
+
+	encoder.begin(staging, reader[first].ts_ns);
+	for (i = first; i < count; i++) {
+		if (sets && !dispatch.match(sets[i], slot))
+			continue;
+		proto_frame(reader[i], &frame);
+		encoder.add(frame);
+	}
+	encoder.finish();
+	records.push_back({ staging.size(), encoder.count() });
+}
+
+/* the frames of a single recvmmsg to the local consumers */
+void gateway::publish(int count)
+{
+	can_proto_frame frame;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		proto_frame(reader[i], &frame);
+		shm->publish(frame);
+	}
+	shm->commit();
+}
+
+/* the frames of a single recvmmsg to the udp stream - a datagram does
+ * not wait for the next wakeup
+ */
+void gateway::stream(int count)
+{
+	can_proto_frame frame;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		proto_frame(reader[i], &frame);
+		udp->add(frame);
+	}
+	udp->finish();
+}
+
+/* make room for need more bytes by dropping the oldest records - all but
+ * one writev sent in part, the stream has to stay framed
+ */
+void gateway::drop_oldest(client *c, size_t need)
+{
+	size_t first = c->sent ? 1 : 0, keep, freed = 0;
+	auto it = c->pending.begin() + first;
+
+	while (it != c->pending.end() && freed < need) {
+		freed += it->bytes;
+		c->drops += it->frames;
+		c->lag -= it->frames;
+		++it;
+	}
+
+	keep = first ? c->pending.front().bytes - c->sent : 0;
+	c->ring.drop(keep, freed);
+	c->pending.erase(c->pending.begin() + first, it);
+}
+
+/* queue a record for a client - a full ring is up to the policy */
+bool gateway::enqueue(client *c, const uint8_t *data, size_t len,
+		      unsigned int frames)
+{
+	if (len > c->ring.space()) {
+		if (config.policy == GATEWAY_DISCONNECT)
+			c->overflow = true;
+		else if (config.policy == GATEWAY_DROP_OLDEST)
+			drop_oldest(c, len - c->ring.space());
+	}
+
+	if (c->overflow || !c->ring.push(data, len)) {
+		c->drops += frames;
+		return false;
+	}
+
+	c->pending.push_back({ len, frames });
+	c->lag += frames;
+	if (c->lag > c->max_lag)
+		c->max_lag = c->lag;
+
+	return true;
+}
+
+void gateway::push(client *c)
+{
+	size_t start = 0;
+
+	for (const record &r : records) {
+		enqueue(c, &staging[start], r.end - start, r.frames);
+		start = r.end;
+	}
+}
+
+void gateway::fan_out()
+{
+	for (auto &it : clients)
+		push(it.second.get());
+}
+
+/* the frames of a single recvmmsg encoded for each client on its own */
+void gateway::dispatch_batch(int count)
+{
+	int i;
+
+	dispatch.trim();
+	for (i = 0; i < count; i++)
+		sets[i] = dispatch.lookup(reader[i].frame.can_id);
+
+	for (client *c : slots) {
+		if (!c)
+			continue;
+		staging.clear();
+		records.clear();
+		encode(count, sets.data(), c->slot);
+		push(c);
+	}
+	staging.clear();
+	records.clear();
+}
+
+void gateway::read_can()
+{
+	std::vector<client *> gone;
+	unsigned int b;
+	int count;
+
+	staging.clear();
+	records.clear();
+	wakeups++;
+
+	/* a bounded number of batches keeps the clients served */
+	for (b = 0; b < config.batches; b++) {
+		count = reader.read();
+		if (count < 0) {
+			can_error(-count);
+			break;
+		}
+
+		if (count) {
+			if (shm)
+				publish(count);
+			if (udp)
+				stream(count);
+			if (filtered)
+				dispatch_batch(count);
+			else
+				encode(count, nullptr, 0);
+		}
+		frames += count;
+
+		if ((unsigned int)count < config.batch)
+			break;
+	}
+
+	if (udp)
+		udp->send();
+
+	/* dispatch_batch() pushed per client already */
+	if (!filtered) {
+		if (records.empty())
+			return;
+		fan_out();
+	}
+
+	/* one writev per client and wakeup - blocked clients get
+	 * flushed when EPOLLOUT fires
+	 */
+	for (auto &it : clients) {
+		client *c = it.second.get();
+
+		if (c->overflow || (!c->blocked && !flush_client(c)))
+			gone.push_back(c);
+	}
+	for (client *c : gone)
+		close_client(c);
+}
+
+/* a read error of the can socket does not end the gateway:
+ * * ENETDOWN is reported once when the interface goes down (ip link set
+ *   down, a bus-off restart) and the socket receives again once it is up
+ * * EINTR and EAGAIN are retried with the next wakeup
+ * * anything else (e.g. ENODEV, the interface is gone) gets the socket
+ *   reopened, every second until the interface is back
+ */
+void gateway::can_error(int err)
+{
+	can_errors++;
+	fprintf(stderr, "%s: recvmmsg: %s\n", config.ifname.c_str(),
+		strerror(err));
+	if (err == ENETDOWN || err == EINTR || err == EAGAIN)
+		return;
+
+	reopen_can();
+}
+
+void gateway::reopen_can()
+{
+	bool lost = can_fd < 0;
+
+	if (!lost) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, can_fd, nullptr);
+		close(can_fd);
+		can_fd = -1;
+	}
+
+	try {
+		can_fd = can_socket_open(config.ifname, true, config.rcvbuf);
+	} catch (const std::system_error &e) {
+		/* run() retries every second - only the first one is told */
+		if (!lost)
+			fprintf(stderr, "%s: reopen failed: %s, retrying\n",
+				config.ifname.c_str(), e.what());
+		return;
+	}
+
+	reader.reset(can_fd);
+	update_filters();
+	epoll_add(can_fd, EPOLLIN);
+	can_reopens++;
+	fprintf(stderr, "%s: socket reopened\n", config.ifname.c_str());
+}
+
+void gateway::print_stats(FILE *out) const
+{
+	fprintf(out, "%s: %llu frames, %llu wakeups, %u kernel drops, "
+		"%llu read errors, %llu reopens, %zu clients\n",
+		config.ifname.c_str(),
+		(unsigned long long)frames, (unsigned long long)wakeups,
+		reader.kernel_drops(), (unsigned long long)can_errors,
+		(unsigned long long)can_reopens, clients.size());
+	if (shm)
+		fprintf(out, "  %-21s %llu frames\n", config.shm_name.c_str(),
+			(unsigned long long)shm->published());
+	if (udp)
+		fprintf(out, "  %-21s %llu frames, %llu datagrams, "
+			"%llu dropped, %llu backfilled\n",
+			udp->name().c_str(),
+			(unsigned long long)udp->frames(),
+			(unsigned long long)udp->datagrams(),
+			(unsigned long long)udp->dropped(),
+			(unsigned long long)udp->backfilled());
+	for (auto &it : clients) {
+		const client *c = it.second.get();
+
+		fprintf(out, "  %-21s %llu frames, %llu bytes, %llu drops, "
+			"lag %llu (max %llu), %zu pending\n", c->name.c_str(),
+			(unsigned long long)c->frames,
+			(unsigned long long)c->bytes,
+			(unsigned long long)c->drops,
+			(unsigned long long)c->lag,
+			(unsigned long long)c->max_lag, c->ring.used());
+	}
+	fflush(out);
+}
+
+int gateway::run()
+{
+	struct epoll_event events[64];
+	int n, i;
+
+	for (;;) {
+		/* wake up every second to reopen a lost can socket */
+		n = epoll_wait(epfd, events, 64, can_fd < 0 ? 1000 : -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			throw_errno("epoll_wait");
+		}
+		if (can_fd < 0)
+			reopen_can();
+
+		for (i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+
+			if (fd == can_fd) {
+				read_can();
+			} else if (fd == listen_fd) {
+				accept_clients();
+			} else if (fd == signal_fd) {
+				print_stats(stderr);
+				return 0;
+			} else if (fd == timer_fd) {
+				uint64_t expired;
+
+				if (read(timer_fd, &expired,
+					 sizeof(expired)) > 0)
+					print_stats(stderr);
+			} else {
+				auto it = clients.find(fd);
+
+				/* may have been closed earlier in this loop */
+				if (it != clients.end())
+					client_event(it->second.get(),
+						     events[i].events);
+			}
+		}
+	}
+}
+
+} /* namespace can_app */
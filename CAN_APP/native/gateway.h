@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* CAN to TCP (and UDP) gateway
+ *
+ * a single raw can socket is read in batches (recvmmsg) and every batch
+ * gets encoded once (see can_proto.h) and appended to the bounded ring of
+ * every connected client - the rings are flushed with writev once per
+ * wakeup, clients that cannot keep up lose frames (counted per client)
+ * instead of stalling the reader or the other clients. what a full ring
+ * does is the policy: drop the new batch, drop the oldest pending ones or
+ * disconnect the client. either way the memory stays within max_clients
+ * times client_buffer (plus the capped socket buffers), however many
+ * clients stall.
+ *
+ * clients may subscribe to a list of id/mask filters. the union of all
+ * subscriptions becomes the CAN_RAW_FILTER of the socket, so the kernel
+ * drops what nobody wants, and each batch gets encoded per client from
+ * the frames dispatch.h picks for it.
+ *
+ * with protocol legacy the stream format of can_receiver.py is sent
+ * instead, one record per frame.
+ *
+ * with a shm name the frames are published to a shared memory ring for
+ * local consumers as well (see shm_ring.h).
+ *
+ * with a udp destination every frame goes out in sequenced datagrams as
+ * well (see udp_stream.h), tcp clients may ask for the ones they missed.
+ *
+ * everything runs in one thread on a single epoll loop.
+ */
+
+#ifndef __GATEWAY_H
+#define __GATEWAY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "byte_ring.h"
+#include "can_proto.h"
+#include "can_socket.h"
+#include "dispatch.h"
+#include "shm_ring.h"
+#include "udp_stream.h"
+
+namespace can_app {
+
+enum gateway_protocol {
+	GATEWAY_PROTO_BATCH,
+	GATEWAY_PROTO_LEGACY,
+};
+
+/* what happens to a client whose ring is full */
+enum gateway_policy {
+	GATEWAY_DROP_NEWEST,
+	GATEWAY_DROP_OLDEST,
+	GATEWAY_DISCONNECT,
+};
+
+struct gateway_config {
+	enum gateway_protocol protocol = GATEWAY_PROTO_BATCH;
+	enum gateway_policy policy = GATEWAY_DROP_NEWEST;
+	std::string ifname = "can1";
+	std::string host = "0.0.0.0";
+	uint16_t port = 8000;
+	/* the ring of each client in bytes */
+	size_t client_buffer = 1 << 20;
+	/* the socket send buffer of each client - without it the kernel
+	 * lets a stalled client take megabytes of its memory
+	 */
+	int client_sndbuf = 128 << 10;
+	/* frames per recvmmsg and batches per wakeup */
+	unsigned int batch = 64;
+	unsigned int batches = 16;
+	/* the receive queue of the can socket in bytes */
+	int rcvbuf = 4 << 20;
+	unsigned int max_clients = 64;
+	/* print the statistics every stats_interval seconds, 0 disables */
+	unsigned int stats_interval = 0;
+	/* the shared memory ring, empty disables it */
+	std::string shm_name;
+	unsigned int shm_slots = 16384;
+	/* access of the ring - readers need write access as well */
+	mode_t shm_mode = 0660;
+	/* replace an existing ring of that name instead of failing */
+	bool shm_replace = false;
+	/* addr:port of the udp stream, empty disables it */
+	std::string udp_dest;
+	size_t udp_mtu = UDP_STREAM_MTU;
+	/* datagrams held for backfill requests */
+	unsigned int udp_history = 4096;
+	int udp_ttl = 1;
+};
+
+class gateway {
+public:
+	explicit gateway(const gateway_config &config);
+	~gateway();
+
+	/* run until SIGINT or SIGTERM - returns the exit code */
+	int run();
+
+	void print_stats(FILE *out) const;
+
+private:
+	struct queued {
+		size_t bytes;
+		unsigned int frames;
+	};
+
+	struct client {
+		client(int fd, unsigned int slot, const std::string &name,
+		       size_t buffer)
+			: fd(fd), slot(slot), name(name), ring(buffer)
+		{
+		}
+
+		int fd;
+		/* the slot in dispatch */
+		unsigned int slot;
+		std::string name;
+		byte_ring ring;
+		/* a partial subscription */
+		std::vector<uint8_t> input;
+		/* the records in ring - writev sent sent bytes of the first */
+		std::deque<queued> pending;
+		size_t sent = 0;
+		/* EPOLLOUT is armed - the socket buffer was full */
+		bool blocked = false;
+		/* the ring ran full with GATEWAY_DISCONNECT */
+		bool overflow = false;
+		/* frames written, queued (the lag) and dropped */
+		uint64_t frames = 0;
+		uint64_t bytes = 0;
+		uint64_t lag = 0;
+		uint64_t max_lag = 0;
+		uint64_t drops = 0;
+	};
+
+	void epoll_add(int fd, uint32_t events);
+	void epoll_mod(int fd, uint32_t events);
+
+	void accept_clients();
+	void close_client(client *c);
+	void client_event(client *c, uint32_t events);
+	bool read_client(client *c);
+	bool parse_client(client *c);
+	bool flush_client(client *c);
+	void update_filters();
+
+	void read_can();
+	void can_error(int err);
+	void reopen_can();
+	void encode_legacy(const can_rx_frame &rx);
+	void encode(int count, const size_t *sets, unsigned int slot);
+	void publish(int count);
+	void stream(int count);
+	void dispatch_batch(int count);
+	void push(client *c);
+	bool enqueue(client *c, const uint8_t *data, size_t len,
+		     unsigned int frames);
+	void drop_oldest(client *c, size_t need);
+	void fan_out();
+
+	gateway_config config;
+	int epfd;
+	int can_fd;
+	int listen_fd;
+	int signal_fd;
+	int timer_fd;
+	can_reader reader;
+
+	std::unordered_map<int, std::unique_ptr<client>> clients;
+	/* the clients by dispatch slot */
+	std::vector<client *> slots;
+	can_dispatch dispatch;
+	/* some clients do not get every frame */
+	bool filtered;
+	std::vector<size_t> sets;
+
+	/* the frames of the current wakeup encoded once for all clients
+	 * as records (batches or legacy frames) that get pushed whole
+	 */
+	struct record {
+		size_t end;
+		unsigned int frames;
+	};
+	std::vector<uint8_t> staging;
+	std::vector<record> records;
+	can_proto_encoder encoder;
+
+	std::unique_ptr<shm_ring_writer> shm;
+	std::unique_ptr<udp_sender> udp;
+	/* a backfill answer */
+	std::vector<uint8_t> reply;
+
+	uint64_t frames;
+	uint64_t wakeups;
+	/* read errors of the can socket and the times it got reopened */
+	uint64_t can_errors;
+	uint64_t can_reopens;
+};
+
+} /* namespace can_app */
+
+#endif /* __GATEWAY_H */
@@ -0,0 +1,209 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* compares the stream of can_receiver.py with the batched stream of
+ * can_proto.h - bytes, syscalls and tcp segments per frame, plus the
+ * cost of encoding and decoding
+ *
+ * can_receiver.py sends 4 times per frame (timestamp, id, dlc, data),
+ * can_gateway sends one batch per recvmmsg with all the frames that
+ * arrived since the last wakeup - at low load that is a single frame,
+ * at full load dozens.
+ *
+ * the wire estimate adds 66 bytes per tcp segment (ethernet, ipv4 and
+ * tcp with timestamps) and splits writes at an mss of 1448 bytes. the
+ * gain in raw bytes is much smaller than on the wire, where the batches
+ * save segments - a single frame batch is larger than the legacy frame.
+ *
+ * usage: proto_bench [frames]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include "can_proto.h"
+
+#define SEGMENT_OVERHEAD	66
+#define MSS			1448
+
+struct result {
+	double bytes;
+	double syscalls;
+	double wire;
+};
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* a deterministic mix of classic and fd frames 100us apart */
+static std::vector<can_app::can_proto_frame> make_frames(int count,
+							 int fd_percent)
+{
+	std::vector<can_app::can_proto_frame> frames(count);
+	uint64_t ts = 1600000000ULL * 1000000000ULL;
+	unsigned int seed = 1;
+	int i, j;
+
+	for (i = 0; i < count; i++) {
+		can_app::can_proto_frame &f = frames[i];
+
+		seed = seed * 1103515245 + 12345;
+		ts += 100000 + (seed >> 16) % 1000;
+		f.ts_ns = ts;
+		f.flags = 0;
+		if ((int)((seed >> 8) % 100) < fd_percent) {
+			f.flags = CAN_PROTO_FLAG_FD | CAN_PROTO_FLAG_BRS;
+			f.len = 64;
+			f.can_id = 0x18DAF100 | CAN_EFF_FLAG;
+		} else {
+			f.len = 8;
+			f.can_id = 0x100 + (seed >> 20) % 0x100;
+		}
+		for (j = 0; j < f.len; j++)
+			f.data[j] = i + j;
+	}
+
+	return frames;
+}
+
+static double segments(size_t bytes)
+{
+	return (bytes + MSS - 1) / MSS;
+}
+
+static struct result legacy(const std::vector<can_app::can_proto_frame> &f)
+{
+	struct result r = {};
+
+	for (const auto &frame : f) {
+		r.bytes += 16 + frame.len;
+		r.syscalls += 4;
+		r.wire += 16 + frame.len + 4 * SEGMENT_OVERHEAD;
+	}
+	r.bytes /= f.size();
+	r.syscalls /= f.size();
+	r.wire /= f.size();
+
+	return r;
+}
+
+static struct result batched(const std::vector<can_app::can_proto_frame> &f,
+			     size_t per_wakeup, double *encode_ns,
+			     double *decode_ns)
+{
+	can_app::can_proto_encoder encoder;
+	can_app::can_proto_decoder decoder;
+	std::vector<uint8_t> out;
+	struct result r = {};
+	uint64_t start, decoded = 0;
+	size_t i, j, len;
+
+	out.reserve(per_wakeup * CAN_PROTO_RECORD_MAX + 64);
+	start = now_ns();
+	for (i = 0; i < f.size(); i += per_wakeup) {
+		out.clear();
+		encoder.begin(out, f[i].ts_ns);
+		for (j = i; j < f.size() && j < i + per_wakeup; j++)
+			encoder.add(f[j]);
+		len = encoder.finish();
+
+		r.bytes += len;
+		r.syscalls += 1;
+		r.wire += len + segments(len) * SEGMENT_OVERHEAD;
+	}
+	*encode_ns = (double)(now_ns() - start) / f.size();
+
+	/* decode the whole stream again and check it */
+	out.clear();
+	for (i = 0; i < f.size(); i += per_wakeup) {
+		encoder.begin(out, f[i].ts_ns);
+		for (j = i; j < f.size() && j < i + per_wakeup; j++)
+			encoder.add(f[j]);
+		encoder.finish();
+	}
+	start = now_ns();
+	decoder.feed(out.data(), out.size(),
+		     [&](const can_app::can_proto_frame &d) {
+			const can_app::can_proto_frame &e = f[decoded++];
+
+			if (d.can_id != e.can_id || d.len != e.len ||
+			    d.flags != e.flags ||
+			    e.ts_ns - d.ts_ns >= 1000 ||
+			    memcmp(d.data, e.data, d.len)) {
+				fprintf(stderr, "frame %llu differs\n",
+					(unsigned long long)decoded - 1);
+				exit(1);
+			}
+		     });
+	*decode_ns = (double)(now_ns() - start) / f.size();
+	if (decoded != f.size()) {
+		fprintf(stderr, "decoded %llu of %zu frames\n",
+			(unsigned long long)decoded, f.size());
+		exit(1);
+	}
+
+	r.bytes /= f.size();
+	r.syscalls /= f.size();
+	r.wire /= f.size();
+
+	return r;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [frames]\n", prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	static const int fd_percents[] = { 0, 50, 100 };
+	static const size_t wakeups[] = { 1, 4, 16, 64 };
+	long count = 1000000;
+	double encode_ns, decode_ns;
+	struct result l, b;
+	char *end;
+
+	if (argc > 2)
+		usage(argv[0]);
+	if (argc > 1) {
+		count = strtol(argv[1], &end, 0);
+		if (*end || end == argv[1] || count <= 0 ||
+		    count > 100000000)
+			usage(argv[0]);
+	}
+
+	printf("%-5s %-16s %8s %8s %9s %8s %8s %8s %8s\n", "fd %", "stream",
+	       "bytes", "x bytes", "syscalls", "wire", "x wire", "enc ns",
+	       "dec ns");
+	for (int fd : fd_percents) {
+		std::vector<can_app::can_proto_frame> f =
+			make_frames(count, fd);
+
+		l = legacy(f);
+		printf("%-5d %-16s %8.1f %8s %9.3f %8.1f %8s %8s %8s\n", fd,
+		       "can_receiver.py", l.bytes, "1.0", l.syscalls, l.wire,
+		       "1.0", "-", "-");
+		for (size_t n : wakeups) {
+			char name[32];
+
+			b = batched(f, n, &encode_ns, &decode_ns);
+			snprintf(name, sizeof(name), "batch of %zu", n);
+			printf("%-5d %-16s %8.1f %8.2f %9.3f %8.1f %8.1f "
+			       "%8.1f %8.1f\n", fd, name, b.bytes,
+			       l.bytes / b.bytes, b.syscalls, b.wire,
+			       l.wire / b.wire, encode_ns, decode_ns);
+		}
+	}
+
+	return 0;
+}
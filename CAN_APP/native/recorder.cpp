@@ -0,0 +1,362 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* capture of a can interface to block logs - see recorder.h */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <system_error>
+
+#include "recorder.h"
+
+namespace can_app {
+
+static void throw_errno(const char *what)
+{
+	throw std::system_error(errno, std::generic_category(), what);
+}
+
+static uint64_t monotonic_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+recorder::recorder(const recorder_config &config)
+	: config(config), can_fd(-1), signal_fd(-1), timer_fd(-1),
+	  reader((can_fd = can_socket_open(config.ifname, true,
+					   config.rcvbuf)), config.batch),
+	  pool(config.blocks), current(nullptr), current_since(0),
+	  stopping(false), file_opened(0), file_number(0), frames(0),
+	  waits(0), can_errors(0), can_reopens(0), blocks_written(0),
+	  raw_bytes(0), stored_bytes(0), files(0)
+{
+	sigset_t mask;
+
+	/* SIGINT and SIGTERM end the recording */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, nullptr);
+	signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd < 0)
+		throw_errno("signalfd");
+
+	if (config.stats_interval) {
+		struct itimerspec its = {};
+
+		its.it_interval.tv_sec = config.stats_interval;
+		its.it_value.tv_sec = config.stats_interval;
+		timer_fd = timerfd_create(CLOCK_MONOTONIC,
+					  TFD_NONBLOCK | TFD_CLOEXEC);
+		if (timer_fd < 0 ||
+		    timerfd_settime(timer_fd, 0, &its, nullptr) < 0)
+			throw_errno("timerfd");
+	}
+
+	/* one block is always being filled */
+	for (can_log_block &b : pool)
+		free_blocks.push_back(&b);
+	current = free_blocks.front();
+	free_blocks.pop_front();
+
+	/* started last - the signal mask above is inherited */
+	writer = std::thread(&recorder::write_loop, this);
+}
+
+recorder::~recorder()
+{
+	stop();
+	if (timer_fd >= 0)
+		close(timer_fd);
+	if (signal_fd >= 0)
+		close(signal_fd);
+	if (can_fd >= 0)
+		close(can_fd);
+}
+
+/* hand the writer what is left and wait for it to finish */
+void recorder::stop()
+{
+	if (!writer.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		if (current->count())
+			full_blocks.push_back(current);
+		current = nullptr;
+		stopping = true;
+	}
+	cond.notify_all();
+	writer.join();
+}
+
+static void proto_frame(const can_rx_frame &rx, can_proto_frame *frame)
+{
+	frame->ts_ns = rx.ts_ns;
+	frame->can_id = rx.frame.can_id;
+	frame->flags = 0;
+	if (rx.fd) {
+		frame->flags |= CAN_PROTO_FLAG_FD;
+		if (rx.frame.flags & CANFD_BRS)
+			frame->flags |= CAN_PROTO_FLAG_BRS;
+		if (rx.frame.flags & CANFD_ESI)
+			frame->flags |= CAN_PROTO_FLAG_ESI;
+	}
+	frame->len = rx.frame.len;
+	memcpy(frame->data, rx.frame.data, rx.frame.len);
+}
+
+/* pass current to the writer and take the next free block */
+void recorder::submit()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	full_blocks.push_back(current);
+	cond.notify_all();
+
+	/* the writer is a whole pool behind - the socket buffers meanwhile */
+	if (free_blocks.empty()) {
+		waits++;
+		cond.wait(guard, [this] {
+			return !free_blocks.empty() || error;
+		});
+	}
+	if (error)
+		std::rethrow_exception(error);
+
+	current = free_blocks.front();
+	free_blocks.pop_front();
+	current->clear();
+}
+
+void recorder::read_can()
+{
+	can_proto_frame frame;
+	int count, i;
+
+	do {
+		count = reader.read();
+		if (count < 0) {
+			can_error(-count);
+			return;
+		}
+
+		for (i = 0; i < count; i++) {
+			if (!current->count())
+				current_since = monotonic_ns();
+			proto_frame(reader[i], &frame);
+			current->add(frame);
+			if (current->size() + CAN_LOG_RECORD_MAX >
+			    config.block_size)
+				submit();
+		}
+		frames += count;
+	} while ((unsigned int)count == config.batch);
+}
+
+/* a read error of the can socket does not end the recording - as in
+ * gateway::can_error ENETDOWN, EINTR and EAGAIN are waited out and
+ * anything else gets the socket reopened, every second until it works
+ */
+void recorder::can_error(int err)
+{
+	can_errors++;
+	fprintf(stderr, "%s: recvmmsg: %s\n", config.ifname.c_str(),
+		strerror(err));
+	if (err == ENETDOWN || err == EINTR || err == EAGAIN)
+		return;
+
+	reopen_can();
+}
+
+void recorder::reopen_can()
+{
+	bool lost = can_fd < 0;
+
+	if (!lost) {
+		close(can_fd);
+		can_fd = -1;
+	}
+
+	try {
+		can_fd = can_socket_open(config.ifname, true, config.rcvbuf);
+	} catch (const std::system_error &e) {
+		if (!lost)
+			fprintf(stderr, "%s: reopen failed: %s, retrying\n",
+				config.ifname.c_str(), e.what());
+		return;
+	}
+
+	reader.reset(can_fd);
+	can_reopens++;
+	fprintf(stderr, "%s: socket reopened\n", config.ifname.c_str());
+}
+
+void recorder::write_loop()
+{
+	can_log_block *block;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> guard(lock);
+
+			cond.wait(guard, [this] {
+				return !full_blocks.empty() || stopping;
+			});
+			if (full_blocks.empty())
+				break;
+			block = full_blocks.front();
+		}
+
+		try {
+			write_block(*block);
+		} catch (...) {
+			std::lock_guard<std::mutex> guard(lock);
+
+			error = std::current_exception();
+			cond.notify_all();
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+
+			full_blocks.pop_front();
+			free_blocks.push_back(block);
+		}
+		cond.notify_all();
+	}
+
+	try {
+		if (file)
+			file->close();
+	} catch (...) {
+		error = std::current_exception();
+	}
+}
+
+/* close the current file (with its index) and open the next one */
+void recorder::rotate()
+{
+	uint64_t now = can_time_ns();
+	time_t secs = now / 1000000000ULL;
+	char stamp[32];
+	struct tm tm;
+
+	if (file)
+		file->close();
+
+	localtime_r(&secs, &tm);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+	file.reset(new can_log_writer(config.prefix + "-" + stamp + "-" +
+				      std::to_string(file_number++) +
+				      ".canlog", config.ifname, now));
+	file_opened = monotonic_ns();
+	files++;
+}
+
+void recorder::write_block(const can_log_block &block)
+{
+	block.seal(config.codec, config.level, sealed);
+
+	if (!file ||
+	    (config.max_size &&
+	     file->size() + sealed.size() > config.max_size &&
+	     file->size() > CAN_LOG_HEADER_LEN) ||
+	    (config.max_secs &&
+	     monotonic_ns() - file_opened >= config.max_secs * 1000000000ULL))
+		rotate();
+
+	file->write(sealed);
+	blocks_written++;
+	raw_bytes += block.size();
+	stored_bytes += sealed.size();
+}
+
+void recorder::print_stats(FILE *out) const
+{
+	uint64_t raw = raw_bytes, stored = stored_bytes;
+
+	fprintf(out, "%s: %llu frames, %u kernel drops, %llu read errors, "
+		"%llu reopens, %llu blocks (%llu waits), %.1f MB -> %.1f MB "
+		"(%.2f), %u files\n",
+		config.ifname.c_str(), (unsigned long long)frames,
+		reader.kernel_drops(), (unsigned long long)can_errors,
+		(unsigned long long)can_reopens,
+		(unsigned long long)blocks_written,
+		(unsigned long long)waits, raw / 1e6, stored / 1e6,
+		raw ? (double)stored / raw : 0.0, (unsigned int)files);
+	fflush(out);
+}
+
+int recorder::run()
+{
+	struct pollfd pfds[3] = {
+		{ can_fd, POLLIN, 0 },
+		{ signal_fd, POLLIN, 0 },
+		{ timer_fd, POLLIN, 0 },
+	};
+	uint64_t flush_ns = config.flush_ms * 1000000ULL, now;
+	int timeout, flush, n;
+
+	for (;;) {
+		/* wake up in time to flush a block that is not full, and
+		 * every second to reopen a lost can socket (poll skips it)
+		 */
+		timeout = can_fd < 0 ? 1000 : -1;
+		pfds[0].fd = can_fd;
+		if (current->count()) {
+			now = monotonic_ns();
+			flush = current_since + flush_ns > now ?
+				(current_since + flush_ns - now) / 1000000 + 1 :
+				0;
+			if (timeout < 0 || flush < timeout)
+				timeout = flush;
+		}
+
+		n = poll(pfds, timer_fd >= 0 ? 3 : 2, timeout);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			throw_errno("poll");
+		}
+
+		if (pfds[1].revents)
+			break;
+		if (can_fd < 0)
+			reopen_can();
+		else if (pfds[0].revents)
+			read_can();
+		if (timer_fd >= 0 && pfds[2].revents) {
+			uint64_t expired;
+
+			if (read(timer_fd, &expired, sizeof(expired)) > 0)
+				print_stats(stderr);
+		}
+
+		if (current->count() &&
+		    monotonic_ns() - current_since >= flush_ns)
+			submit();
+	}
+
+	stop();
+	print_stats(stderr);
+	if (error)
+		std::rethrow_exception(error);
+
+	return 0;
+}
+
+} /* namespace can_app */
@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* capture of a can interface to block logs (see can_log.h)
+ *
+ * the main thread only reads: recvmmsg batches go straight into the
+ * current block, a full block (or one older than flush_ms) is handed to
+ * the writer thread, which compresses it, rotates the file when it got
+ * too big or too old and writes it. blocks come from a fixed pool, so the
+ * memory stays bounded - when the writer falls behind by the whole pool
+ * the reader waits and the socket receive buffer takes up the slack.
+ */
+
+#ifndef __RECORDER_H
+#define __RECORDER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "can_log.h"
+#include "can_socket.h"
+
+namespace can_app {
+
+struct recorder_config {
+	std::string ifname = "can1";
+	/* files are <prefix>-<yyyymmdd>-<hhmmss>-<n>.canlog */
+	std::string prefix = "can";
+	enum can_log_codec codec = CAN_LOG_RAW;
+	/* of the codec, 0 for its default */
+	int level = 0;
+	/* uncompressed bytes per block and blocks in the pool */
+	size_t block_size = 256 << 10;
+	unsigned int blocks = 16;
+	/* frames per recvmmsg */
+	unsigned int batch = 256;
+	/* the receive queue of the can socket in bytes */
+	int rcvbuf = 8 << 20;
+	/* start a new file after max_size bytes or max_secs seconds,
+	 * 0 never does
+	 */
+	uint64_t max_size = 0;
+	unsigned int max_secs = 0;
+	/* a block that is not full goes to disk after flush_ms */
+	unsigned int flush_ms = 1000;
+	/* print the statistics every stats_interval seconds, 0 disables */
+	unsigned int stats_interval = 0;
+};
+
+class recorder {
+public:
+	/* throws std::system_error on failure */
+	explicit recorder(const recorder_config &config);
+	~recorder();
+
+	/* record until SIGINT or SIGTERM - returns the exit code */
+	int run();
+
+	void print_stats(FILE *out) const;
+
+private:
+	void read_can();
+	void can_error(int err);
+	void reopen_can();
+	void submit();
+	void stop();
+
+	/* the writer thread */
+	void write_loop();
+	void write_block(const can_log_block &block);
+	void rotate();
+
+	recorder_config config;
+	int can_fd;
+	int signal_fd;
+	int timer_fd;
+	can_reader reader;
+
+	/* free blocks are with the reader, full ones with the writer */
+	std::vector<can_log_block> pool;
+	std::deque<can_log_block *> free_blocks;
+	std::deque<can_log_block *> full_blocks;
+	can_log_block *current;
+	/* CLOCK_MONOTONIC ns of the first frame in current */
+	uint64_t current_since;
+	std::mutex lock;
+	std::condition_variable cond;
+	bool stopping;
+	std::exception_ptr error;
+	std::thread writer;
+
+	/* writer thread only */
+	std::unique_ptr<can_log_writer> file;
+	uint64_t file_opened;
+	unsigned int file_number;
+	std::vector<uint8_t> sealed;
+
+	uint64_t frames;
+	uint64_t waits;
+	/* read errors of the can socket and the times it got reopened */
+	uint64_t can_errors;
+	uint64_t can_reopens;
+	std::atomic<uint64_t> blocks_written;
+	std::atomic<uint64_t> raw_bytes;
+	std::atomic<uint64_t> stored_bytes;
+	std::atomic<unsigned int> files;
+};
+
+} /* namespace can_app */
+
+#endif /* __RECORDER_H */
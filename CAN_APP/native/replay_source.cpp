@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* the frames of a recorded log - see replay_source.h */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stdexcept>
+#include <system_error>
+
+#include "replay_source.h"
+
+namespace can_app {
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+bool replay_parse_candump(const char *s, can_proto_frame *frame)
+{
+	const char *hash = strchr(s, '#');
+	unsigned int max = CAN_MAX_DLEN;
+	size_t digits;
+	canid_t id = 0;
+	int hi, lo;
+
+	if (!hash)
+		return false;
+	digits = hash - s;
+	if (digits != 3 && digits != 8)
+		return false;
+	for (; s < hash; s++) {
+		hi = hex_digit(*s);
+		if (hi < 0)
+			return false;
+		id = id << 4 | hi;
+	}
+	if (digits == 8 && !(id & CAN_ERR_FLAG))
+		id |= CAN_EFF_FLAG;
+	else if (digits == 3 && id > CAN_SFF_MASK)
+		return false;
+
+	frame->can_id = id;
+	frame->flags = 0;
+	frame->len = 0;
+	s = hash + 1;
+
+	if (*s == '#') {
+		hi = hex_digit(s[1]);
+		if (hi < 0)
+			return false;
+		frame->flags = CAN_PROTO_FLAG_FD;
+		if (hi & CANFD_BRS)
+			frame->flags |= CAN_PROTO_FLAG_BRS;
+		if (hi & CANFD_ESI)
+			frame->flags |= CAN_PROTO_FLAG_ESI;
+		max = CANFD_MAX_DLEN;
+		s += 2;
+	} else if (*s == 'R' || *s == 'r') {
+		frame->can_id |= CAN_RTR_FLAG;
+		s++;
+		if (*s >= '0' && *s <= '8')
+			frame->len = *s++ - '0';
+		/* the len8_dlc of a remote frame, e.g. "R8_9" */
+		if (*s == '_' && hex_digit(s[1]) >= 0)
+			s += 2;
+		return !*s;
+	}
+
+	while (*s && *s != '_') {
+		if (*s == '.') {
+			s++;
+			continue;
+		}
+		hi = hex_digit(s[0]);
+		lo = hi < 0 ? -1 : hex_digit(s[1]);
+		if (lo < 0 || frame->len == max)
+			return false;
+		frame->data[frame->len++] = hi << 4 | lo;
+		s += 2;
+	}
+	/* the len8_dlc of a classic frame, e.g. "1122334455667788_9" */
+	if (*s == '_' && hex_digit(s[1]) >= 0)
+		s += 2;
+
+	/* fd frames only come in the lengths of a dlc */
+	if (frame->flags & CAN_PROTO_FLAG_FD && frame->len > 8 &&
+	    (frame->len > 24 ? frame->len % 16 : frame->len % 4))
+		return false;
+
+	return !*s;
+}
+
+replay_source::replay_source(const std::string &path)
+	: path(path), block_index(0), frame_index(0), text(nullptr),
+	  line(nullptr), line_size(0), line_number(0), unsupported(0)
+{
+	char magic[8];
+
+	text = fopen(path.c_str(), "r");
+	if (!text)
+		throw std::system_error(errno, std::generic_category(),
+					"open " + path);
+
+	if (fread(magic, sizeof(magic), 1, text) == 1 &&
+	    !memcmp(magic, CAN_LOG_MAGIC, sizeof(magic))) {
+		fclose(text);
+		text = nullptr;
+		log.reset(new can_log_reader(path));
+		return;
+	}
+	fseek(text, 0, SEEK_SET);
+}
+
+replay_source::~replay_source()
+{
+	free(line);
+	if (text)
+		fclose(text);
+}
+
+void replay_source::rewind()
+{
+	block.clear();
+	block_index = 0;
+	frame_index = 0;
+	if (text) {
+		fseek(text, 0, SEEK_SET);
+		clearerr(text);
+		line_number = 0;
+	}
+}
+
+bool replay_source::next(can_proto_frame *frame)
+{
+	if (text)
+		return next_line(frame);
+
+	/* a block at a time - blocks without frames are skipped */
+	while (frame_index == block.size()) {
+		if (block_index == log->blocks().size())
+			return false;
+		log->read(block_index++, block);
+		frame_index = 0;
+	}
+	*frame = block[frame_index++];
+
+	return true;
+}
+
+/* "(<secs>.<fraction>) <ifname> <frame>", anything after is ignored */
+bool replay_source::next_line(can_proto_frame *frame)
+{
+	char *p, *end, *token;
+	uint64_t secs, ns;
+	int digits;
+
+	while (getline(&line, &line_size, text) > 0) {
+		line_number++;
+		p = line + strspn(line, " \t");
+		if (*p == '\n' || *p == '\0')
+			continue;
+
+		if (*p != '(')
+			goto invalid;
+		secs = strtoull(p + 1, &end, 10);
+		ns = 0;
+		digits = 0;
+		if (*end == '.') {
+			for (end++; *end >= '0' && *end <= '9'; end++) {
+				if (digits++ < 9)
+					ns = ns * 10 + *end - '0';
+			}
+		}
+		if (*end != ')')
+			goto invalid;
+		for (; digits < 9; digits++)
+			ns *= 10;
+		frame->ts_ns = secs * 1000000000ULL + ns;
+
+		/* the interface, then the frame */
+		p = end + 1;
+		p += strspn(p, " \t");
+		p += strcspn(p, " \t\n");
+		p += strspn(p, " \t");
+		token = p;
+		p += strcspn(p, " \t\n");
+		*p = '\0';
+
+		/* can xl ("###") has no place in a can_proto_frame */
+		if (strstr(token, "###")) {
+			unsupported++;
+			continue;
+		}
+		if (!replay_parse_candump(token, frame))
+			goto invalid;
+
+		return true;
+	}
+	if (ferror(text))
+		throw std::system_error(errno, std::generic_category(),
+					"read " + path);
+
+	return false;
+
+invalid:
+	throw std::runtime_error(path + ":" + std::to_string(line_number) +
+				 ": not a candump -l line");
+}
+
+} /* namespace can_app */
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* the frames of a recorded log, one at a time, for can_replay
+ *
+ * reads the block logs of can_recorder (see can_log.h), a block at a
+ * time, and the text logs of candump -l, a line at a time:
+ *
+ *   (1600000000.123456) can0 123#DEADBEEF
+ *   (1600000000.123500) can0 18DAF110#R
+ *   (1600000000.123600) can0 123##1112233445566778899AABBCCDDEEFF00
+ *
+ * 3 hex digits are a standard id, 8 an extended one (or an error frame
+ * with CAN_ERR_FLAG), "##<flags>" an fd frame with CANFD_BRS/CANFD_ESI in
+ * the flags digit and "#R<len>" a remote frame. the format is told by the
+ * magic of the block log, anything else is read as text.
+ */
+
+#ifndef __REPLAY_SOURCE_H
+#define __REPLAY_SOURCE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "can_log.h"
+#include "can_proto.h"
+
+namespace can_app {
+
+/* parse one frame of candump -l, e.g. "123#DEADBEEF" - false if invalid */
+bool replay_parse_candump(const char *s, can_proto_frame *frame);
+
+class replay_source {
+public:
+	/* throws std::system_error or std::runtime_error */
+	explicit replay_source(const std::string &path);
+	~replay_source();
+
+	/* the next frame - false at the end of the file, throws
+	 * std::runtime_error on a line or block that cannot be read
+	 */
+	bool next(can_proto_frame *frame);
+
+	/* start over at the first frame */
+	void rewind();
+
+	/* frames the format cannot carry (e.g. can xl) were skipped */
+	uint64_t skipped() const { return unsupported; }
+
+private:
+	bool next_line(can_proto_frame *frame);
+
+	std::string path;
+	/* the block log, or nullptr for a candump log in text */
+	std::unique_ptr<can_log_reader> log;
+	std::vector<can_proto_frame> block;
+	size_t block_index;
+	size_t frame_index;
+
+	FILE *text;
+	char *line;
+	size_t line_size;
+	unsigned long line_number;
+	uint64_t unsupported;
+};
+
+} /* namespace can_app */
+
+#endif /* __REPLAY_SOURCE_H */
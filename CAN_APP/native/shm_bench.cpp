@@ -0,0 +1,446 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* local consumers: shared memory ring versus a raw socket each
+ *
+ * sends sequenced traffic (traffic.h) on the tx interface and lets n
+ * consumer processes receive it on the rx interface, either each with a
+ * raw can socket of its own or all from the shared memory ring filled by
+ * a single publisher process (what can_gateway -S does). reports per
+ * configuration the frames received and lost, the latency from the
+ * receive timestamp of the kernel to the consumer and the cpu time of
+ * all processes involved.
+ *
+ * works on vcan, the same interface sends and receives there:
+ *   shm_bench -t vcan0 -i vcan0 -c 1,4,16 -r 20000 -d 5
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "can_socket.h"
+#include "shm_ring.h"
+#include "traffic.h"
+
+enum bench_mode {
+	BENCH_RAW,
+	BENCH_SHM,
+	BENCH_SHM_SPIN,
+};
+
+static const char *const mode_names[] = { "raw", "shm", "shm-spin" };
+
+struct bench_config {
+	std::string tx_ifname = "vcan0";
+	std::string rx_ifname = "vcan0";
+	std::vector<unsigned long> consumers = { 1, 2, 4, 8 };
+	std::vector<enum bench_mode> modes = { BENCH_RAW, BENCH_SHM };
+	double rate = 10000;
+	double duration = 5;
+	unsigned int len = 8;
+	unsigned int batch = 64;
+};
+
+/* what a consumer (or the publisher) reports through its pipe */
+struct bench_report {
+	uint64_t frames;
+	uint64_t lost;
+	double latency_p50_us;
+	double latency_p99_us;
+	double latency_max_us;
+	double cpu_s;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static double cpu_seconds(int who)
+{
+	struct rusage ru;
+
+	getrusage(who, &ru);
+
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+class consumer_stats {
+public:
+	consumer_stats() : frames(0), lost(0), expected(0)
+	{
+		latencies.reserve(1 << 20);
+	}
+
+	void add(uint64_t ts_ns, const uint8_t *data, uint8_t len)
+	{
+		uint32_t seq = can_app::traffic_seq(data, len, expected);
+
+		/* a late frame (seq below expected) was counted as lost */
+		if (frames && seq > expected)
+			lost += seq - expected;
+		if (!frames || seq >= expected)
+			expected = seq + 1;
+		latencies.push_back(can_app::can_time_ns() - ts_ns);
+		frames++;
+	}
+
+	void report(struct bench_report *r)
+	{
+		memset(r, 0, sizeof(*r));
+		r->frames = frames;
+		r->lost = lost;
+		r->cpu_s = cpu_seconds(RUSAGE_SELF);
+		if (latencies.empty())
+			return;
+		std::sort(latencies.begin(), latencies.end());
+		r->latency_p50_us = latencies[latencies.size() / 2] / 1000.0;
+		r->latency_p99_us =
+			latencies[latencies.size() * 99 / 100] / 1000.0;
+		r->latency_max_us = latencies.back() / 1000.0;
+	}
+
+private:
+	uint64_t frames;
+	uint64_t lost;
+	uint32_t expected;
+	std::vector<int64_t> latencies;
+};
+
+static void raw_consumer(const bench_config &config,
+			 struct bench_report *r)
+{
+	int sock = can_app::can_socket_open(config.rx_ifname, true, 4 << 20);
+	can_app::can_reader reader(sock, config.batch);
+	consumer_stats stats;
+	int count, i;
+
+	while (!stop) {
+		struct pollfd pfd = { sock, POLLIN, 0 };
+
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		while ((count = reader.read()) > 0)
+			for (i = 0; i < count; i++)
+				stats.add(reader[i].ts_ns,
+					  reader[i].frame.data,
+					  reader[i].frame.len);
+	}
+
+	stats.report(r);
+	r->lost += reader.kernel_drops();
+}
+
+static void shm_consumer(const bench_config &config, bool spin,
+			 const std::string &name, struct bench_report *r)
+{
+	can_app::shm_ring_reader ring(name);
+	std::vector<can_app::can_proto_frame> frames(config.batch);
+	consumer_stats stats;
+	unsigned int count, i;
+
+	while (!stop) {
+		if (!spin && !ring.wait(100))
+			continue;
+		count = ring.read(frames.data(), frames.size());
+		for (i = 0; i < count; i++)
+			stats.add(frames[i].ts_ns, frames[i].data,
+				  frames[i].len);
+	}
+
+	stats.report(r);
+	r->lost += ring.lost();
+}
+
+/* the part of can_gateway -S that matters here */
+static void publisher(const bench_config &config,
+		      can_app::shm_ring_writer *ring, struct bench_report *r)
+{
+	int sock = can_app::can_socket_open(config.rx_ifname, true, 4 << 20);
+	can_app::can_reader reader(sock, config.batch);
+	can_app::can_proto_frame frame;
+	int count, i;
+
+	while (!stop) {
+		struct pollfd pfd = { sock, POLLIN, 0 };
+
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		while ((count = reader.read()) > 0) {
+			for (i = 0; i < count; i++) {
+				const can_app::can_rx_frame &rx = reader[i];
+
+				frame.ts_ns = rx.ts_ns;
+				frame.can_id = rx.frame.can_id;
+				frame.flags = rx.fd ? CAN_PROTO_FLAG_FD : 0;
+				frame.len = rx.frame.len;
+				memcpy(frame.data, rx.frame.data, frame.len);
+				ring->publish(frame);
+			}
+			ring->commit();
+		}
+	}
+
+	memset(r, 0, sizeof(*r));
+	r->frames = ring->published();
+	r->lost = reader.kernel_drops();
+	r->cpu_s = cpu_seconds(RUSAGE_SELF);
+}
+
+/* run fn in a child that reports through a pipe - returns the pid */
+template <typename Fn>
+static pid_t spawn(int *report_fd, Fn fn)
+{
+	int fds[2];
+	pid_t pid;
+
+	if (pipe(fds) < 0)
+		throw std::runtime_error("pipe failed");
+
+	pid = fork();
+	if (pid < 0)
+		throw std::runtime_error("fork failed");
+	if (!pid) {
+		struct bench_report r = {};
+		int ret = 0;
+
+		close(fds[0]);
+		try {
+			fn(&r);
+		} catch (const std::exception &e) {
+			fprintf(stderr, "shm_bench: %s\n", e.what());
+			ret = 1;
+		}
+		if (write(fds[1], &r, sizeof(r)) != sizeof(r))
+			ret = 1;
+		_exit(ret);
+	}
+
+	close(fds[1]);
+	*report_fd = fds[0];
+
+	return pid;
+}
+
+static uint64_t send_traffic(const bench_config &config)
+{
+	can_app::traffic_config tc;
+	int sock;
+	uint64_t sent = 0, start, now, end;
+	int ret;
+
+	tc.lens = { { can_app::traffic_fd_len(config.len), 1 } };
+	can_app::traffic traffic(tc);
+	sock = can_app::can_socket_open_tx(config.tx_ifname, traffic.fd(), 0);
+	can_app::can_writer writer(sock, 1);
+
+	start = can_app::can_time_ns();
+	end = start + (uint64_t)(config.duration * 1e9);
+	while (!stop && (now = can_app::can_time_ns()) < end) {
+		uint64_t due = (now - start) / 1e9 * config.rate;
+		struct timespec ts = { 0, 100000 };
+
+		if (sent >= due) {
+			nanosleep(&ts, nullptr);
+			continue;
+		}
+		writer.set_fd(0, traffic.next(writer.frame(0)));
+		while ((ret = writer.write(0, 1)) < 0 && !stop) {
+			if (ret != -EAGAIN && ret != -ENOBUFS)
+				throw std::system_error(-ret,
+							std::generic_category(),
+							"sendmmsg");
+			nanosleep(&ts, nullptr);
+		}
+		sent++;
+	}
+	close(sock);
+
+	return sent;
+}
+
+static void run_case(const bench_config &config, enum bench_mode mode,
+		     unsigned long consumers)
+{
+	std::string name = "/can_app.shm_bench";
+	std::unique_ptr<can_app::shm_ring_writer> ring;
+	std::vector<std::pair<pid_t, int>> children;
+	struct bench_report pub = {}, r;
+	std::vector<double> p50;
+	uint64_t sent, frames = 0, lost = 0;
+	double p99 = 0, max = 0, cpu = 0;
+	unsigned long i;
+	int fd;
+
+	if (mode != BENCH_RAW) {
+		/* the bench owns its ring name - replace a stale one */
+		ring.reset(new can_app::shm_ring_writer(name, 1 << 16, 0600,
+							true));
+		children.push_back({ spawn(&fd, [&](struct bench_report *r) {
+			publisher(config, ring.get(), r);
+		}), fd });
+	}
+	for (i = 0; i < consumers; i++) {
+		children.push_back({ spawn(&fd, [&](struct bench_report *r) {
+			if (mode == BENCH_RAW)
+				raw_consumer(config, r);
+			else
+				shm_consumer(config, mode == BENCH_SHM_SPIN,
+					     name, r);
+		}), fd });
+	}
+
+	/* let everyone open its socket or attach to the ring */
+	usleep(200000);
+	sent = send_traffic(config);
+	usleep(200000);
+
+	for (auto &c : children)
+		kill(c.first, SIGTERM);
+	for (i = 0; i < children.size(); i++) {
+		int status;
+
+		if (read(children[i].second, &r, sizeof(r)) != sizeof(r))
+			memset(&r, 0, sizeof(r));
+		close(children[i].second);
+		waitpid(children[i].first, &status, 0);
+
+		cpu += r.cpu_s;
+		if (ring && !i) {
+			pub = r;
+			continue;
+		}
+		frames += r.frames;
+		lost += r.lost;
+		p50.push_back(r.latency_p50_us);
+		p99 = std::max(p99, r.latency_p99_us);
+		max = std::max(max, r.latency_max_us);
+	}
+	std::sort(p50.begin(), p50.end());
+
+	printf("%-8s %4lu consumers: %llu sent, %.0f received and "
+	       "%llu lost per consumer, latency p50 %.1fus p99 %.1fus "
+	       "max %.1fus, cpu %.2fs (%.1f%%, publisher %.2fs)\n",
+	       mode_names[mode], consumers, (unsigned long long)sent,
+	       (double)frames / consumers,
+	       (unsigned long long)(lost / consumers),
+	       p50.empty() ? 0 : p50[p50.size() / 2], p99, max, cpu,
+	       cpu / config.duration * 100, pub.cpu_s);
+	fflush(stdout);
+}
+
+static std::vector<std::string> split(const std::string &spec)
+{
+	std::vector<std::string> items;
+	std::stringstream ss(spec);
+	std::string item;
+
+	while (std::getline(ss, item, ','))
+		items.push_back(item);
+	if (items.empty())
+		throw std::invalid_argument("empty list: " + spec);
+
+	return items;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -t <ifname>    sending interface (default vcan0)\n"
+		"  -i <ifname>    receiving interface (default vcan0)\n"
+		"  -c <counts>    numbers of consumers (default 1,2,4,8)\n"
+		"  -m <modes>     raw, shm (waiting on the futex) and/or\n"
+		"                 shm-spin (default raw,shm)\n"
+		"  -r <rate>      frames per second (default 10000)\n"
+		"  -d <secs>      seconds per case (default 5)\n"
+		"  -L <len>       payload length (default 8)\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	bench_config config;
+	int opt;
+
+	try {
+		while ((opt = getopt(argc, argv, "t:i:c:m:r:d:L:h")) != -1) {
+			switch (opt) {
+			case 't':
+				config.tx_ifname = optarg;
+				break;
+			case 'i':
+				config.rx_ifname = optarg;
+				break;
+			case 'c':
+				config.consumers.clear();
+				for (auto &s : split(optarg))
+					config.consumers.push_back(
+						strtoul(s.c_str(), NULL, 0));
+				break;
+			case 'm':
+				config.modes.clear();
+				for (auto &s : split(optarg)) {
+					unsigned int m;
+
+					for (m = 0; m < 3; m++)
+						if (s == mode_names[m])
+							break;
+					if (m == 3)
+						usage(argv[0]);
+					config.modes.push_back(
+						(enum bench_mode)m);
+				}
+				break;
+			case 'r':
+				config.rate = atof(optarg);
+				break;
+			case 'd':
+				config.duration = atof(optarg);
+				break;
+			case 'L':
+				config.len = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				usage(argv[0]);
+			}
+		}
+		if (config.rate <= 0 || config.duration <= 0 ||
+		    config.len > CANFD_MAX_DLEN)
+			usage(argv[0]);
+
+		signal(SIGINT, on_signal);
+		signal(SIGTERM, on_signal);
+
+		for (enum bench_mode mode : config.modes)
+			for (unsigned long n : config.consumers)
+				if (!stop)
+					run_case(config, mode, n);
+	} catch (const std::exception &e) {
+		fprintf(stderr, "shm_bench: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* shared memory ring of received can frames - see shm_ring.h */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <system_error>
+
+#include "shm_ring.h"
+
+namespace can_app {
+
+std::string shm_ring_name(const std::string &ifname)
+{
+	return "/can_app." + ifname;
+}
+
+static long futex(std::atomic<uint32_t> *addr, int op, uint32_t val,
+		  const struct timespec *timeout)
+{
+	/* not FUTEX_PRIVATE_FLAG - the word is shared between processes */
+	return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), op, val,
+		       timeout, nullptr, 0);
+}
+
+static uint64_t round_up(uint64_t n)
+{
+	uint64_t size = 1;
+
+	while (size < n)
+		size <<= 1;
+
+	return size;
+}
+
+shm_ring_writer::shm_ring_writer(const std::string &name, unsigned int slots,
+				 mode_t mode, bool replace)
+	: name(name), base(nullptr), next(0)
+{
+	void *mem;
+	int fd;
+
+	mask = round_up(slots ? slots : 1) - 1;
+	size = SHM_RING_HEADER_SIZE + (mask + 1) * SHM_RING_SLOT_SIZE;
+
+	if (replace)
+		shm_unlink(name.c_str());
+	fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+		      mode);
+	if (fd < 0)
+		throw std::system_error(errno, std::generic_category(),
+					"shm_open " + name);
+	/* the umask must not take the write access of the readers */
+	if (fchmod(fd, mode) < 0) {
+		int err = errno;
+
+		close(fd);
+		shm_unlink(name.c_str());
+		throw std::system_error(err, std::generic_category(),
+					"fchmod " + name);
+	}
+	if (ftruncate(fd, size) < 0) {
+		int err = errno;
+
+		close(fd);
+		shm_unlink(name.c_str());
+		throw std::system_error(err, std::generic_category(),
+					"ftruncate " + name);
+	}
+	mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		int err = errno;
+
+		shm_unlink(name.c_str());
+		throw std::system_error(err, std::generic_category(),
+					"mmap " + name);
+	}
+
+	/* the object comes zeroed - every seq is 0, matching no frame */
+	base = static_cast<uint8_t *>(mem);
+	header = reinterpret_cast<shm_ring_header *>(base);
+	header->version = SHM_RING_VERSION;
+	header->header_size = SHM_RING_HEADER_SIZE;
+	header->slot_size = SHM_RING_SLOT_SIZE;
+	header->slots = mask + 1;
+	/* readers check the magic last */
+	std::atomic_thread_fence(std::memory_order_release);
+	header->magic = SHM_RING_MAGIC;
+}
+
+shm_ring_writer::~shm_ring_writer()
+{
+	munmap(base, size);
+	shm_unlink(name.c_str());
+}
+
+void shm_ring_writer::publish(const can_proto_frame &frame)
+{
+	shm_ring_slot *s = slot(next);
+
+	s->seq.store(2 * next + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	s->ts_ns = frame.ts_ns;
+	s->can_id = frame.can_id;
+	s->flags = frame.flags;
+	s->len = frame.len;
+	memcpy(s->data, frame.data, frame.len);
+
+	s->seq.store(2 * next + 2, std::memory_order_release);
+	next++;
+}
+
+void shm_ring_writer::commit()
+{
+	/* pairs with the waiters/head check in shm_ring_reader::wait */
+	header->head.store(next, std::memory_order_seq_cst);
+	header->futex.fetch_add(1, std::memory_order_seq_cst);
+	if (header->waiters.load(std::memory_order_seq_cst))
+		futex(&header->futex, FUTEX_WAKE, INT_MAX, nullptr);
+}
+
+shm_ring_reader::shm_ring_reader(const std::string &name)
+	: base(nullptr), lost_frames(0)
+{
+	struct stat st;
+	void *mem;
+	int fd;
+
+	fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+	if (fd < 0)
+		throw std::system_error(errno, std::generic_category(),
+					"shm_open " + name);
+	if (fstat(fd, &st) < 0 ||
+	    (size_t)st.st_size < SHM_RING_HEADER_SIZE) {
+		close(fd);
+		throw std::runtime_error(name + ": not a frame ring");
+	}
+	size = st.st_size;
+	mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+		throw std::system_error(errno, std::generic_category(),
+					"mmap " + name);
+
+	base = static_cast<uint8_t *>(mem);
+	header = reinterpret_cast<shm_ring_header *>(base);
+	if (header->magic != SHM_RING_MAGIC ||
+	    header->version != SHM_RING_VERSION ||
+	    header->slot_size < sizeof(shm_ring_slot) ||
+	    !header->slots || (header->slots & (header->slots - 1)) ||
+	    header->header_size + (size_t)header->slots *
+	    header->slot_size > size) {
+		munmap(base, size);
+		throw std::runtime_error(name + ": not a frame ring");
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	mask = header->slots - 1;
+	cursor = header->head.load(std::memory_order_acquire);
+}
+
+shm_ring_reader::~shm_ring_reader()
+{
+	munmap(base, size);
+}
+
+unsigned int shm_ring_reader::read(can_proto_frame *frames, unsigned int max)
+{
+	uint64_t head = header->head.load(std::memory_order_acquire);
+	unsigned int n = 0;
+
+	/* lapped - skip to the oldest frame that is still there */
+	if (head - cursor > mask + 1) {
+		lost_frames += head - (mask + 1) - cursor;
+		cursor = head - (mask + 1);
+	}
+
+	while (cursor < head && n < max) {
+		const shm_ring_slot *s = slot(cursor);
+		can_proto_frame *frame = &frames[n];
+		uint64_t seq = 2 * cursor + 2;
+
+		if (s->seq.load(std::memory_order_acquire) != seq) {
+			/* already overwritten by the next lap */
+			lost_frames++;
+			cursor++;
+			continue;
+		}
+
+		frame->ts_ns = s->ts_ns;
+		frame->can_id = s->can_id;
+		frame->flags = s->flags;
+		frame->len = s->len;
+		if (frame->len > CANFD_MAX_DLEN)
+			frame->len = CANFD_MAX_DLEN;
+		memcpy(frame->data, s->data, frame->len);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (s->seq.load(std::memory_order_relaxed) != seq) {
+			/* overwritten while copying */
+			lost_frames++;
+			cursor++;
+			continue;
+		}
+
+		cursor++;
+		n++;
+	}
+
+	return n;
+}
+
+static uint64_t monotonic_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool shm_ring_reader::wait(int timeout_ms)
+{
+	uint64_t deadline = monotonic_ns() + timeout_ms * 1000000ULL;
+
+	for (;;) {
+		uint32_t val = header->futex.load(std::memory_order_seq_cst);
+		struct timespec ts, *timeout = nullptr;
+
+		if (pending())
+			return true;
+
+		if (timeout_ms >= 0) {
+			uint64_t now = monotonic_ns();
+
+			if (now >= deadline)
+				return false;
+			ts.tv_sec = (deadline - now) / 1000000000ULL;
+			ts.tv_nsec = (deadline - now) % 1000000000ULL;
+			timeout = &ts;
+		}
+
+		/* the writer wakes only if it sees a waiter - and bumps the
+		 * futex word before, so a commit after the check below fails
+		 * the wait. a wakeup may be meant for an earlier commit that
+		 * was read already, so check again.
+		 */
+		header->waiters.fetch_add(1, std::memory_order_seq_cst);
+		if (!pending())
+			futex(&header->futex, FUTEX_WAIT, val, timeout);
+		header->waiters.fetch_sub(1, std::memory_order_seq_cst);
+	}
+}
+
+} /* namespace can_app */
@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* shared memory ring of received can frames for local consumers
+ *
+ * the gateway (the single writer) publishes every frame it reads into a
+ * POSIX shared memory object, any number of local readers follow it
+ * without syscalls and without a socket - and skb clone - of their own.
+ * readers never hold up the writer: a reader that falls more than the
+ * ring behind loses the overwritten frames and counts them.
+ *
+ * layout, all values little endian (native on the pi):
+ *
+ * header (SHM_RING_HEADER_SIZE bytes):
+ *   u32 magic       SHM_RING_MAGIC ("CSHM")
+ *   u16 version     1
+ *   u16 header_size offset of the first slot
+ *   u16 slot_size   bytes per slot
+ *   u16 reserved
+ *   u32 slots       number of slots, a power of 2
+ *   - at offset 64, on a cache line of its own:
+ *   u64 head        number of frames published so far
+ *   u32 futex       bumped on every publish, readers may FUTEX_WAIT on it
+ *   u32 waiters     number of readers in FUTEX_WAIT
+ *
+ * slot (frame n lives in slot n % slots):
+ *   u64 seq         2n + 1 while frame n gets written, 2n + 2 once done
+ *   u64 ts_ns       receive timestamp (CLOCK_REALTIME)
+ *   u32 can_id      with the socketcan EFF/RTR/ERR bits
+ *   u8  flags       CAN_PROTO_FLAG_FD/BRS/ESI, see can_proto.h
+ *   u8  len
+ *   u8  pad[2]
+ *   u8  data[64]
+ *
+ * a reader of frame n checks that seq is 2n + 2 before and after copying
+ * the slot (a seqlock) - anything else means the writer lapped it.
+ * see can_shm.py for the python reader.
+ */
+
+#ifndef __SHM_RING_H
+#define __SHM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <string>
+
+#include "can_proto.h"
+
+namespace can_app {
+
+#define SHM_RING_MAGIC		0x4d485343
+#define SHM_RING_VERSION	1
+#define SHM_RING_HEADER_SIZE	128
+#define SHM_RING_SLOT_SIZE	128
+
+/* the name of the ring the gateway publishes for ifname */
+std::string shm_ring_name(const std::string &ifname);
+
+struct shm_ring_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size;
+	uint16_t slot_size;
+	uint16_t reserved;
+	uint32_t slots;
+	uint8_t pad[64 - 16];
+
+	std::atomic<uint64_t> head;
+	std::atomic<uint32_t> futex;
+	std::atomic<uint32_t> waiters;
+};
+
+struct shm_ring_slot {
+	std::atomic<uint64_t> seq;
+	uint64_t ts_ns;
+	uint32_t can_id;
+	uint8_t flags;
+	uint8_t len;
+	uint8_t pad[2];
+	uint8_t data[CANFD_MAX_DLEN];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+	      "the ring needs lock free 64 bit atomics");
+static_assert(sizeof(shm_ring_header) <= SHM_RING_HEADER_SIZE,
+	      "shm_ring_header too large");
+static_assert(sizeof(shm_ring_slot) <= SHM_RING_SLOT_SIZE,
+	      "shm_ring_slot too large");
+
+/* the writer side - creates the shared memory object and removes it
+ * again when destroyed
+ */
+class shm_ring_writer {
+public:
+	/* slots gets rounded up to a power of 2. readers need read and
+	 * write access (to register as waiters), so mode 0660 lets the
+	 * group of the writer read. an existing object of that name - a
+	 * running writer or a stale ring - is an error unless replace is
+	 * set, readers of a replaced ring keep the old one
+	 * throws std::system_error on failure
+	 */
+	shm_ring_writer(const std::string &name, unsigned int slots,
+			mode_t mode = 0660, bool replace = false);
+	~shm_ring_writer();
+
+	/* write the next frame - readers see it after commit */
+	void publish(const can_proto_frame &frame);
+
+	/* make the published frames visible and wake waiting readers */
+	void commit();
+
+	uint64_t published() const { return next; }
+
+private:
+	shm_ring_slot *slot(uint64_t n)
+	{
+		return reinterpret_cast<shm_ring_slot *>(
+			base + SHM_RING_HEADER_SIZE +
+			(n & mask) * SHM_RING_SLOT_SIZE);
+	}
+
+	std::string name;
+	uint8_t *base;
+	size_t size;
+	shm_ring_header *header;
+	uint64_t mask;
+	uint64_t next;
+};
+
+/* a reader - starts with the frames published after it attached */
+class shm_ring_reader {
+public:
+	/* throws std::system_error if the ring does not exist and
+	 * std::runtime_error if it is not a valid ring
+	 */
+	explicit shm_ring_reader(const std::string &name);
+	~shm_ring_reader();
+
+	/* copy up to max frames without blocking - returns the count */
+	unsigned int read(can_proto_frame *frames, unsigned int max);
+
+	/* sleep until there are frames to read or timeout_ms passed,
+	 * -1 waits forever - returns whether there are frames
+	 */
+	bool wait(int timeout_ms);
+
+	/* frames overwritten before they were read */
+	uint64_t lost() const { return lost_frames; }
+
+	/* frames published but not read yet */
+	uint64_t pending() const
+	{
+		return header->head.load(std::memory_order_acquire) - cursor;
+	}
+
+private:
+	const shm_ring_slot *slot(uint64_t n) const
+	{
+		return reinterpret_cast<const shm_ring_slot *>(
+			base + header->header_size +
+			(n & mask) * header->slot_size);
+	}
+
+	uint8_t *base;
+	size_t size;
+	shm_ring_header *header;
+	uint64_t mask;
+	uint64_t cursor;
+	uint64_t lost_frames;
+};
+
+} /* namespace can_app */
+
+#endif /* __SHM_RING_H */
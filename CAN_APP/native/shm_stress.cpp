@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* stress test of the shared memory ring (see shm_ring.h)
+ *
+ * a writer thread publishes frames in batches of random size as fast as
+ * it can into a small ring, reader threads - half of them spinning, half
+ * sleeping on the futex - follow it and get lapped all the time. every
+ * frame is derived from its number, so a reader checks each one it gets
+ * for torn contents and order, and at the end that the frames it read
+ * plus the ones it counted as lost add up to all the frames published.
+ *
+ * usage: shm_stress [-n frames] [-s slots] [-r readers] [-b batch]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "shm_ring.h"
+
+struct stress_config {
+	unsigned long frames = 10000000;
+	unsigned int slots = 64;
+	unsigned int readers = 4;
+	unsigned int batch = 32;
+};
+
+struct stress_result {
+	uint64_t received;
+	uint64_t lost;
+	/* frames missing between the ones read */
+	uint64_t gaps;
+	uint64_t torn;
+	uint64_t reordered;
+};
+
+/* frame n - the number goes into ts_ns, the rest follows from it */
+static void make_frame(uint64_t n, can_app::can_proto_frame *frame)
+{
+	unsigned int i;
+
+	frame->ts_ns = n;
+	frame->can_id = n & CAN_SFF_MASK;
+	frame->flags = CAN_PROTO_FLAG_FD;
+	frame->len = 8 + n % (CANFD_MAX_DLEN - 7);
+	for (i = 0; i < frame->len; i++)
+		frame->data[i] = n * 31 + i;
+}
+
+static bool frame_ok(const can_app::can_proto_frame &frame)
+{
+	can_app::can_proto_frame expected;
+
+	make_frame(frame.ts_ns, &expected);
+
+	return frame.can_id == expected.can_id &&
+		frame.flags == expected.flags &&
+		frame.len == expected.len &&
+		!memcmp(frame.data, expected.data, frame.len);
+}
+
+static void writer(const stress_config &config,
+		   can_app::shm_ring_writer *ring)
+{
+	can_app::can_proto_frame frame;
+	unsigned int seed = 1;
+	uint64_t n = 0;
+
+	while (n < config.frames) {
+		unsigned int count;
+
+		seed = seed * 1103515245 + 12345;
+		count = 1 + (seed >> 16) % config.batch;
+		for (; count && n < config.frames; count--, n++) {
+			make_frame(n, &frame);
+			ring->publish(frame);
+		}
+		ring->commit();
+	}
+}
+
+static void reader(const stress_config &config, can_app::shm_ring_reader *ring,
+		   bool spin, stress_result *r)
+{
+	std::vector<can_app::can_proto_frame> frames(config.batch);
+	int64_t last = -1;
+
+	*r = {};
+	while (r->received + ring->lost() < config.frames) {
+		unsigned int count, i;
+
+		if (!spin)
+			ring->wait(100);
+		count = ring->read(frames.data(), frames.size());
+		for (i = 0; i < count; i++) {
+			const can_app::can_proto_frame &f = frames[i];
+
+			if (!frame_ok(f))
+				r->torn++;
+			if ((int64_t)f.ts_ns <= last) {
+				r->reordered++;
+				continue;
+			}
+			r->gaps += f.ts_ns - last - 1;
+			last = f.ts_ns;
+		}
+		r->received += count;
+	}
+	r->lost = ring->lost();
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -n <frames>   frames to publish (default 10000000)\n"
+		"  -s <slots>    slots of the ring (default 64)\n"
+		"  -r <readers>  reader threads (default 4)\n"
+		"  -b <frames>   largest batch per commit (default 32)\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	const std::string name = "/can_app.shm_stress";
+	stress_config config;
+	bool failed = false;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:r:b:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			config.frames = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			config.slots = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			config.readers = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			config.batch = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!config.frames || !config.slots || !config.batch)
+		usage(argv[0]);
+
+	try {
+		can_app::shm_ring_writer ring(name, config.slots, 0600, true);
+		std::vector<std::unique_ptr<can_app::shm_ring_reader>> readers;
+		std::vector<stress_result> results(config.readers);
+		std::vector<std::thread> threads;
+
+		/* all readers attach before the first frame */
+		for (i = 0; i < config.readers; i++)
+			readers.emplace_back(
+				new can_app::shm_ring_reader(name));
+		for (i = 0; i < config.readers; i++)
+			threads.emplace_back(reader, std::cref(config),
+					     readers[i].get(), i & 1,
+					     &results[i]);
+		writer(config, &ring);
+		for (std::thread &t : threads)
+			t.join();
+
+		for (i = 0; i < config.readers; i++) {
+			const stress_result &r = results[i];
+			bool ok = !r.torn && !r.reordered &&
+				r.gaps == r.lost &&
+				r.received + r.lost == config.frames;
+
+			printf("reader %u (%s): %llu received, %llu lost, "
+			       "%llu torn, %llu reordered%s\n",
+			       i, i & 1 ? "spin" : "futex",
+			       (unsigned long long)r.received,
+			       (unsigned long long)r.lost,
+			       (unsigned long long)r.torn,
+			       (unsigned long long)r.reordered,
+			       ok ? "" : " - FAILED");
+			if (!ok)
+				failed = true;
+		}
+	} catch (const std::exception &e) {
+		fprintf(stderr, "shm_stress: %s\n", e.what());
+		return 1;
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* synthetic can traffic - see traffic.h */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sstream>
+#include <stdexcept>
+
+#include "traffic.h"
+
+namespace can_app {
+
+static const uint8_t fd_lens[] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64
+};
+
+uint8_t traffic_fd_len(unsigned int len)
+{
+	for (uint8_t l : fd_lens)
+		if (l >= len)
+			return l;
+
+	return CANFD_MAX_DLEN;
+}
+
+static unsigned long parse_number(const std::string &s, char **end)
+{
+	unsigned long val;
+
+	errno = 0;
+	val = strtoul(s.c_str(), end, 0);
+	if (errno || *end == s.c_str())
+		throw std::invalid_argument("invalid number: " + s);
+
+	return val;
+}
+
+std::vector<traffic_id_range> traffic_parse_ids(const std::string &spec)
+{
+	std::vector<traffic_id_range> ids;
+	std::stringstream ss(spec);
+	std::string item;
+
+	while (std::getline(ss, item, ',')) {
+		unsigned long first, last;
+		bool eff = false;
+		char *end;
+
+		first = last = parse_number(item, &end);
+		if (*end == '-')
+			last = parse_number(end + 1, &end);
+		if (*end == 'e') {
+			eff = true;
+			end++;
+		}
+		if (*end || last < first || last > CAN_EFF_MASK)
+			throw std::invalid_argument("invalid id: " + item);
+
+		ids.push_back({ (canid_t)first, (canid_t)last, eff });
+	}
+	if (ids.empty())
+		throw std::invalid_argument("no ids: " + spec);
+
+	return ids;
+}
+
+std::vector<std::pair<uint8_t, unsigned int>>
+traffic_parse_lens(const std::string &spec)
+{
+	std::vector<std::pair<uint8_t, unsigned int>> lens;
+	std::stringstream ss(spec);
+	std::string item;
+
+	while (std::getline(ss, item, ',')) {
+		unsigned long len, weight = 1;
+		char *end;
+
+		len = parse_number(item, &end);
+		if (*end == ':')
+			weight = parse_number(end + 1, &end);
+		if (*end || len > CANFD_MAX_DLEN || !weight)
+			throw std::invalid_argument("invalid length: " + item);
+
+		lens.push_back({ traffic_fd_len(len), weight });
+	}
+	if (lens.empty())
+		throw std::invalid_argument("no lengths: " + spec);
+
+	return lens;
+}
+
+traffic::traffic(const traffic_config &config, uint32_t seed)
+	: config(config), len_total(0), state(seed), sequence(0),
+	  id_range(0), id_offset(0)
+{
+	if (this->config.ids.empty())
+		this->config.ids.push_back({ 0x123, 0x123, false });
+	if (this->config.lens.empty())
+		this->config.lens.push_back({ 8, 1 });
+	for (auto &l : this->config.lens)
+		len_total += l.second;
+}
+
+bool traffic::fd() const
+{
+	if (config.fd_percent)
+		return true;
+
+	/* classic frames carry at most 8 bytes */
+	for (auto &l : config.lens)
+		if (l.first > CAN_MAX_DLEN)
+			return true;
+
+	return false;
+}
+
+/* xorshift - cheap and good enough to mix the traffic */
+uint32_t traffic::random()
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+
+	return state;
+}
+
+bool traffic::next(struct canfd_frame *frame)
+{
+	unsigned int pick = random() % len_total;
+	uint32_t seq = sequence++;
+	const traffic_id_range &ids = config.ids[id_range];
+	canid_t id = ids.first + id_offset;
+	bool is_fd;
+	uint8_t len = 0;
+	int i;
+
+	for (auto &l : config.lens) {
+		len = l.first;
+		if (pick < l.second)
+			break;
+		pick -= l.second;
+	}
+
+	is_fd = len > CAN_MAX_DLEN || random() % 100 < config.fd_percent;
+
+	memset(frame, 0, sizeof(*frame));
+	frame->can_id = id |
+		(ids.eff || id > CAN_SFF_MASK ? CAN_EFF_FLAG : 0);
+	if (id == ids.last) {
+		id_range = (id_range + 1) % config.ids.size();
+		id_offset = 0;
+	} else {
+		id_offset++;
+	}
+	frame->len = len;
+	if (is_fd && random() % 100 < config.brs_percent)
+		frame->flags |= CANFD_BRS;
+
+	for (i = 0; i < len; i++)
+		frame->data[i] = i < 4 ? seq >> (8 * i) : seq + i;
+
+	return is_fd;
+}
+
+uint32_t traffic_seq(const uint8_t *data, uint8_t len, uint32_t expected)
+{
+	uint32_t seq = 0, mask = 0, span, half;
+	int32_t distance;
+	int i;
+
+	if (!len)
+		return expected;
+
+	for (i = 0; i < len && i < 4; i++) {
+		seq |= (uint32_t)data[i] << (8 * i);
+		mask |= 0xffU << (8 * i);
+	}
+	if (mask == 0xffffffff)
+		return seq;
+	seq |= expected & ~mask;
+
+	/* one wrap of the truncated bits back or ahead may be closer -
+	 * but never before 0, where the sequence starts
+	 */
+	span = mask + 1;
+	half = span / 2;
+	distance = (int32_t)(seq - expected);
+	if (distance > (int32_t)half && seq >= span)
+		seq -= span;
+	else if (distance <= -(int32_t)half)
+		seq += span;
+
+	return seq;
+}
+
+} /* namespace can_app */
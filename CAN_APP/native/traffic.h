@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* synthetic can traffic for the generator and the benchmarks
+ *
+ * frames cycle through a weighted set of ids and payload lengths, a
+ * share of them is sent as fd frames (with or without bit rate switch).
+ * the first 4 bytes of the payload carry a little endian sequence number
+ * that is global over all frames of a traffic instance, so receivers can
+ * detect lost and reordered frames (see traffic_seq) - shorter payloads
+ * carry only the low bytes of it.
+ */
+
+#ifndef __TRAFFIC_H
+#define __TRAFFIC_H
+
+#include <linux/can.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace can_app {
+
+/* the ids first to last - ids above 0x7ff are extended ones, eff makes
+ * the lower ones extended as well
+ */
+struct traffic_id_range {
+	canid_t first;
+	canid_t last;
+	bool eff;
+};
+
+struct traffic_config {
+	/* the ids are sent in turn, range by range */
+	std::vector<traffic_id_range> ids;
+	/* payload length and weight */
+	std::vector<std::pair<uint8_t, unsigned int>> lens;
+	/* share of fd frames and of those with bit rate switch */
+	unsigned int fd_percent = 0;
+	unsigned int brs_percent = 100;
+};
+
+/* "0x123,0x200-0x20f,0x18daf100e" - ids above 0x7ff or with the suffix
+ * e are extended ones. ranges are kept as such, so "0-0x1fffffff" does
+ * not expand to half a billion ids
+ * throws std::invalid_argument
+ */
+std::vector<traffic_id_range> traffic_parse_ids(const std::string &spec);
+
+/* "8" or "0:1,8:4,64:2" - payload lengths with weights, lengths that
+ * are not valid fd lengths get rounded up
+ * throws std::invalid_argument
+ */
+std::vector<std::pair<uint8_t, unsigned int>>
+traffic_parse_lens(const std::string &spec);
+
+/* the valid fd payload length holding at least len bytes */
+uint8_t traffic_fd_len(unsigned int len);
+
+class traffic {
+public:
+	explicit traffic(const traffic_config &config, uint32_t seed = 1);
+
+	/* fill the next frame - returns true for fd frames */
+	bool next(struct canfd_frame *frame);
+
+	/* the sequence number the next frame gets */
+	uint32_t seq() const { return sequence; }
+
+	/* whether any frame may be an fd frame */
+	bool fd() const;
+
+private:
+	uint32_t random();
+
+	traffic_config config;
+	unsigned int len_total;
+	uint32_t state;
+	uint32_t sequence;
+	/* the next id is first + id_offset of the range id_range */
+	size_t id_range;
+	canid_t id_offset;
+};
+
+/* the sequence number carried by a frame of len bytes, with the bits
+ * that did not fit taken from expected: of the numbers ending in the
+ * bytes carried, the one closest to expected - so a late frame comes out
+ * as an earlier number (a reorder) and not as one a whole wrap ahead.
+ * a frame without payload carries nothing and gets expected.
+ */
+uint32_t traffic_seq(const uint8_t *data, uint8_t len, uint32_t expected);
+
+} /* namespace can_app */
+
+#endif /* __TRAFFIC_H */
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* sequenced udp datagrams of batched can frames - see udp_stream.h */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+#include "udp_stream.h"
+
+namespace can_app {
+
+static struct sockaddr_in parse_dest(const std::string &dest)
+{
+	struct sockaddr_in addr = {};
+	size_t colon = dest.rfind(':');
+	unsigned long port;
+	char *end;
+
+	if (colon == std::string::npos)
+		throw std::invalid_argument(dest + ": not addr:port");
+	port = strtoul(dest.c_str() + colon + 1, &end, 10);
+	if (*end || !port || port > 65535 ||
+	    inet_pton(AF_INET, dest.substr(0, colon).c_str(),
+		      &addr.sin_addr) != 1)
+		throw std::invalid_argument(dest + ": not addr:port");
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+
+	return addr;
+}
+
+static uint64_t round_up(uint64_t n)
+{
+	uint64_t size = 1;
+
+	while (size < n)
+		size <<= 1;
+
+	return size;
+}
+
+udp_sender::udp_sender(const std::string &dest, size_t mtu,
+		       unsigned int history, int ttl)
+	: dest(dest), fd(-1), mtu(mtu), open(false), next(0), unsent(0),
+	  sent_frames(0), drops(0), resent(0)
+{
+	struct sockaddr_in addr = parse_dest(dest);
+	int on = 1;
+
+	/* room for the largest frame, and a length that fits the header */
+	if (mtu < CAN_PROTO_DGRAM_HEADER_LEN + CAN_PROTO_HEADER_LEN +
+	    CAN_PROTO_RECORD_MAX || mtu > 65507)
+		throw std::invalid_argument("datagram size out of range");
+	/* what a single send can queue */
+	mask = round_up(std::max(history, send_batch)) - 1;
+	this->history.resize((mask + 1) * mtu);
+	lengths.resize(mask + 1);
+	current.reserve(mtu);
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		throw std::system_error(errno, std::generic_category(),
+					"socket");
+	if (IN_MULTICAST(ntohl(addr.sin_addr.s_addr))) {
+		/* receivers on the pi itself get it as well */
+		setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+		setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &on, sizeof(on));
+	}
+	if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr),
+		    sizeof(addr)) < 0) {
+		int err = errno;
+
+		close(fd);
+		throw std::system_error(err, std::generic_category(),
+					"connect " + dest);
+	}
+}
+
+udp_sender::~udp_sender()
+{
+	close(fd);
+}
+
+void udp_sender::add(const can_proto_frame &frame)
+{
+	if (open && current.size() + CAN_PROTO_RECORD_MAX > mtu)
+		finish();
+
+	if (!open) {
+		current.resize(CAN_PROTO_DGRAM_HEADER_LEN);
+		encoder.begin(current, frame.ts_ns);
+		open = true;
+	}
+	encoder.add(frame);
+	sent_frames++;
+}
+
+void udp_sender::finish()
+{
+	size_t len;
+
+	if (!open)
+		return;
+	open = false;
+
+	len = encoder.finish() + CAN_PROTO_DGRAM_HEADER_LEN;
+	can_proto_dgram_header(current.data(), next, 0,
+			       len - CAN_PROTO_DGRAM_HEADER_LEN);
+	memcpy(slot(next), current.data(), len);
+	lengths[next & mask] = len;
+	next++;
+
+	if (next - unsent >= send_batch)
+		send();
+}
+
+void udp_sender::send()
+{
+	struct mmsghdr msgs[send_batch];
+	struct iovec iov[send_batch];
+	unsigned int n, i;
+	int ret;
+
+	while (unsent < next) {
+		n = std::min<uint64_t>(next - unsent, send_batch);
+		for (i = 0; i < n; i++) {
+			iov[i].iov_base = slot(unsent + i);
+			iov[i].iov_len = lengths[(unsent + i) & mask];
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		ret = sendmmsg(fd, msgs, n, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			/* EAGAIN/ENOBUFS with a full queue, ECONNREFUSED
+			 * when nobody listens on a unicast port - the
+			 * receivers see the gap, backfill still has them
+			 */
+			drops += n;
+			ret = n;
+		}
+		unsent += ret;
+	}
+}
+
+void udp_sender::backfill(uint64_t seq, uint32_t count,
+			  std::vector<uint8_t> &out, size_t max)
+{
+	uint64_t end = std::min(seq + count, next);
+	size_t pos, len;
+
+	/* the end marker always fits */
+	if (out.size() + CAN_PROTO_DGRAM_HEADER_LEN > max)
+		return;
+
+	for (; seq < end; seq++) {
+		bool held = next - seq <= mask + 1;
+
+		len = held ? lengths[seq & mask] : CAN_PROTO_DGRAM_HEADER_LEN;
+		pos = out.size();
+		if (pos + len + CAN_PROTO_DGRAM_HEADER_LEN > max)
+			break;
+
+		out.resize(pos + len);
+		if (held) {
+			memcpy(&out[pos], slot(seq), len);
+			resent++;
+		} else {
+			can_proto_dgram_header(&out[pos], seq,
+					       CAN_PROTO_DGRAM_GONE, 0);
+		}
+	}
+
+	pos = out.size();
+	out.resize(pos + CAN_PROTO_DGRAM_HEADER_LEN);
+	can_proto_dgram_header(&out[pos], seq, CAN_PROTO_DGRAM_END, 0);
+}
+
+} /* namespace can_app */
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* sequenced udp datagrams of batched can frames
+ *
+ * the gateway packs the frames it reads into datagrams of at most mtu
+ * bytes - a datagram header and a single batch each, see can_proto.h -
+ * and sends them with sendmmsg to a unicast or multicast address. a
+ * receiver that cannot keep up loses datagrams and sees the gap in the
+ * sequence numbers, the gateway never waits for it.
+ *
+ * the last history datagrams stay around, so a lossless consumer can
+ * ask for the ones it missed over tcp (a backfill request).
+ */
+
+#ifndef __UDP_STREAM_H
+#define __UDP_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "can_proto.h"
+
+namespace can_app {
+
+/* ipv4 payload of a 1500 byte ethernet frame */
+#define UDP_STREAM_MTU		1472
+
+class udp_sender {
+public:
+	/* dest is addr:port, a multicast group gets ttl. history gets
+	 * rounded up to a power of 2
+	 * throws std::invalid_argument or std::system_error on failure
+	 */
+	udp_sender(const std::string &dest, size_t mtu, unsigned int history,
+		   int ttl);
+	~udp_sender();
+
+	/* append a frame to the current datagram */
+	void add(const can_proto_frame &frame);
+
+	/* close the current datagram, it goes out with the next send */
+	void finish();
+
+	/* send the finished datagrams - those the socket does not take
+	 * count as dropped
+	 */
+	void send();
+
+	/* append the answer to a backfill request to out, as long as out
+	 * stays within max bytes
+	 */
+	void backfill(uint64_t seq, uint32_t count, std::vector<uint8_t> &out,
+		      size_t max);
+
+	const std::string &name() const { return dest; }
+	uint64_t datagrams() const { return next; }
+	uint64_t frames() const { return sent_frames; }
+	uint64_t dropped() const { return drops; }
+	uint64_t backfilled() const { return resent; }
+
+private:
+	/* queued datagrams that trigger a send */
+	static constexpr unsigned int send_batch = 64;
+
+	uint8_t *slot(uint64_t seq)
+	{
+		return &history[(seq & mask) * mtu];
+	}
+
+	std::string dest;
+	int fd;
+	size_t mtu;
+	uint64_t mask;
+	/* mtu bytes per datagram, lengths[] tells how many are used */
+	std::vector<uint8_t> history;
+	std::vector<uint16_t> lengths;
+
+	/* the datagram being filled */
+	std::vector<uint8_t> current;
+	can_proto_encoder encoder;
+	bool open;
+
+	/* seq of the next datagram and of the first one not sent */
+	uint64_t next;
+	uint64_t unsent;
+
+	uint64_t sent_frames;
+	uint64_t drops;
+	uint64_t resent;
+};
+
+} /* namespace can_app */
+
+#endif /* __UDP_STREAM_H */